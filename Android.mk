@@ -69,13 +69,15 @@ LOCAL_SRC_FILES := \
     partitionmanager.cpp \
     progresstracking.cpp \
     startupArgs.cpp \
+    startupTaskGraph.cpp \
     twrp-functions.cpp \
     orangefox.cpp \
     twrpDigestDriver.cpp \
     openrecoveryscript.cpp \
     tarWrite.c \
     twrpAdbBuFifo.cpp \
-    twrpRepacker.cpp
+    twrpRepacker.cpp \
+    twrpBootImage.cpp
 
 ifeq ($(TW_EXCLUDE_APEX),)
     LOCAL_SRC_FILES += twrpApex.cpp
@@ -137,9 +139,9 @@ LOCAL_C_INCLUDES += \
 LOCAL_STATIC_LIBRARIES += libguitwrp libvold
 LOCAL_SHARED_LIBRARIES += libz libc libcutils libstdc++ libtar libblkid libminuitwrp libmtdutils libtwadbbu 
 LOCAL_SHARED_LIBRARIES += libbootloader_message libcrecovery libtwrpdigest libc++ libaosprecovery libcrypto libbase 
-LOCAL_SHARED_LIBRARIES += libziparchive libselinux libdl_android.bootstrap
+LOCAL_SHARED_LIBRARIES += libziparchive libselinux libdl_android.bootstrap liblz4
 
-ifneq ($(wildcard system/core/libsparse/Android.mk),)
+ifneq ($(wildcard system/core/libsparse/.),)
 LOCAL_SHARED_LIBRARIES += libsparse
 endif
 
@@ -467,6 +469,7 @@ TWRP_REQUIRED_MODULES += \
     permissive.sh \
     simg2img_twrp \
     libbootloader_message \
+    liblz4 \
     init.recovery.hlthchrg.rc \
     init.recovery.service.rc \
     init.recovery.ldconfig.rc \
@@ -11,6 +11,7 @@ endif
 
 LOCAL_SRC_FILES = \
         libtwadbbu.cpp \
+        twadbring.cpp \
         twrpback.cpp
 
 LOCAL_SHARED_LIBRARIES += libz libc libstdc++ libtwrpdigest
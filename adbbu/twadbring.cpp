@@ -0,0 +1,141 @@
+/*
+		Copyright 2013 to 2017 TeamWin
+		TWRP is free software: you can redistribute it and/or modify
+		it under the terms of the GNU General Public License as published by
+		the Free Software Foundation, either version 3 of the License, or
+		(at your option) any later version.
+
+		TWRP is distributed in the hope that it will be useful,
+		but WITHOUT ANY WARRANTY; without even the implied warranty of
+		MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+		GNU General Public License for more details.
+
+		You should have received a copy of the GNU General Public License
+		along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string>
+#include <algorithm>
+#include <system_error>
+
+#include "twadbstream.h"
+#include "twadbring.hpp"
+
+twadbring::twadbring(size_t size) {
+	ring = new char[size];
+	mask = size - 1;
+	adb_fd = -1;
+	head = 0;
+	tail = 0;
+	eos = false;
+	stopping = false;
+}
+
+twadbring::~twadbring(void) {
+	stop();
+	delete [] ring;
+}
+
+bool twadbring::start(int fd) {
+	adb_fd = fd;
+	try {
+		reader = std::thread(&twadbring::readStream, this);
+	} catch (const std::system_error&) {
+		return false;
+	}
+	return true;
+}
+
+void twadbring::stop(void) {
+	stopping = true;
+	wake();
+	if (reader.joinable())
+		reader.join();
+}
+
+void twadbring::wake(void) {
+	// Taking the lock orders the position update before a waiter's predicate check
+	{
+		std::lock_guard<std::mutex> lock(waitLock);
+	}
+	waitCond.notify_all();
+}
+
+void twadbring::readStream(void) {
+	size_t size = mask + 1;
+	struct pollfd pfd;
+
+	pfd.fd = adb_fd;
+	pfd.events = POLLIN;
+	while (!stopping) {
+		uint64_t h = head.load(std::memory_order_relaxed);
+		uint64_t t = tail.load(std::memory_order_acquire);
+		if (h - t == size) {
+			std::unique_lock<std::mutex> lock(waitLock);
+			waitCond.wait(lock, [&] { return stopping || head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) < size; });
+			continue;
+		}
+		size_t offset = h & mask;
+		size_t len = std::min(std::min(size - (size_t)(h - t), size - offset), (size_t)ADB_RING_MAX_READ);
+
+		// Poll so that stop() is noticed while adb is idle
+		int ret = poll(&pfd, 1, 100);
+		if (ret == 0 || (ret < 0 && errno == EINTR))
+			continue;
+		ssize_t bytes = ::read(adb_fd, ring + offset, len);
+		if (bytes < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (bytes <= 0)
+			break;
+		head.store(h + bytes, std::memory_order_release);
+		wake();
+	}
+	eos = true;
+	wake();
+}
+
+size_t twadbring::peek(const char** data, size_t len, size_t unit) {
+	size_t size = mask + 1;
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	uint64_t avail = head.load(std::memory_order_acquire) - t;
+
+	if (avail < unit) {
+		std::unique_lock<std::mutex> lock(waitLock);
+		waitCond.wait(lock, [&] {
+			bool ended = eos;
+			avail = head.load(std::memory_order_acquire) - t;
+			return avail >= unit || ended;
+		});
+		if (avail < unit)
+			return 0;
+	}
+	size_t offset = t & mask;
+	size_t span = std::min(std::min((size_t)avail, size - offset), len);
+	*data = ring + offset;
+	return span - span % unit;
+}
+
+void twadbring::consume(size_t len) {
+	tail.store(tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+	wake();
+}
+
+bool twadbring::read(void* buf, size_t len) {
+	char* out = (char*) buf;
+
+	while (len > 0) {
+		const char* data;
+		size_t bytes = peek(&data, len, 1);
+		if (bytes == 0)
+			return false;
+		memcpy(out, data, bytes);
+		consume(bytes);
+		out += bytes;
+		len -= bytes;
+	}
+	return true;
+}
@@ -0,0 +1,58 @@
+/*
+		Copyright 2013 to 2017 TeamWin
+		TWRP is free software: you can redistribute it and/or modify
+		it under the terms of the GNU General Public License as published by
+		the Free Software Foundation, either version 3 of the License, or
+		(at your option) any later version.
+
+		TWRP is distributed in the hope that it will be useful,
+		but WITHOUT ANY WARRANTY; without even the implied warranty of
+		MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+		GNU General Public License for more details.
+
+		You should have received a copy of the GNU General Public License
+		along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _TWADBRING_HPP
+#define _TWADBRING_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/*
+Single producer, single consumer ring between a thread reading the adb
+stream and the restore demux. The positions are lock free; the mutex and
+condition variable are only used to park a side that has to wait.
+*/
+class twadbring {
+public:
+	twadbring(size_t size);                                                  // size must be a power of two and a multiple of MAX_ADB_READ
+	~twadbring(void);
+	bool start(int fd);                                                      // start reading fd on a thread
+	void stop(void);                                                         // stop and join the reader thread
+	size_t peek(const char** data, size_t len, size_t unit);                 // wait for and map up to len contiguous bytes in whole units, 0 at end of stream
+	void consume(size_t len);                                                // release bytes returned by peek
+	bool read(void* buf, size_t len);                                        // copy len bytes out of the ring, false at end of stream
+
+private:
+	void readStream(void);                                                   // reader thread
+	void wake(void);                                                         // wake the other side after moving a position
+
+	char* ring;
+	size_t mask;
+	int adb_fd;
+	std::atomic<uint64_t> head;                                              // bytes read from adb
+	std::atomic<uint64_t> tail;                                              // bytes consumed by the demux
+	std::atomic<bool> eos;                                                   // adb stream ended or failed
+	std::atomic<bool> stopping;
+	std::mutex waitLock;
+	std::condition_variable waitCond;
+	std::thread reader;
+};
+
+#endif // _TWADBRING_HPP
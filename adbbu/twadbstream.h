@@ -42,6 +42,8 @@
 #define ADB_BACKUP_VERSION 3				//Backup Version
 #define DATA_MAX_CHUNK_SIZE 1048576			//Maximum size between each data header
 #define MAX_ADB_READ 512				//align with default tar size for amount to read fom adb stream
+#define ADB_RING_SIZE 4194304				//adb stream read ahead of the restore demux
+#define ADB_RING_MAX_READ 262144			//largest single read from adbd during restore
 
 /*
 structs for adb backup need to align to 512 bytes for reading 512
@@ -43,6 +43,7 @@
 
 twrpback::twrpback(void) {
 	adbd_fp = NULL;
+	adb_ring = NULL;
 	read_fd = 0;
 	write_fd = 0;
 	adb_control_twrp_fd = 0;
@@ -57,6 +58,7 @@ twrpback::twrpback(void) {
 }
 
 twrpback::~twrpback(void) {
+	delete adb_ring;
 	adblogfile.close();
 	closeFifos();
 }
@@ -118,6 +120,10 @@ void twrpback::close_backup_fds() {
 }
 
 void twrpback::close_restore_fds() {
+	if (adb_ring != NULL) {
+		delete adb_ring;
+		adb_ring = NULL;
+	}
 	if (ors_fd > 0)
 		close(ors_fd);
 	if (write_fd > 0)
@@ -500,17 +506,37 @@ bool twrpback::backup(std::string command) {
 	return true;
 }
 
+//Compare the type in place; data blocks are checked one by one and should not cost a copy
+static bool isMD5Trailer(const char* block) {
+	const struct AdbBackupControlType* hdr = (const struct AdbBackupControlType*) block;
+	return strncmp(hdr->type, MD5TRAILER, sizeof(hdr->type)) == 0;
+}
+
+bool twrpback::writeRestoreData(const char* data, size_t len) {
+	while (len > 0) {
+		ssize_t bytes = write(adb_write_fd, data, len);
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += bytes;
+		len -= bytes;
+	}
+	return true;
+}
+
 bool twrpback::restore(void) {
 	twrpMD5 digest;
 	char cmd[MAX_ADB_READ];
 	char readAdbStream[MAX_ADB_READ];
 	struct AdbBackupControlType structcmd;
 	int errctr = 0;
-	uint64_t totalbytes = 0, dataChunkBytes = 0;
+	uint64_t totalbytes = 0;
 	uint64_t md5fnsize = 0, fileBytes = 0;
 	bool read_from_adb;
-	bool md5sumdata;
-	bool compressed, tweofrcvd, extraData;
+	bool md5sumdata = false;
+	bool compressed, tweofrcvd = false, extraData;
 
 	read_from_adb = true;
 
@@ -524,6 +550,14 @@ bool twrpback::restore(void) {
 		return false;
 	}
 
+	//Read the adb stream ahead on a thread so USB transfers overlap writing to TWRP
+	adb_ring = new twadbring(ADB_RING_SIZE);
+	if (!adb_ring->start(fileno(adbd_fp))) {
+		adblogwrite("Unable to start adb stream reader\n");
+		close_restore_fds();
+		return false;
+	}
+
 	if(mkfifo(TW_ADB_RESTORE, 0666)) {
 		adblogwrite("Unable to create TW_ADB_RESTORE fifo\n");
 		close_restore_fds();
@@ -610,8 +644,7 @@ bool twrpback::restore(void) {
 		}
 		//If we should read from the adb stream, write commands and data to TWRP
 		if (read_from_adb) {
-			int readbytes;
-			if ((readbytes = fread(readAdbStream, 1, sizeof(readAdbStream), adbd_fp)) == sizeof(readAdbStream)) {
+			if (adb_ring->read(readAdbStream, sizeof(readAdbStream))) {
 				memcpy(&structcmd, readAdbStream, sizeof(readAdbStream));
 				std::string cmdtype = structcmd.get_type();
 
@@ -681,7 +714,6 @@ bool twrpback::restore(void) {
 					md5sumdata = false;
 					fileBytes = 0;
 					read_from_adb = true;
-					dataChunkBytes = 0;
 					extraData = false;
 
 					digest.init();
@@ -727,7 +759,6 @@ bool twrpback::restore(void) {
 					fileBytes = 0;
 					md5sumdata = false;
 					read_from_adb = true;
-					dataChunkBytes = 0;
 					extraData = false;
 
 					digest.init();
@@ -786,20 +817,52 @@ bool twrpback::restore(void) {
 				}
 				//Send the tar or partition image md5 to TWRP
 				else if (cmdtype == TWDATA) {
-					dataChunkBytes += sizeof(readAdbStream);
-					while (true) {
-						if ((readbytes = fread(readAdbStream, 1, sizeof(readAdbStream), adbd_fp)) != sizeof(readAdbStream)) {
+					//The rest of the chunk is data. Hand it to TWRP in spans as large as the
+					//read ahead allows, only stopping early if a trailer shows up on a block boundary.
+					uint64_t chunkLeft = DATA_MAX_CHUNK_SIZE - sizeof(readAdbStream);
+					while (chunkLeft > 0) {
+						const char *data;
+						size_t len = adb_ring->peek(&data, chunkLeft, MAX_ADB_READ);
+						size_t span = 0;
+
+						if (len == 0) {
 							close_restore_fds();
 							return false;
 						}
-						memcpy(&structcmd, readAdbStream, sizeof(readAdbStream));
-						std::string cmdtype = structcmd.get_type();
+						while (span < len && !isMD5Trailer(data + span))
+							span += MAX_ADB_READ;
 
-						dataChunkBytes += readbytes;
-						totalbytes += readbytes;
-						fileBytes += readbytes;
+						if (span > 0) {
+							digest.update((unsigned char*)data, span);
+
+							#ifdef _DEBUG_ADB_BACKUP
+							if (write(debug_adb_fd, data, span) < 0) {
+								std::string msg = "Cannot write to ADB_CONTROL_READ_FD: ";
+								printErrMsg(msg, errno);
+								close_restore_fds();
+								return false;
+							}
+							#endif
+
+							//Once TWRP stops reading keep digesting so the trailer still verifies
+							if (!md5sumdata && !writeRestoreData(data, span)) {
+								std::string msg = "Cannot write to TWRP ADB FIFO: ";
+								md5sumdata = true;
+								printErrMsg(msg, errno);
+								adblogwrite("end of stream reached.\n");
+							}
+							adb_ring->consume(span);
+							chunkLeft -= span;
+							totalbytes += span;
+							fileBytes += span;
+						}
+
+						if (span < len) {
+							memcpy(readAdbStream, data + span, sizeof(readAdbStream));
+							adb_ring->consume(sizeof(readAdbStream));
+							totalbytes += sizeof(readAdbStream);
+							fileBytes += sizeof(readAdbStream);
 
-						if (cmdtype == MD5TRAILER) {
 							if (fileBytes >= md5fnsize)
 								close(adb_write_fd);
 							if (tweofrcvd) {
@@ -808,39 +871,13 @@ bool twrpback::restore(void) {
 							}
 							else
 								read_from_adb = false; //don't read from adb until TWRP sends TWEOF
+							md5sumdata = false;
 							if (!checkMD5Trailer(readAdbStream, md5fnsize, &digest)) {
 								close_restore_fds();
-								break;
+								return false;
 							}
 							break;
 						}
-
-						digest.update((unsigned char*)readAdbStream, readbytes);
-
-						read_from_adb = true;
-
-						#ifdef _DEBUG_ADB_BACKUP
-						if (write(debug_adb_fd, readAdbStream, sizeof(readAdbStream)) < 0) {
-							std::string msg = "Cannot write to ADB_CONTROL_READ_FD: ";
-							printErrMsg(msg, errno);
-							close_restore_fds();
-							return false;
-						}
-						#endif
-
-						if (write(adb_write_fd, readAdbStream, sizeof(readAdbStream)) < 0) {
-							std::string msg = "Cannot write to TWRP ADB FIFO: ";
-							md5sumdata = true;
-							printErrMsg(msg, errno);
-							adblogwrite("end of stream reached.\n"); 
-							break;
-						}
-
-						if (dataChunkBytes == DATA_MAX_CHUNK_SIZE) {
-							dataChunkBytes = 0;
-							md5sumdata = false;
-							break;
-						}
 					}
 				}
 				else if (md5sumdata) {
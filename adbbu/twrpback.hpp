@@ -19,6 +19,7 @@
 
 #include <fstream>
 #include "../twrpDigest/twrpMD5.hpp"
+#include "twadbring.hpp"
 
 class twrpback {
 public:
@@ -45,6 +46,7 @@ private:
 	int debug_adb_fd;                                                        // fd to write debug tars
 	bool firstPart;                                                          // first partition in the stream
 	FILE *adbd_fp;                                                           // file pointer for adb stream
+	twadbring *adb_ring;                                                     // adb stream read ahead for restore
 	char cmd[512];                                                           // store result of commands
 	char operation[512];                                                     // operation to send to ors
 	std::ofstream adblogfile;                                                // adb stream log file
@@ -55,6 +57,7 @@ private:
 	void close_backup_fds();                                                 // close backup resources
 	void close_restore_fds();                                                // close restore resources
 	bool checkMD5Trailer(char adbReadStream[], uint64_t md5fnsize, twrpMD5* digest); // Check MD5 Trailer
+	bool writeRestoreData(const char* data, size_t len);                     // write a data span to TWRP
 	void printErrMsg(std::string msg, int errNum);                          // print error msg to adb log
 };
 
@@ -1189,6 +1189,9 @@ void DataManager::SetDefaultValues()
   mPersist.SetValue(TW_RM_RF_VAR, "0");
   mPersist.SetValue(TW_SKIP_DIGEST_CHECK_VAR, "0");
   mPersist.SetValue(TW_SKIP_DIGEST_GENERATE_VAR, "0");
+  mPersist.SetValue(TW_BACKUP_IMG_THREADS_VAR, "0");
+  mPersist.SetValue(TW_BACKUP_IMG_BW_LIMIT_VAR, "0");
+  mPersist.SetValue(TW_ORS_EVENTS_VAR, "0");
   mPersist.SetValue(TW_SDEXT_SIZE, "0");
   mPersist.SetValue(TW_SWAP_SIZE, "0");
   mPersist.SetValue(TW_SDPART_FILE_SYSTEM, "ext3");
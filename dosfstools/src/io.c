@@ -45,15 +45,21 @@
 #include "common.h"
 #include "io.h"
 
+/* Pending changes never overlap. They are kept in a treap ordered by
+   position, so that reads and writes only visit the changes they touch.
+   A write that overlaps or adjoins queued changes is merged with them. */
 typedef struct _change {
     void *data;
     loff_t pos;
     int size;
-    struct _change *next;
+    int alloc;			/* bytes allocated for data */
+    unsigned priority;
+    struct _change *left, *right;
 } CHANGE;
 
-static CHANGE *changes, *last;
+static CHANGE *changes;
 static int fd, did_change = 0;
+static unsigned seed = 1;
 
 unsigned device_no;
 
@@ -85,7 +91,7 @@ void fs_open(char *path, int rw)
 	perror("open");
 	exit(6);
     }
-    changes = last = NULL;
+    changes = NULL;
     did_change = 0;
 
 #ifndef _DJGPP_
@@ -108,6 +114,100 @@ void fs_open(char *path, int rw)
 #endif
 }
 
+static unsigned next_priority(void)
+{
+    /* xorshift, any sequence that looks random keeps the treap balanced */
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/* Splits ROOT into the changes that start before POS and the rest. */
+static void split_changes(CHANGE * root, loff_t pos, CHANGE ** before,
+			  CHANGE ** after)
+{
+    if (!root) {
+	*before = *after = NULL;
+    } else if (root->pos < pos) {
+	split_changes(root->right, pos, &root->right, after);
+	*before = root;
+    } else {
+	split_changes(root->left, pos, before, &root->left);
+	*after = root;
+    }
+}
+
+/* Joins two treaps, all changes in BEFORE must precede those in AFTER. */
+static CHANGE *merge_changes(CHANGE * before, CHANGE * after)
+{
+    if (!before)
+	return after;
+    if (!after)
+	return before;
+    if (before->priority > after->priority) {
+	before->right = merge_changes(before->right, after);
+	return before;
+    }
+    after->left = merge_changes(before, after->left);
+    return after;
+}
+
+/* Detaches and returns the last change of ROOT. */
+static CHANGE *remove_last(CHANGE ** root)
+{
+    CHANGE *this;
+
+    if (!*root)
+	return NULL;
+    while ((*root)->right)
+	root = &(*root)->right;
+    this = *root;
+    *root = this->left;
+    this->left = NULL;
+    return this;
+}
+
+static void free_changes(CHANGE * root)
+{
+    if (!root)
+	return;
+    free_changes(root->left);
+    free_changes(root->right);
+    free(root->data);
+    free(root);
+}
+
+/* Copies the changes of ROOT that overlap SIZE bytes at POS over DATA. */
+static void apply_changes(CHANGE * root, loff_t pos, int size, void *data)
+{
+    if (!root)
+	return;
+    if (root->pos > pos)
+	apply_changes(root->left, pos, size, data);
+    if (root->pos < pos + size && root->pos + root->size > pos) {
+	if (root->pos < pos)
+	    memcpy(data, (char *)root->data + pos - root->pos,
+		   min(size, root->size - (pos - root->pos)));
+	else
+	    memcpy((char *)data + root->pos - pos, root->data,
+		   min(root->size, size - (root->pos - pos)));
+    }
+    if (root->pos + root->size < pos + size)
+	apply_changes(root->right, pos, size, data);
+}
+
+/* Copies the changes of ROOT into DATA, which starts at POS and is large
+   enough to hold all of them. */
+static void copy_changes(CHANGE * root, loff_t pos, char *data)
+{
+    if (!root)
+	return;
+    copy_changes(root->left, pos, data);
+    memcpy(data + root->pos - pos, root->data, root->size);
+    copy_changes(root->right, pos, data);
+}
+
 /**
  * Read data from the partition, accounting for any pending updates that are
  * queued for writing.
@@ -119,29 +219,20 @@ void fs_open(char *path, int rw)
  */
 void fs_read(loff_t pos, int size, void *data)
 {
-    CHANGE *walk;
-    int got;
+    int got, done;
 
     if (llseek(fd, pos, 0) != pos)
 	pdie("Seek to %lld", pos);
-    if ((got = read(fd, data, size)) < 0)
-	pdie("Read %d bytes at %lld", size, pos);
-    if (got != size)
-	die("Got %d bytes instead of %d at %lld", got, size, pos);
-    for (walk = changes; walk; walk = walk->next) {
-	if (walk->pos < pos + size && walk->pos + walk->size > pos) {
-	    if (walk->pos < pos)
-		memcpy(data, (char *)walk->data + pos - walk->pos, min(size,
-								       walk->
-								       size -
-								       pos +
-								       walk->
-								       pos));
-	    else
-		memcpy((char *)data + walk->pos - pos, walk->data,
-		       min(walk->size, size + pos - walk->pos));
-	}
+    /* large reads such as a whole FAT may be split by the kernel */
+    for (done = 0; done < size; done += got) {
+	if ((got = read(fd, (char *)data + done, size - done)) < 0)
+	    pdie("Read %d bytes at %lld", size, pos);
+	if (got == 0)
+	    break;
     }
+    if (done != size)
+	die("Got %d bytes instead of %d at %lld", done, size, pos);
+    apply_changes(changes, pos, size, data);
 }
 
 int fs_test(loff_t pos, int size)
@@ -159,8 +250,9 @@ int fs_test(loff_t pos, int size)
 
 void fs_write(loff_t pos, int size, void *data)
 {
-    CHANGE *new;
-    int did;
+    CHANGE *before, *middle, *after, *new, *tail;
+    loff_t start, end;
+    int did, need;
 
     if (write_immed) {
 	did_change = 1;
@@ -172,55 +264,91 @@ void fs_write(loff_t pos, int size, void *data)
 	    pdie("Write %d bytes at %lld", size, pos);
 	die("Wrote %d bytes instead of %d at %lld", did, size, pos);
     }
-    new = alloc(sizeof(CHANGE));
-    new->pos = pos;
-    memcpy(new->data = alloc(new->size = size), data, size);
-    new->next = NULL;
-    if (last)
-	last->next = new;
-    else
-	changes = new;
-    last = new;
+
+    /* take out the changes that start inside or right after the new one */
+    split_changes(changes, pos, &before, &after);
+    split_changes(after, pos + size + 1, &middle, &after);
+    /* the change before it is extended if it reaches POS */
+    new = remove_last(&before);
+    if (new && new->pos + new->size < pos) {
+	before = merge_changes(before, new);
+	new = NULL;
+    }
+    if (!new) {
+	new = alloc(sizeof(CHANGE));
+	new->pos = pos;
+	new->size = new->alloc = 0;
+	new->data = NULL;
+	new->priority = next_priority();
+	new->left = new->right = NULL;
+    }
+
+    start = new->pos;
+    end = pos + size;
+    if (new->pos + new->size > end)
+	end = new->pos + new->size;
+    tail = middle;
+    while (tail && tail->right)
+	tail = tail->right;
+    if (tail && tail->pos + tail->size > end)
+	end = tail->pos + tail->size;
+    need = end - start;
+    if (need > new->alloc || !new->data) {
+	/* grow geometrically, sequential writes keep extending the same change */
+	new->alloc = need > 2 * new->alloc ? need : 2 * new->alloc;
+	if (!new->alloc)
+	    new->alloc = 1;
+	if (!(new->data = realloc(new->data, new->alloc)))
+	    pdie("realloc");
+    }
+    new->size = need;
+    copy_changes(middle, start, new->data);
+    memcpy((char *)new->data + pos - start, data, size);
+    free_changes(middle);
+
+    changes = merge_changes(merge_changes(before, new), after);
 }
 
-static void fs_flush(void)
+/* Writes the changes of ROOT in disk order and frees them. */
+static void flush_changes(CHANGE * this)
 {
-    CHANGE *this;
     int size;
 
-    while (changes) {
-	this = changes;
-	changes = changes->next;
-	if (llseek(fd, this->pos, 0) != this->pos)
-	    fprintf(stderr,
-		    "Seek to %lld failed: %s\n  Did not write %d bytes.\n",
-		    (long long)this->pos, strerror(errno), this->size);
-	else if ((size = write(fd, this->data, this->size)) < 0)
-	    fprintf(stderr, "Writing %d bytes at %lld failed: %s\n", this->size,
-		    (long long)this->pos, strerror(errno));
-	else if (size != this->size)
-	    fprintf(stderr, "Wrote %d bytes instead of %d bytes at %lld."
-		    "\n", size, this->size, (long long)this->pos);
-	free(this->data);
-	free(this);
-    }
+    if (!this)
+	return;
+    flush_changes(this->left);
+    if (llseek(fd, this->pos, 0) != this->pos)
+	fprintf(stderr,
+		"Seek to %lld failed: %s\n  Did not write %d bytes.\n",
+		(long long)this->pos, strerror(errno), this->size);
+    else if ((size = write(fd, this->data, this->size)) < 0)
+	fprintf(stderr, "Writing %d bytes at %lld failed: %s\n", this->size,
+		(long long)this->pos, strerror(errno));
+    else if (size != this->size)
+	fprintf(stderr, "Wrote %d bytes instead of %d bytes at %lld."
+		"\n", size, this->size, (long long)this->pos);
+    flush_changes(this->right);
+    free(this->data);
+    free(this);
+}
+
+static void fs_flush(void)
+{
+    flush_changes(changes);
+    changes = NULL;
 }
 
 int fs_close(int write)
 {
-    CHANGE *next;
     int changed;
 
     changed = ! !changes;
     if (write)
 	fs_flush();
-    else
-	while (changes) {
-	    next = changes->next;
-	    free(changes->data);
-	    free(changes);
-	    changes = next;
-	}
+    else {
+	free_changes(changes);
+	changes = NULL;
+    }
     if (close(fd) < 0)
 	pdie("closing filesystem");
     return changed || did_change;
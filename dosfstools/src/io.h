@@ -51,8 +51,8 @@ int fs_test(loff_t pos, int size);
 void fs_write(loff_t pos, int size, void *data);
 
 /* If write_immed is non-zero, SIZE bytes are written from DATA to the disk,
-   starting at POS. If write_immed is zero, the change is added to a list in
-   memory. */
+   starting at POS. If write_immed is zero, the change is queued in memory,
+   merged with any queued change it overlaps or adjoins. */
 
 int fs_close(int write);
 
@@ -70,10 +70,97 @@ static uint32_t bytes2clusters(const struct exfat* ef, uint64_t bytes)
 	return (bytes + cluster_size - 1) / cluster_size;
 }
 
+/*
+ * The FAT is cached in pages of FAT_PAGE_SIZE bytes, each page can be held
+ * in exactly one slot. 256 slots (1 MB) hold the whole FAT of a file system
+ * with up to 256K clusters.
+ */
+#define FAT_PAGE_SIZE 4096
+#define FAT_PAGE_ENTRIES (FAT_PAGE_SIZE / sizeof(cluster_t))
+#define FAT_CACHE_SLOTS 256
+
+struct exfat_fat_cache
+{
+	struct
+	{
+		uint32_t page;
+		bool valid;
+	}
+	tags[FAT_CACHE_SLOTS];
+	le32_t pages[FAT_CACHE_SLOTS][FAT_PAGE_ENTRIES];
+};
+
+void exfat_init_fat_cache(struct exfat* ef)
+{
+	ef->fat_cache = malloc(sizeof(struct exfat_fat_cache));
+	if (ef->fat_cache == NULL)
+	{
+		/* not fatal, FAT entries will be read one by one */
+		exfat_warn("failed to allocate FAT cache");
+		return;
+	}
+	memset(ef->fat_cache->tags, 0, sizeof(ef->fat_cache->tags));
+}
+
+void exfat_free_fat_cache(struct exfat* ef)
+{
+	free(ef->fat_cache);
+	ef->fat_cache = NULL;
+}
+
+/*
+ * Returns the cached FAT page that holds the entry of the cluster, reading it
+ * if needed, or NULL if the entry should be read directly.
+ */
+static le32_t* get_fat_page(const struct exfat* ef, cluster_t cluster)
+{
+	struct exfat_fat_cache* cache = ef->fat_cache;
+	const uint32_t page = cluster / FAT_PAGE_ENTRIES;
+	const uint32_t slot = page % FAT_CACHE_SLOTS;
+	loff_t fat_size;
+	loff_t offset;
+	size_t size;
+
+	if (cache == NULL)
+		return NULL;
+	if (cache->tags[slot].valid && cache->tags[slot].page == page)
+		return cache->pages[slot];
+
+	fat_size = s2o(ef, le32_to_cpu(ef->sb->fat_sector_count));
+	offset = (loff_t) page * FAT_PAGE_SIZE;
+	if (((loff_t) cluster + 1) * (loff_t) sizeof(cluster_t) > fat_size)
+		return NULL;
+	size = MIN(FAT_PAGE_SIZE, fat_size - offset);
+	cache->tags[slot].valid = false;
+	if (exfat_pread(ef->dev, cache->pages[slot], size,
+			s2o(ef, le32_to_cpu(ef->sb->fat_sector_start)) + offset) < 0)
+		return NULL;
+	memset((char*) cache->pages[slot] + size, 0, FAT_PAGE_SIZE - size);
+	cache->tags[slot].page = page;
+	cache->tags[slot].valid = true;
+	return cache->pages[slot];
+}
+
+/*
+ * Keeps a cached FAT page in sync after its entry was written to disk.
+ */
+static void update_fat_page(const struct exfat* ef, cluster_t cluster,
+		le32_t next)
+{
+	struct exfat_fat_cache* cache = ef->fat_cache;
+	const uint32_t page = cluster / FAT_PAGE_ENTRIES;
+	const uint32_t slot = page % FAT_CACHE_SLOTS;
+
+	if (cache != NULL && cache->tags[slot].valid &&
+			cache->tags[slot].page == page)
+		cache->pages[slot][cluster % FAT_PAGE_ENTRIES] = next;
+}
+
 cluster_t exfat_next_cluster(const struct exfat* ef,
 		const struct exfat_node* node, cluster_t cluster)
 {
 	le32_t next;
+	le32_t* page;
 	loff_t fat_offset;
 
 	if (cluster < EXFAT_FIRST_DATA_CLUSTER)
@@ -81,6 +168,9 @@ cluster_t exfat_next_cluster(const struct exfat* ef,
 
 	if (IS_CONTIGUOUS(*node))
 		return cluster + 1;
+	page = get_fat_page(ef, cluster);
+	if (page != NULL)
+		return le32_to_cpu(page[cluster % FAT_PAGE_ENTRIES]);
 	fat_offset = s2o(ef, le32_to_cpu(ef->sb->fat_sector_start))
 		+ cluster * sizeof(cluster_t);
 	if (exfat_pread(ef->dev, &next, sizeof(next), fat_offset) < 0)
@@ -89,49 +179,171 @@ cluster_t exfat_next_cluster(const struct exfat* ef,
 	return le32_to_cpu(next);
 }
 
-cluster_t exfat_advance_cluster(const struct exfat* ef,
-		struct exfat_node* node, uint32_t count)
+/*
+ * Appends the cluster that follows the mapped ones to the extent map.
+ */
+static bool add_extent(struct exfat_node* node, cluster_t cluster)
 {
-	uint32_t i;
+	struct exfat_extent* last = NULL;
 
-	if (node->fptr_index > count)
+	if (node->extents_count != 0)
 	{
-		node->fptr_index = 0;
-		node->fptr_cluster = node->start_cluster;
+		last = &node->extents[node->extents_count - 1];
+		if (last->cluster + last->count == cluster)
+		{
+			last->count++;
+			node->mapped++;
+			return true;
+		}
 	}
+	if (node->extents_count == node->extents_allocated)
+	{
+		uint32_t allocated = MAX(node->extents_allocated * 2, 16);
+		struct exfat_extent* extents = realloc(node->extents,
+				allocated * sizeof(struct exfat_extent));
+		if (extents == NULL)
+		{
+			exfat_error("failed to allocate %u extents", allocated);
+			return false;
+		}
+		node->extents = extents;
+		node->extents_allocated = allocated;
+	}
+	last = &node->extents[node->extents_count++];
+	last->index = node->mapped;
+	last->cluster = cluster;
+	last->count = 1;
+	node->mapped++;
+	return true;
+}
 
-	for (i = node->fptr_index; i < count; i++)
+/*
+ * Forgets the extents past the first count clusters of the node.
+ */
+static void trim_extents(struct exfat_node* node, uint32_t count)
+{
+	struct exfat_extent* last;
+
+	while (node->extents_count != 0 &&
+			node->extents[node->extents_count - 1].index >= count)
+		node->extents_count--;
+	if (node->extents_count != 0)
 	{
-		node->fptr_cluster = exfat_next_cluster(ef, node, node->fptr_cluster);
-		if (CLUSTER_INVALID(node->fptr_cluster))
-			break; /* the caller should handle this and print appropriate 
-			          error message */
+		last = &node->extents[node->extents_count - 1];
+		last->count = MIN(last->count, count - last->index);
 	}
+	node->mapped = MIN(node->mapped, count);
+}
+
+void exfat_free_extents(struct exfat_node* node)
+{
+	free(node->extents);
+	node->extents = NULL;
+	node->extents_count = 0;
+	node->extents_allocated = 0;
+	node->mapped = 0;
+}
+
+/*
+ * Walks the FAT until the first count clusters of the node are mapped.
+ * Returns the invalid cluster where the chain ended if it is shorter.
+ */
+static cluster_t map_clusters(const struct exfat* ef, struct exfat_node* node,
+		uint32_t count)
+{
+	const struct exfat_extent* last;
+	cluster_t next;
+
+	if (node->mapped == 0 && count != 0)
+	{
+		if (CLUSTER_INVALID(node->start_cluster))
+			return node->start_cluster;
+		if (!add_extent(node, node->start_cluster))
+			return EXFAT_CLUSTER_BAD;
+	}
+	while (node->mapped < count)
+	{
+		last = &node->extents[node->extents_count - 1];
+		next = exfat_next_cluster(ef, node, last->cluster + last->count - 1);
+		if (CLUSTER_INVALID(next))
+			return next;
+		if (!add_extent(node, next))
+			return EXFAT_CLUSTER_BAD;
+	}
+	return EXFAT_CLUSTER_FREE;
+}
+
+/*
+ * Returns the cluster that holds cluster number index of the node. The run
+ * is set to the number of clusters (up to count) that follow it on disk
+ * without a gap, so they can be read or written at once.
+ */
+cluster_t exfat_map_cluster(const struct exfat* ef, struct exfat_node* node,
+		uint32_t index, uint32_t count, uint32_t* run)
+{
+	const struct exfat_extent* extent;
+	cluster_t rc;
+	uint32_t first = 0;
+	uint32_t last;
+
+	if (count == 0)
+		exfat_bug("zero clusters count passed");
+
+	if (IS_CONTIGUOUS(*node))
+	{
+		*run = count;
+		return node->start_cluster + index;
+	}
+
+	/* map the whole range now, the FAT is not touched again after that */
+	rc = map_clusters(ef, node, index + MIN(count, UINT32_MAX - index));
+	if (index >= node->mapped)
+		return rc;
+
+	last = node->extents_count - 1;
+	while (first < last)
+	{
+		uint32_t middle = first + (last - first + 1) / 2;
+		if (node->extents[middle].index <= index)
+			first = middle;
+		else
+			last = middle - 1;
+	}
+	extent = &node->extents[first];
+	*run = MIN(extent->index + extent->count - index, count);
+	return extent->cluster + (index - extent->index);
+}
+
+cluster_t exfat_advance_cluster(const struct exfat* ef,
+		struct exfat_node* node, uint32_t count)
+{
+	uint32_t run;
+
+	node->fptr_cluster = exfat_map_cluster(ef, node, count, 1, &run);
 	node->fptr_index = count;
 	return node->fptr_cluster;
 }
 
 static cluster_t find_bit_and_set(bitmap_t* bitmap, size_t start, size_t end)
 {
-	const size_t start_index = start / sizeof(bitmap_t) / 8;
-	const size_t end_index = DIV_ROUND_UP(end, sizeof(bitmap_t) * 8);
+	const size_t end_index = DIV_ROUND_UP(end, BMAP_BITS);
+	const bitmap_t all = ~((bitmap_t) 0);
 	size_t i;
-	size_t start_bitindex;
-	size_t end_bitindex;
 	size_t c;
+	bitmap_t free_bits;
 
-	for (i = start_index; i < end_index; i++)
+	for (i = start / BMAP_BITS; i < end_index; i++)
 	{
-		if (bitmap[i] == ~((bitmap_t) 0))
+		free_bits = ~bitmap[i];
+		if (i == start / BMAP_BITS)
+			free_bits &= (bitmap_t) (all << (start % BMAP_BITS));
+		if (free_bits == 0)
 			continue;
-		start_bitindex = MAX(i * sizeof(bitmap_t) * 8, start);
-		end_bitindex = MIN((i + 1) * sizeof(bitmap_t) * 8, end);
-		for (c = start_bitindex; c < end_bitindex; c++)
-			if (BMAP_GET(bitmap, c) == 0)
-			{
-				BMAP_SET(bitmap, c);
-				return c + EXFAT_FIRST_DATA_CLUSTER;
-			}
+		c = i * BMAP_BITS + CTZ(free_bits);
+		if (c >= end)
+			break;
+		BMAP_SET(bitmap, c);
+		return c + EXFAT_FIRST_DATA_CLUSTER;
 	}
 	return EXFAT_CLUSTER_END;
 }
@@ -188,6 +400,7 @@ static bool set_next_cluster(const struct exfat* ef, bool contiguous,
 				current);
 		return false;
 	}
+	update_fat_page(ef, current, next_le32);
 	return true;
 }
 
@@ -198,16 +411,22 @@ static cluster_t allocate_cluster(struct exfat* ef, cluster_t hint)
 	hint -= EXFAT_FIRST_DATA_CLUSTER;
 	if (hint >= ef->cmap.chunk_size)
 		hint = 0;
+	/* there is nothing free below first_free, so the result is the same */
+	if (hint < ef->cmap.first_free)
+		hint = ef->cmap.first_free;
 
 	cluster = find_bit_and_set(ef->cmap.chunk, hint, ef->cmap.chunk_size);
 	if (cluster == EXFAT_CLUSTER_END)
-		cluster = find_bit_and_set(ef->cmap.chunk, 0, hint);
+		cluster = find_bit_and_set(ef->cmap.chunk, ef->cmap.first_free, hint);
 	if (cluster == EXFAT_CLUSTER_END)
 	{
 		exfat_error("no free space left");
 		return EXFAT_CLUSTER_END;
 	}
 
+	ef->cmap.free_count--;
+	if (cluster - EXFAT_FIRST_DATA_CLUSTER == ef->cmap.first_free)
+		ef->cmap.first_free++;
 	ef->cmap.dirty = true;
 	return cluster;
 }
@@ -220,7 +439,11 @@ static void free_cluster(struct exfat* ef, cluster_t cluster)
 		exfat_bug("freeing non-existing cluster 0x%x (0x%x)", cluster,
 				ef->cmap.size);
 
+	if (BMAP_GET(ef->cmap.chunk, cluster - EXFAT_FIRST_DATA_CLUSTER))
+		ef->cmap.free_count++;
 	BMAP_CLR(ef->cmap.chunk, cluster - EXFAT_FIRST_DATA_CLUSTER);
+	ef->cmap.first_free = MIN(ef->cmap.first_free,
+			cluster - EXFAT_FIRST_DATA_CLUSTER);
 	ef->cmap.dirty = true;
 }
 
@@ -339,6 +562,7 @@ static int shrink_file(struct exfat* ef, struct exfat_node* node,
 	}
 	node->fptr_index = 0;
 	node->fptr_cluster = node->start_cluster;
+	trim_extents(node, current - difference);
 
 	/* free remaining clusters */
 	while (difference--)
@@ -438,15 +662,43 @@ int exfat_truncate(struct exfat* ef, struct exfat_node* node, uint64_t size,
 	return 0;
 }
 
-uint32_t exfat_count_free_clusters(const struct exfat* ef)
+/*
+ * Counts free clusters and finds the first one after the bitmap is loaded,
+ * allocate_cluster() and free_cluster() keep both up to date after that.
+ */
+void exfat_scan_cmap(struct exfat* ef)
 {
-	uint32_t free_clusters = 0;
-	uint32_t i;
+	const size_t full_words = ef->cmap.chunk_size / BMAP_BITS;
+	const size_t tail_bits = ef->cmap.chunk_size % BMAP_BITS;
+	uint32_t used = 0;
+	size_t i;
 
-	for (i = 0; i < ef->cmap.size; i++)
-		if (BMAP_GET(ef->cmap.chunk, i) == 0)
-			free_clusters++;
-	return free_clusters;
+	ef->cmap.first_free = ef->cmap.chunk_size;
+	for (i = 0; i < full_words; i++)
+	{
+		used += POPCOUNT(ef->cmap.chunk[i]);
+		if (ef->cmap.first_free == ef->cmap.chunk_size &&
+				ef->cmap.chunk[i] != (bitmap_t) ~((bitmap_t) 0))
+			ef->cmap.first_free = i * BMAP_BITS +
+				CTZ((bitmap_t) ~ef->cmap.chunk[i]);
+	}
+	if (tail_bits != 0)
+	{
+		/* bits past the end of the bitmap are not clusters */
+		const bitmap_t mask = (bitmap_t) (((bitmap_t) 1 << tail_bits) - 1);
+		const bitmap_t tail = ef->cmap.chunk[full_words] & mask;
+
+		used += POPCOUNT(tail);
+		if (ef->cmap.first_free == ef->cmap.chunk_size && tail != mask)
+			ef->cmap.first_free = full_words * BMAP_BITS +
+				CTZ((bitmap_t) ~tail);
+	}
+	ef->cmap.free_count = ef->cmap.chunk_size - used;
+}
+
+uint32_t exfat_count_free_clusters(const struct exfat* ef)
+{
+	return ef->cmap.free_count;
 }
 
 static int find_used_clusters(const struct exfat* ef,
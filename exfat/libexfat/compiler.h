@@ -33,6 +33,8 @@
 #define PRINTF __attribute__((format(printf, 1, 2)))
 #define NORETURN __attribute__((noreturn))
 #define PACKED __attribute__((packed))
+#define POPCOUNT(x) __builtin_popcountll(x)
+#define CTZ(x) __builtin_ctzll(x)
 #if __has_extension(c_static_assert)
 #define USE_C11_STATIC_ASSERT
 #endif
@@ -42,6 +44,8 @@
 #define PRINTF __attribute__((format(printf, 1, 2)))
 #define NORETURN __attribute__((noreturn))
 #define PACKED __attribute__((packed))
+#define POPCOUNT(x) __builtin_popcountll(x)
+#define CTZ(x) __builtin_ctzll(x)
 #if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 6)
 #define USE_C11_STATIC_ASSERT
 #endif
@@ -51,6 +55,27 @@
 #define PRINTF
 #define NORETURN
 #define PACKED
+#define POPCOUNT(x) exfat_popcount(x)
+#define CTZ(x) exfat_ctz(x)
+
+static inline int exfat_popcount(unsigned long long x)
+{
+	int count = 0;
+
+	for (; x != 0; x &= x - 1)
+		count++;
+	return count;
+}
+
+/* the argument must not be zero */
+static inline int exfat_ctz(unsigned long long x)
+{
+	int count = 0;
+
+	for (; (x & 1) == 0; x >>= 1)
+		count++;
+	return count;
+}
 
 #endif
 
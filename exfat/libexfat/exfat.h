@@ -64,11 +64,20 @@
 	((bitmap)[BMAP_BLOCK(index)] |= BMAP_MASK(index))
 #define BMAP_CLR(bitmap, index) \
 	((bitmap)[BMAP_BLOCK(index)] &= ~BMAP_MASK(index))
+#define BMAP_BITS (sizeof(bitmap_t) * 8)
 
 /* The size of off_t type must be 64 bits. File systems larger than 2 GB will
    be corrupted with 32-bit off_t. So, we use loff_t here.*/
 STATIC_ASSERT(sizeof(loff_t) == 8);
 
+/* run of clusters that are contiguous on disk */
+struct exfat_extent
+{
+	uint32_t index;				/* first cluster index in the file */
+	cluster_t cluster;
+	uint32_t count;
+};
+
 struct exfat_node
 {
 	struct exfat_node* parent;
@@ -86,6 +95,10 @@ struct exfat_node
 	uint64_t size;
 	time_t mtime, atime;
 	le16_t name[EXFAT_NAME_MAX + 1];
+	struct exfat_extent* extents;	/* built lazily for fragmented nodes */
+	uint32_t extents_count;
+	uint32_t extents_allocated;
+	uint32_t mapped;			/* clusters covered by extents */
 };
 
 enum exfat_mode
@@ -96,10 +109,12 @@ enum exfat_mode
 };
 
 struct exfat_dev;
+struct exfat_fat_cache;
 
 struct exfat
 {
 	struct exfat_dev* dev;
+	struct exfat_fat_cache* fat_cache;
 	struct exfat_super_block* sb;
 	le16_t* upcase;
 	size_t upcase_chars;
@@ -110,6 +125,8 @@ struct exfat
 		uint32_t size;				/* in bits */
 		bitmap_t* chunk;
 		uint32_t chunk_size;		/* in bits */
+		uint32_t free_count;		/* kept up to date on allocation and free */
+		uint32_t first_free;		/* all bits below this one are set */
 		bool dirty;
 	}
 	cmap;
@@ -173,10 +190,16 @@ cluster_t exfat_next_cluster(const struct exfat* ef,
 		const struct exfat_node* node, cluster_t cluster);
 cluster_t exfat_advance_cluster(const struct exfat* ef,
 		struct exfat_node* node, uint32_t count);
+cluster_t exfat_map_cluster(const struct exfat* ef, struct exfat_node* node,
+		uint32_t index, uint32_t count, uint32_t* run);
+void exfat_free_extents(struct exfat_node* node);
+void exfat_init_fat_cache(struct exfat* ef);
+void exfat_free_fat_cache(struct exfat* ef);
 int exfat_flush_nodes(struct exfat* ef);
 int exfat_flush(struct exfat* ef);
 int exfat_truncate(struct exfat* ef, struct exfat_node* node, uint64_t size,
 		bool erase);
+void exfat_scan_cmap(struct exfat* ef);
 uint32_t exfat_count_free_clusters(const struct exfat* ef);
 int exfat_find_used_sectors(const struct exfat* ef, loff_t* a, loff_t* b);
 
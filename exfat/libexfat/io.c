@@ -352,29 +352,27 @@ ssize_t exfat_generic_pread(const struct exfat* ef, struct exfat_node* node,
 	cluster_t cluster;
 	char* bufp = buffer;
 	loff_t lsize, loffset, remainder;
+	uint32_t index, run;
 
 	if (offset >= node->size)
 		return 0;
 	if (size == 0)
 		return 0;
 
-	cluster = exfat_advance_cluster(ef, node, offset / CLUSTER_SIZE(*ef->sb));
-	if (CLUSTER_INVALID(cluster))
-	{
-		exfat_error("invalid cluster 0x%x while reading", cluster);
-		return -1;
-	}
-
+	index = offset / CLUSTER_SIZE(*ef->sb);
 	loffset = offset % CLUSTER_SIZE(*ef->sb);
 	remainder = MIN(size, node->size - offset);
 	while (remainder > 0)
 	{
+		/* read all clusters that follow each other on disk at once */
+		cluster = exfat_map_cluster(ef, node, index,
+				DIV_ROUND_UP(loffset + remainder, CLUSTER_SIZE(*ef->sb)), &run);
 		if (CLUSTER_INVALID(cluster))
 		{
 			exfat_error("invalid cluster 0x%x while reading", cluster);
 			return -1;
 		}
-		lsize = MIN(CLUSTER_SIZE(*ef->sb) - loffset, remainder);
+		lsize = MIN((loff_t) run * CLUSTER_SIZE(*ef->sb) - loffset, remainder);
 		if (exfat_pread(ef->dev, bufp, lsize,
 					exfat_c2o(ef, cluster) + loffset) < 0)
 		{
@@ -384,7 +382,7 @@ ssize_t exfat_generic_pread(const struct exfat* ef, struct exfat_node* node,
 		bufp += lsize;
 		loffset = 0;
 		remainder -= lsize;
-		cluster = exfat_next_cluster(ef, node, cluster);
+		index += run;
 	}
 	if (!ef->ro && !ef->noatime)
 		exfat_update_atime(node);
@@ -397,6 +395,7 @@ ssize_t exfat_generic_pwrite(struct exfat* ef, struct exfat_node* node,
 	cluster_t cluster;
 	const char* bufp = buffer;
 	loff_t lsize, loffset, remainder;
+	uint32_t index, run;
 
  	if (offset > node->size)
  		if (exfat_truncate(ef, node, offset, true) != 0)
@@ -407,23 +406,19 @@ ssize_t exfat_generic_pwrite(struct exfat* ef, struct exfat_node* node,
 	if (size == 0)
 		return 0;
 
-	cluster = exfat_advance_cluster(ef, node, offset / CLUSTER_SIZE(*ef->sb));
-	if (CLUSTER_INVALID(cluster))
-	{
-		exfat_error("invalid cluster 0x%x while writing", cluster);
-		return -1;
-	}
-
+	index = offset / CLUSTER_SIZE(*ef->sb);
 	loffset = offset % CLUSTER_SIZE(*ef->sb);
 	remainder = size;
 	while (remainder > 0)
 	{
+		cluster = exfat_map_cluster(ef, node, index,
+				DIV_ROUND_UP(loffset + remainder, CLUSTER_SIZE(*ef->sb)), &run);
 		if (CLUSTER_INVALID(cluster))
 		{
 			exfat_error("invalid cluster 0x%x while writing", cluster);
 			return -1;
 		}
-		lsize = MIN(CLUSTER_SIZE(*ef->sb) - loffset, remainder);
+		lsize = MIN((loff_t) run * CLUSTER_SIZE(*ef->sb) - loffset, remainder);
 		if (exfat_pwrite(ef->dev, bufp, lsize,
 				exfat_c2o(ef, cluster) + loffset) < 0)
 		{
@@ -433,7 +428,7 @@ ssize_t exfat_generic_pwrite(struct exfat* ef, struct exfat_node* node,
 		bufp += lsize;
 		loffset = 0;
 		remainder -= lsize;
-		cluster = exfat_next_cluster(ef, node, cluster);
+		index += run;
 	}
 	exfat_update_mtime(node);
 	return size - remainder;
@@ -305,6 +305,7 @@ int exfat_mount(struct exfat* ef, const char* spec, const char* options)
 	ef->root->atime = 0;
 	/* always keep at least 1 reference to the root node */
 	exfat_get_node(ef->root);
+	exfat_init_fat_cache(ef);
 
 	rc = exfat_cache_directory(ef, ef->root);
 	if (rc != 0)
@@ -328,7 +329,9 @@ int exfat_mount(struct exfat* ef, const char* spec, const char* options)
 error:
 	exfat_put_node(ef, ef->root);
 	exfat_reset_cache(ef);
+	exfat_free_extents(ef->root);
 	free(ef->root);
+	exfat_free_fat_cache(ef);
 	free(ef->zero_cluster);
 	exfat_close(ef->dev);
 	free(ef->sb);
@@ -363,8 +366,10 @@ void exfat_unmount(struct exfat* ef)
 	exfat_flush(ef);		/* ignore return code */
 	exfat_put_node(ef, ef->root);
 	exfat_reset_cache(ef);
+	exfat_free_extents(ef->root);
 	free(ef->root);
 	ef->root = NULL;
+	exfat_free_fat_cache(ef);
 	finalize_super_block(ef);
 	exfat_close(ef->dev);	/* close descriptor immediately after fsync */
 	ef->dev = NULL;
@@ -79,6 +79,7 @@ int exfat_cleanup_node(struct exfat* ef, struct exfat_node* node)
 		/* free all clusters and node structure itself */
 		rc = exfat_truncate(ef, node, 0, true);
 		/* free the node even in case of error or its memory will be lost */
+		exfat_free_extents(node);
 		free(node);
 	}
 	return rc;
@@ -439,6 +440,7 @@ static int readdir(struct exfat* ef, const struct exfat_node* parent,
 						le64_to_cpu(bitmap->size), ef->cmap.start_cluster);
 				goto error;
 			}
+			exfat_scan_cmap(ef);
 			break;
 
 		case EXFAT_ENTRY_LABEL:
@@ -560,6 +562,7 @@ static void reset_cache(struct exfat* ef, struct exfat_node* node)
 		struct exfat_node* p = node->child;
 		reset_cache(ef, p);
 		tree_detach(p);
+		exfat_free_extents(p);
 		free(p);
 	}
 	node->flags &= ~EXFAT_ATTRIB_CACHED;
@@ -17,11 +17,20 @@
 */
 
 #include <string>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <cctype>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "fixContexts.hpp"
 #include "twrp-functions.hpp"
 #include "twcommon.h"
@@ -30,6 +39,8 @@
 #include <selinux/android.h>
 #include <selinux/label.h>
 
+#define FIX_CONTEXTS_MAX_THREADS 8
+
 using namespace std;
 
 struct selabel_handle *sehandle;
@@ -37,60 +48,153 @@ struct selinux_opt selinux_options[] = {
 	{ SELABEL_OPT_PATH, "/file_contexts" }
 };
 
-int fixContexts::restorecon(string entry, struct stat *sb) {
-	char *oldcontext, *newcontext;
+// Walks the trees handed to Add_Root on a pool of threads. Each directory is
+// read through its fd, entries are typed from d_type (stat only as a fallback),
+// and the relabels of a directory are applied as one batch once it has been
+// read. file_contexts may have rules for single file names, so every entry is
+// looked up; each worker has its own label handle so lookups run in parallel.
+class fixContextsWalker {
+public:
+	void Add_Root(const string& path);
+	void Run();
+
+private:
+	struct relabel {
+		string path;
+		string context;
+	};
+
+	void Worker(struct selabel_handle *handle);
+	void Process_Directory(struct selabel_handle *handle, const string& dir);
+	void Check(struct selabel_handle *handle, const string& path, mode_t mode, vector<relabel>& batch);
+	void Queue(const string& dir);
+
+	mutex queue_lock;
+	condition_variable queue_cond;
+	deque<string> queue;
+	size_t busy = 0;
+
+	atomic<unsigned long> checked { 0 };
+	atomic<unsigned long> relabeled { 0 };
+};
 
-	if (lgetfilecon(entry.c_str(), &oldcontext) < 0) {
-		LOGINFO("Couldn't get selinux context for %s\n", entry.c_str());
-		return -1;
-	}
-	if (selabel_lookup(sehandle, &newcontext, entry.c_str(), sb->st_mode) < 0) {
-		LOGINFO("Couldn't lookup selinux context for %s\n", entry.c_str());
-		return -1;
+void fixContextsWalker::Add_Root(const string& path) {
+	vector<relabel> batch;
+	Check(sehandle, path, S_IFDIR, batch);
+	for (auto&& r:batch) {
+		if (lsetfilecon(r.path.c_str(), r.context.c_str()) < 0)
+			LOGINFO("Couldn't label %s with %s: %s\n", r.path.c_str(), r.context.c_str(), strerror(errno));
 	}
-	if (strcmp(oldcontext, newcontext) != 0) {
-		LOGINFO("Relabeling %s from %s to %s\n", entry.c_str(), oldcontext, newcontext);
-		if (lsetfilecon(entry.c_str(), newcontext) < 0) {
-			LOGINFO("Couldn't label %s with %s: %s\n", entry.c_str(), newcontext, strerror(errno));
-		}
+	Queue(path);
+}
+
+void fixContextsWalker::Run() {
+	unsigned int threads = std::max(1U, std::min(thread::hardware_concurrency(), (unsigned int)FIX_CONTEXTS_MAX_THREADS));
+	vector<thread> workers;
+	for (unsigned int i = 1; i < threads; i++) {
+		workers.emplace_back([this]() {
+			// selabel_lookup is not thread safe, so each worker opens its own handle
+			struct selabel_handle *handle = selabel_open(SELABEL_CTX_FILE, selinux_options, 1);
+			if (!handle)
+				return;
+			Worker(handle);
+			selabel_close(handle);
+		});
 	}
-	freecon(oldcontext);
-	freecon(newcontext);
-	return 0;
+	Worker(sehandle);
+	for (auto&& w:workers)
+		w.join();
+	LOGINFO("Checked %lu entries with %u threads, relabeled %lu\n",
+		checked.load(), threads, relabeled.load());
 }
 
-int fixContexts::fixContextsRecursively(string name, int level) {
-	DIR *d;
-	struct dirent *de;
-	struct stat sb;
-	string path;
+void fixContextsWalker::Queue(const string& dir) {
+	lock_guard<mutex> guard(queue_lock);
+	queue.push_back(dir);
+	queue_cond.notify_one();
+}
 
-	if (!(d = opendir(name.c_str())))
-		return -1;
-	if (!(de = readdir(d)))
-		return -1;
+void fixContextsWalker::Worker(struct selabel_handle *handle) {
+	unique_lock<mutex> guard(queue_lock);
+	for (;;) {
+		queue_cond.wait(guard, [this]() { return !queue.empty() || busy == 0; });
+		if (queue.empty())
+			break;
+		string dir = queue.back();
+		queue.pop_back();
+		busy++;
+		guard.unlock();
+		Process_Directory(handle, dir);
+		guard.lock();
+		busy--;
+		if (busy == 0 && queue.empty())
+			queue_cond.notify_all();
+	}
+}
+
+void fixContextsWalker::Process_Directory(struct selabel_handle *handle, const string& dir) {
+	int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	DIR *d = fdopendir(fd);
+	if (!d) {
+		close(fd);
+		return;
+	}
 
-	do {
-		if (de->d_type ==  DT_DIR) {
-			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+	vector<relabel> batch;
+	struct dirent *de;
+	while ((de = readdir(d))) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		mode_t mode = DTTOIF(de->d_type);
+		if (de->d_type == DT_UNKNOWN) {
+			struct stat sb;
+			if (fstatat(fd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
 				continue;
-			path = name + "/" + de->d_name;
-			restorecon(path, &sb);
-			fixContextsRecursively(path, level + 1);
+			mode = sb.st_mode & S_IFMT;
 		}
-		else {
-			path = name + "/" + de->d_name;
-			restorecon(path, &sb);
-		}
-	} while ((de = readdir(d)));
+		string path = dir + "/" + de->d_name;
+		Check(handle, path, mode, batch);
+		if (S_ISDIR(mode))
+			Queue(path);
+	}
 	closedir(d);
-	return 0;
+
+	for (auto&& r:batch) {
+		if (lsetfilecon(r.path.c_str(), r.context.c_str()) < 0)
+			LOGINFO("Couldn't label %s with %s: %s\n", r.path.c_str(), r.context.c_str(), strerror(errno));
+	}
+	if (!batch.empty())
+		LOGINFO("Relabeled %zu entries in %s\n", batch.size(), dir.c_str());
+}
+
+void fixContextsWalker::Check(struct selabel_handle *handle, const string& path, mode_t mode, vector<relabel>& batch) {
+	char *oldcontext;
+	char *newcontext;
+
+	checked++;
+	if (lgetfilecon(path.c_str(), &oldcontext) < 0) {
+		LOGINFO("Couldn't get selinux context for %s\n", path.c_str());
+		return;
+	}
+	if (selabel_lookup(handle, &newcontext, path.c_str(), mode) < 0) {
+		LOGINFO("Couldn't lookup selinux context for %s\n", path.c_str());
+		freecon(oldcontext);
+		return;
+	}
+	if (strcmp(oldcontext, newcontext) != 0) {
+		batch.push_back({ path, newcontext });
+		relabeled++;
+	}
+	freecon(oldcontext);
+	freecon(newcontext);
 }
 
 int fixContexts::fixDataMediaContexts(string Mount_Point) {
 	DIR *d;
 	struct dirent *de;
-	struct stat sb;
+	fixContextsWalker walker;
 
 	LOGINFO("Fixing media contexts on '%s'\n", Mount_Point.c_str());
 
@@ -104,15 +208,11 @@ int fixContexts::fixDataMediaContexts(string Mount_Point) {
 		string dir = Mount_Point + "/media";
 		if (!(d = opendir(dir.c_str()))) {
 			LOGINFO("opendir failed (%s)\n", strerror(errno));
-			return -1;
-		}
-		if (!(de = readdir(d))) {
-			LOGINFO("readdir failed (%s)\n", strerror(errno));
-			closedir(d);
+			selabel_close(sehandle);
 			return -1;
 		}
 
-		do {
+		while ((de = readdir(d))) {
 			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 || de->d_type != DT_DIR)
 				continue;
 			size_t len = strlen(de->d_name);
@@ -128,18 +228,18 @@ int fixContexts::fixDataMediaContexts(string Mount_Point) {
 			if (is_numeric) {
 				dir = Mount_Point + "/media/";
 				dir += de->d_name;
-				restorecon(dir, &sb);
-				fixContextsRecursively(dir, 0);
+				walker.Add_Root(dir);
 			}
-		} while ((de = readdir(d)));
+		}
 		closedir(d);
 	} else if (TWFunc::Path_Exists(Mount_Point + "/media")) {
-		restorecon(Mount_Point + "/media", &sb);
-		fixContextsRecursively(Mount_Point + "/media", 0);
+		walker.Add_Root(Mount_Point + "/media");
 	} else {
 		LOGINFO("fixDataMediaContexts: %s/media does not exist!\n", Mount_Point.c_str());
+		selabel_close(sehandle);
 		return 0;
 	}
+	walker.Run();
 	selabel_close(sehandle);
 	return 0;
 }
@@ -26,10 +26,6 @@ using namespace std;
 class fixContexts {
 	public:
 		static int fixDataMediaContexts(string Mount_Point);
-
-	private:
-		static int restorecon(string entry, struct stat *sb);
-		static int fixContextsRecursively(string path, int level);
 };
 
 #endif
@@ -28,12 +28,16 @@
 #include <unistd.h>
 #include <pthread.h>
 
+#include <atomic>
+#include <deque>
 #include <string>
 
 extern "C" {
 #include "../twcommon.h"
 }
 #include "minuitwrp/minui.h"
+#include "../data.hpp"
+#include "../variables.h"
 
 #include "rapidxml.hpp"
 #include "objects.hpp"
@@ -41,13 +45,40 @@ extern "C" {
 #include "twmsg.h"
 
 #define GUI_CONSOLE_BUFFER_SIZE 512
+#define GUI_CONSOLE_MAX_LINES 2048 // power of two, older lines are dropped
+#define GUI_CONSOLE_COLOR_NAME_SIZE 32
 
-static pthread_mutex_t console_lock;
-static size_t last_message_count = 0;
-static std::vector<Message> gMessages;
+// A line in the console ring. seq is the line number + 1 once the line is
+// complete and 0 while a writer fills it in, so readers can tell a finished
+// line from one that is still being written or has been reused since.
+struct ConsoleLine
+{
+	std::atomic<uint64_t> seq;
+	uint16_t length;
+	uint8_t color;
+	char text[GUI_CONSOLE_BUFFER_SIZE];
+};
+
+enum ConsoleReadResult
+{
+	CONSOLE_LINE_GONE = -1,
+	CONSOLE_LINE_PENDING = 0,
+	CONSOLE_LINE_OK = 1
+};
 
-static std::vector<std::string> gConsole;
-static std::vector<std::string> gConsoleColor;
+static pthread_mutex_t console_lock;
+static std::atomic<size_t> last_message_count(0); // next message to translate, counted from the first message ever queued
+static size_t messages_dropped = 0; // messages popped off the front of gMessages
+static std::atomic<size_t> message_total(0);
+static std::deque<Message> gMessages;
+
+static ConsoleLine gConsole[GUI_CONSOLE_MAX_LINES];
+static std::atomic<uint64_t> gConsoleHead(0); // next line number to hand out
+static std::atomic<uint64_t> gConsoleStart(0); // first line to show, moved by Clear_For_Retranslation
+
+static pthread_mutex_t color_lock = PTHREAD_MUTEX_INITIALIZER;
+static char gConsoleColorNames[CONSOLE_COLOR_MAX][GUI_CONSOLE_COLOR_NAME_SIZE] = { "normal", "error", "highlight", "warning" };
+static std::atomic<int> gConsoleColorCount(CONSOLE_COLOR_WARNING + 1);
 static FILE* ors_file = NULL;
 
 struct InitMutex
@@ -55,6 +86,85 @@ struct InitMutex
 	InitMutex() { pthread_mutex_init(&console_lock, NULL); }
 } initMutex;
 
+// Maps a color name to its ConsoleColor, interning names seen for the first time
+static uint8_t console_color(const char *color)
+{
+	int count = gConsoleColorCount.load(std::memory_order_acquire);
+	for (int i = 0; i < count; i++) {
+		if (strcmp(gConsoleColorNames[i], color) == 0)
+			return i;
+	}
+
+	uint8_t res = CONSOLE_COLOR_NORMAL;
+	pthread_mutex_lock(&color_lock);
+	count = gConsoleColorCount.load(std::memory_order_relaxed);
+	for (int i = 0; i < count; i++) {
+		if (strcmp(gConsoleColorNames[i], color) == 0) {
+			res = i;
+			goto exit;
+		}
+	}
+	if (count < CONSOLE_COLOR_MAX && strlen(color) < GUI_CONSOLE_COLOR_NAME_SIZE) {
+		strcpy(gConsoleColorNames[count], color);
+		gConsoleColorCount.store(count + 1, std::memory_order_release);
+		res = count;
+	}
+exit:
+	pthread_mutex_unlock(&color_lock);
+	return res;
+}
+
+// Appends a line to the console ring without taking any lock
+static void console_append(const char *text, size_t length, uint8_t color)
+{
+	do {
+		// Lines too long for a slot carry on in the next one, split on a UTF-8 character boundary
+		size_t part = length;
+		if (part > GUI_CONSOLE_BUFFER_SIZE - 1) {
+			part = GUI_CONSOLE_BUFFER_SIZE - 1;
+			while (part > 1 && (text[part] & 0xC0) == 0x80)
+				part--;
+		}
+
+		uint64_t line = gConsoleHead.fetch_add(1, std::memory_order_relaxed);
+		ConsoleLine& slot = gConsole[line & (GUI_CONSOLE_MAX_LINES - 1)];
+		slot.seq.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(slot.text, text, part);
+		slot.text[part] = '\0';
+		slot.length = part;
+		slot.color = color;
+		slot.seq.store(line + 1, std::memory_order_release);
+
+		text += part;
+		length -= part;
+	} while (length);
+}
+
+// Copies up to count bytes of a line starting at offset into text, which must hold GUI_CONSOLE_BUFFER_SIZE bytes
+static ConsoleReadResult console_read(uint64_t line, size_t offset, size_t count, char *text, uint8_t *color)
+{
+	const ConsoleLine& slot = gConsole[line & (GUI_CONSOLE_MAX_LINES - 1)];
+	uint64_t seq = slot.seq.load(std::memory_order_acquire);
+
+	if (seq == line + 1) {
+		size_t length = slot.length;
+		if (offset > length)
+			offset = length;
+		if (count > length - offset)
+			count = length - offset;
+		memcpy(text, slot.text + offset, count);
+		text[count] = '\0';
+		*color = slot.color;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.seq.load(std::memory_order_relaxed) == seq)
+			return CONSOLE_LINE_OK;
+	}
+	if (line + GUI_CONSOLE_MAX_LINES <= gConsoleHead.load(std::memory_order_relaxed))
+		return CONSOLE_LINE_GONE;
+	return CONSOLE_LINE_PENDING;
+}
+
 static void internal_gui_print(const char *color, char *buf)
 {
 	// make sure to flush any outstanding messages first to preserve order of outputs
@@ -73,15 +183,12 @@ static void internal_gui_print(const char *color, char *buf)
 		return;
 	}
 
-	pthread_mutex_lock(&console_lock);
+	uint8_t color_index = console_color(color);
 	for (start = next = buf; *next != '\0';)
 	{
 		if (*next == '\n')
 		{
-			*next = '\0';
-			gConsole.push_back(start);
-			gConsoleColor.push_back(color);
-
+			console_append(start, next - start, color_index);
 			start = ++next;
 		}
 		else
@@ -89,11 +196,8 @@ static void internal_gui_print(const char *color, char *buf)
 	}
 
 	// The text after last \n (or whole string if there is no \n)
-	if (*start) {
-		gConsole.push_back(start);
-		gConsoleColor.push_back(color);
-	}
-	pthread_mutex_unlock(&console_lock);
+	if (*start)
+		console_append(start, next - start, color_index);
 }
 
 extern "C" void gui_print(const char *fmt, ...)
@@ -125,6 +229,15 @@ extern "C" void gui_set_FILE(FILE* f)
 	ors_file = f;
 }
 
+void gui_event(const std::string& line)
+{
+	FILE* f = ors_file;
+	if (!f || DataManager::GetIntValue(TW_ORS_EVENTS_VAR) == 0)
+		return;
+	fprintf(f, "%s\n", line.c_str());
+	fflush(f);
+}
+
 void gui_msg(const char* text)
 {
 	if (text) {
@@ -168,13 +281,25 @@ void gui_msg(Message msg)
 	}
 	pthread_mutex_lock(&console_lock);
 	gMessages.push_back(msg);
+	if (gMessages.size() > GUI_CONSOLE_MAX_LINES) {
+		// Only kept for retranslation, which can't bring back more lines than the console holds anyway
+		gMessages.pop_front();
+		messages_dropped++;
+		if (last_message_count < messages_dropped)
+			last_message_count = messages_dropped;
+	}
+	message_total.store(messages_dropped + gMessages.size(), std::memory_order_release);
 	pthread_mutex_unlock(&console_lock);
 }
 
 void GUIConsole::Translate_Now()
 {
+	// Skip the lock on the common path where nothing was queued
+	if (message_total.load(std::memory_order_acquire) == last_message_count)
+		return;
+
 	pthread_mutex_lock(&console_lock);
-	size_t message_count = gMessages.size();
+	size_t message_count = messages_dropped + gMessages.size();
 	if (message_count <= last_message_count)
 	{
 		pthread_mutex_unlock(&console_lock);
@@ -182,16 +307,16 @@ void GUIConsole::Translate_Now()
 	}
 
 	for (size_t m = last_message_count; m < message_count; m++) {
-		std::string message = gMessages[m];
-		std::string color = "normal";
-		if (gMessages[m].GetKind() == msg::kError)
-			color = "error";
-		else if (gMessages[m].GetKind() == msg::kHighlight)
-			color = "highlight";
-		else if (gMessages[m].GetKind() == msg::kWarning)
-			color = "warning";
-		gConsole.push_back(message);
-		gConsoleColor.push_back(color);
+		Message& msg = gMessages[m - messages_dropped];
+		std::string message = msg;
+		uint8_t color = CONSOLE_COLOR_NORMAL;
+		if (msg.GetKind() == msg::kError)
+			color = CONSOLE_COLOR_ERROR;
+		else if (msg.GetKind() == msg::kHighlight)
+			color = CONSOLE_COLOR_HIGHLIGHT;
+		else if (msg.GetKind() == msg::kWarning)
+			color = CONSOLE_COLOR_WARNING;
+		console_append(message.c_str(), message.size(), color);
 	}
 	last_message_count = message_count;
 	pthread_mutex_unlock(&console_lock);
@@ -200,9 +325,8 @@ void GUIConsole::Translate_Now()
 void GUIConsole::Clear_For_Retranslation()
 {
 	pthread_mutex_lock(&console_lock);
-	last_message_count = 0;
-	gConsole.clear();
-	gConsoleColor.clear();
+	last_message_count = messages_dropped;
+	gConsoleStart.store(gConsoleHead.load());
 	pthread_mutex_unlock(&console_lock);
 }
 
@@ -210,7 +334,8 @@ GUIConsole::GUIConsole(xml_node<>* node) : GUIScrollList(node)
 {
 	xml_node<>* child;
 
-	mLastCount = 0;
+	mNextLine = 0;
+	mColorsValid = 0;
 	scrollToEnd = true;
 	mSlideoutX = mSlideoutY = mSlideoutW = mSlideoutH = 0;
 	mSlideout = 0;
@@ -268,12 +393,75 @@ int GUIConsole::RenderSlideout(void)
 	return 0;
 }
 
+// Wraps the lines added to the console ring since the last call into rConsole
+// and drops the rows of lines that the ring has reused since
+bool GUIConsole::AddConsoleLines(void)
+{
+	if (!mFont || !mFont->GetResource())
+		return false;
+
+	uint64_t head = gConsoleHead.load(std::memory_order_acquire);
+	uint64_t start = gConsoleStart.load(std::memory_order_acquire);
+	bool added = false;
+
+	if (mNextLine < start) {
+		rConsole.clear();
+		mNextLine = start;
+		added = true;
+	}
+	if (head > GUI_CONSOLE_MAX_LINES && mNextLine < head - GUI_CONSOLE_MAX_LINES)
+		mNextLine = head - GUI_CONSOLE_MAX_LINES;
+
+	char text[GUI_CONSOLE_BUFFER_SIZE];
+	uint8_t color;
+	for (; mNextLine < head; mNextLine++) {
+		ConsoleReadResult res = console_read(mNextLine, 0, GUI_CONSOLE_BUFFER_SIZE - 1, text, &color);
+		if (res == CONSOLE_LINE_PENDING)
+			break; // still being written, pick it up next time
+		if (res == CONSOLE_LINE_GONE)
+			continue;
+
+		// Each line is wrapped once, as console widths don't change
+		size_t length = strlen(text);
+		size_t offset = 0;
+		for (;;) {
+			ConsoleRow row;
+			row.line = mNextLine;
+			row.offset = offset;
+			row.length = GetLineBreak(text + offset, length - offset);
+			row.color = color;
+			rConsole.push_back(row);
+			offset += row.length;
+			// After word wrapping, skip any leading spaces
+			while (offset < length && text[offset] == ' ')
+				offset++;
+			if (offset >= length)
+				break;
+		}
+		added = true;
+	}
+
+	size_t dropped = 0;
+	while (!rConsole.empty() && rConsole.front().line + GUI_CONSOLE_MAX_LINES <= head) {
+		rConsole.pop_front();
+		dropped++;
+	}
+	if (dropped && !scrollToEnd) {
+		// keep the rows in view where they are
+		firstDisplayedItem -= dropped;
+		if (firstDisplayedItem < 0) {
+			firstDisplayedItem = 0;
+			y_offset = 0;
+		}
+	}
+	return added || dropped;
+}
+
 int GUIConsole::RenderConsole(void)
 {
 	Translate_Now();
-	pthread_mutex_lock(&console_lock);
-	AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor);
-	pthread_mutex_unlock(&console_lock);
+	AddConsoleLines();
+	mColorsValid = 0;
 	GUIScrollList::Render();
 
 	// if last line is fully visible, keep tracking the last line when new lines are added
@@ -324,9 +512,7 @@ int GUIConsole::Update(void)
 		scrollToEnd = true;
 	}
 
-	pthread_mutex_lock(&console_lock);
-	bool addedNewText = AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor);
-	pthread_mutex_unlock(&console_lock);
+	bool addedNewText = AddConsoleLines();
 	if (addedNewText) {
 		// someone added new text
 		// at least the scrollbar must be updated, even if the new lines are currently not visible
@@ -392,19 +578,27 @@ size_t GUIConsole::GetItemCount()
 
 void GUIConsole::RenderItem(size_t itemindex, int yPos, bool selected __unused)
 {
-	// Set the color for the font
-	if (rConsoleColor[itemindex] == "normal") {
-		gr_color(mFontColor.red, mFontColor.green, mFontColor.blue, mFontColor.alpha);
-	} else {
-		COLOR FontColor;
-		std::string color = rConsoleColor[itemindex];
-		ConvertStrToColor(color, &FontColor);
-		FontColor.alpha = 255;
-		gr_color(FontColor.red, FontColor.green, FontColor.blue, FontColor.alpha);
+	const ConsoleRow& row = rConsole[itemindex];
+	char text[GUI_CONSOLE_BUFFER_SIZE];
+	uint8_t color;
+
+	// The line may have been reused since it was wrapped, it will be dropped on the next update
+	if (console_read(row.line, row.offset, row.length, text, &color) != CONSOLE_LINE_OK)
+		return;
+
+	// Set the color for the font, theme colors are looked up once per render
+	if (!(mColorsValid & (1 << color))) {
+		if (color == CONSOLE_COLOR_NORMAL) {
+			mColors[color] = mFontColor;
+		} else {
+			ConvertStrToColor(gConsoleColorNames[color], &mColors[color]);
+			mColors[color].alpha = 255;
+		}
+		mColorsValid |= 1 << color;
 	}
+	gr_color(mColors[color].red, mColors[color].green, mColors[color].blue, mColors[color].alpha);
 
 	// render text
-	const char* text = rConsole[itemindex].c_str();
 	gr_textEx_scaleW(mRenderX, yPos, text, mFont->GetResource(), mRenderW, TOP_LEFT, 0);
 }
 
@@ -74,6 +74,7 @@ int ors_read_fd = -1;
 static FILE* orsout = NULL;
 static float scale_theme_w = 1;
 static float scale_theme_h = 1;
+static std::string gThemePath;  // theme package found by gui_prepareTheme
 
 // Needed by pages.cpp too
 int gGuiRunning = 0;
@@ -835,6 +836,41 @@ extern "C" int gui_init(void)
 	return 0;
 }
 
+// Compiles the base language catalog so gui_loadResources only has to map it.
+// Touches nothing but files, so it may run while the partitions are set up.
+extern "C" int gui_prepareResources(void)
+{
+	LanguageCatalog* catalog = LanguageCatalog::Open(TWRES "languages/en.xml");
+	if (!catalog)
+		return -1;
+	delete catalog;
+	return 0;
+}
+
+// Mounts the settings storage and works out the theme package that
+// gui_loadResources tries first. Failures are only logged, so this may run
+// off the main thread while the splash screen is up.
+extern "C" int gui_prepareTheme(void)
+{
+#ifndef TW_OEM_BUILD
+	if (DataManager::GetIntValue(TW_IS_ENCRYPTED))
+		return 0;
+
+	int retry_count = 5;
+	while (!PartitionManager.Mount_Settings_Storage(false))
+	{
+		if (retry_count-- == 0)
+		{
+			LOGINFO("Unable to mount %s while preparing the theme.\n", DataManager::GetSettingsStoragePath().c_str());
+			return -1;
+		}
+		usleep(500000);
+	}
+	gThemePath = DataManager::GetSettingsStoragePath() + "/Fox/.bin./pa.zip";
+#endif
+	return 0;
+}
+
 extern "C" int gui_loadResources(void)
 {
 #ifndef TW_OEM_BUILD
@@ -854,26 +890,20 @@ extern "C" int gui_loadResources(void)
 
 	if (check == 0)
 	{
-		std::string theme_path;
+		std::string theme_path = gThemePath;
 
-		theme_path = DataManager::GetSettingsStoragePath();
-		if (!PartitionManager.Mount_Settings_Storage(false))
+		if (theme_path.empty())
 		{
-			int retry_count = 5;
-			while (retry_count > 0 && !PartitionManager.Mount_Settings_Storage(false))
-			{
-				usleep(500000);
-				retry_count--;
-			}
-
-			if (!PartitionManager.Mount_Settings_Storage(true))
+			// gui_prepareTheme did not run or could not mount the storage
+			if (PartitionManager.Mount_Settings_Storage(true))
+				theme_path = DataManager::GetSettingsStoragePath() + "/Fox/.bin./pa.zip";
+			else
 			{
-				LOGINFO("Unable to mount %s during GUI startup.\n", theme_path.c_str());
+				LOGINFO("Unable to mount %s during GUI startup.\n", DataManager::GetSettingsStoragePath().c_str());
 				check = 1;
 			}
 		}
 
-		theme_path += "/Fox/.bin./pa.zip"; 
 		if (check || PageManager::LoadPackage("OrangeFox", theme_path, "main"))
 		{
 #endif // ifndef TW_OEM_BUILD
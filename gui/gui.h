@@ -22,6 +22,8 @@
 #include <stdio.h>
 
 int gui_init();
+int gui_prepareResources();
+int gui_prepareTheme();
 int gui_loadResources();
 int gui_loadCustomResources();
 int gui_start();
@@ -29,6 +29,7 @@ void gui_err(const char* text);
 void gui_highlight(const char* text);
 void gui_msg(Message msg);
 void gui_err(Message msg);
+void gui_event(const std::string& line);       // Sends one line of the JSON event stream to the ORS client, if it asked for events
 
 extern long mime;
 std::string gui_parse_text(std::string inText);
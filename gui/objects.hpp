@@ -27,6 +27,7 @@
 #include "rapidxml.hpp"
 #include <vector>
 #include <string>
+#include <deque>
 #include <map>
 #include <set>
 #include <time.h>
@@ -657,6 +658,7 @@ protected:
 	int fastScroll; // indicates that the inital touch was inside the fastscroll region - makes for easier fast scrolling as the touches don't have to stay within the fast scroll region and you drag your finger
 	int mUpdate; // indicates that a change took place and we need to re-render
 	bool AddLines(std::vector<std::string>* origText, std::vector<std::string>* origColor, size_t* lastCount, std::vector<std::string>* rText, std::vector<std::string>* rColor);
+	size_t GetLineBreak(const char* text, size_t length); // number of bytes of text that go on the next wrapped row
 };
 
 class GUIFileSelector : public GUIScrollList
@@ -848,6 +850,16 @@ protected:
 
 };
 
+// Console line colors, values after CONSOLE_COLOR_WARNING are interned theme color names
+enum ConsoleColor
+{
+	CONSOLE_COLOR_NORMAL = 0,
+	CONSOLE_COLOR_ERROR,
+	CONSOLE_COLOR_HIGHLIGHT,
+	CONSOLE_COLOR_WARNING,
+	CONSOLE_COLOR_MAX = 16
+};
+
 class GUIConsole : public GUIScrollList
 {
 public:
@@ -886,18 +898,29 @@ protected:
 		request_show
 	};
 
+	// A wrapped row, pointing into a line of the console ring
+	struct ConsoleRow
+	{
+		uint64_t line;
+		uint16_t offset;
+		uint16_t length;
+		uint8_t color;
+	};
+
 	ImageResource* mSlideoutImage;
-	size_t mLastCount; // lines from gConsole that are already split and copied into rConsole
+	uint64_t mNextLine; // first line of the console ring that is not yet wrapped into rConsole
 	bool scrollToEnd; // true if we want to keep tracking the last line
 	int mSlideoutX, mSlideoutY, mSlideoutW, mSlideoutH;
 	int mSlideout;
 	SlideoutState mSlideoutState;
-	std::vector<std::string> rConsole;
-	std::vector<std::string> rConsoleColor;
+	std::deque<ConsoleRow> rConsole;
+	COLOR mColors[CONSOLE_COLOR_MAX]; // resolved colors, valid for one render
+	unsigned int mColorsValid;
 
 protected:
 	int RenderSlideout(void);
 	int RenderConsole(void);
+	bool AddConsoleLines(void);
 };
 
 class TerminalEngine;
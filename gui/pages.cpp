@@ -880,6 +880,25 @@ int PageSet::LoadLanguage(char* languageFile, ZipArchiveHandle package)
 	return ret;
 }
 
+int PageSet::LoadLanguageCatalog(const std::string& filename)
+{
+	LanguageCatalog* catalog = LanguageCatalog::Open(filename);
+	if (!catalog) {
+		// Not compilable (e.g. it has font overrides), parse the XML instead
+		char* xmlFile = PageManager::LoadFileToBuffer(filename, NULL);
+		if (!xmlFile)
+			return -1;
+		int ret = LoadLanguage(xmlFile, NULL);
+		free(xmlFile);
+		return ret;
+	}
+
+	DataManager::SetValue("tw_language_display", catalog->GetDisplay());
+	mResources->AddLanguageCatalog(catalog);
+	DataManager::SetValue("tw_backup_name", gui_lookup("auto_generate", "(Auto Generate)"));
+	return 0;
+}
+
 int PageSet::LoadDetails(LoadingContext& ctx, xml_node<>* root)
 {
 	xml_node<>* child = root->first_node("details");
@@ -1317,34 +1336,18 @@ void PageManager::LoadLanguageListDir(string dir) {
 		string file = p->d_name;
 		if (file.substr(strlen(p->d_name) - 4) != ".xml")
 			continue;
-		string path = dir + p->d_name;
 		string file_no_extn = file.substr(0, strlen(p->d_name) - 4);
 		struct language_struct language_entry;
 		language_entry.filename = file_no_extn;
-		char* xmlFile = PageManager::LoadFileToBuffer(dir + p->d_name, NULL);
-		if (xmlFile == NULL) {
-			LOGERR("LoadLanguageListDir unable to load '%s'\n", language_entry.filename.c_str());
+		if (!LanguageCatalog::ReadDisplayName(dir + p->d_name, &language_entry.displayvalue)) {
+			LOGERR("Invalid language XML file '%s'\n", language_entry.filename.c_str());
 			continue;
 		}
-		xml_document<> *doc = new xml_document<>();
-		doc->parse<0>(xmlFile);
-
-		xml_node<>* parent = doc->first_node("language");
-		if (!parent) {
-			LOGERR("Invalid language XML file '%s'\n", language_entry.filename.c_str());
-		} else {
-			xml_node<>* child = parent->first_node("display");
-			if (child) {
-				language_entry.displayvalue = child->value();
-			} else {
-				LOGERR("No display value for '%s'\n", language_entry.filename.c_str());
-				language_entry.displayvalue = language_entry.filename;
-			}
-			Language_List.push_back(language_entry);
+		if (language_entry.displayvalue.empty()) {
+			LOGERR("No display value for '%s'\n", language_entry.filename.c_str());
+			language_entry.displayvalue = language_entry.filename;
 		}
-		doc->clear();
-		delete doc;
-		free(xmlFile);
+		Language_List.push_back(language_entry);
 	}
 	closedir(d);
 }
@@ -1372,13 +1375,8 @@ void PageManager::LoadLanguage(string filename) {
 		actual_filename = TWRES "customlanguages/" + filename + ".xml";
 	else
 		actual_filename = TWRES "languages/" + filename + ".xml";
-	char* xmlFile = PageManager::LoadFileToBuffer(actual_filename, NULL);
-	if (xmlFile == NULL)
+	if (mCurrentSet->LoadLanguageCatalog(actual_filename) != 0)
 		LOGERR("Unable to load '%s'\n", actual_filename.c_str());
-	else {
-		mCurrentSet->LoadLanguage(xmlFile, NULL);
-		free(xmlFile);
-	}
 	PartitionManager.Translate_Partition_Display_Names();
 }
 
@@ -1386,7 +1384,7 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 {
 	std::string mainxmlfilename = package;
 	char* languageFile = NULL;
-	char* baseLanguageFile = NULL;
+	std::string baseLanguagePath;
 	PageSet* pageSet = NULL;
 	int ret;
 
@@ -1407,7 +1405,7 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 		tw_h_offset = TW_H_OFFSET;
 		if (name != "splash") {
 			LoadLanguageList(NULL);
-			languageFile = LoadFileToBuffer(TWRES "languages/en.xml", NULL);
+			baseLanguagePath = TWRES "languages/en.xml";
 		}
 		ctx.basepath = TWRES;
 	}
@@ -1432,17 +1430,15 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 		mainxmlfilename = "ui.xml";
 		LoadLanguageList(ctx.zip);
 		languageFile = LoadFileToBuffer("languages/en.xml", ctx.zip);
-		baseLanguageFile = LoadFileToBuffer(TWRES "languages/en.xml", NULL);
+		baseLanguagePath = TWRES "languages/en.xml";
 	}
 
 	// Before loading, mCurrentSet must be the loading package so we can find resources
 	pageSet = mCurrentSet;
 	mCurrentSet = new PageSet();
 
-	if (baseLanguageFile) {
-		mCurrentSet->LoadLanguage(baseLanguageFile, NULL);
-		free(baseLanguageFile);
-	}
+	if (!baseLanguagePath.empty())
+		mCurrentSet->LoadLanguageCatalog(baseLanguagePath);
 
 	if (languageFile) {
 		mCurrentSet->LoadLanguage(languageFile, ctx.zip);
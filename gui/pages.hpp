@@ -117,6 +117,7 @@ public:
 public:
 	int Load(LoadingContext& ctx, const std::string& filename);
 	int LoadLanguage(char* languageFile, ZipArchiveHandle package);
+	int LoadLanguageCatalog(const std::string& filename);
 	void MakeEmergencyConsoleIfNeeded();
 
 	Page* FindPage(std::string name);
@@ -28,9 +28,19 @@
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <set>
+#include <atomic>
+#include <functional>
+#include <thread>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <ziparchive/zip_archive.h>
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
 #include <android-base/unique_fd.h>
+#include <dirent.h>
 
 extern "C" {
 #include "../twcommon.h"
@@ -42,8 +52,355 @@ extern "C" {
 
 #include "rapidxml.hpp"
 #include "objects.hpp"
+#include "../data.hpp"
+#include "../twrp-functions.hpp"
+#include "../partitions.hpp"
 
-#define TMP_RESOURCE_NAME   "/tmp/extract.bin"
+// Scaled theme images are cached in the settings folder (or TW_THEME_CACHE_DIR
+// if the device sets one) so that cold starts skip decoding and scaling.
+// Entries live in a folder per cache version; the key of each entry holds the
+// image's zip CRC or file mtime, so edited themes are simply cache misses.
+// Once the folder outgrows THEME_CACHE_MAX_SIZE the least recently used
+// entries not used by the current load are evicted.
+#define THEME_CACHE_FOLDER  ".theme-cache"
+#define THEME_CACHE_VERSION 2
+#define THEME_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+#ifndef TW_LANGUAGE_CACHE_DIR
+#define TW_LANGUAGE_CACHE_DIR  "/tmp/language-cache"
+#endif
+
+// Works out the scale factors for an image; returns false if the theme is not scaled
+static bool GetImageScale(int retain_aspect, float* scale_w, float* scale_h)
+{
+	if (get_scale_w() == 0 || get_scale_h() == 0)
+		return false;
+	*scale_w = get_scale_w();
+	*scale_h = get_scale_h();
+	if (retain_aspect) {
+		if (*scale_w < *scale_h)
+			*scale_h = *scale_w;
+		else
+			*scale_w = *scale_h;
+	}
+	return true;
+}
+
+static bool ReadZipEntry(ZipArchiveHandle pZip, const std::string& name, std::string* data, std::string* identity)
+{
+	ZipEntry entry;
+	if (FindEntry(pZip, name, &entry) != 0)
+		return false;
+	data->resize(entry.uncompressed_length);
+	if (ExtractToMemory(pZip, &entry, reinterpret_cast<uint8_t*>(&(*data)[0]), entry.uncompressed_length) != 0)
+		return false;
+	if (identity)
+		*identity = android::base::StringPrintf("zip:%s:%08x:%u", name.c_str(), entry.crc32, entry.uncompressed_length);
+	return true;
+}
+
+static bool ReadImageFile(const std::string& path, std::string* data, std::string* identity)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	if (!android::base::ReadFileToString(path, data))
+		return false;
+	if (identity)
+		*identity = android::base::StringPrintf("file:%s:%lld:%lld.%09ld", path.c_str(), (long long)st.st_size,
+			(long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+	return true;
+}
+
+// Reads the encoded image into memory, looking in the same places as the
+// theme loader always has: images/<file>.png and images/<file> in the theme
+// zip, or the stock theme's images folder / a full path otherwise.
+static bool ReadImageData(ZipArchiveHandle pZip, const std::string& file, std::string* data, std::string* identity)
+{
+	if (pZip) {
+		// JPG includes the .jpg extension in the filename so extension should be blank
+		return ReadZipEntry(pZip, "images/" + file + ".png", data, identity) ||
+			ReadZipEntry(pZip, "images/" + file, data, identity);
+	}
+	if (file.size() > 4 && file.compare(file.size() - 4, 4, ".jpg") == 0)
+		return ReadImageFile(file, data, identity) ||
+			ReadImageFile(TWRES "images/" + file, data, identity);
+	// File name in xml may have included .png so try without adding .png
+	return ReadImageFile(TWRES "images/" + file + ".png", data, identity) ||
+		ReadImageFile(file, data, identity) ||
+		ReadImageFile(TWRES "images/" + file, data, identity);
+}
+
+static std::string AnimationFrameName(const std::string& file, int fileNum)
+{
+	std::ostringstream fileName;
+	fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
+	return fileName.str();
+}
+
+static std::string GetResourceType(xml_node<>* child)
+{
+	std::string type = child->name();
+	if (type == "resource") {
+		// legacy format : <resource type="...">
+		xml_attribute<>* attr = child->first_attribute("type");
+		type = attr ? attr->value() : "*unspecified*";
+	}
+	return type;
+}
+
+// Decodes and scales the images of a resource list on worker threads before
+// the resource objects are created. The encoded data is read on the calling
+// thread because the zip handle is not shared between threads.
+class ImageLoader
+{
+public:
+	ImageLoader(ZipArchiveHandle pZip) : mZip(pZip) {}
+	~ImageLoader();
+
+	bool Queue(const std::string& file, int retain_aspect);
+	void Run();
+	bool Take(const std::string& file, int retain_aspect, gr_surface* surface);
+
+private:
+	struct Job {
+		std::string file;
+		std::string data;
+		std::string cache_key;
+		float scale_w, scale_h;
+		gr_surface surface;
+		bool taken;
+	};
+
+	static std::string JobKey(const std::string& file, int retain_aspect) { return file + (retain_aspect ? "|1" : "|0"); }
+	static std::string OpenCacheDir();
+	void PruneCacheDir() const;
+	std::string CacheFile(const Job& job) const;
+	void Process(Job& job) const;
+	bool LoadCached(Job& job) const;
+	void StoreCached(const Job& job) const;
+
+	ZipArchiveHandle mZip;
+	std::map<std::string, Job> mJobs;
+	std::string mCacheDir;                   // empty while no persistent storage is available
+};
+
+ImageLoader::~ImageLoader()
+{
+	for (std::map<std::string, Job>::iterator it = mJobs.begin(); it != mJobs.end(); ++it)
+		if (!it->second.taken && it->second.surface)
+			res_free_surface(it->second.surface);
+}
+
+bool ImageLoader::Queue(const std::string& file, int retain_aspect)
+{
+	std::string key = JobKey(file, retain_aspect);
+	if (mJobs.find(key) != mJobs.end())
+		return true;
+
+	Job job;
+	std::string identity;
+	if (!ReadImageData(mZip, file, &job.data, &identity))
+		return false;
+	job.file = file;
+	job.surface = NULL;
+	job.taken = false;
+	if (GetImageScale(retain_aspect, &job.scale_w, &job.scale_h))
+		job.cache_key = android::base::StringPrintf("%d|%s|%a|%a", THEME_CACHE_VERSION, identity.c_str(), job.scale_w, job.scale_h);
+	mJobs[key] = std::move(job);
+	return true;
+}
+
+void ImageLoader::Run()
+{
+	std::vector<Job*> jobs;
+	for (std::map<std::string, Job>::iterator it = mJobs.begin(); it != mJobs.end(); ++it)
+		if (!it->second.data.empty())
+			jobs.push_back(&it->second);
+	if (jobs.empty())
+		return;
+
+	mCacheDir = OpenCacheDir();
+	size_t threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > jobs.size())
+		threads = jobs.size();
+
+	std::atomic<size_t> next(0);
+	auto worker = [this, &jobs, &next]() {
+		for (size_t i = next++; i < jobs.size(); i = next++)
+			Process(*jobs[i]);
+	};
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; i++)
+		workers.emplace_back(worker);
+	worker();
+	for (std::thread& t : workers)
+		t.join();
+	LOGINFO("Decoded %zu images on %zu threads\n", jobs.size(), threads);
+	if (!mCacheDir.empty())
+		PruneCacheDir();
+}
+
+bool ImageLoader::Take(const std::string& file, int retain_aspect, gr_surface* surface)
+{
+	std::map<std::string, Job>::iterator it = mJobs.find(JobKey(file, retain_aspect));
+	if (it == mJobs.end() || it->second.taken)
+		return false;
+	it->second.taken = true;
+	*surface = it->second.surface;
+	return true;
+}
+
+// Returns the cache folder for this cache version, creating it and dropping
+// the folders of other versions, or an empty string if the settings storage
+// is not mounted yet (the images are then decoded without a cache)
+std::string ImageLoader::OpenCacheDir()
+{
+#ifdef TW_THEME_CACHE_DIR
+	std::string base = TW_THEME_CACHE_DIR;
+#else
+	std::string settings = DataManager::GetSettingsStoragePath();
+	if (settings.empty() || !PartitionManager.Is_Mounted_By_Path(settings) || !TWFunc::Path_Exists(settings))
+		return "";
+	std::string base = settings + "/" THEME_CACHE_FOLDER;
+#endif
+	std::string version = android::base::StringPrintf("v%d", THEME_CACHE_VERSION);
+	std::string dir = base + "/" + version;
+	if (!TWFunc::Recursive_Mkdir(dir, false))
+		return "";
+
+	DIR* d = opendir(base.c_str());
+	if (d) {
+		struct dirent* de;
+		while ((de = readdir(d)) != NULL) {
+			if (de->d_type == DT_DIR && de->d_name[0] == 'v' && version != de->d_name)
+				TWFunc::removeDir(base + "/" + de->d_name, false);
+		}
+		closedir(d);
+	}
+	return dir;
+}
+
+// Evicts the least recently used entries until the folder fits in
+// THEME_CACHE_MAX_SIZE, keeping the ones this load used or stored
+void ImageLoader::PruneCacheDir() const
+{
+	struct CacheEntry {
+		std::string path;
+		off_t size;
+		struct timespec mtime;
+	};
+	std::set<std::string> current;
+	for (std::map<std::string, Job>::const_iterator it = mJobs.begin(); it != mJobs.end(); ++it)
+		if (!it->second.cache_key.empty())
+			current.insert(CacheFile(it->second));
+
+	DIR* d = opendir(mCacheDir.c_str());
+	if (!d)
+		return;
+	std::vector<CacheEntry> entries;
+	uint64_t total = 0;
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL) {
+		struct stat st;
+		std::string path = mCacheDir + "/" + de->d_name;
+		if (de->d_name[0] == '.' || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		total += st.st_size;
+		if (current.find(path) == current.end())
+			entries.push_back({path, st.st_size, st.st_mtim});
+	}
+	closedir(d);
+	if (total <= THEME_CACHE_MAX_SIZE)
+		return;
+
+	std::sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b) {
+		if (a.mtime.tv_sec != b.mtime.tv_sec)
+			return a.mtime.tv_sec < b.mtime.tv_sec;
+		return a.mtime.tv_nsec < b.mtime.tv_nsec;
+	});
+	size_t evicted = 0;
+	for (size_t i = 0; i < entries.size() && total > THEME_CACHE_MAX_SIZE; i++) {
+		if (unlink(entries[i].path.c_str()) == 0) {
+			total -= entries[i].size;
+			evicted++;
+		}
+	}
+	LOGINFO("Evicted %zu theme cache entries\n", evicted);
+}
+
+std::string ImageLoader::CacheFile(const Job& job) const
+{
+	return android::base::StringPrintf("%s/%016zx", mCacheDir.c_str(), std::hash<std::string>()(job.cache_key));
+}
+
+void ImageLoader::Process(Job& job) const
+{
+	bool cached = !job.cache_key.empty() && !mCacheDir.empty();
+	if (cached && LoadCached(job)) {
+		std::string().swap(job.data);
+		return;
+	}
+
+	gr_surface source = nullptr;
+	int rc = res_create_surface_mem(reinterpret_cast<const unsigned char*>(job.data.data()), job.data.size(), &source);
+	std::string().swap(job.data);
+	if (rc != 0) {
+		LOGINFO("Failed to load image from %s, error %d\n", job.file.c_str(), rc);
+		return;
+	}
+	if (job.cache_key.empty()) {
+		job.surface = source;
+		return;
+	}
+	if (res_scale_surface(source, &job.surface, job.scale_w, job.scale_h)) {
+		LOGINFO("Error scaling image, using regular size.\n");
+		job.surface = source;
+		return;
+	}
+	if (cached)
+		StoreCached(job);
+}
+
+// Cache files hold the full cache key ahead of the surface, so a hash
+// collision or a stale file is simply treated as a miss
+bool ImageLoader::LoadCached(Job& job) const
+{
+	android::base::unique_fd fd(open(CacheFile(job).c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd == -1)
+		return false;
+
+	uint32_t key_len;
+	std::string key;
+	if (!android::base::ReadFully(fd, &key_len, sizeof(key_len)) || key_len != job.cache_key.size())
+		return false;
+	key.resize(key_len);
+	if (!android::base::ReadFully(fd, &key[0], key_len) || key != job.cache_key)
+		return false;
+	if (res_read_surface(fd, &job.surface) != 0)
+		return false;
+	futimens(fd, NULL); // mark the entry as recently used for PruneCacheDir
+	return true;
+}
+
+void ImageLoader::StoreCached(const Job& job) const
+{
+	std::string cache_file = CacheFile(job);
+	std::string tmp_file = android::base::StringPrintf("%s.%d", cache_file.c_str(), gettid());
+	android::base::unique_fd fd(open(tmp_file.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600));
+	if (fd == -1)
+		return;
+
+	uint32_t key_len = job.cache_key.size();
+	if (!android::base::WriteFully(fd, &key_len, sizeof(key_len)) ||
+		!android::base::WriteFully(fd, job.cache_key.data(), key_len) ||
+		res_write_surface(fd, job.surface) != 0 ||
+		rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+		unlink(tmp_file.c_str());
+	}
+}
 
 Resource::Resource(xml_node<>* node, ZipArchiveHandle pZip __unused)
 {
@@ -75,41 +432,26 @@ int Resource::ExtractResource(ZipArchiveHandle pZip, std::string folderName, std
 
 void Resource::LoadImage(ZipArchiveHandle pZip, std::string file, gr_surface* surface)
 {
-	int rc = 0;
-	if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0)
-	{
-		rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-		unlink(TMP_RESOURCE_NAME);
-	}
-	else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0)
-	{
-		// JPG includes the .jpg extension in the filename so extension should be blank
-		rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-		unlink(TMP_RESOURCE_NAME);
-	}
-	else if (!pZip)
-	{
-		// File name in xml may have included .png so try without adding .png
-		rc = res_create_surface(file.c_str(), surface);
-	}
+	std::string data;
+	int rc;
+
+	if (!ReadImageData(pZip, file, &data, NULL))
+		rc = pZip ? 0 : -1; // a missing zip entry is not reported, e.g. the end of an animation
+	else
+		rc = res_create_surface_mem(reinterpret_cast<const unsigned char*>(data.data()), data.size(), surface);
 	if (rc != 0)
 		LOGINFO("Failed to load image from %s%s, error %d\n", file.c_str(), pZip ? " (zip)" : "", rc);
 }
 
 void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect)
 {
+	float scale_w, scale_h;
+
 	if (!source) {
 		*destination = nullptr;
 		return;
 	}
-	if (get_scale_w() != 0 && get_scale_h() != 0) {
-		float scale_w = get_scale_w(), scale_h = get_scale_h();
-		if (retain_aspect) {
-			if (scale_w < scale_h)
-				scale_h = scale_w;
-			else
-				scale_w = scale_h;
-		}
+	if (GetImageScale(retain_aspect, &scale_w, &scale_h)) {
 		if (res_scale_surface(source, destination, scale_w, scale_h)) {
 			LOGINFO("Error scaling image, using regular size.\n");
 			*destination = source;
@@ -119,6 +461,16 @@ void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, in
 	}
 }
 
+void Resource::LoadScaledImage(ImageLoader* loader, ZipArchiveHandle pZip, std::string file, gr_surface* surface, int retain_aspect)
+{
+	if (loader && loader->Take(file, retain_aspect, surface))
+		return;
+
+	gr_surface temp_surface = nullptr;
+	LoadImage(pZip, file, &temp_surface);
+	CheckAndScaleImage(temp_surface, surface, retain_aspect);
+}
+
 FontResource::FontResource(xml_node<>* node, ZipArchiveHandle pZip)
  : Resource(node, pZip)
 {
@@ -165,7 +517,7 @@ void FontResource::LoadFont(xml_node<>* node, ZipArchiveHandle pZip)
 		if (attr)
 			dpi = atoi(attr->value());
 
-		// we can't use TMP_RESOURCE_NAME here because the ttf subsystem is caching the name and scaling needs to reload the font
+		// fonts are extracted to their own file because the ttf subsystem is caching the name and scaling needs to reload the font
 		std::string tmpname = "/tmp/" + file;
 		if (ExtractResource(pZip, "fonts", file, "", tmpname) == 0)
 		{
@@ -209,11 +561,10 @@ FontResource::~FontResource()
 	DeleteFont();
 }
 
-ImageResource::ImageResource(xml_node<>* node, ZipArchiveHandle pZip)
+ImageResource::ImageResource(xml_node<>* node, ZipArchiveHandle pZip, ImageLoader* loader)
  : Resource(node, pZip)
 {
 	std::string file;
-	gr_surface temp_surface = nullptr;
 
 	mSurface = NULL;
 	if (!node) {
@@ -230,8 +581,7 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchiveHandle pZip)
 
 	bool retain_aspect = (node->first_attribute("retainaspect") != NULL);
 	// the value does not matter, if retainaspect is present, we assume that we want to retain it
-	LoadImage(pZip, file, &temp_surface);
-	CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+	LoadScaledImage(loader, pZip, file, &mSurface, retain_aspect);
 }
 
 ImageResource::~ImageResource()
@@ -240,7 +590,7 @@ ImageResource::~ImageResource()
 		res_free_surface(mSurface);
 }
 
-AnimationResource::AnimationResource(xml_node<>* node, ZipArchiveHandle pZip)
+AnimationResource::AnimationResource(xml_node<>* node, ZipArchiveHandle pZip, ImageLoader* loader)
  : Resource(node, pZip)
 {
 	std::string file;
@@ -260,13 +610,8 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchiveHandle pZip)
 	// the value does not matter, if retainaspect is present, we assume that we want to retain it
 	for (;;)
 	{
-		std::ostringstream fileName;
-		fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
-
 		gr_surface surface = nullptr;
-		gr_surface temp_surface = nullptr;
-		LoadImage(pZip, fileName.str(), &temp_surface);
-		CheckAndScaleImage(temp_surface, &surface, retain_aspect);
+		LoadScaledImage(loader, pZip, AnimationFrameName(file, fileNum), &surface, retain_aspect);
 		if (surface) {
 			mSurfaces.push_back(surface);
 			fileNum++;
@@ -285,6 +630,249 @@ AnimationResource::~AnimationResource()
 	mSurfaces.clear();
 }
 
+// Language catalog file layout: header, an open addressing hash table of
+// slots, then NUL-terminated strings. Offset 0 of the string area is an empty
+// string, so a slot with name == 0 is unused.
+#define LANGUAGE_CATALOG_MAGIC   0x4754434c // "LCTG"
+#define LANGUAGE_CATALOG_VERSION 1
+
+struct language_catalog_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t source_size;
+	int64_t source_mtime_sec;
+	int64_t source_mtime_nsec;
+	uint32_t source_path;
+	uint32_t display;
+	uint32_t slot_count; // power of 2
+	uint32_t strings_size;
+};
+
+struct language_catalog_slot {
+	uint32_t hash;
+	uint32_t name;
+	uint32_t value;
+};
+
+static uint32_t CatalogHash(const char* str, size_t len)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static std::string DecodeXmlEntities(const std::string& str)
+{
+	static const struct { const char* entity; char value; } entities[] = {
+		{ "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' },
+	};
+	std::string ret;
+	for (size_t i = 0; i < str.size(); i++) {
+		bool decoded = false;
+		if (str[i] == '&') {
+			for (size_t e = 0; e < sizeof(entities) / sizeof(entities[0]); e++) {
+				size_t len = strlen(entities[e].entity);
+				if (str.compare(i, len, entities[e].entity) == 0) {
+					ret += entities[e].value;
+					i += len - 1;
+					decoded = true;
+					break;
+				}
+			}
+		}
+		if (!decoded)
+			ret += str[i];
+	}
+	return ret;
+}
+
+LanguageCatalog::LanguageCatalog(void* map, size_t map_size)
+{
+	mMap = map;
+	mMapSize = map_size;
+	mHeader = reinterpret_cast<const language_catalog_header*>(map);
+	mSlots = reinterpret_cast<const language_catalog_slot*>(mHeader + 1);
+	mStrings = reinterpret_cast<const char*>(mSlots + mHeader->slot_count);
+}
+
+LanguageCatalog::~LanguageCatalog()
+{
+	munmap(mMap, mMapSize);
+}
+
+LanguageCatalog* LanguageCatalog::Open(const std::string& xml_path)
+{
+	struct stat st;
+	if (stat(xml_path.c_str(), &st) != 0)
+		return NULL;
+
+	std::string cache_path = android::base::StringPrintf(TW_LANGUAGE_CACHE_DIR "/%08x.bin", CatalogHash(xml_path.c_str(), xml_path.size()));
+	LanguageCatalog* catalog = Map(cache_path, xml_path, st);
+	if (!catalog && Compile(xml_path, st, cache_path))
+		catalog = Map(cache_path, xml_path, st);
+	return catalog;
+}
+
+LanguageCatalog* LanguageCatalog::Map(const std::string& cache_path, const std::string& xml_path, const struct stat& st)
+{
+	android::base::unique_fd fd(open(cache_path.c_str(), O_RDONLY | O_CLOEXEC));
+	struct stat cache_st;
+	if (fd == -1 || fstat(fd, &cache_st) != 0 || (size_t)cache_st.st_size < sizeof(language_catalog_header))
+		return NULL;
+
+	size_t map_size = cache_st.st_size;
+	void* map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	const language_catalog_header* header = reinterpret_cast<const language_catalog_header*>(map);
+	const char* strings = reinterpret_cast<const char*>(map) + sizeof(*header) + (size_t)header->slot_count * sizeof(language_catalog_slot);
+	bool valid = header->magic == LANGUAGE_CATALOG_MAGIC && header->version == LANGUAGE_CATALOG_VERSION &&
+		header->source_size == (int64_t)st.st_size && header->source_mtime_sec == (int64_t)st.st_mtim.tv_sec &&
+		header->source_mtime_nsec == (int64_t)st.st_mtim.tv_nsec &&
+		header->slot_count != 0 && (header->slot_count & (header->slot_count - 1)) == 0 &&
+		sizeof(*header) + (size_t)header->slot_count * sizeof(language_catalog_slot) + header->strings_size == map_size &&
+		header->strings_size != 0 && strings[header->strings_size - 1] == '\0' &&
+		header->source_path < header->strings_size && header->display < header->strings_size &&
+		xml_path == strings + header->source_path;
+	if (!valid) {
+		munmap(map, map_size);
+		return NULL;
+	}
+	return new LanguageCatalog(map, map_size);
+}
+
+// Builds the catalog from the language XML. Only plain string resources can
+// be compiled; anything else (e.g. font overrides) is left to the XML loader.
+bool LanguageCatalog::Compile(const std::string& xml_path, const struct stat& st, const std::string& cache_path)
+{
+	std::string xml;
+	if (!android::base::ReadFileToString(xml_path, &xml))
+		return false;
+
+	xml_document<> doc;
+	doc.parse<0>(&xml[0]);
+	xml_node<>* parent = doc.first_node("language");
+	xml_node<>* display = parent ? parent->first_node("display") : NULL;
+	xml_node<>* resList = parent ? parent->first_node("resources") : NULL;
+	if (!display || !resList)
+		return false;
+
+	std::map<std::string, std::string> entries;
+	for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling()) {
+		xml_attribute<>* attr = child->first_attribute("name");
+		if (GetResourceType(child) != "string" || !attr)
+			return false;
+		entries[attr->value()] = child->value();
+	}
+
+	std::string strings(1, '\0');
+	uint32_t source_path = strings.size();
+	strings.append(xml_path).push_back('\0');
+	uint32_t display_offset = strings.size();
+	strings.append(display->value()).push_back('\0');
+
+	uint32_t slot_count = 16;
+	while (slot_count < entries.size() * 2)
+		slot_count *= 2;
+	std::vector<language_catalog_slot> slots(slot_count);
+	memset(slots.data(), 0, slot_count * sizeof(language_catalog_slot));
+	for (std::map<std::string, std::string>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		uint32_t hash = CatalogHash(it->first.c_str(), it->first.size());
+		uint32_t i = hash & (slot_count - 1);
+		while (slots[i].name != 0)
+			i = (i + 1) & (slot_count - 1);
+		slots[i].hash = hash;
+		slots[i].name = strings.size();
+		strings.append(it->first).push_back('\0');
+		slots[i].value = strings.size();
+		strings.append(it->second).push_back('\0');
+	}
+
+	language_catalog_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = LANGUAGE_CATALOG_MAGIC;
+	header.version = LANGUAGE_CATALOG_VERSION;
+	header.source_size = st.st_size;
+	header.source_mtime_sec = st.st_mtim.tv_sec;
+	header.source_mtime_nsec = st.st_mtim.tv_nsec;
+	header.source_path = source_path;
+	header.display = display_offset;
+	header.slot_count = slot_count;
+	header.strings_size = strings.size();
+
+	mkdir(TW_LANGUAGE_CACHE_DIR, 0700);
+	std::string tmp_path = cache_path + ".tmp";
+	android::base::unique_fd fd(open(tmp_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600));
+	if (fd == -1)
+		return false;
+	if (!android::base::WriteFully(fd, &header, sizeof(header)) ||
+		!android::base::WriteFully(fd, slots.data(), slot_count * sizeof(language_catalog_slot)) ||
+		!android::base::WriteFully(fd, strings.data(), strings.size()) ||
+		rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	LOGINFO("Compiled language catalog for '%s' (%zu strings)\n", xml_path.c_str(), entries.size());
+	return true;
+}
+
+// Reads just the display name of a language file for the language list,
+// without building a DOM. Returns false if this is not a language file.
+bool LanguageCatalog::ReadDisplayName(const std::string& xml_path, std::string* display)
+{
+	std::string xml;
+	if (!android::base::ReadFileToString(xml_path, &xml))
+		return false;
+
+	size_t start = xml.find("<language");
+	if (start == std::string::npos)
+		return false;
+	display->clear();
+	start = xml.find("<display>", start);
+	if (start == std::string::npos)
+		return true;
+	start += strlen("<display>");
+	size_t end = xml.find("</display>", start);
+	if (end != std::string::npos)
+		*display = DecodeXmlEntities(xml.substr(start, end - start));
+	return true;
+}
+
+const char* LanguageCatalog::GetDisplay() const
+{
+	return mStrings + mHeader->display;
+}
+
+const char* LanguageCatalog::Find(const std::string& name) const
+{
+	uint32_t hash = CatalogHash(name.c_str(), name.size());
+	uint32_t mask = mHeader->slot_count - 1;
+	for (uint32_t i = hash & mask; mSlots[i].name != 0; i = (i + 1) & mask) {
+		if (mSlots[i].hash == hash && name == mStrings + mSlots[i].name)
+			return mStrings + mSlots[i].value;
+	}
+	return NULL;
+}
+
+size_t LanguageCatalog::GetSlotCount() const
+{
+	return mHeader->slot_count;
+}
+
+bool LanguageCatalog::GetEntry(size_t slot, const char** name, const char** value) const
+{
+	if (slot >= mHeader->slot_count || mSlots[slot].name == 0)
+		return false;
+	*name = mStrings + mSlots[slot].name;
+	*value = mStrings + mSlots[slot].value;
+	return true;
+}
+
 FontResource* ResourceManager::FindFont(const std::string& name) const
 {
 	for (std::vector<FontResource*>::const_iterator it = mFonts.begin(); it != mFonts.end(); ++it)
@@ -309,12 +897,31 @@ AnimationResource* ResourceManager::FindAnimation(const std::string& name) const
 	return NULL;
 }
 
+const char* ResourceManager::LookupString(const std::string& name) const
+{
+	const char* value = NULL;
+	int layer = -1;
+
+	std::map<std::string, string_resource_struct>::const_iterator it = mStrings.find(name);
+	if (it != mStrings.end()) {
+		value = it->second.value.c_str();
+		layer = it->second.layer;
+	}
+	// only catalogs loaded after the matching string can override it
+	for (std::vector<catalog_layer>::const_reverse_iterator c = mCatalogs.rbegin(); c != mCatalogs.rend() && c->layer > layer; ++c) {
+		const char* found = c->catalog->Find(name);
+		if (found)
+			return found;
+	}
+	return value;
+}
+
 std::string ResourceManager::FindString(const std::string& name) const
 {
 	//if (this != NULL) {
-		std::map<std::string, string_resource_struct>::const_iterator it = mStrings.find(name);
-		if (it != mStrings.end())
-			return it->second.value;
+		const char* value = LookupString(name);
+		if (value)
+			return value;
 		LOGERR("String resource '%s' not found. No default value.\n", name.c_str());
 		PageManager::AddStringResource("NO DEFAULT", name, "[" + name + ("]"));
 	/*} else {
@@ -326,9 +933,9 @@ std::string ResourceManager::FindString(const std::string& name) const
 std::string ResourceManager::FindString(const std::string& name, const std::string& default_string) const
 {
 	//if (this != NULL) {
-		std::map<std::string, string_resource_struct>::const_iterator it = mStrings.find(name);
-		if (it != mStrings.end())
-			return it->second.value;
+		const char* value = LookupString(name);
+		if (value)
+			return value;
 		LOGERR("String resource '%s' not found. Using default value.\n", name.c_str());
 		PageManager::AddStringResource("DEFAULT", name, default_string);
 	/*} else {
@@ -347,11 +954,19 @@ void ResourceManager::DumpStrings() const
 	gui_print("Dumping all strings:\n");
 	for (it = mStrings.begin(); it != mStrings.end(); it++)
 		gui_print("source: %s: '%s' = '%s'\n", it->second.source.c_str(), it->first.c_str(), it->second.value.c_str());
+	for (std::vector<catalog_layer>::const_iterator c = mCatalogs.begin(); c != mCatalogs.end(); ++c) {
+		const char* name;
+		const char* value;
+		for (size_t slot = 0; slot < c->catalog->GetSlotCount(); slot++)
+			if (c->catalog->GetEntry(slot, &name, &value))
+				gui_print("source: %s: '%s' = '%s'\n", c->catalog->GetDisplay(), name, value);
+	}
 	gui_print("Done dumping strings\n");
 }
 
 ResourceManager::ResourceManager()
 {
+	mLayer = 0;
 }
 
 void ResourceManager::AddStringResource(std::string resource_source, std::string resource_name, std::string value)
@@ -359,22 +974,46 @@ void ResourceManager::AddStringResource(std::string resource_source, std::string
 	string_resource_struct res;
 	res.source = resource_source;
 	res.value = value;
+	res.layer = mLayer;
 	mStrings[resource_name] = res;
 }
 
+void ResourceManager::AddLanguageCatalog(LanguageCatalog* catalog)
+{
+	catalog_layer entry;
+	entry.catalog = catalog;
+	entry.layer = ++mLayer;
+	mCatalogs.push_back(entry);
+}
+
 void ResourceManager::LoadResources(xml_node<>* resList, ZipArchiveHandle pZip, std::string resource_source)
 {
 	if (!resList)
 		return;
 
+	mLayer++;
+
+	// Decode all images and animation frames up front on worker threads
+	ImageLoader loader(pZip);
 	for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling())
 	{
-		std::string type = child->name();
-		if (type == "resource") {
-			// legacy format : <resource type="...">
-			xml_attribute<>* attr = child->first_attribute("type");
-			type = attr ? attr->value() : "*unspecified*";
-		}
+		std::string type = GetResourceType(child);
+		if ((type != "image" && type != "animation") || !child->first_attribute("filename"))
+			continue;
+
+		std::string file = child->first_attribute("filename")->value();
+		int retain_aspect = (child->first_attribute("retainaspect") != NULL);
+		if (type == "image")
+			loader.Queue(file, retain_aspect);
+		else
+			for (int fileNum = 1; loader.Queue(AnimationFrameName(file, fileNum), retain_aspect); fileNum++)
+				;
+	}
+	loader.Run();
+
+	for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling())
+	{
+		std::string type = GetResourceType(child);
 
 		bool error = false;
 		if (type == "font")
@@ -409,7 +1048,7 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchiveHandle pZip,
 		}
 		else if (type == "image")
 		{
-			ImageResource* res = new ImageResource(child, pZip);
+			ImageResource* res = new ImageResource(child, pZip, &loader);
 			if (res && res->GetResource())
 				mImages.push_back(res);
 			else {
@@ -419,7 +1058,7 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchiveHandle pZip,
 		}
 		else if (type == "animation")
 		{
-			AnimationResource* res = new AnimationResource(child, pZip);
+			AnimationResource* res = new AnimationResource(child, pZip, &loader);
 			if (res && res->GetResourceCount())
 				mAnimations.push_back(res);
 			else {
@@ -433,6 +1072,7 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchiveHandle pZip,
 				string_resource_struct res;
 				res.source = resource_source;
 				res.value = child->value();
+				res.layer = mLayer;
 				mStrings[attr->value()] = res;
 			} else
 				error = true;
@@ -469,4 +1109,7 @@ ResourceManager::~ResourceManager()
 
 	for (std::vector<AnimationResource*>::iterator it = mAnimations.begin(); it != mAnimations.end(); ++it)
 		delete *it;
+
+	for (std::vector<catalog_layer>::iterator it = mCatalogs.begin(); it != mCatalogs.end(); ++it)
+		delete it->catalog;
 }
@@ -24,6 +24,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <sys/stat.h>
 #include "rapidxml.hpp"
 #include "ziparchive/zip_archive.h"
 #include "minuitwrp/truetype.hpp"
@@ -32,6 +33,8 @@ extern "C" {
 #include "minuitwrp/minui.h"
 }
 
+class ImageLoader;
+
 // Base Objects
 class Resource
 {
@@ -49,6 +52,7 @@ protected:
 	static int ExtractResource(ZipArchiveHandle pZip, std::string folderName, std::string fileName, std::string fileExtn, std::string destFile);
 	static void LoadImage(ZipArchiveHandle pZip, std::string file, gr_surface* surface);
 	static void CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect);
+	static void LoadScaledImage(ImageLoader* loader, ZipArchiveHandle pZip, std::string file, gr_surface* surface, int retain_aspect);
 };
 
 class FontResource : public Resource
@@ -77,7 +81,7 @@ private:
 class ImageResource : public Resource
 {
 public:
-	ImageResource(xml_node<>* node, ZipArchiveHandle pZip);
+	ImageResource(xml_node<>* node, ZipArchiveHandle pZip, ImageLoader* loader = NULL);
 	virtual ~ImageResource();
 
 public:
@@ -92,7 +96,7 @@ protected:
 class AnimationResource : public Resource
 {
 public:
-	AnimationResource(xml_node<>* node, ZipArchiveHandle pZip);
+	AnimationResource(xml_node<>* node, ZipArchiveHandle pZip, ImageLoader* loader = NULL);
 	virtual ~AnimationResource();
 
 public:
@@ -106,6 +110,35 @@ protected:
 	std::vector<gr_surface> mSurfaces;
 };
 
+// Compiled string table for one language XML file. It is built the first
+// time the language is loaded and kept in TW_LANGUAGE_CACHE_DIR; later loads
+// map the table read-only instead of parsing the XML again.
+class LanguageCatalog
+{
+public:
+	static LanguageCatalog* Open(const std::string& xml_path);
+	static bool ReadDisplayName(const std::string& xml_path, std::string* display);
+	~LanguageCatalog();
+
+public:
+	const char* GetDisplay() const;
+	const char* Find(const std::string& name) const;
+	size_t GetSlotCount() const;
+	bool GetEntry(size_t slot, const char** name, const char** value) const;
+
+private:
+	LanguageCatalog(void* map, size_t map_size);
+	static LanguageCatalog* Map(const std::string& cache_path, const std::string& xml_path, const struct stat& st);
+	static bool Compile(const std::string& xml_path, const struct stat& st, const std::string& cache_path);
+
+private:
+	void* mMap;
+	size_t mMapSize;
+	const struct language_catalog_header* mHeader;
+	const struct language_catalog_slot* mSlots;
+	const char* mStrings;
+};
+
 class ResourceManager
 {
 public:
@@ -113,6 +146,7 @@ public:
 	virtual ~ResourceManager();
 	void AddStringResource(std::string resource_source, std::string resource_name, std::string value);
 	void LoadResources(xml_node<>* resList, ZipArchiveHandle pZip, std::string resource_source);
+	void AddLanguageCatalog(LanguageCatalog* catalog);
 
 public:
 	FontResource* FindFont(const std::string& name) const;
@@ -123,10 +157,22 @@ public:
 	void DumpStrings() const;
 
 private:
+	const char* LookupString(const std::string& name) const;
+
+private:
+	// Strings and catalogs are tagged with the layer they were loaded in,
+	// so that whatever was loaded last wins, as it did with a single map
 	struct string_resource_struct {
 		std::string value;
 		std::string source;
+		int layer;
+	};
+	struct catalog_layer {
+		LanguageCatalog* catalog;
+		int layer;
 	};
+	int mLayer;
+	std::vector<catalog_layer> mCatalogs;
 	std::vector<FontResource*> mFonts;
 	std::vector<ImageResource*> mImages;
 	std::vector<AnimationResource*> mAnimations;
@@ -668,14 +668,8 @@ bool GUIScrollList::AddLines(std::vector<std::string>* origText, std::vector<std
 		if (origColor)
 			curr_color = origColor->at(i);
 		for (;;) {
-			size_t line_char_width = twrpTruetype::gr_ttf_maxExW(curr_line.c_str(), mFont->GetResource(), mRenderW);
-			if (line_char_width < curr_line.size()) {
-				//string left = curr_line.substr(0, line_char_width);
-				size_t wrap_pos = curr_line.find_last_of(" ,./:-_;", line_char_width - 1);
-				if (wrap_pos == string::npos)
-					wrap_pos = line_char_width;
-				else if (wrap_pos < line_char_width - 1)
-					wrap_pos++;
+			size_t wrap_pos = GetLineBreak(curr_line.c_str(), curr_line.size());
+			if (wrap_pos < curr_line.size()) {
 				rText->push_back(curr_line.substr(0, wrap_pos));
 				if (origColor)
 					rColor->push_back(curr_color);
@@ -693,3 +687,31 @@ bool GUIScrollList::AddLines(std::vector<std::string>* origText, std::vector<std
 	}
 	return true;
 }
+
+size_t GUIScrollList::GetLineBreak(const char* text, size_t length)
+{
+	size_t line_char_width = twrpTruetype::gr_ttf_maxExW(text, mFont->GetResource(), mRenderW);
+	if (line_char_width >= length)
+		return length;
+
+	if (line_char_width == 0) {
+		// Not even one character fits, give it a row of its own rather than looping forever
+		size_t char_len = 1;
+		while (char_len < length && (text[char_len] & 0xC0) == 0x80)
+			char_len++;
+		return char_len;
+	}
+
+	size_t wrap_pos = line_char_width;
+	for (size_t i = line_char_width; i-- > 0;) {
+		if (text[i] && strchr(" ,./:-_;", text[i])) {
+			wrap_pos = i;
+			if (wrap_pos < line_char_width - 1)
+				wrap_pos++;
+			break;
+		}
+	}
+	if (wrap_pos == 0)
+		wrap_pos = line_char_width;
+	return wrap_pos;
+}
@@ -1,8 +1,20 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <android-base/unique_fd.h>
+
 #include "kernel_module_loader.hpp"
 #include "common.h"
 
 const std::vector<std::string> kernel_modules_requested = TWFunc::split_string(EXPAND(TW_LOAD_VENDOR_MODULES), ' ', true);
 
+std::mutex KernelModuleLoader::loaded_lock;
+std::set<std::string> KernelModuleLoader::loaded_modules;
+bool KernelModuleLoader::loaded_modules_read = false;
+
 bool KernelModuleLoader::Load_Vendor_Modules() {
 	// check /lib/modules (ramdisk vendor_boot)
 	// check /lib/modules/N.N (ramdisk vendor_boot)
@@ -12,7 +24,7 @@ bool KernelModuleLoader::Load_Vendor_Modules() {
 	// check /vendor/lib/modules/N.N (vendor mounted)
 	// check /vendor/lib/modules/N.N-gki (vendor mounted)
 	// check /vendor_dlkm/lib/modules (vendor_dlkm mounted)
-	int modules_loaded = 0;
+	int modules_loaded;
 
 	LOGINFO("Attempting to load modules\n");
 	std::string vendor_base_dir(VENDOR_MODULE_DIR);
@@ -43,13 +55,18 @@ bool KernelModuleLoader::Load_Vendor_Modules() {
 	vendor_module_dirs.push_back(vendor_base_dir + gki);
 #endif
 
+	// modules already loaded by init count towards the expected total
+	modules_loaded = Count_Loaded_Requested_Modules();
+	LOGINFO("number of requested modules loaded by init: %d\n", modules_loaded);
+	if (modules_loaded >= expected_module_count) goto exit;
+
 	for (auto&& module_dir:module_dirs) {
-		modules_loaded += Try_And_Load_Modules(module_dir, false);
+		modules_loaded += Try_And_Load_Modules(module_dir);
 		if (modules_loaded >= expected_module_count) goto exit;
 	}
 
 	for (auto&& module_dir:vendor_module_dirs) {
-		modules_loaded += Try_And_Load_Modules(module_dir, false);
+		modules_loaded += Try_And_Load_Modules(module_dir);
 		if (modules_loaded >= expected_module_count) goto exit;
 	}
 
@@ -63,11 +80,11 @@ bool KernelModuleLoader::Load_Vendor_Modules() {
 	}
 
 	for (auto&& module_dir:vendor_module_dirs) {
-		modules_loaded += Try_And_Load_Modules(module_dir, true);
+		modules_loaded += Try_And_Load_Modules(module_dir);
 		if (modules_loaded >= expected_module_count) goto exit;
 	}
 
-	modules_loaded += Try_And_Load_Modules(vendor_dlkm_base_dir, true);
+	modules_loaded += Try_And_Load_Modules(vendor_dlkm_base_dir);
 	if (modules_loaded >= expected_module_count) goto exit;
 
 exit:
@@ -84,102 +101,311 @@ exit:
 	return true;
 }
 
-int KernelModuleLoader::Try_And_Load_Modules(std::string module_dir, bool vendor_is_mounted) {
-		LOGINFO("Checking directory: %s\n", module_dir.c_str());
-		int modules_loaded = 0;
-		std::string dest_module_dir;
-		dest_module_dir = "/tmp" + module_dir;
-		TWFunc::Recursive_Mkdir(dest_module_dir);
-		Copy_Modules_To_Tmpfs(module_dir);
-		if (!Write_Module_List(dest_module_dir))
-			return kernel_modules_requested.size();
-		if (!vendor_is_mounted && module_dir == "/vendor/lib/modules") {
-			module_dir = "/lib/modules";
+// Loads the requested modules that are still missing, together with their
+// dependencies and soft dependencies, straight from module_dir. Modules are
+// put in the order libmodprobe would load them: requested modules in
+// modules.load order, each preceded by its pre softdeps and dependencies and
+// followed by its post softdeps. Modules that something else depends on or
+// that take part in a softdep keep that order between them; the remaining
+// leaves load concurrently as soon as their own dependencies are loaded.
+// Returns the number of requested modules that were loaded.
+int KernelModuleLoader::Try_And_Load_Modules(std::string module_dir) {
+	LOGINFO("Checking directory: %s\n", module_dir.c_str());
+	std::map<std::string, Kernel_Module> modules = Read_Module_Dependencies(module_dir);
+	if (modules.empty())
+		return 0;
+	std::map<std::string, std::string> options = Read_Module_Options(module_dir);
+	Read_Module_Softdeps(module_dir, modules);
+
+	std::set<std::string> requested;
+	for (auto&& module:kernel_modules_requested)
+		requested.insert(Module_Name(module));
+	std::set<std::string> listed;
+	std::vector<std::string> requested_order;
+	for (auto&& name:Read_Module_Load_Order(module_dir)) {
+		if (requested.count(name) && listed.insert(name).second)
+			requested_order.push_back(name);
+	}
+	for (auto&& module:kernel_modules_requested) {
+		std::string name = Module_Name(module);
+		if (listed.insert(name).second)
+			requested_order.push_back(name);
+	}
+
+	std::set<std::string> seen;
+	std::vector<std::string> order;
+	for (auto&& name:requested_order)
+		Add_Load_Order(modules, name, seen, order);
+	if (order.empty())
+		return 0;
+
+	// Anything a needed module depends on, and anything in a softdep, is
+	// loaded in sequence; the rest are leaves
+	std::set<std::string> needed(order.begin(), order.end());
+	std::set<std::string> sequenced;
+	for (auto&& name:order) {
+		const Kernel_Module& module = modules.at(name);
+		for (auto&& dep:module.deps)
+			sequenced.insert(dep);
+		if (!module.pre.empty() || !module.post.empty())
+			sequenced.insert(name);
+		sequenced.insert(module.pre.begin(), module.pre.end());
+		sequenced.insert(module.post.begin(), module.post.end());
+	}
+
+	// A failed dependency skips the modules that need it; a failed softdep
+	// or an earlier module in the sequence does not
+	std::map<std::string, int> pending;
+	std::map<std::string, std::vector<std::pair<std::string, bool>>> dependents;
+	std::deque<std::string> ready;
+	std::string previous;
+	for (auto&& name:order) {
+		int count = 0;
+		for (auto&& dep:modules.at(name).deps) {
+			if (needed.count(dep)) {
+				dependents[dep].emplace_back(name, true);
+				count++;
+			}
 		}
-		LOGINFO("mounting %s on %s\n", dest_module_dir.c_str(), module_dir.c_str());
-		if (mount(dest_module_dir.c_str(), module_dir.c_str(), "", MS_BIND, NULL) == 0) {
-			Modprobe m({module_dir}, "modules.load.twrp", false);
-			m.LoadListedModules(false);
-			modules_loaded = m.GetModuleCount();
-			umount2(module_dir.c_str(), MNT_DETACH);
-			LOGINFO("Modules Loaded: %d\n", modules_loaded);
+		if (sequenced.count(name)) {
+			if (!previous.empty()) {
+				dependents[previous].emplace_back(name, false);
+				count++;
+			}
+			previous = name;
+		}
+		pending[name] = count;
+		if (count == 0)
+			ready.push_back(name);
+	}
+
+	std::mutex lock;
+	std::condition_variable cond;
+	std::set<std::string> failed;
+	int in_flight = 0, modules_loaded = 0;
+	auto worker = [&]() {
+		std::unique_lock<std::mutex> guard(lock);
+		for (;;) {
+			// nothing ready and nothing loading means nothing can become ready
+			cond.wait(guard, [&]() { return !ready.empty() || in_flight == 0; });
+			if (ready.empty())
+				break;
+			std::string name = ready.front();
+			ready.pop_front();
+
+			bool loaded = false;
+			if (!failed.count(name)) {
+				std::map<std::string, std::string>::const_iterator opt = options.find(name);
+				in_flight++;
+				guard.unlock();
+				loaded = Load_Module(modules.at(name).path, opt == options.end() ? "" : opt->second);
+				guard.lock();
+				in_flight--;
+				if (loaded) {
+					Set_Module_Loaded(name);
+					if (requested.count(name))
+						modules_loaded++;
+				}
+			}
+			std::map<std::string, std::vector<std::pair<std::string, bool>>>::iterator deps = dependents.find(name);
+			if (deps != dependents.end()) {
+				for (auto&& dependent:deps->second) {
+					if (!loaded && dependent.second)
+						failed.insert(dependent.first);
+					if (--pending[dependent.first] == 0)
+						ready.push_back(dependent.first);
+				}
+			}
+			cond.notify_all();
 		}
-		return modules_loaded;
+	};
+
+	size_t threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), order.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; i++)
+		workers.emplace_back(worker);
+	worker();
+	for (auto&& t:workers)
+		t.join();
+
+	LOGINFO("Modules Loaded: %d\n", modules_loaded);
+	return modules_loaded;
+}
+
+// Appends name to order the way libmodprobe's InsmodWithDeps loads it: pre
+// softdeps, then dependencies deepest first, then the module, then post
+// softdeps. Loaded modules and modules missing from the directory are skipped.
+void KernelModuleLoader::Add_Load_Order(const std::map<std::string, Kernel_Module>& modules, const std::string& name, std::set<std::string>& seen, std::vector<std::string>& order) {
+	std::map<std::string, Kernel_Module>::const_iterator it = modules.find(name);
+	if (it == modules.end() || Is_Module_Loaded(name) || !seen.insert(name).second)
+		return;
+	for (auto&& pre:it->second.pre)
+		Add_Load_Order(modules, pre, seen, order);
+	for (auto dep = it->second.deps.rbegin(); dep != it->second.deps.rend(); ++dep)
+		Add_Load_Order(modules, *dep, seen, order);
+	order.push_back(name);
+	for (auto&& post:it->second.post)
+		Add_Load_Order(modules, post, seen, order);
 }
 
-std::vector<string> KernelModuleLoader::Skip_Loaded_Kernel_Modules() {
-	std::vector<string> kernel_modules = kernel_modules_requested;
-	std::vector<string> loaded_modules;
-	std::string kernel_module_file = "/proc/modules";
-	if (TWFunc::read_file(kernel_module_file, loaded_modules) < 0)
-		LOGINFO("failed to get loaded kernel modules\n");
-	LOGINFO("number of modules loaded by init: %zu\n", loaded_modules.size());
-	if (loaded_modules.size() == 0)
-		return kernel_modules;
-	for (auto&& module_line:loaded_modules) {
-		auto module = TWFunc::Split_String(module_line, " ")[0];
-		std::string full_module_name = module + ".ko";
-		auto found = std::find(kernel_modules.begin(), kernel_modules.end(), full_module_name);
-		if (found != kernel_modules.end()) {
-			LOGINFO("found module to dedupe: %s\n", (*found).c_str());
-			kernel_modules.erase(found);
+std::map<std::string, KernelModuleLoader::Kernel_Module> KernelModuleLoader::Read_Module_Dependencies(const std::string& module_dir) {
+	std::map<std::string, Kernel_Module> modules;
+	std::vector<std::string> lines;
+
+	// modules.dep paths are either relative to the module directory or
+	// absolute paths from where the image is normally mounted
+	auto resolve = [&module_dir](const std::string& entry) {
+		std::string path = entry[0] == '/' ? entry : module_dir + "/" + entry;
+		if (!TWFunc::Path_Exists(path))
+			path = module_dir + "/" + TWFunc::Get_Filename(entry);
+		return path;
+	};
+
+	if (TWFunc::Path_Exists(module_dir + "/modules.dep") && TWFunc::read_file(module_dir + "/modules.dep", lines) == 0) {
+		for (auto&& line:lines) {
+			size_t colon = line.find(':');
+			if (colon == std::string::npos)
+				continue;
+			Kernel_Module module;
+			module.path = resolve(android::base::Trim(line.substr(0, colon)));
+			if (!TWFunc::Path_Exists(module.path))
+				continue;
+			for (auto&& dep:TWFunc::Split_String(line.substr(colon + 1), " "))
+				module.deps.push_back(Module_Name(dep));
+			modules[Module_Name(module.path)] = module;
 		}
+		return modules;
 	}
-	return kernel_modules;
-}
 
-bool KernelModuleLoader::Write_Module_List(std::string module_dir) {
-	DIR* d;
+	DIR* d = opendir(module_dir.c_str());
+	if (d == nullptr) {
+		LOGINFO("Unable to open module directory: %s. Skipping\n", module_dir.c_str());
+		return modules;
+	}
 	struct dirent* de;
-	std::vector<std::string> kernel_modules;
-	d = opendir(module_dir.c_str());
-	auto deduped_modules = Skip_Loaded_Kernel_Modules();
-	if (deduped_modules.size() == 0) {
-		LOGINFO("Requested modules are loaded\n");
-		return false;
+	while ((de = readdir(d)) != nullptr) {
+		std::string kernel_module = de->d_name;
+		if (de->d_type == DT_REG && android::base::EndsWith(kernel_module, ".ko")) {
+			Kernel_Module module;
+			module.path = module_dir + "/" + kernel_module;
+			modules[Module_Name(kernel_module)] = module;
+		}
 	}
-	if (d != nullptr) {
-		while ((de = readdir(d)) != nullptr) {
-			std::string kernel_module = de->d_name;
-			if (de->d_type == DT_REG) {
-				if (android::base::EndsWith(kernel_module, ".ko")) {
-					for (auto&& requested:kernel_modules_requested) {
-						if (kernel_module == requested) {
-							kernel_modules.push_back(kernel_module);
-							continue;
-						}
-					}
-					continue;
-				}
-			}
+	closedir(d);
+	return modules;
+}
+
+std::map<std::string, std::string> KernelModuleLoader::Read_Module_Options(const std::string& module_dir) {
+	std::map<std::string, std::string> options;
+	std::vector<std::string> lines;
+
+	if (!TWFunc::Path_Exists(module_dir + "/modules.options") || TWFunc::read_file(module_dir + "/modules.options", lines) != 0)
+		return options;
+	for (auto&& line:lines) {
+		std::vector<std::string> args = TWFunc::Split_String(line, " ");
+		if (args.size() < 3 || args[0] != "options")
+			continue;
+		std::string& value = options[Module_Name(args[1])];
+		for (size_t i = 2; i < args.size(); i++) {
+			if (!value.empty())
+				value += " ";
+			value += args[i];
 		}
-		std::string module_file = module_dir + "/modules.load.twrp";
-		TWFunc::write_to_file(module_file, kernel_modules);
-		closedir(d);
 	}
-	return true;
+	return options;
 }
 
-bool KernelModuleLoader::Copy_Modules_To_Tmpfs(std::string module_dir) {
-	std::string ramdisk_dir = "/tmp" + module_dir;
-	DIR* d;
-	struct dirent* de;
-	d = opendir(module_dir.c_str());
-	if (d != nullptr) {
-		while ((de = readdir(d)) != nullptr) {
-			std::string kernel_module = de->d_name;
-			if (de->d_type == DT_REG) {
-				std::string src =  module_dir + "/" + de->d_name;
-				std::string dest = ramdisk_dir + "/" + de->d_name;
-				if (TWFunc::copy_file(src, dest, 0700, false) != 0) {
-					return false;
-				}
-			}
+// Parses "softdep <module> pre: <modules...> post: <modules...>" lines
+void KernelModuleLoader::Read_Module_Softdeps(const std::string& module_dir, std::map<std::string, Kernel_Module>& modules) {
+	std::vector<std::string> lines;
+
+	if (!TWFunc::Path_Exists(module_dir + "/modules.softdep") || TWFunc::read_file(module_dir + "/modules.softdep", lines) != 0)
+		return;
+	for (auto&& line:lines) {
+		std::vector<std::string> args = TWFunc::Split_String(line, " ");
+		if (args.size() < 2 || args[0] != "softdep")
+			continue;
+		std::map<std::string, Kernel_Module>::iterator module = modules.find(Module_Name(args[1]));
+		if (module == modules.end())
+			continue;
+		std::vector<std::string>* list = nullptr;
+		for (size_t i = 2; i < args.size(); i++) {
+			if (args[i] == "pre:")
+				list = &module->second.pre;
+			else if (args[i] == "post:")
+				list = &module->second.post;
+			else if (list)
+				list->push_back(Module_Name(args[i]));
 		}
-		closedir(d);
-	} else {
-		LOGINFO("Unable to open module directory: %s. Skipping\n", module_dir.c_str());
+	}
+}
+
+// Lists the modules in modules.load.recovery, or modules.load, in file order
+std::vector<std::string> KernelModuleLoader::Read_Module_Load_Order(const std::string& module_dir) {
+	std::vector<std::string> order;
+	std::vector<std::string> lines;
+	std::string load_file = module_dir + "/modules.load.recovery";
+
+	if (!TWFunc::Path_Exists(load_file))
+		load_file = module_dir + "/modules.load";
+	if (!TWFunc::Path_Exists(load_file) || TWFunc::read_file(load_file, lines) != 0)
+		return order;
+	for (auto&& line:lines) {
+		std::string entry = android::base::Trim(line);
+		if (!entry.empty() && entry[0] != '#')
+			order.push_back(Module_Name(entry));
+	}
+	return order;
+}
+
+bool KernelModuleLoader::Load_Module(const std::string& path, const std::string& options) {
+	android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_CLOEXEC)));
+	if (fd == -1) {
+		LOGINFO("Unable to open kernel module %s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	if (syscall(__NR_finit_module, fd.get(), options.c_str(), 0) != 0 && errno != EEXIST) {
+		LOGINFO("Unable to load kernel module %s: %s\n", path.c_str(), strerror(errno));
 		return false;
 	}
+	LOGINFO("Loaded kernel module %s\n", path.c_str());
 	return true;
 }
+
+std::string KernelModuleLoader::Module_Name(const std::string& file) {
+	std::string name = TWFunc::Get_Filename(android::base::Trim(file));
+	if (android::base::EndsWith(name, ".ko"))
+		name.resize(name.size() - 3);
+	std::replace(name.begin(), name.end(), '-', '_');
+	return name;
+}
+
+bool KernelModuleLoader::Is_Module_Loaded(const std::string& name) {
+	std::lock_guard<std::mutex> lock(loaded_lock);
+	if (!loaded_modules_read) {
+		std::vector<string> lines;
+		if (TWFunc::read_file("/proc/modules", lines) < 0)
+			LOGINFO("failed to get loaded kernel modules\n");
+		for (auto&& module_line:lines) {
+			std::vector<std::string> fields = TWFunc::Split_String(module_line, " ");
+			if (!fields.empty())
+				loaded_modules.insert(fields[0]);
+		}
+		loaded_modules_read = true;
+	}
+	return loaded_modules.count(name) != 0;
+}
+
+void KernelModuleLoader::Set_Module_Loaded(const std::string& name) {
+	std::lock_guard<std::mutex> lock(loaded_lock);
+	loaded_modules.insert(name);
+}
+
+int KernelModuleLoader::Count_Loaded_Requested_Modules() {
+	int count = 0;
+	for (auto&& module:kernel_modules_requested) {
+		if (Is_Module_Loaded(Module_Name(module)))
+			count++;
+	}
+	return count;
+}
@@ -2,10 +2,12 @@
 #define _KERNELMODULELOADER_HPP
 
 #include <dirent.h>
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 #include <android-base/strings.h>
-#include <modprobe/modprobe.h>
 #include <sys/mount.h>
 #include <sys/utsname.h>
 
@@ -27,10 +29,28 @@ public:
     static bool Load_Vendor_Modules(); // Load specific maintainer defined kernel modules in TWRP
 
 private:
-	static int Try_And_Load_Modules(std::string module_dir, bool vendor_is_mounted); // Use libmodprobe to attempt loading kernel modules
-	static bool Write_Module_List(std::string module_dir); // Write list of modules to load from TW_LOAD_VENDOR_MODULES
-    static bool Copy_Modules_To_Tmpfs(std::string module_dir); // Copy modules to ramdisk for loading
-	static std::vector<string> Skip_Loaded_Kernel_Modules(); // return list of loaded kernel modules already done by init
+	struct Kernel_Module {
+		std::string path;
+		std::vector<std::string> deps; // module names, as in /proc/modules
+		std::vector<std::string> pre;  // softdeps loaded before the module
+		std::vector<std::string> post; // softdeps loaded after the module
+	};
+
+	static int Try_And_Load_Modules(std::string module_dir); // Load the missing requested modules found in module_dir, in place and in parallel
+	static void Add_Load_Order(const std::map<std::string, Kernel_Module>& modules, const std::string& name, std::set<std::string>& seen, std::vector<std::string>& order); // Append a module after its softdeps and dependencies
+	static std::map<std::string, Kernel_Module> Read_Module_Dependencies(const std::string& module_dir); // Parse modules.dep, or list the .ko files if there is none
+	static std::map<std::string, std::string> Read_Module_Options(const std::string& module_dir); // Parse modules.options
+	static void Read_Module_Softdeps(const std::string& module_dir, std::map<std::string, Kernel_Module>& modules); // Parse modules.softdep
+	static std::vector<std::string> Read_Module_Load_Order(const std::string& module_dir); // Parse modules.load.recovery or modules.load
+	static bool Load_Module(const std::string& path, const std::string& options); // finit_module() a single .ko file
+	static std::string Module_Name(const std::string& file); // foo-bar.ko -> foo_bar
+	static bool Is_Module_Loaded(const std::string& name);
+	static void Set_Module_Loaded(const std::string& name);
+	static int Count_Loaded_Requested_Modules();
+
+	static std::mutex loaded_lock;
+	static std::set<std::string> loaded_modules; // read from /proc/modules once, then kept up to date
+	static bool loaded_modules_read;
 };
 
-#endif // _KERNELMODULELOADER_HPP
\ No newline at end of file
+#endif // _KERNELMODULELOADER_HPP
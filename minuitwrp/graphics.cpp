@@ -36,6 +36,7 @@
 #include "gui/placement.h"
 #include "minuitwrp/minui.h"
 #include "graphics.h"
+#include "graphics_blit.h"
 // For std::min and std::max
 #include <algorithm>
 #include "minuitwrp/truetype.hpp"
@@ -62,6 +63,12 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+// The current color as pixelflinger sees it and the scissor box in display
+// coordinates, kept for the 32bpp fast paths that bypass pixelflinger
+static unsigned char gr_curr_clr[4] = { 255, 255, 255, 255 };
+static bool gr_clip_enabled = false;
+static int gr_clip_l = 0, gr_clip_t = 0, gr_clip_r = 0, gr_clip_b = 0;
+
 unsigned int gr_rotation = 0;
 
 int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, int placement, int scale)
@@ -120,19 +127,33 @@ void gr_clip(int x, int y, int w, int h)
 
     switch (gr_rotation) {
         case 90:
-            gl->scissor(gl, gr_draw->width - y - h, x, h, w);
+            gr_clip_l = gr_draw->width - y - h;
+            gr_clip_t = x;
+            gr_clip_r = gr_clip_l + h;
+            gr_clip_b = gr_clip_t + w;
             break;
         case 180:
-            gl->scissor(gl, gr_draw->width - x - w, gr_draw->height - y - h, w, h);
+            gr_clip_l = gr_draw->width - x - w;
+            gr_clip_t = gr_draw->height - y - h;
+            gr_clip_r = gr_clip_l + w;
+            gr_clip_b = gr_clip_t + h;
             break;
         case 270:
-            gl->scissor(gl, y, gr_draw->height - x - w, h, w);
+            gr_clip_l = y;
+            gr_clip_t = gr_draw->height - x - w;
+            gr_clip_r = gr_clip_l + h;
+            gr_clip_b = gr_clip_t + w;
             break;
         default:
-            gl->scissor(gl, x, y, w, h);
+            gr_clip_l = x;
+            gr_clip_t = y;
+            gr_clip_r = x + w;
+            gr_clip_b = y + h;
             break;
     }
+    gl->scissor(gl, gr_clip_l, gr_clip_t, gr_clip_r - gr_clip_l, gr_clip_b - gr_clip_t);
     gl->enable(gl, GGL_SCISSOR_TEST);
+    gr_clip_enabled = true;
 }
 
 void gr_noclip()
@@ -142,6 +163,50 @@ void gr_noclip()
                 gr_draw->width - 2 * overscan_offset_x,
                 gr_draw->height - 2 * overscan_offset_y);
     gl->disable(gl, GGL_SCISSOR_TEST);
+    gr_clip_enabled = false;
+}
+
+// Byte order of a 32bpp format, 0 for RGB(A/X), 1 for BGRA, -1 if the fast paths can't handle it
+static int gr_fast_channel_order(int format)
+{
+    switch (format) {
+        case GGL_PIXEL_FORMAT_RGBX_8888:
+        case GGL_PIXEL_FORMAT_RGBA_8888:
+            return 0;
+        case GGL_PIXEL_FORMAT_BGRA_8888:
+            return 1;
+        default:
+            return -1;
+    }
+}
+
+// Clips a rectangle in display coordinates the way pixelflinger would,
+// returns false if nothing is left to draw
+static bool gr_fast_clip(int* l, int* t, int* r, int* b)
+{
+    *l = std::max(*l, 0);
+    *t = std::max(*t, 0);
+    *r = std::min(*r, gr_draw->width);
+    *b = std::min(*b, gr_draw->height);
+    if (gr_clip_enabled) {
+        *l = std::max(*l, gr_clip_l);
+        *t = std::max(*t, gr_clip_t);
+        *r = std::min(*r, gr_clip_r);
+        *b = std::min(*b, gr_clip_b);
+    }
+    return *l < *r && *t < *b;
+}
+
+static inline uint32_t* gr_fast_row(int x, int y)
+{
+    return (uint32_t*)(gr_draw->data + y * gr_draw->row_bytes) + x;
+}
+
+static uint32_t gr_fast_pack(const unsigned char* c, int order)
+{
+    if (order == 1)
+        return (c[3] << 24) | (c[0] << 16) | (c[1] << 8) | c[2];
+    return (c[3] << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -216,6 +281,15 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
 #endif
     gl->color4xv(gl, color);
 
+#if defined(RECOVERY_ARGB) || defined(RECOVERY_BGRA) || defined(RECOVERY_ABGR)
+    gr_curr_clr[0] = b;
+    gr_curr_clr[2] = r;
+#else
+    gr_curr_clr[0] = r;
+    gr_curr_clr[2] = b;
+#endif
+    gr_curr_clr[1] = g;
+    gr_curr_clr[3] = a;
     gr_is_curr_clr_opaque = (a == 255);
 }
 
@@ -230,16 +304,10 @@ void gr_clear()
     if (gr_current_r == gr_current_g && gr_current_r == gr_current_b) {
         memset(gr_draw->data, gr_current_r, gr_draw->height * gr_draw->row_bytes);
     } else {
-        unsigned char* px = gr_draw->data;
-        for (int y = 0; y < gr_draw->height; ++y) {
-            for (int x = 0; x < gr_draw->width; ++x) {
-                *px++ = gr_current_r;
-                *px++ = gr_current_g;
-                *px++ = gr_current_b;
-                px++;
-            }
-            px += gr_draw->row_bytes - (gr_draw->width * gr_draw->pixel_bytes);
-        }
+        const unsigned char clr[4] = { gr_current_r, gr_current_g, gr_current_b, 255 };
+        uint32_t px = gr_fast_pack(clr, 0);
+        for (int y = 0; y < gr_draw->height; ++y)
+            gr_fill_row32(gr_fast_row(0, y), px, gr_draw->width);
     }
 }
 
@@ -260,7 +328,21 @@ void gr_fill(int x, int y, int w, int h)
     r_disp = std::max(x0_disp, x1_disp);
     t_disp = std::min(y0_disp, y1_disp);
     b_disp = std::max(y0_disp, y1_disp);
-    gl->recti(gl, l_disp, t_disp, r_disp, b_disp);
+
+    int order = gr_draw->pixel_bytes == 4 ? gr_fast_channel_order(gr_draw->format) : -1;
+    if (order != -1) {
+        if (gr_fast_clip(&l_disp, &t_disp, &r_disp, &b_disp)) {
+            uint32_t px = gr_fast_pack(gr_curr_clr, order);
+            for (int row = t_disp; row < b_disp; ++row) {
+                if (gr_is_curr_clr_opaque)
+                    gr_fill_row32(gr_fast_row(l_disp, row), px, r_disp - l_disp);
+                else
+                    gr_blend_fill_row32(gr_fast_row(l_disp, row), px, r_disp - l_disp);
+            }
+        }
+    } else {
+        gl->recti(gl, l_disp, t_disp, r_disp, b_disp);
+    }
 
     if(gr_is_curr_clr_opaque)
         gl->enable(gl, GGL_BLEND);
@@ -275,6 +357,25 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    // Unrotated copies and blends between surfaces with the same byte order
+    // skip pixelflinger's generic scanline code
+    int order = gr_draw->pixel_bytes == 4 ? gr_fast_channel_order(gr_draw->format) : -1;
+    if (gr_rotation == 0 && order != -1 && gr_fast_channel_order(surface->format) == order &&
+            sx >= 0 && sy >= 0 && w >= 0 && h >= 0 &&
+            sx + w <= (int)surface->width && sy + h <= (int)surface->height) {
+        int l = dx, t = dy, r = dx + w, b = dy + h;
+        if (!gr_fast_clip(&l, &t, &r, &b))
+            return;
+        const uint32_t* src = (const uint32_t*)surface->data + (sy + t - dy) * surface->stride + (sx + l - dx);
+        for (int row = t; row < b; ++row, src += surface->stride) {
+            if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888)
+                gr_copy_row32(gr_fast_row(l, row), src, r - l);
+            else
+                gr_blend_row32(gr_fast_row(l, row), src, r - l);
+        }
+        return;
+    }
+
     if(surface->format == GGL_PIXEL_FORMAT_RGBX_8888)
         gl->disable(gl, GGL_BLEND);
 
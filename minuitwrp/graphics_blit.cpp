@@ -0,0 +1,165 @@
+/*
+	Copyright (C) 2020-2023 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Row kernels for the 32bpp fast paths of gr_fill, gr_blit and gr_clear.
+// Blending matches the GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA function set
+// up in gr_init, with the alpha in the fourth byte of every pixel.
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GR_BLIT_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define GR_BLIT_SSE2
+#endif
+
+#include "graphics_blit.h"
+
+// Alpha scaled to 0 - 256 so that the blend can shift instead of divide
+static inline uint32_t blend_factor(uint32_t a) {
+    return a + (a >> 7);
+}
+
+static inline uint32_t blend_pixel(uint32_t dst, uint32_t src) {
+    uint32_t f = blend_factor(src >> 24);
+    uint32_t inv = 256 - f;
+    uint32_t rb = ((src & 0x00FF00FF) * f + (dst & 0x00FF00FF) * inv + 0x00800080) >> 8;
+    uint32_t ga = ((src >> 8) & 0x00FF00FF) * f + ((dst >> 8) & 0x00FF00FF) * inv + 0x00800080;
+    return (rb & 0x00FF00FF) | (ga & 0xFF00FF00);
+}
+
+#if defined(GR_BLIT_SSE2)
+// Blends the four pixels of s over d
+static inline __m128i blend_sse2(__m128i s, __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+    const __m128i half = _mm_set1_epi16(128);
+    __m128i s_lo = _mm_unpacklo_epi8(s, zero);
+    __m128i s_hi = _mm_unpackhi_epi8(s, zero);
+    __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+    __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+    __m128i a_lo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i a_hi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s_hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i f_lo = _mm_add_epi16(a_lo, _mm_srli_epi16(a_lo, 7));
+    __m128i f_hi = _mm_add_epi16(a_hi, _mm_srli_epi16(a_hi, 7));
+    __m128i r_lo = _mm_add_epi16(_mm_mullo_epi16(s_lo, f_lo), _mm_mullo_epi16(d_lo, _mm_sub_epi16(full, f_lo)));
+    __m128i r_hi = _mm_add_epi16(_mm_mullo_epi16(s_hi, f_hi), _mm_mullo_epi16(d_hi, _mm_sub_epi16(full, f_hi)));
+    r_lo = _mm_srli_epi16(_mm_add_epi16(r_lo, half), 8);
+    r_hi = _mm_srli_epi16(_mm_add_epi16(r_hi, half), 8);
+    return _mm_packus_epi16(r_lo, r_hi);
+}
+#endif
+
+#if defined(GR_BLIT_NEON)
+// Blends the eight deinterleaved pixels of s over d
+static inline uint8x8x4_t blend_neon(uint8x8x4_t s, uint8x8x4_t d) {
+    uint16x8_t a = vmovl_u8(s.val[3]);
+    uint16x8_t f = vaddq_u16(a, vshrq_n_u16(a, 7));
+    uint16x8_t inv = vsubq_u16(vdupq_n_u16(256), f);
+    uint8x8x4_t res;
+    for (int c = 0; c < 4; ++c) {
+        uint16x8_t r = vmulq_u16(vmovl_u8(s.val[c]), f);
+        r = vmlaq_u16(r, vmovl_u8(d.val[c]), inv);
+        res.val[c] = vrshrn_n_u16(r, 8);
+    }
+    return res;
+}
+#endif
+
+void gr_fill_row32(uint32_t* dst, uint32_t px, int count) {
+    int i = 0;
+#if defined(GR_BLIT_NEON)
+    uint32x4_t v = vdupq_n_u32(px);
+    for (; i + 8 <= count; i += 8) {
+        vst1q_u32(dst + i, v);
+        vst1q_u32(dst + i + 4, v);
+    }
+#elif defined(GR_BLIT_SSE2)
+    __m128i v = _mm_set1_epi32((int)px);
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), v);
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = px;
+}
+
+void gr_copy_row32(uint32_t* dst, const uint32_t* src, int count) {
+    memcpy(dst, src, count * sizeof(uint32_t));
+}
+
+void gr_blend_row32(uint32_t* dst, const uint32_t* src, int count) {
+    int i = 0;
+#if defined(GR_BLIT_NEON)
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t*)(src + i));
+        uint8x8x4_t d = vld4_u8((const uint8_t*)(dst + i));
+        vst4_u8((uint8_t*)(dst + i), blend_neon(s, d));
+    }
+#elif defined(GR_BLIT_SSE2)
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        // Runs of fully transparent or opaque pixels are common in icons
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_srli_epi32(s, 24), _mm_setzero_si128()));
+        if (mask == 0xFFFF)
+            continue;
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_srli_epi32(s, 24), _mm_set1_epi32(0xFF))) == 0xFFFF) {
+            _mm_storeu_si128((__m128i*)(dst + i), s);
+            continue;
+        }
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend_sse2(s, d));
+    }
+#endif
+    for (; i < count; ++i) {
+        uint32_t a = src[i] >> 24;
+        if (a == 0xFF)
+            dst[i] = src[i];
+        else if (a)
+            dst[i] = blend_pixel(dst[i], src[i]);
+    }
+}
+
+void gr_blend_fill_row32(uint32_t* dst, uint32_t px, int count) {
+    int i = 0;
+    if ((px >> 24) == 0)
+        return;
+#if defined(GR_BLIT_NEON)
+    uint8x8x4_t s;
+    s.val[0] = vdup_n_u8(px & 0xFF);
+    s.val[1] = vdup_n_u8((px >> 8) & 0xFF);
+    s.val[2] = vdup_n_u8((px >> 16) & 0xFF);
+    s.val[3] = vdup_n_u8(px >> 24);
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t d = vld4_u8((const uint8_t*)(dst + i));
+        vst4_u8((uint8_t*)(dst + i), blend_neon(s, d));
+    }
+#elif defined(GR_BLIT_SSE2)
+    __m128i s = _mm_set1_epi32((int)px);
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend_sse2(s, d));
+    }
+#endif
+    for (; i < count; ++i)
+        dst[i] = blend_pixel(dst[i], px);
+}
@@ -0,0 +1,32 @@
+/*
+	Copyright (C) 2020-2023 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _GRAPHICS_BLIT_H_
+#define _GRAPHICS_BLIT_H_
+
+#include <stdint.h>
+
+// Stores px count times
+void gr_fill_row32(uint32_t* dst, uint32_t px, int count);
+void gr_copy_row32(uint32_t* dst, const uint32_t* src, int count);
+// Blends src over dst using the alpha of each source pixel
+void gr_blend_row32(uint32_t* dst, const uint32_t* src, int count);
+// Blends a single color over dst
+void gr_blend_fill_row32(uint32_t* dst, uint32_t px, int count);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+	Copyright (C) 2020-2023 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Full frame redraws at 1080x2400 through the 32bpp row kernels
+
+#include <stdint.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "graphics_blit.h"
+
+static const int kWidth = 1080;
+static const int kHeight = 2400;
+
+static std::vector<uint32_t> MakeFrame(bool translucent) {
+    std::vector<uint32_t> frame(kWidth * kHeight);
+    for (size_t i = 0; i < frame.size(); ++i) {
+        uint32_t a = translucent ? (i * 7) & 0xFF : 0xFF;
+        frame[i] = (a << 24) | ((i * 13) & 0xFFFFFF);
+    }
+    return frame;
+}
+
+static void SetBytes(benchmark::State& state) {
+    state.SetBytesProcessed(state.iterations() * kWidth * kHeight * sizeof(uint32_t));
+}
+
+// What gr_clear used to do for a non-gray background
+static void BM_ClearFrameBytewise(benchmark::State& state) {
+    std::vector<uint32_t> frame(kWidth * kHeight);
+    for (auto _ : state) {
+        unsigned char* px = (unsigned char*)frame.data();
+        for (int y = 0; y < kHeight; ++y) {
+            for (int x = 0; x < kWidth; ++x) {
+                *px++ = 0x20;
+                *px++ = 0x30;
+                *px++ = 0x40;
+                px++;
+            }
+        }
+        benchmark::DoNotOptimize(frame.data());
+    }
+    SetBytes(state);
+}
+BENCHMARK(BM_ClearFrameBytewise);
+
+static void BM_FillFrame(benchmark::State& state) {
+    std::vector<uint32_t> frame(kWidth * kHeight);
+    for (auto _ : state) {
+        for (int y = 0; y < kHeight; ++y)
+            gr_fill_row32(frame.data() + y * kWidth, 0xFF403020, kWidth);
+        benchmark::DoNotOptimize(frame.data());
+    }
+    SetBytes(state);
+}
+BENCHMARK(BM_FillFrame);
+
+static void BM_BlendFillFrame(benchmark::State& state) {
+    std::vector<uint32_t> frame = MakeFrame(false);
+    for (auto _ : state) {
+        for (int y = 0; y < kHeight; ++y)
+            gr_blend_fill_row32(frame.data() + y * kWidth, 0x80403020, kWidth);
+        benchmark::DoNotOptimize(frame.data());
+    }
+    SetBytes(state);
+}
+BENCHMARK(BM_BlendFillFrame);
+
+static void BM_CopyFrame(benchmark::State& state) {
+    std::vector<uint32_t> frame(kWidth * kHeight);
+    std::vector<uint32_t> src = MakeFrame(false);
+    for (auto _ : state) {
+        for (int y = 0; y < kHeight; ++y)
+            gr_copy_row32(frame.data() + y * kWidth, src.data() + y * kWidth, kWidth);
+        benchmark::DoNotOptimize(frame.data());
+    }
+    SetBytes(state);
+}
+BENCHMARK(BM_CopyFrame);
+
+static void BM_BlendFrame(benchmark::State& state) {
+    std::vector<uint32_t> frame = MakeFrame(false);
+    std::vector<uint32_t> src = MakeFrame(true);
+    for (auto _ : state) {
+        for (int y = 0; y < kHeight; ++y)
+            gr_blend_row32(frame.data() + y * kWidth, src.data() + y * kWidth, kWidth);
+        benchmark::DoNotOptimize(frame.data());
+    }
+    SetBytes(state);
+}
+BENCHMARK(BM_BlendFrame);
+
+BENCHMARK_MAIN();
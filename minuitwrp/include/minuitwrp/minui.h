@@ -95,8 +95,13 @@ int ev_has_mouse(void);
 
 // Returns 0 if no error, else negative.
 int res_create_surface(const char* name, gr_surface* pSurface);
+// Decodes a PNG (or JPEG, if supported) image held in memory.
+int res_create_surface_mem(const unsigned char* data, size_t size, gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h);
+// Save/restore a decoded surface as raw framebuffer-format pixels.
+int res_write_surface(int fd, gr_surface surface);
+int res_read_surface(int fd, gr_surface* pSurface);
 
 int vibrate(int timeout_ms);
 
@@ -17,8 +17,11 @@
 #ifndef _TWRP_TRUETYPE_HPP
 #define _TWRP_TRUETYPE_HPP
 
+#include <atomic>
 #include <map>
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include <ft2build.h>
 #include <pthread.h>
 #include FT_FREETYPE_H
@@ -36,26 +39,61 @@ inline bool operator<(const TrueTypeFontKey &ttfkLeft, const TrueTypeFontKey &tt
     return std::tie(ttfkLeft.size, ttfkLeft.dpi, ttfkLeft.path) < std::tie(ttfkRight.size, ttfkRight.dpi, ttfkRight.path);
 }
 
+// Metrics of a rendered codepoint and where its bitmap lives in the font's atlas
 typedef struct {
-    FT_BBox bbox;
-    FT_BitmapGlyph glyph;
-} TrueTypeCacheEntry;
+    unsigned int codepoint;
+    int char_idx;
+    int left; // bitmap offset from the pen position
+    int top; // bitmap top above the baseline
+    int width;
+    int height;
+    int advance;
+    int atlas_x;
+    int atlas_y;
+    unsigned int atlas_gen; // atlas generation the bitmap was packed in, 0 if not packed yet
+} TrueTypeGlyph;
 
-typedef struct StringCacheKey {
-    int max_width;
-    std::string text;
-} StringCacheKey;
-
-inline bool operator<(const StringCacheKey &sckLeft, const StringCacheKey &sckRight)  {
-    return std::tie(sckLeft.text, sckLeft.max_width) < std::tie(sckRight.text, sckRight.max_width);
-}
+typedef struct {
+    TrueTypeGlyph *glyph;
+    int x; // pen position, kerning included
+} TrueTypeRunGlyph;
 
+// A laid out string: the glyph run is drawn straight from the atlas
 typedef struct StringCacheEntry {
-    GGLSurface surface;
+    std::string text;
+    int max_width;
+    int width;
     int rendered_bytes; // number of bytes from C string rendered, not number of UTF8 characters!
-    StringCacheKey *key;
+    unsigned long last_used;
+    std::vector<TrueTypeRunGlyph> run;
 } StringCacheEntry;
 
+typedef struct {
+    int x; // first free column
+    int y;
+    int height;
+} TrueTypeAtlasShelf;
+
+// One A_8 texture per font size, filled shelf by shelf
+typedef struct {
+    GGLSurface surface;
+    GGLSurface rotated; // surface in display orientation, only built when gr_rotation != 0
+    unsigned int rotation; // gr_rotation the rotated copy was made for
+    unsigned int gen; // bumped whenever the atlas is flushed
+    int bottom;
+    std::vector<TrueTypeAtlasShelf> shelves;
+} TrueTypeAtlas;
+
+typedef struct {
+    unsigned long glyph_hits;
+    unsigned long glyph_misses;
+    unsigned long string_hits;
+    unsigned long string_misses;
+    unsigned long atlas_flushes;
+} TrueTypeCacheStats;
+
+#define TTF_ASCII_GLYPHS 128
+
 typedef struct {
     int type;
     int refcount;
@@ -64,8 +102,17 @@ typedef struct {
     int max_height;
     int base;
     FT_Face face;
-    std::map<int, TrueTypeCacheEntry*> glyph_cache;
-    std::map<StringCacheKey, StringCacheEntry*> string_cache;
+    std::unordered_map<unsigned int, TrueTypeGlyph> glyph_cache;
+    TrueTypeGlyph *ascii_glyphs[TTF_ASCII_GLYPHS]; // direct lookup into glyph_cache
+    std::unordered_map<uint32_t, StringCacheEntry*> string_cache;
+    unsigned long string_clock;
+    TrueTypeAtlas atlas;
+    // Counters are only bumped under mutex but can be read without it
+    std::atomic<unsigned long> glyph_hits;
+    std::atomic<unsigned long> glyph_misses;
+    std::atomic<unsigned long> string_hits;
+    std::atomic<unsigned long> string_misses;
+    std::atomic<unsigned long> atlas_flushes;
     pthread_mutex_t mutex;
     TrueTypeFontKey *key;
 } TrueTypeFont;
@@ -76,8 +123,8 @@ typedef struct {
     pthread_mutex_t mutex;
 } FontData;
 
-typedef std::map<StringCacheKey, StringCacheEntry*> StringCacheMap;
-typedef std::map<int, TrueTypeCacheEntry*> TrueTypeCacheEntryMap;
+typedef std::unordered_map<uint32_t, StringCacheEntry*> StringCacheMap;
+typedef std::unordered_map<unsigned int, TrueTypeGlyph> TrueTypeGlyphMap;
 typedef std::map<TrueTypeFontKey, TrueTypeFont*> TrueTypeFontMap;
 
 #define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
@@ -91,21 +138,29 @@ static const uint32_t offset_basis = 2166136261U;
 #define STRING_CACHE_MAX_ENTRIES 400
 #define STRING_CACHE_TRUNCATE_ENTRIES 150
 
+#define TTF_ATLAS_WIDTH 1024
+#define TTF_ATLAS_MIN_HEIGHT 64
+#define TTF_ATLAS_MAX_HEIGHT 1024
+#define TTF_ATLAS_PADDING 1
+
 class twrpTruetype {
 public:
     twrpTruetype();
     static int utf8_to_unicode(const char* pIn, unsigned int *pOut);
     static void* gr_ttf_loadFont(const char *filename, int size, int dpi);
     static void* gr_ttf_scaleFont(void *font, int max_width, int measured_width);
-    static void gr_ttf_freeStringCache(void *key, void *value, void *context __unused);
     static void gr_ttf_freeFont(void *font);
-    static TrueTypeCacheEntry* gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_index);
-    static TrueTypeCacheEntry* gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index);
-    static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base);
+    static TrueTypeGlyph* gr_ttf_glyph_cache_peek(TrueTypeFont *font, unsigned int codepoint);
+    static TrueTypeGlyph* gr_ttf_glyph_cache_get(TrueTypeFont *font, unsigned int codepoint);
+    static bool gr_ttf_atlas_grow(TrueTypeFont *font, int min_height);
+    static void gr_ttf_atlas_flush(TrueTypeFont *font);
+    static bool gr_ttf_atlas_reserve(TrueTypeFont *font, int width, int height, int *x, int *y);
+    static bool gr_ttf_atlas_add(TrueTypeFont *font, TrueTypeGlyph *glyph, FT_GlyphSlot slot);
+    static GGLSurface* gr_ttf_atlas_texture(TrueTypeFont *font);
     static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f);
-    static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const std::string text, int max_width);
-    static StringCacheEntry* gr_ttf_string_cache_peek(TrueTypeFont *font, const std::string text, __attribute__((unused)) int max_width);
-    static StringCacheEntry* gr_ttf_string_cache_get(TrueTypeFont *font, const std::string text, int max_width);
+    static int gr_ttf_render_text(TrueTypeFont *font, StringCacheEntry *entry, const char *text, int max_width);
+    static StringCacheEntry* gr_ttf_string_cache_peek(TrueTypeFont *font, const char *text, int max_width);
+    static StringCacheEntry* gr_ttf_string_cache_get(TrueTypeFont *font, const char *text, int max_width);
     static int gr_ttf_measureEx(const char *s, void *font);
     static int gr_ttf_maxExW(const char *s, void *font, int max_width);
     static int gr_ttf_textExWH(void *context, int x, int y,
@@ -114,5 +169,6 @@ public:
                     const gr_surface gr_draw_surface);
     static int gr_ttf_getMaxFontHeight(void *font);
     static void gr_ttf_string_cache_truncate(TrueTypeFont *font);
+    static void gr_ttf_getCacheStats(void *font, TrueTypeCacheStats *stats);
 };
 #endif // _TWRP_TRUETYPE_HPP
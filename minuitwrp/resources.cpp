@@ -50,12 +50,39 @@ static GGLSurface* malloc_surface(size_t data_size) {
     return surface;
 }
 
+// Reads the image geometry and sets up the transforms that expand the
+// PNG to 8-bit gray, RGB or RGBA rows.
+static void configure_png(png_structp png_ptr, png_infop info_ptr,
+                          png_uint_32* width, png_uint_32* height, png_byte* channels) {
+    int color_type, bit_depth;
+
+    png_get_IHDR(png_ptr, info_ptr, width, height, &bit_depth,
+            &color_type, NULL, NULL, NULL);
+
+    *channels = png_get_channels(png_ptr, info_ptr);
+
+    if (bit_depth == 8 && *channels == 3 && color_type == PNG_COLOR_TYPE_RGB) {
+        // 8-bit RGB images: great, nothing to do.
+    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_GRAY) {
+        // 1-, 2-, 4-, or 8-bit gray images: expand to 8-bit gray.
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_PALETTE) {
+        // paletted images: expand to 8-bit RGB.  Note that we DON'T
+        // currently expand the tRNS chunk (if any) to an alpha
+        // channel, because minui doesn't support alpha channels in
+        // general.
+        png_set_palette_to_rgb(png_ptr);
+        *channels = 3;
+    } else if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    }
+}
+
 static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
                     png_uint_32* width, png_uint_32* height, png_byte* channels, FILE** fpp) {
     char resPath[256];
     unsigned char header[8];
     int result = 0;
-    int color_type, bit_depth;
     size_t bytesRead;
 
     snprintf(resPath, sizeof(resPath)-1, TWRES "images/%s.png", name);
@@ -100,27 +127,7 @@ static int open_png(const char* name, png_structp* png_ptr, png_infop* info_ptr,
     png_init_io(*png_ptr, fp);
     png_set_sig_bytes(*png_ptr, sizeof(header));
     png_read_info(*png_ptr, *info_ptr);
-
-    png_get_IHDR(*png_ptr, *info_ptr, width, height, &bit_depth,
-            &color_type, NULL, NULL, NULL);
-
-    *channels = png_get_channels(*png_ptr, *info_ptr);
-
-    if (bit_depth == 8 && *channels == 3 && color_type == PNG_COLOR_TYPE_RGB) {
-        // 8-bit RGB images: great, nothing to do.
-    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_GRAY) {
-        // 1-, 2-, 4-, or 8-bit gray images: expand to 8-bit gray.
-        png_set_expand_gray_1_2_4_to_8(*png_ptr);
-    } else if (bit_depth <= 8 && *channels == 1 && color_type == PNG_COLOR_TYPE_PALETTE) {
-        // paletted images: expand to 8-bit RGB.  Note that we DON'T
-        // currently expand the tRNS chunk (if any) to an alpha
-        // channel, because minui doesn't support alpha channels in
-        // general.
-        png_set_palette_to_rgb(*png_ptr);
-        *channels = 3;
-    } else if (color_type == PNG_COLOR_TYPE_PALETTE) {
-        png_set_palette_to_rgb(*png_ptr);
-    }
+    configure_png(*png_ptr, *info_ptr, width, height, channels);
 
     *fpp = fp;
     return result;
@@ -253,51 +260,110 @@ int res_create_surface_png(const char* name, gr_surface* pSurface) {
     return result;
 }
 
-#ifdef TW_INCLUDE_JPEG
-int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
-    GGLSurface* surface = NULL;
-    int result = 0, y;
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    unsigned char* pData;
-    size_t width, height, stride, pixelSize;
+// libpng read callback for PNG data held in memory
+struct png_mem_source {
+    const unsigned char* data;
+    size_t size;
+    size_t offset;
+};
+
+static void read_png_mem(png_structp png_ptr, png_bytep out, png_size_t length) {
+    png_mem_source* src = reinterpret_cast<png_mem_source*>(png_get_io_ptr(png_ptr));
+    if (length > src->size - src->offset)
+        png_error(png_ptr, "read past end of PNG data");
+    memcpy(out, src->data + src->offset, length);
+    src->offset += length;
+}
 
-    FILE* fp = fopen(name, "rb");
-    if (fp == NULL) {
-        char resPath[256];
+static int res_create_surface_png_mem(const unsigned char* data, size_t size, gr_surface* pSurface) {
+    GGLSurface* volatile surface = NULL;
+    unsigned char* volatile p_row = NULL;
+    png_structp png_ptr = NULL;
+    png_infop info_ptr = NULL;
+    png_uint_32 width, height, y;
+    png_byte channels;
+    png_mem_source src = { data, size, 8 };
+    int result = 0;
 
-        snprintf(resPath, sizeof(resPath)-1, TWRES "images/%s", name);
-        resPath[sizeof(resPath)-1] = '\0';
-        fp = fopen(resPath, "rb");
-        if (fp == NULL) {
-            result = -1;
-            goto exit;
-        }
+    png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png_ptr)
+        return -4;
+
+    info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        result = -5;
+        goto exit;
     }
 
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_decompress(&cinfo);
+    // Unlike open_png(), the whole decode runs under this jump buffer
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        result = -6;
+        goto exit;
+    }
 
-    /* Specify data source for decompression */
-    jpeg_stdio_src(&cinfo, fp);
+    png_set_read_fn(png_ptr, &src, read_png_mem);
+    png_set_sig_bytes(png_ptr, 8);
+    png_read_info(png_ptr, info_ptr);
+    configure_png(png_ptr, info_ptr, &width, &height, &channels);
 
-    /* Read file header, set default decompression parameters */
-    if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK)
+    surface = init_display_surface(width, height);
+    if (surface == NULL) {
+        result = -8;
         goto exit;
+    }
+
+#if defined(RECOVERY_ARGB) || defined(RECOVERY_BGRA) || defined(RECOVERY_ABGR)
+    png_set_bgr(png_ptr);
+#endif
+
+    p_row = reinterpret_cast<unsigned char*>(malloc(width * 4));
+    if (p_row == NULL) {
+        result = -9;
+        goto exit;
+    }
+    for (y = 0; y < height; ++y) {
+        png_read_row(png_ptr, p_row, NULL);
+        transform_rgb_to_draw(p_row, surface->data + y * width * 4, channels, width);
+    }
+
+    if (channels == 3)
+        surface->format = GGL_PIXEL_FORMAT_RGBX_8888;
+    else
+        surface->format = GGL_PIXEL_FORMAT_RGBA_8888;
+
+    *pSurface = (gr_surface) surface;
+
+  exit:
+    free(p_row);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    if (result < 0 && surface != NULL) free(surface);
+    return result;
+}
+
+#ifdef TW_INCLUDE_JPEG
+// Decodes a JPEG from the source manager already attached to cinfo.
+static int read_jpg_surface(struct jpeg_decompress_struct* cinfo, gr_surface* pSurface) {
+    GGLSurface* surface = NULL;
+    int y;
+    unsigned char* pData;
+    size_t width, height, stride, pixelSize;
+
+    /* Read file header, set default decompression parameters */
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK)
+        return -2;
 
     /* Start decompressor */
-    (void) jpeg_start_decompress(&cinfo);
+    (void) jpeg_start_decompress(cinfo);
 
-    width = cinfo.image_width;
-    height = cinfo.image_height;
+    width = cinfo->image_width;
+    height = cinfo->image_height;
     stride = 4 * width;
     pixelSize = stride * height;
 
     surface = reinterpret_cast<GGLSurface*>(malloc(sizeof(GGLSurface) + pixelSize));
-    //p_row = reinterpret_cast<unsigned char*>(malloc(width * 4));
     if (surface == NULL) {
-        result = -8;
-        goto exit;
+        jpeg_abort_decompress(cinfo);
+        return -8;
     }
 
     pData = (unsigned char*) (surface + 1);
@@ -310,7 +376,7 @@ int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
 
     for (y = 0; y < (int) height; ++y) {
         unsigned char* pRow = pData + y * stride;
-        jpeg_read_scanlines(&cinfo, &pRow, 1);
+        jpeg_read_scanlines(cinfo, &pRow, 1);
 
         int x;
         for(x = width - 1; x >= 0; x--) {
@@ -333,22 +399,50 @@ int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
 #endif
         }
     }
+    (void) jpeg_finish_decompress(cinfo);
     *pSurface = (gr_surface) surface;
+    return 0;
+}
 
-exit:
-    if (fp != NULL)
-    {
-        if (surface)
-        {
-            (void) jpeg_finish_decompress(&cinfo);
-            if (result < 0)
-            {
-                free(surface);
-            }
-        }
-        jpeg_destroy_decompress(&cinfo);
-        fclose(fp);
+int res_create_surface_jpg(const char* name, gr_surface* pSurface) {
+    int result;
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    FILE* fp = fopen(name, "rb");
+    if (fp == NULL) {
+        char resPath[256];
+
+        snprintf(resPath, sizeof(resPath)-1, TWRES "images/%s", name);
+        resPath[sizeof(resPath)-1] = '\0';
+        fp = fopen(resPath, "rb");
+        if (fp == NULL)
+            return -1;
     }
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+
+    /* Specify data source for decompression */
+    jpeg_stdio_src(&cinfo, fp);
+
+    result = read_jpg_surface(&cinfo, pSurface);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    return result;
+}
+
+static int res_create_surface_jpg_mem(const unsigned char* data, size_t size, gr_surface* pSurface) {
+    int result;
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(data), size);
+
+    result = read_jpg_surface(&cinfo, pSurface);
+    jpeg_destroy_decompress(&cinfo);
     return result;
 }
 #endif
@@ -371,6 +465,99 @@ int res_create_surface(const char* name, gr_surface* pSurface) {
     return ret;
 }
 
+int res_create_surface_mem(const unsigned char* data, size_t size, gr_surface* pSurface) {
+    if (!data || !pSurface) return -1;
+    *pSurface = NULL;
+
+    if (size >= 8 && png_sig_cmp(const_cast<png_bytep>(data), 0, 8) == 0)
+        return res_create_surface_png_mem(data, size, pSurface);
+#ifdef TW_INCLUDE_JPEG
+    if (size >= 2 && data[0] == 0xff && data[1] == 0xd8)
+        return res_create_surface_jpg_mem(data, size, pSurface);
+#endif
+    return -3;
+}
+
+// Serialized surface layout: header followed by stride * height * 4 bytes
+// of pixel data, already in the framebuffer pixel format.
+#define SURFACE_FILE_MAGIC 0x53535754 // "TWSS"
+
+struct surface_file_header {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t format;
+};
+
+static bool write_fully(int fd, const void* buf, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(buf);
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w <= 0)
+            return false;
+        p += w;
+        len -= w;
+    }
+    return true;
+}
+
+static bool read_fully(int fd, void* buf, size_t len) {
+    unsigned char* p = reinterpret_cast<unsigned char*>(buf);
+    while (len > 0) {
+        ssize_t r = read(fd, p, len);
+        if (r <= 0)
+            return false;
+        p += r;
+        len -= r;
+    }
+    return true;
+}
+
+int res_write_surface(int fd, gr_surface surface) {
+    GGLSurface* pSurface = (GGLSurface*) surface;
+    if (!pSurface) return -1;
+
+    surface_file_header header;
+    header.magic = SURFACE_FILE_MAGIC;
+    header.width = pSurface->width;
+    header.height = pSurface->height;
+    header.stride = pSurface->stride;
+    header.format = pSurface->format;
+    if (!write_fully(fd, &header, sizeof(header)))
+        return -2;
+    if (!write_fully(fd, pSurface->data, (size_t) pSurface->stride * pSurface->height * 4))
+        return -2;
+    return 0;
+}
+
+int res_read_surface(int fd, gr_surface* pSurface) {
+    surface_file_header header;
+    *pSurface = NULL;
+
+    if (!read_fully(fd, &header, sizeof(header)))
+        return -2;
+    if (header.magic != SURFACE_FILE_MAGIC || header.stride < header.width ||
+        header.width == 0 || header.height == 0 || header.stride > 16384 || header.height > 16384)
+        return -3;
+
+    size_t data_size = (size_t) header.stride * header.height * 4;
+    GGLSurface* surface = malloc_surface(data_size);
+    if (surface == NULL)
+        return -8;
+    surface->version = sizeof(GGLSurface);
+    surface->width = header.width;
+    surface->height = header.height;
+    surface->stride = header.stride;
+    surface->format = header.format;
+    if (!read_fully(fd, surface->data, data_size)) {
+        free(surface);
+        return -2;
+    }
+    *pSurface = (gr_surface) surface;
+    return 0;
+}
+
 void res_free_surface(gr_surface surface) {
     GGLSurface* pSurface = (GGLSurface*) surface;
     if (pSurface) {
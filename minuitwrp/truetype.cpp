@@ -22,6 +22,7 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 
 #include <pthread.h>
 #include <algorithm>
@@ -132,6 +133,18 @@ void* twrpTruetype::gr_ttf_loadFont(const char *filename, int size, int dpi) {
 	res->max_height = -1;
 	res->base = -1;
 	res->refcount = 1;
+	std::fill(res->ascii_glyphs, res->ascii_glyphs + TTF_ASCII_GLYPHS, nullptr);
+	res->string_clock = 0;
+	memset(&res->atlas.surface, 0, sizeof(res->atlas.surface));
+	memset(&res->atlas.rotated, 0, sizeof(res->atlas.rotated));
+	res->atlas.rotation = 0;
+	res->atlas.gen = 1;
+	res->atlas.bottom = 0;
+	res->glyph_hits = 0;
+	res->glyph_misses = 0;
+	res->string_hits = 0;
+	res->string_misses = 0;
+	res->atlas_flushes = 0;
 
 	pthread_mutex_init(&res->mutex, 0);
 
@@ -162,21 +175,18 @@ void* twrpTruetype::gr_ttf_scaleFont(void *font, int max_width, int measured_wid
 	return gr_ttf_loadFont(file, new_size, dpi);
 }
 
-static bool gr_ttf_freeFontCache(void *value, void *context __unused)
-{
-	TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-	FT_Done_Glyph((FT_Glyph)e->glyph);
-	delete e;
-	return true;
-}
-
-void twrpTruetype::gr_ttf_freeStringCache(void *key, void *value, void *context __unused) {
-	StringCacheKey *k = (StringCacheKey *)key;
-	delete k;
-
-	StringCacheEntry *e = (StringCacheEntry *)value;
-	free(e->surface.data);
-	delete e;
+// 32bit FNV-1a over the text and the width it was laid out for
+static uint32_t gr_ttf_string_hash(const char *text, int max_width) {
+	uint32_t hash = offset_basis;
+	for (const unsigned char *itr = (const unsigned char *)text; *itr; ++itr) {
+		hash ^= *itr;
+		hash *= FNV_prime;
+	}
+	for (size_t i = 0; i < sizeof(max_width); ++i) {
+		hash ^= ((unsigned int)max_width >> (i * 8)) & 0xFF;
+		hash *= FNV_prime;
+	}
+	return hash;
 }
 
 void twrpTruetype::gr_ttf_freeFont(void *font) {
@@ -185,124 +195,254 @@ void twrpTruetype::gr_ttf_freeFont(void *font) {
 	TrueTypeFont *d = (TrueTypeFont *)font;
 	if(--d->refcount == 0)
 	{
-		delete d->key;
-
 		FT_Done_Face(d->face);
 
 		StringCacheMap::iterator stringCacheEntryIt = d->string_cache.begin();
 		while (stringCacheEntryIt != d->string_cache.end()) {
-			gr_ttf_freeStringCache(stringCacheEntryIt->second->key, stringCacheEntryIt->second, nullptr);
+			delete stringCacheEntryIt->second;
 			stringCacheEntryIt = d->string_cache.erase(stringCacheEntryIt);
 		}
 
-		TrueTypeCacheEntryMap::iterator ttcIt = d->glyph_cache.begin();
-		while(ttcIt != d->glyph_cache.end()) {
-			gr_ttf_freeFontCache(ttcIt->second, nullptr);
-			ttcIt = d->glyph_cache.erase(ttcIt);
-		}
+		free(d->atlas.surface.data);
+		free(d->atlas.rotated.data);
 
 		pthread_mutex_destroy(&d->mutex);
 
 		TrueTypeFontMap::iterator trueTypeFontIt = font_data.fonts.find(*(d->key));
-		delete d;
 		font_data.fonts.erase(trueTypeFontIt);
-
+		delete d->key;
+		delete d;
 	}
 
 	pthread_mutex_unlock(&font_data.mutex);
 }
 
-TrueTypeCacheEntry* twrpTruetype::gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_index) {
-	TrueTypeCacheEntryMap::iterator glyphCacheItr = font->glyph_cache.find(char_index);
+TrueTypeGlyph* twrpTruetype::gr_ttf_glyph_cache_peek(TrueTypeFont *font, unsigned int codepoint) {
+	if (codepoint < TTF_ASCII_GLYPHS)
+		return font->ascii_glyphs[codepoint];
 
-	if(glyphCacheItr != font->glyph_cache.end()) {
-		return font->glyph_cache[char_index];
-	}
+	TrueTypeGlyphMap::iterator glyphCacheItr = font->glyph_cache.find(codepoint);
+	if (glyphCacheItr != font->glyph_cache.end())
+		return &glyphCacheItr->second;
 	return nullptr;
 }
 
-TrueTypeCacheEntry* twrpTruetype::gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_index) {
-	TrueTypeCacheEntryMap::iterator glyphCacheItr = font->glyph_cache.find(char_index);
-	TrueTypeCacheEntry* res = nullptr;
-	if(glyphCacheItr == font->glyph_cache.end())
+TrueTypeGlyph* twrpTruetype::gr_ttf_glyph_cache_get(TrueTypeFont *font, unsigned int codepoint) {
+	TrueTypeGlyph *res = gr_ttf_glyph_cache_peek(font, codepoint);
+	if (res) {
+		font->glyph_hits++;
+		return res;
+	}
+	font->glyph_misses++;
+
+	// Shelves are sized from the font height, and measuring it reloads the glyph slot
+	if (font->max_height == -1)
+		gr_ttf_calcMaxFontHeight(font);
+
+	int char_idx = FT_Get_Char_Index(font->face, codepoint);
+	int error = FT_Load_Glyph(font->face, char_idx, FT_LOAD_RENDER);
+	if(error)
 	{
-		int error = FT_Load_Glyph(font->face, char_index, FT_LOAD_RENDER);
-		if(error)
-		{
-			fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_index, error);
-			return nullptr;
-		}
+		fprintf(stderr, "Failed to load glyph idx %d: %d\n", char_idx, error);
+		return nullptr;
+	}
 
-		FT_BitmapGlyph glyph;
-		error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-		if(error)
-		{
-			fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-			return nullptr;
-		}
+	FT_GlyphSlot slot = font->face->glyph;
+	res = &font->glyph_cache[codepoint];
+	res->codepoint = codepoint;
+	res->char_idx = char_idx;
+	res->left = slot->bitmap_left;
+	res->top = slot->bitmap_top;
+	res->width = slot->bitmap.width;
+	res->height = slot->bitmap.rows;
+	res->advance = slot->advance.x >> 6;
+	res->atlas_x = 0;
+	res->atlas_y = 0;
+	res->atlas_gen = 0;
+	if (codepoint < TTF_ASCII_GLYPHS)
+		font->ascii_glyphs[codepoint] = res;
+
+	// Pack it now while the bitmap is still in the glyph slot
+	gr_ttf_atlas_add(font, res, slot);
+	return res;
+}
+
+bool twrpTruetype::gr_ttf_atlas_grow(TrueTypeFont *font, int min_height) {
+	TrueTypeAtlas *atlas = &font->atlas;
+	int height = atlas->surface.height ? atlas->surface.height * 2 : TTF_ATLAS_MIN_HEIGHT;
+
+	while (height < min_height)
+		height *= 2;
+	if (height > TTF_ATLAS_MAX_HEIGHT)
+		return false;
+
+	GGLubyte *data = (GGLubyte *)realloc(atlas->surface.data, TTF_ATLAS_WIDTH * height);
+	if (!data) {
+		fprintf(stderr, "Failed to grow glyph atlas to %dx%d\n", TTF_ATLAS_WIDTH, height);
+		return false;
+	}
+	memset(data + TTF_ATLAS_WIDTH * atlas->surface.height, 0, TTF_ATLAS_WIDTH * (height - atlas->surface.height));
+
+	atlas->surface.version = sizeof(atlas->surface);
+	atlas->surface.width = TTF_ATLAS_WIDTH;
+	atlas->surface.height = height;
+	atlas->surface.stride = TTF_ATLAS_WIDTH;
+	atlas->surface.format = GGL_PIXEL_FORMAT_A_8;
+	atlas->surface.data = data;
+
+	// Rebuilt on the next draw
+	free(atlas->rotated.data);
+	atlas->rotated.data = NULL;
+	return true;
+}
+
+void twrpTruetype::gr_ttf_atlas_flush(TrueTypeFont *font) {
+	TrueTypeAtlas *atlas = &font->atlas;
+
+	// Glyphs keep their metrics, their bitmaps get packed again when next drawn
+	++atlas->gen;
+	atlas->bottom = 0;
+	atlas->shelves.clear();
+	if (atlas->surface.data)
+		memset(atlas->surface.data, 0, atlas->surface.stride * atlas->surface.height);
+	free(atlas->rotated.data);
+	atlas->rotated.data = NULL;
+	font->atlas_flushes++;
+}
 
-		res = new TrueTypeCacheEntry;
-		res->glyph = glyph;
-		FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
-		font->glyph_cache[char_index] = res;
+bool twrpTruetype::gr_ttf_atlas_reserve(TrueTypeFont *font, int width, int height, int *x, int *y) {
+	TrueTypeAtlas *atlas = &font->atlas;
+
+	width += TTF_ATLAS_PADDING;
+	height += TTF_ATLAS_PADDING;
+	if (width > TTF_ATLAS_WIDTH || height > TTF_ATLAS_MAX_HEIGHT)
+		return false;
+
+	for (TrueTypeAtlasShelf& shelf : atlas->shelves) {
+		if (height <= shelf.height && shelf.x + width <= TTF_ATLAS_WIDTH) {
+			*x = shelf.x;
+			*y = shelf.y;
+			shelf.x += width;
+			return true;
+		}
 	}
-	else {
-		res = glyphCacheItr->second;
+
+	// Open a new shelf, a full line high so that every glyph of the font fits on it
+	TrueTypeAtlasShelf shelf;
+	shelf.height = MAX(height, font->max_height + TTF_ATLAS_PADDING);
+	if (atlas->bottom + shelf.height > (int)atlas->surface.height && !gr_ttf_atlas_grow(font, atlas->bottom + shelf.height)) {
+		gr_ttf_atlas_flush(font);
+		if (shelf.height > (int)atlas->surface.height && !gr_ttf_atlas_grow(font, shelf.height))
+			return false;
 	}
+	shelf.x = width;
+	shelf.y = atlas->bottom;
+	atlas->bottom += shelf.height;
+	atlas->shelves.push_back(shelf);
 
-	return res;
+	*x = 0;
+	*y = shelf.y;
+	return true;
 }
 
-int twrpTruetype::gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base) {
-	unsigned y;
-	uint8_t *src_itr = glyph->bitmap.buffer;
-	uint8_t *dest_itr = dest->data;
+bool twrpTruetype::gr_ttf_atlas_add(TrueTypeFont *font, TrueTypeGlyph *glyph, FT_GlyphSlot slot) {
+	TrueTypeAtlas *atlas = &font->atlas;
+	int x, y, row, col;
 
-	if(glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY)
-	{
-		fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
-		return -1;
+	if (glyph->width == 0 || glyph->height == 0) {
+		glyph->atlas_gen = atlas->gen;
+		return true;
 	}
 
-	dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
+	if (!slot) {
+		int error = FT_Load_Glyph(font->face, glyph->char_idx, FT_LOAD_RENDER);
+		if (error) {
+			fprintf(stderr, "Failed to load glyph idx %d: %d\n", glyph->char_idx, error);
+			return false;
+		}
+		slot = font->face->glyph;
+	}
 
-	// FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
-	// the result might end up being before the buffer - I'm not sure how to properly handle this.
-	if(dest_itr < dest->data)
-		dest_itr = dest->data;
+	if (slot->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
+		fprintf(stderr, "Unsupported pixel mode in FT_GlyphSlot %d\n", slot->bitmap.pixel_mode);
+		return false;
+	}
 
-	for(y = 0; y < glyph->bitmap.rows; ++y)
-	{
-		memcpy(dest_itr, src_itr, glyph->bitmap.width);
-		src_itr += glyph->bitmap.pitch;
-		dest_itr += dest->stride;
+	if (!gr_ttf_atlas_reserve(font, glyph->width, glyph->height, &x, &y))
+		return false;
+
+	const uint8_t *src_itr = slot->bitmap.buffer;
+	uint8_t *dest_itr = atlas->surface.data + y * atlas->surface.stride + x;
+	for (row = 0; row < glyph->height; ++row) {
+		memcpy(dest_itr, src_itr, glyph->width);
+		src_itr += slot->bitmap.pitch;
+		dest_itr += atlas->surface.stride;
+	}
+
+	// Keep an existing rotated copy current rather than rotating the whole atlas again
+	if (atlas->rotated.data && atlas->rotation == gr_rotation) {
+		src_itr = slot->bitmap.buffer;
+		for (row = 0; row < glyph->height; ++row) {
+			for (col = 0; col < glyph->width; ++col) {
+				int x_disp = ROTATION_X_DISP(x + col, y + row, atlas->rotated.width);
+				int y_disp = ROTATION_Y_DISP(x + col, y + row, atlas->rotated.height);
+				atlas->rotated.data[y_disp * atlas->rotated.stride + x_disp] = src_itr[col];
+			}
+			src_itr += slot->bitmap.pitch;
+		}
 	}
-	return 0;
+
+	glyph->atlas_x = x;
+	glyph->atlas_y = y;
+	glyph->atlas_gen = atlas->gen;
+	return true;
+}
+
+GGLSurface* twrpTruetype::gr_ttf_atlas_texture(TrueTypeFont *font) {
+	TrueTypeAtlas *atlas = &font->atlas;
+
+	if (gr_rotation == 0)
+		return &atlas->surface;
+
+	if (!atlas->rotated.data || atlas->rotation != gr_rotation) {
+		free(atlas->rotated.data);
+		atlas->rotated.version = sizeof(atlas->rotated);
+		atlas->rotated.width   = (gr_rotation == 180) ? atlas->surface.width  : atlas->surface.height;
+		atlas->rotated.height  = (gr_rotation == 180) ? atlas->surface.height : atlas->surface.width;
+		atlas->rotated.stride  = atlas->rotated.width;
+		atlas->rotated.format  = atlas->surface.format;
+		atlas->rotated.data    = (GGLubyte*) malloc(atlas->rotated.stride * atlas->rotated.height);
+		if (!atlas->rotated.data)
+			return nullptr;
+		surface_ROTATION_transform((gr_surface) &atlas->rotated, (const gr_surface) &atlas->surface, 1);
+		atlas->rotation = gr_rotation;
+	}
+	return &atlas->rotated;
 }
 
 void twrpTruetype::gr_ttf_calcMaxFontHeight(TrueTypeFont *f) {
-	char c;
+	unsigned int c;
 	int char_idx;
 	int error;
 	FT_Glyph glyph;
 	FT_BBox bbox;
 	FT_BBox bbox_glyph;
-	TrueTypeCacheEntry *ent;
+	TrueTypeGlyph *ent;
 
 	bbox.yMin = bbox_glyph.yMin = LONG_MAX;
 	bbox.yMax = bbox_glyph.yMax = LONG_MIN;
 
 	for(c = '!'; c <= '~'; ++c)
 	{
-		char_idx = FT_Get_Char_Index(f->face, c);
-		ent = gr_ttf_glyph_cache_peek(f, char_idx);
+		ent = gr_ttf_glyph_cache_peek(f, c);
 		if(ent)
 		{
-			bbox.yMin = MIN(bbox.yMin, ent->bbox.yMin);
-			bbox.yMax = MAX(bbox.yMax, ent->bbox.yMax);
+			bbox.yMin = MIN(bbox.yMin, ent->top - ent->height);
+			bbox.yMax = MAX(bbox.yMax, ent->top);
 		}
 		else
 		{
+			char_idx = FT_Get_Char_Index(f->face, c);
 			error = FT_Load_Glyph(f->face, char_idx, 0);
 			if(error)
 				continue;
@@ -331,156 +471,117 @@ void twrpTruetype::gr_ttf_calcMaxFontHeight(TrueTypeFont *f) {
 	f->base += f->size / 4;
 }
 
-// returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
-int twrpTruetype::gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const std::string text, int max_width) {
+// Lays text out into entry->run, returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
+int twrpTruetype::gr_ttf_render_text(TrueTypeFont *font, StringCacheEntry *entry, const char *text, int max_width) {
 	TrueTypeFont *f = font;
-	TrueTypeCacheEntry *ent;
+	TrueTypeGlyph *ent;
+	TrueTypeRunGlyph run_glyph;
 	int bytes_rendered = 0, total_w = 0;
 	int utf_bytes = 0;
 	unsigned int unicode = 0;
-	int i, x, diff, char_idx, prev_idx = 0;
-	int height;
+	int kern, diff, prev_idx = 0;
 	FT_Vector delta;
-	uint8_t *data = NULL;
-	const char *text_itr = text.c_str();
-	int *char_idxs;
-	int char_idxs_len = 0;
+	const char *text_itr = text;
 
-	char_idxs = new int[text.length()];
+	if(f->max_height == -1)
+		gr_ttf_calcMaxFontHeight(f);
 
+	entry->run.clear();
 	while(*text_itr)
 	{
 		utf_bytes = utf8_to_unicode(text_itr, &unicode);
-		text_itr += utf_bytes;
-		bytes_rendered += utf_bytes;
 
-		char_idx = FT_Get_Char_Index(f->face, unicode);
-		char_idxs[char_idxs_len] = char_idx;
-		ent = gr_ttf_glyph_cache_get(f, char_idx);
+		ent = gr_ttf_glyph_cache_get(f, unicode);
 		if(ent)
 		{
-			diff = ent->glyph->root.advance.x >> 16;
-
-			if(FT_HAS_KERNING(f->face) && prev_idx && char_idx)
+			kern = 0;
+			if(FT_HAS_KERNING(f->face) && prev_idx && ent->char_idx)
 			{
-				FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-				diff += delta.x >> 6;
+				FT_Get_Kerning(f->face, prev_idx, ent->char_idx, FT_KERNING_DEFAULT, &delta);
+				kern = delta.x >> 6;
 			}
+			diff = ent->advance + kern;
 
 			if(max_width != -1 && total_w + diff > max_width)
 				break;
 
+			run_glyph.glyph = ent;
+			run_glyph.x = total_w + kern;
+			entry->run.push_back(run_glyph);
 			total_w += diff;
+			prev_idx = ent->char_idx;
 		}
-		prev_idx = char_idx;
-		++char_idxs_len;
-	}
-
-	if(font->max_height == -1)
-		gr_ttf_calcMaxFontHeight(font);
-
-	if(font->max_height == -1)
-	{
-		delete [] char_idxs;
-		return -1;
-	}
-
-	height = font->max_height;
-
-	data = (uint8_t *)malloc(total_w*height);
-    memset(data, 0, total_w*height);	x = 0;
-	prev_idx = 0;
-
-	surface->version = sizeof(*surface);
-	surface->width = total_w;
-	surface->height = height;
-	surface->stride = total_w;
-	surface->data = (GGLubyte*)data;
-	surface->format = GGL_PIXEL_FORMAT_A_8;
-
-	for(i = 0; i < char_idxs_len; ++i)
-	{
-		char_idx = char_idxs[i];
-		if(FT_HAS_KERNING(f->face) && prev_idx && char_idx)
-		{
-			FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-			x += delta.x >> 6;
-		}
-
-		ent = gr_ttf_glyph_cache_get(f, char_idx);
-		if(ent)
-		{
-			gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-			x += ent->glyph->root.advance.x >> 16;
-		}
+		else
+			prev_idx = 0;
 
-		prev_idx = char_idx;
+		text_itr += utf_bytes;
+		bytes_rendered += utf_bytes;
 	}
 
-	delete [] char_idxs;
+	entry->width = total_w;
+	entry->rendered_bytes = bytes_rendered;
 	return bytes_rendered;
 }
 
-StringCacheEntry* twrpTruetype::gr_ttf_string_cache_peek(TrueTypeFont *font, 
-	const std::string text, 
-	__attribute__((unused)) int max_width) {
-		StringCacheKey k = {
-			.text = text,
-			.max_width = max_width
-		};
-		StringCacheMap::iterator stringCacheItr = font->string_cache.find(k);
-		if (stringCacheItr != font->string_cache.end()) {
-			return stringCacheItr->second;
-		}
-		else {
-			return nullptr;
-		}
+StringCacheEntry* twrpTruetype::gr_ttf_string_cache_peek(TrueTypeFont *font, const char *text, int max_width) {
+	StringCacheMap::iterator stringCacheItr = font->string_cache.find(gr_ttf_string_hash(text, max_width));
+	if (stringCacheItr != font->string_cache.end()) {
+		StringCacheEntry *e = stringCacheItr->second;
+		if (e->max_width == max_width && e->text == text)
+			return e;
+	}
+	return nullptr;
 }
 
 void twrpTruetype::gr_ttf_string_cache_truncate(TrueTypeFont *font) {
 	StringCacheMap::iterator stringCacheItr;
 
-	if (font->string_cache.size() == STRING_CACHE_MAX_ENTRIES) {
-		StringCacheEntry *truncateEntry = nullptr;
-		stringCacheItr = font->string_cache.begin();
-		int deleteCtr = 0;
-		while (stringCacheItr != font->string_cache.end() || deleteCtr == (STRING_CACHE_MAX_ENTRIES - 1)) {
-			truncateEntry = stringCacheItr->second;
-			gr_ttf_freeStringCache(truncateEntry->key, truncateEntry, nullptr);
+	if (font->string_cache.size() < STRING_CACHE_MAX_ENTRIES)
+		return;
+
+	// Drop the least recently used entries
+	std::vector<unsigned long> last_used;
+	last_used.reserve(font->string_cache.size());
+	for (stringCacheItr = font->string_cache.begin(); stringCacheItr != font->string_cache.end(); ++stringCacheItr)
+		last_used.push_back(stringCacheItr->second->last_used);
+	std::nth_element(last_used.begin(), last_used.begin() + STRING_CACHE_TRUNCATE_ENTRIES - 1, last_used.end());
+	unsigned long cutoff = last_used[STRING_CACHE_TRUNCATE_ENTRIES - 1];
+
+	stringCacheItr = font->string_cache.begin();
+	while (stringCacheItr != font->string_cache.end()) {
+		if (stringCacheItr->second->last_used <= cutoff) {
+			delete stringCacheItr->second;
 			stringCacheItr = font->string_cache.erase(stringCacheItr);
-			deleteCtr++;
+		} else {
+			++stringCacheItr;
 		}
 	}
 }
 
-StringCacheEntry* twrpTruetype::gr_ttf_string_cache_get(TrueTypeFont *font, const std::string text, int max_width) {
+StringCacheEntry* twrpTruetype::gr_ttf_string_cache_get(TrueTypeFont *font, const char *text, int max_width) {
 	StringCacheEntry *res = nullptr;
-	StringCacheMap::iterator stringCacheItr;
+	uint32_t hash = gr_ttf_string_hash(text, max_width);
+	StringCacheMap::iterator stringCacheItr = font->string_cache.find(hash);
 
-	StringCacheKey k = {
-		.text = text,
-		.max_width = max_width
-	};
-
-	stringCacheItr = font->string_cache.find(k);
-	if (stringCacheItr == font->string_cache.end()) {
-		res = new StringCacheEntry;
-		res->rendered_bytes = gr_ttf_render_text(font, &res->surface, text, max_width);
-		if(res->rendered_bytes < 0) {
-			delete res;
-			return nullptr;
-		}
-
-		StringCacheKey *new_key = new StringCacheKey;
-		new_key->max_width = max_width;
-		new_key->text = text;
-		res->key = new_key;
-		font->string_cache[*new_key] = res; 
-	}
-	else
-	{
+	if (stringCacheItr != font->string_cache.end()) {
 		res = stringCacheItr->second;
+		if (res->max_width == max_width && res->text == text) {
+			font->string_hits++;
+			res->last_used = ++font->string_clock;
+			return res;
+		}
+		// Hash collision, lay the new string out in this entry
+	} else {
+		gr_ttf_string_cache_truncate(font);
+		res = new StringCacheEntry;
+		font->string_cache[hash] = res;
 	}
+	font->string_misses++;
+
+	res->text = text;
+	res->max_width = max_width;
+	res->last_used = ++font->string_clock;
+	gr_ttf_render_text(font, res, text, max_width);
 	return res;
 }
 
@@ -489,10 +590,9 @@ int twrpTruetype::gr_ttf_measureEx(const char *s, void *font) {
 	int res = -1;
 
 	pthread_mutex_lock(&f->mutex);
-	gr_ttf_string_cache_truncate(f);
 	StringCacheEntry *e = gr_ttf_string_cache_get(f, s, -1);
 	if(e)
-		res = e->surface.width;
+		res = e->width;
 	pthread_mutex_unlock(&f->mutex);
 
 	return res;
@@ -500,7 +600,7 @@ int twrpTruetype::gr_ttf_measureEx(const char *s, void *font) {
 
 int twrpTruetype::gr_ttf_maxExW(const char *s, void *font, int max_width) {
 	TrueTypeFont *f = (TrueTypeFont *)font;
-	TrueTypeCacheEntry *ent;
+	TrueTypeGlyph *ent;
 	int max_bytes = 0, total_w = 0;
 	int utf_bytes, prev_utf_bytes = 0;
 	unsigned int unicode = 0;
@@ -521,7 +621,8 @@ int twrpTruetype::gr_ttf_maxExW(const char *s, void *font, int max_width) {
 		utf_bytes = utf8_to_unicode(s, &unicode);
 		s += utf_bytes;
 
-		char_idx = FT_Get_Char_Index(f->face, unicode);
+		ent = gr_ttf_glyph_cache_get(f, unicode);
+		char_idx = ent ? ent->char_idx : 0;
 		if(FT_HAS_KERNING(f->face) && prev_idx && char_idx)
 		{
 			FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
@@ -535,11 +636,10 @@ int twrpTruetype::gr_ttf_maxExW(const char *s, void *font, int max_width) {
 			break;
 		}
 		prev_utf_bytes = utf_bytes;
-		ent = gr_ttf_glyph_cache_get(f, char_idx);
 		if(!ent)
 			continue;
 
-		total_w += ent->glyph->root.advance.x >> 16;
+		total_w += ent->advance;
 		max_bytes += utf_bytes;
 	}
 	pthread_mutex_unlock(&f->mutex);
@@ -553,6 +653,7 @@ int twrpTruetype::gr_ttf_textExWH(void *context, int x, int y,
 	GGLContext *gl = (GGLContext *)context;
 	TrueTypeFont *font = (TrueTypeFont *)pFont;
 	const GRSurface *gr_draw = (const GRSurface*) gr_draw_surface;
+	std::vector<TrueTypeRunGlyph>::const_iterator glyphItr;
 
 	// not actualy max width, but max_width + x
 	if(max_width != -1)
@@ -570,22 +671,8 @@ int twrpTruetype::gr_ttf_textExWH(void *context, int x, int y,
 		return -1;
 	}
 
-	GGLSurface string_surface_rotated;
-	if (gr_rotation != 0) {
-		// Do not perform relatively expensive operation if not needed
-		string_surface_rotated.version = sizeof(string_surface_rotated);
-		// Skip the **(gr_rotation == 0)** || (gr_rotation == 180) check
-		// because we are under a gr_rotation != 0 conditional compilation statement
-		string_surface_rotated.width   = (gr_rotation == 180) ? e->surface.width  : e->surface.height;
-		string_surface_rotated.height  = (gr_rotation == 180) ? e->surface.height : e->surface.width;
-		string_surface_rotated.stride  = string_surface_rotated.width;
-		string_surface_rotated.format  = e->surface.format;
-		// e->surface.format is GGL_PIXEL_FORMAT_A_8 (grayscale)
-		string_surface_rotated.data    = (GGLubyte*) malloc(string_surface_rotated.stride * string_surface_rotated.height * 1);
-		surface_ROTATION_transform((gr_surface) &string_surface_rotated, (const gr_surface) &e->surface, 1);
-	}
-
-	int y_bottom = y + e->surface.height;
+	int x_right = x + e->width;
+	int y_bottom = y + font->max_height;
 	int res = e->rendered_bytes;
 
 	if(max_height != -1 && max_height < y_bottom)
@@ -598,42 +685,90 @@ int twrpTruetype::gr_ttf_textExWH(void *context, int x, int y,
 		}
 	}
 
-	// Figuring out display coordinates works for gr_rotation == 0 too,
-	// and isn't as expensive as allocating and rotating another surface,
-	// so we do this anyway.
-	int x0_disp, y0_disp, x1_disp, y1_disp;
-	int l_disp, r_disp, t_disp, b_disp;
-
-	x0_disp = ROTATION_X_DISP(x, y, gr_draw->width);
-	y0_disp = ROTATION_Y_DISP(x, y, gr_draw->height);
-	x1_disp = ROTATION_X_DISP(x + e->surface.width, y_bottom, gr_draw->width);
-	y1_disp = ROTATION_Y_DISP(x + e->surface.width, y_bottom, gr_draw->height);
-	l_disp = std::min(x0_disp, x1_disp);
-	r_disp = std::max(x0_disp, x1_disp);
-	t_disp = std::min(y0_disp, y1_disp);
-	b_disp = std::max(y0_disp, y1_disp);
+	// Make sure the whole run is in the atlas. Packing a glyph may flush the
+	// atlas, in which case the glyphs packed before it have to go in again.
+	for (int pass = 0; pass < 2; ++pass) {
+		unsigned int gen = font->atlas.gen;
+		for (glyphItr = e->run.begin(); glyphItr != e->run.end(); ++glyphItr) {
+			if (glyphItr->glyph->atlas_gen != font->atlas.gen)
+				gr_ttf_atlas_add(font, glyphItr->glyph, NULL);
+		}
+		if (gen == font->atlas.gen)
+			break;
+	}
 
-	if (gr_rotation != 0) {
-		gl->bindTexture(gl, &string_surface_rotated);
-	} else {
-		gl->bindTexture(gl, &e->surface);
+	GGLSurface *texture = gr_ttf_atlas_texture(font);
+	if (!texture || !texture->data) {
+		pthread_mutex_unlock(&font->mutex);
+		return res;
 	}
+
+	gl->bindTexture(gl, texture);
 	gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
 	gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
 	gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
-
 	gl->enable(gl, GGL_TEXTURE_2D);
-	gl->texCoord2i(gl, -l_disp, -t_disp);
-	gl->recti(gl, l_disp, t_disp, r_disp, b_disp);
-	gl->disable(gl, GGL_TEXTURE_2D);
 
-	if (gr_rotation != 0)
-		free(string_surface_rotated.data);
+	for (glyphItr = e->run.begin(); glyphItr != e->run.end(); ++glyphItr) {
+		const TrueTypeGlyph *glyph = glyphItr->glyph;
+		if (glyph->width == 0 || glyph->height == 0 || glyph->atlas_gen != font->atlas.gen)
+			continue;
+
+		// Clip to the line box, glyphs may overhang it
+		int dx = x + glyphItr->x + glyph->left;
+		int dy = y + font->base - glyph->top;
+		int sx = glyph->atlas_x;
+		int sy = glyph->atlas_y;
+		int w = glyph->width;
+		int h = glyph->height;
+		if (dx < x) {
+			sx += x - dx;
+			w -= x - dx;
+			dx = x;
+		}
+		if (dy < y) {
+			sy += y - dy;
+			h -= y - dy;
+			dy = y;
+		}
+		w = std::min(w, x_right - dx);
+		h = std::min(h, y_bottom - dy);
+		if (w <= 0 || h <= 0)
+			continue;
+
+		// Both rectangles go through the same rotation, so the texture offset
+		// is the difference of their top left corners in display orientation
+		int x0_disp = ROTATION_X_DISP(dx, dy, gr_draw->width);
+		int y0_disp = ROTATION_Y_DISP(dx, dy, gr_draw->height);
+		int x1_disp = ROTATION_X_DISP(dx + w - 1, dy + h - 1, gr_draw->width);
+		int y1_disp = ROTATION_Y_DISP(dx + w - 1, dy + h - 1, gr_draw->height);
+		int s0_disp = ROTATION_X_DISP(sx, sy, texture->width);
+		int t0_disp = ROTATION_Y_DISP(sx, sy, texture->height);
+		int s1_disp = ROTATION_X_DISP(sx + w - 1, sy + h - 1, texture->width);
+		int t1_disp = ROTATION_Y_DISP(sx + w - 1, sy + h - 1, texture->height);
+		int l_disp = std::min(x0_disp, x1_disp);
+		int t_disp = std::min(y0_disp, y1_disp);
+
+		gl->texCoord2i(gl, std::min(s0_disp, s1_disp) - l_disp, std::min(t0_disp, t1_disp) - t_disp);
+		gl->recti(gl, l_disp, t_disp, std::max(x0_disp, x1_disp) + 1, std::max(y0_disp, y1_disp) + 1);
+	}
+
+	gl->disable(gl, GGL_TEXTURE_2D);
 
-	pthread_mutex_unlock(&font->mutex);;
+	pthread_mutex_unlock(&font->mutex);
 	return res;
 }
 
+void twrpTruetype::gr_ttf_getCacheStats(void *font, TrueTypeCacheStats *stats) {
+	TrueTypeFont *f = (TrueTypeFont *)font;
+
+	stats->glyph_hits = f->glyph_hits.load();
+	stats->glyph_misses = f->glyph_misses.load();
+	stats->string_hits = f->string_hits.load();
+	stats->string_misses = f->string_misses.load();
+	stats->atlas_flushes = f->atlas_flushes.load();
+}
+
 int twrpTruetype::gr_ttf_getMaxFontHeight(void *font) {
 	int res;
 	TrueTypeFont *f = (TrueTypeFont *)font;
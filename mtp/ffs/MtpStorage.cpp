@@ -80,6 +80,7 @@ MtpStorage::~MtpStorage() {
 		// deleting all of the trees and nodes.
 		delete mtpmap[0];
 		mtpmap.clear();
+		handlemap.clear();
 		if (use_mutex) {
 				use_mutex = false;
 				MTPD("~MtpStorage destroying mutexes\n");
@@ -128,20 +129,25 @@ int MtpStorage::renameObject(MtpObjectHandle handle, std::string newName) {
 				MTPE("parent == MTP_PARENT_ROOT, cannot rename root\n");
 				return -1;
 		} else {
-				for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-						Node* node = i->second->findNode(handle);
-						if (node != NULL) {
-				std::string oldName = getNodePath(node);
-								std::string parentdir = oldName.substr(0, oldName.find_last_of('/'));
-								std::string newFullName = parentdir + "/" + newName;
-								MTPD("old: '%s', new: '%s'\n", oldName.c_str(), newFullName.c_str());
-								if (rename(oldName.c_str(), newFullName.c_str()) == 0) {
-										node->rename(newName);
-										return 0;
-								} else {
-										MTPE("MtpStorage::renameObject failed, handle: %u, new name: '%s'\n", handle, newName.c_str());
-										return -1;
-								}
+				Node* node = findNode(handle);
+				if (node != NULL) {
+						std::string oldName = getNodePath(node);
+						std::string parentdir = oldName.substr(0, oldName.find_last_of('/'));
+						std::string newFullName = parentdir + "/" + newName;
+						MTPD("old: '%s', new: '%s'\n", oldName.c_str(), newFullName.c_str());
+						if (rename(oldName.c_str(), newFullName.c_str()) == 0) {
+								iter it = mtpmap.find(node->getMtpParentId());
+								const char* interned = namearena.intern(newName);
+								namearena.release(node->getName());
+								if (it != mtpmap.end())
+										it->second->renameEntry(node, interned);
+								else
+										node->rename(interned);
+								compactNames();
+								return 0;
+						} else {
+								MTPE("MtpStorage::renameObject failed, handle: %u, new name: '%s'\n", handle, newName.c_str());
+								return -1;
 						}
 				}
 		}
@@ -211,28 +217,72 @@ int MtpStorage::createDB() {
 }
 
 Node* MtpStorage::findNode(MtpObjectHandle handle) {
-		for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-				Node* node = i->second->findNode(handle);
-				if (node != NULL) {
-						MTPD("findNode: found node %p for handle %u, name: %s\n", node, handle, node->getName().c_str());
-						if (node->Mtpid() != handle)
-						{
-								MTPE("BUG: entry for handle %u points to node with handle %u\n", handle, node->Mtpid());
-						}
-						return node;
+		std::unordered_map<MtpObjectHandle, Node*>::iterator it = handlemap.find(handle);
+		if (it != handlemap.end()) {
+				Node* node = it->second;
+				MTPD("findNode: found node %p for handle %u, name: %s\n", node, handle, node->getName());
+				if (node->Mtpid() != handle)
+				{
+						MTPE("BUG: entry for handle %u points to node with handle %u\n", handle, node->Mtpid());
 				}
+				return node;
 		}
 		// Item is not on this storage device
-		MTPD("MtpStorage::findNode: no node found for handle %u on storage %u, searched %u trees\n", handle, mStorageID, mtpmap.size());
+		MTPD("MtpStorage::findNode: no node found for handle %u on storage %u\n", handle, mStorageID);
 		return NULL;
 }
 
+void MtpStorage::forgetNode(Node* node) {
+		// Drops node and, for trees, everything below it from the lookup maps.
+		// The nodes themselves are freed by the Tree destructor cascade.
+		MtpObjectHandle handle = node->Mtpid();
+		if (node->isDir()) {
+				Tree* tree = static_cast<Tree*>(node);
+				MtpObjectHandleList children;
+				tree->getmtpids(&children);
+				for (MtpObjectHandleList::iterator it = children.begin(); it != children.end(); ++it) {
+						Node* child = tree->findNode(*it);
+						if (child)
+								forgetNode(child);
+				}
+				for (std::map<int, Tree*>::iterator it = inotifymap.begin(); it != inotifymap.end(); ++it) {
+						if (it->second == tree) {
+								inotify_rm_watch(inotify_fd, it->first);
+								inotifymap.erase(it);
+								break;
+						}
+				}
+				mtpmap.erase(handle);
+		}
+		namearena.release(node->getName());
+		handlemap.erase(handle);
+}
+
+void MtpStorage::compactNames() {
+		// Deleted and renamed nodes leave their old names behind in the arena;
+		// once those dominate, copy the live names over and drop the old blocks.
+		if (!namearena.needsCompaction())
+				return;
+		MTPD("MtpStorage::compactNames for %zu nodes\n", handlemap.size());
+		NameArena fresh;
+		for (std::unordered_map<MtpObjectHandle, Node*>::iterator it = handlemap.begin(); it != handlemap.end(); ++it) {
+				Node* node = it->second;
+				const char* interned = fresh.intern(node->getName());
+				iter parent = mtpmap.find(node->getMtpParentId());
+				if (parent != mtpmap.end())
+						parent->second->renameEntry(node, interned);
+				else
+						node->rename(interned);
+		}
+		namearena = std::move(fresh);
+}
+
 std::string MtpStorage::getNodePath(Node* node) {
 	std::string path;
 		MTPD("getNodePath: node %p, handle %u\n", node, node->Mtpid());
 		while (node)
 		{
-				path = "/" + node->getName() + path;
+				path = std::string("/") + node->getName() + path;
 				MtpObjectHandle parent = node->getMtpParentId();
 				if (parent == 0)		// root
 						break;
@@ -266,7 +316,7 @@ MtpObjectHandleList* MtpStorage::getObjectList(__attribute__((unused)) MtpStorag
 		}
 
 		mtpmap[parent]->getmtpids(list);
-		MTPD("returning %u objects in %s.\n", list->size(), tree->getName().c_str());
+		MTPD("returning %u objects in %s.\n", list->size(), tree->getName());
 		return list;
 }
 
@@ -278,20 +328,21 @@ Node* MtpStorage::addNewNode(bool isDir, Tree* tree, const std::string& name)
 		++mtpid;
 		MTPD("adding new %s node for %s, new handle: %u\n", isDir ? "dir" : "file", name.c_str(), mtpid);
 		MtpObjectHandle parent = tree->Mtpid();
-		MTPD("parent tree: %x, handle: %u, name: %s\n", tree, parent, tree->getName().c_str());
+		MTPD("parent tree: %x, handle: %u, name: %s\n", tree, parent, tree->getName());
 		Node* node;
+		const char* interned = namearena.intern(name);
 		if (isDir)
-				node = mtpmap[mtpid] = new Tree(mtpid, parent, name);
+				node = mtpmap[mtpid] = new Tree(mtpid, parent, interned);
 		else
-				node = new Node(mtpid, parent, name);
+				node = new Node(mtpid, parent, interned);
 		tree->addEntry(node);
+		handlemap[mtpid] = node;
 		return node;
 }
 
 int MtpStorage::readDir(const std::string& path, Tree* tree)
 {
 		struct dirent *de;
-		int storageID = getStorageID();
 		MtpObjectHandle parent = tree->Mtpid();
 
 		DIR *d = opendir(path.c_str());
@@ -316,7 +367,7 @@ int MtpStorage::readDir(const std::string& path, Tree* tree)
 				if (strcmp(de->d_name, "..") == 0)
 						continue;
 				Node* node = addNewNode(st.st_mode & S_IFDIR, tree, de->d_name);
-				node->addProperties(item, storageID);
+				node->addProperties(st);
 				//if (sendEvents)
 				//		mServer->sendObjectAdded(node->Mtpid());
 				//		sending events here makes simple-mtpfs very slow, and it is probably the wrong thing to do anyway
@@ -420,7 +471,7 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 				return;
 		}
 		Tree* tree = it->second;
-		MTPD("inotify_t tree: %x '%s'\n", tree, tree->getName().c_str());
+		MTPD("inotify_t tree: %x '%s'\n", tree, tree->getName());
 		Node* node = tree->findEntryByName(basename(event->name));
 		if (node && node->Mtpid() == handleCurrentlySending) {
 				MTPD("ignoring inotify event for currently uploading file, handle: %u\n", node->Mtpid());
@@ -435,7 +486,7 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 				if (node == NULL) {
 						node = addNewNode(event->mask & IN_ISDIR, tree, event->name);
 						std::string item = getNodePath(tree) + "/" + event->name;
-						node->addProperties(item, getStorageID());
+						node->addProperties(item);
 						mServer->sendObjectAdded(node->Mtpid());
 				} else {
 						MTPD("inotify_t item already exists.\n");
@@ -451,17 +502,6 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 				}
 				if (node)
 				{
-						if (event->mask & IN_ISDIR) {
-								for (std::map<int, Tree*>::iterator it = inotifymap.begin(); it != inotifymap.end(); ++it) {
-										if (it->second == node) {
-												inotify_rm_watch(inotify_fd, it->first);
-												MTPD("inotify_t removing watch on '%s'\n", getNodePath(it->second).c_str());
-												inotifymap.erase(it->first);
-												break;
-										}
-
-								}
-						}
 						MtpObjectHandle handle = node->Mtpid();
 						deleteFile(handle);
 						mServer->sendObjectRemoved(handle);
@@ -471,14 +511,14 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 		} else if (event->mask & IN_MODIFY) {
 				MTPD("inotify_t item %s modified.\n", event->name);
 				if (node != NULL) {
-						uint64_t orig_size = node->getProperty(MTP_PROPERTY_OBJECT_SIZE).valueInt;
+						uint64_t orig_size = node->getSize();
 						struct stat st;
 						uint64_t new_size = 0;
 						if (lstat(getNodePath(node).c_str(), &st) == 0)
 								new_size = (uint64_t)st.st_size;
 						if (orig_size != new_size) {
 								MTPD("size changed from %llu to %llu on mtpid: %u\n", orig_size, new_size, node->Mtpid());
-								node->updateProperty(MTP_PROPERTY_OBJECT_SIZE, new_size, "", MTP_TYPE_UINT64);
+								node->setSize(new_size);
 								mServer->sendObjectUpdated(node->Mtpid());
 						}
 				} else {
@@ -519,22 +559,19 @@ void MtpStorage::unlockMutex( __attribute__((unused)) int thread_type) {
 }
 
 int MtpStorage::getObjectPropertyValue(MtpObjectHandle handle, MtpObjectProperty property, MtpStorage::PropEntry& pe) {
-		Node *node;
-		for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-				node = i->second->findNode(handle);
-				if (node != NULL) {
-						const Node::mtpProperty& prop = node->getProperty(property);
-						if (prop.property != property) {
-								MTPD("getObjectPropertyValue: unknown property %x for handle %u\n", property, handle);
-								return -1;
-						}
-						pe.datatype = prop.dataType;
-						pe.intvalue = prop.valueInt;
-						pe.strvalue = prop.valueStr;
-						pe.handle = handle;
-						pe.property = property;
-						return 0;
+		Node* node = findNode(handle);
+		if (node != NULL) {
+				Node::mtpProperty prop;
+				if (!node->getProperty(property, mStorageID, prop)) {
+						MTPD("getObjectPropertyValue: unknown property %x for handle %u\n", property, handle);
+						return -1;
 				}
+				pe.datatype = prop.dataType;
+				pe.intvalue = prop.valueInt;
+				pe.strvalue = prop.valueStr;
+				pe.handle = handle;
+				pe.property = property;
+				return 0;
 		}
 		// handle not found on this storage
 		return -1;
@@ -546,7 +583,7 @@ void MtpStorage::endSendObject(const char* path, MtpObjectHandle handle, __attri
 		if (!node)
 				return; // just ignore if this is for another storage
 
-		node->addProperties(path, mStorageID);
+		node->addProperties(path);
 		handleCurrentlySending = 0;
 		// TODO: are we supposed to send an event about an upload by the initiator?
 		if (sendEvents)
@@ -686,7 +723,7 @@ int MtpStorage::getObjectInfo(MtpObjectHandle handle, MtpObjectInfo& info) {
 		else {
 				info.mFormat = MTP_FORMAT_UNDEFINED;
 		}
-		info.mName = strdup(node->getName().c_str());
+		info.mName = strdup(node->getName());
 		MTPD("MtpStorage::getObjectInfo found, Exiting getObjectInfo()\n");
 		return 0;
 }
@@ -724,14 +761,14 @@ int MtpStorage::deleteFile(MtpObjectHandle handle) {
 				MTPE("parent tree for handle %u not found\n", parent);
 				return -1;
 		}
-		if (node->isDir()) {
+		if (node->isDir())
 				MTPD("deleting tree from mtpmap: %u\n", handle);
-				mtpmap.erase(handle);
-		}
+		forgetNode(node);
 
 		MTPD("deleting handle: %u\n", handle);
 		tree->deleteNode(handle);
 		MTPD("deleted\n");
+		compactNames();
 		return 0;
 }
 
@@ -746,12 +783,14 @@ void MtpStorage::queryNodeProperties(std::vector<MtpStorage::PropEntry>& results
 		{
 				// add all properties
 				MTPD("MtpStorage::queryNodeProperties for all properties\n");
-				std::vector<Node::mtpProperty> mtpprop = node->getMtpProps();
-				for (size_t i = 0; i < mtpprop.size(); ++i) {
-						pe.property = mtpprop[i].property;
-						pe.datatype = mtpprop[i].dataType;
-						pe.intvalue = mtpprop[i].valueInt;
-						pe.strvalue = mtpprop[i].valueStr;
+				Node::mtpProperty prop;
+				for (size_t i = 0; i < Node::supportedPropertyCount; ++i) {
+						if (!node->getProperty(Node::supportedProperties[i], storageID, prop))
+								continue;
+						pe.property = prop.property;
+						pe.datatype = prop.dataType;
+						pe.intvalue = prop.valueInt;
+						pe.strvalue = prop.valueStr;
 						results.push_back(pe);
 				}
 				return;
@@ -791,8 +830,8 @@ void MtpStorage::queryNodeProperties(std::vector<MtpStorage::PropEntry>& results
 
 				default:
 				{
-						const Node::mtpProperty& prop = node->getProperty(property);
-						if (prop.property != property)
+						Node::mtpProperty prop;
+						if (!node->getProperty(property, storageID, prop))
 						{
 								MTPD("queryNodeProperties: unknown property %x\n", property);
 								return;
@@ -48,6 +48,8 @@ private:
 	typedef					std::map<int, Tree*> maptree;
 	typedef					maptree::iterator iter;
 	maptree					mtpmap;
+	std::unordered_map<MtpObjectHandle, Node*> handlemap;	// every node on this storage, by handle
+	NameArena				namearena;		   // backing store for all node names
 	std::string				mtpstorageparent;
 	MtpObjectHandle			handleCurrentlySending;
 	int						inotify_fd;
@@ -64,6 +66,8 @@ private:
 	Node*					findNode(MtpObjectHandle handle);
 	std::string				getNodePath(Node* node);
 	Node*					addNewNode(bool isDir, Tree* tree, const std::string& name);
+	void					forgetNode(Node* node);
+	void					compactNames();
 	void					queryNodeProperties(std::vector<PropEntry>& results, Node* node, uint32_t property, int groupCode, MtpStorageID storageID);
 	int						addInotify(Tree* tree);
 	void					handleInotifyEvent(struct inotify_event* event);
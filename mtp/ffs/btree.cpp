@@ -18,7 +18,7 @@
 #include "btree.hpp"
 #include "MtpDebug.h"
 
-Tree::Tree(MtpObjectHandle handle, MtpObjectHandle parent, const std::string& name)
+Tree::Tree(MtpObjectHandle handle, MtpObjectHandle parent, const char* name)
 	: Node(handle, parent, name), alreadyRead(false) {
 }
 
@@ -26,6 +26,7 @@ Tree::~Tree() {
 	for (std::map<MtpObjectHandle, Node*>::iterator it = entries.begin(); it != entries.end(); ++it)
 		delete it->second;
 	entries.clear();
+	names.clear();
 }
 
 int Tree::getCount(void) {
@@ -44,15 +45,13 @@ void Tree::addEntry(Node* node) {
 		return;
 	}
 	entries[node->Mtpid()] = node;
+	names[node->getName()] = node;
 }
 
 Node* Tree::findEntryByName(std::string name) {
-	for (std::map<MtpObjectHandle, Node*>::iterator it = entries.begin(); it != entries.end(); ++it)
-	{
-		Node* node = it->second;
-		if (node->getName().compare(name) == 0 && node->Mtpid() > 0)
-			return node;
-	}
+	std::unordered_map<std::string_view, Node*>::iterator it = names.find(name);
+	if (it != names.end() && it->second->Mtpid() > 0)
+		return it->second;
 	return NULL;
 }
 
@@ -71,7 +70,18 @@ void Tree::getmtpids(MtpObjectHandleList* mtpids) {
 void Tree::deleteNode(MtpObjectHandle handle) {
 	std::map<MtpObjectHandle, Node*>::iterator it = entries.find(handle);
 	if (it != entries.end()) {
+		std::unordered_map<std::string_view, Node*>::iterator nameit = names.find(it->second->getName());
+		if (nameit != names.end() && nameit->second == it->second)
+			names.erase(nameit);
 		delete it->second;
 		entries.erase(it);
 	}
 }
+
+void Tree::renameEntry(Node* node, const char* newName) {
+	std::unordered_map<std::string_view, Node*>::iterator it = names.find(node->getName());
+	if (it != names.end() && it->second == node)
+		names.erase(it);
+	node->rename(newName);
+	names[newName] = node;
+}
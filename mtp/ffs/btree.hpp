@@ -19,31 +19,55 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <sys/stat.h>
 #include "MtpTypes.h"
 
+// Append-only storage for node names. Names are not freed individually;
+// released names are only counted, and the owning storage moves the live
+// names into a fresh arena once most of the space is dead.
+class NameArena {
+	std::vector<std::unique_ptr<char[]>> blocks;
+	size_t used;
+	size_t capacity;
+	size_t live;
+	size_t dead;
+
+public:
+	NameArena() : used(0), capacity(0), live(0), dead(0) {}
+	const char* intern(const std::string& name);
+	void release(const char* name);
+	bool needsCompaction() const;
+};
+
 // A directory entry
 class Node {
 	MtpObjectHandle handle;
 	MtpObjectHandle parent;
-	std::string name;	// name only without path
+	const char* name;	// name only without path, interned in the storage's NameArena
+	uint64_t size;
+	time_t mtime;
+	uint16_t format;
 
 public:
 	Node();
-	Node(MtpObjectHandle handle, MtpObjectHandle parent, const std::string& name);
+	Node(MtpObjectHandle handle, MtpObjectHandle parent, const char* name);
 	virtual ~Node() {}
 
 	virtual bool isDir() const { return false; }
 
-	void rename(const std::string& newName);
+	void rename(const char* newName);
 	MtpObjectHandle Mtpid() const;
 	MtpObjectHandle getMtpParentId() const;
-	const std::string& getName() const;
+	const char* getName() const;
 
-	void addProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType);
-	void updateProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType);
-	void addProperties(const std::string& path, int storageID);
-	uint64_t getIntProperty(MtpPropertyCode property);
+	void addProperties(const std::string& path);
+	void addProperties(const struct stat& st);
+	uint64_t getSize() const { return size; }
+	void setSize(uint64_t newSize) { size = newSize; }
 	struct mtpProperty {
 		MtpPropertyCode property;
 		MtpDataType dataType;
@@ -51,17 +75,19 @@ public:
 		std::string valueStr;
 		mtpProperty() : property(0), dataType(0), valueInt(0) {}
 	};
-	std::vector<mtpProperty>& getMtpProps();
-	std::vector<mtpProperty> mtpProp;
-	const mtpProperty& getProperty(MtpPropertyCode property);
+	// Property values are derived on demand from the cached stat fields above
+	static const MtpPropertyCode supportedProperties[];
+	static const size_t supportedPropertyCount;
+	bool getProperty(MtpPropertyCode property, MtpStorageID storageID, mtpProperty& prop) const;
 };
 
 // A directory
 class Tree : public Node {
 	std::map<MtpObjectHandle, Node*> entries;
+	std::unordered_map<std::string_view, Node*> names;	// name -> entry, kept in sync with entries
 	bool alreadyRead;
 public:
-	Tree(MtpObjectHandle handle, MtpObjectHandle parent, const std::string& name);
+	Tree(MtpObjectHandle handle, MtpObjectHandle parent, const char* name);
 	~Tree();
 
 	virtual bool isDir() const { return true; }
@@ -70,6 +96,7 @@ public:
 	Node* findNode(MtpObjectHandle handle);
 	void getmtpids(MtpObjectHandleList* mtpids);
 	void deleteNode(MtpObjectHandle handle);
+	void renameEntry(Node* node, const char* newName);
 	std::string getPath(Node* node);
 	int getMtpParentId() { return Node::getMtpParentId(); }
 	int getMtpParentId(Node* node);
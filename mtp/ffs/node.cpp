@@ -31,116 +31,160 @@
 #include "MtpDebug.h"
 
 
+const char* NameArena::intern(const std::string& name) {
+	static const size_t blockSize = 64 * 1024;
+	size_t len = name.size() + 1;
+	if (used + len > capacity) {
+		size_t alloc = len > blockSize ? len : blockSize;
+		blocks.emplace_back(new char[alloc]);
+		used = 0;
+		capacity = alloc;
+	}
+	char* dst = blocks.back().get() + used;
+	memcpy(dst, name.c_str(), len);
+	used += len;
+	live += len;
+	return dst;
+}
+
+void NameArena::release(const char* name) {
+	size_t len = strlen(name) + 1;
+	live -= len;
+	dead += len;
+}
+
+bool NameArena::needsCompaction() const {
+	static const size_t minDead = 256 * 1024;
+	return dead >= minDead && dead > live;
+}
+
 Node::Node()
-	: handle(-1), parent(0), name("")
+	: handle(-1), parent(0), name(""), size(0), mtime(0), format(MTP_FORMAT_UNDEFINED)
 {
 }
 
-Node::Node(MtpObjectHandle handle, MtpObjectHandle parent, const std::string& name)
-	: handle(handle), parent(parent), name(name)
+Node::Node(MtpObjectHandle handle, MtpObjectHandle parent, const char* name)
+	: handle(handle), parent(parent), name(name), size(0), mtime(0), format(MTP_FORMAT_UNDEFINED)
 {
 				MTPD("handle: %d\n", handle);
 				MTPD("parent: %d\n", parent);
-				MTPD("name: %s\n", name.c_str());
+				MTPD("name: %s\n", name);
 }
 
-void Node::rename(const std::string& newName) {
+void Node::rename(const char* newName) {
 	name = newName;
-	updateProperty(MTP_PROPERTY_OBJECT_FILE_NAME, 0, name.c_str(), MTP_TYPE_STR);
-	updateProperty(MTP_PROPERTY_NAME, 0, name.c_str(), MTP_TYPE_STR);
-	updateProperty(MTP_PROPERTY_DISPLAY_NAME, 0, name.c_str(), MTP_TYPE_STR);
 }
 
 MtpObjectHandle Node::Mtpid() const { return handle; }
 MtpObjectHandle Node::getMtpParentId() const { return parent; }
-const std::string& Node::getName() const { return name; }
-
-uint64_t Node::getIntProperty(MtpPropertyCode property) {
-	for (unsigned index = 0; index < mtpProp.size(); ++index) {
-		if (mtpProp[index].property == property)
-			return mtpProp[index].valueInt;
-	}
-	MTPE("Node::getIntProperty failed to find property %x, returning -1\n", (unsigned)property);
-	return -1;
-}
-
-const Node::mtpProperty& Node::getProperty(MtpPropertyCode property) {
-	static const mtpProperty dummyProp;
-	for (size_t i = 0; i < mtpProp.size(); ++i) {
-		if (mtpProp[i].property == property)
-			return mtpProp[i];
-	}
-	MTPE("Node::getProperty failed to find property %x, returning dummy property\n", (unsigned)property);
-	return dummyProp;
-}
-
-void Node::addProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType) {
-//	MTPD("adding property: %lld, valueInt: %lld, valueStr: %s, dataType: %d\n", property, valueInt, valueStr.c_str(), dataType);
-	struct mtpProperty prop;
-	prop.property = property;
-	prop.valueInt = valueInt;
-	prop.valueStr = valueStr;
-	prop.dataType = dataType;
-	mtpProp.push_back(prop);
-}
+const char* Node::getName() const { return name; }
 
-void Node::updateProperty(MtpPropertyCode property, uint64_t valueInt, std::string valueStr, MtpDataType dataType) {
-	for (unsigned i = 0; i < mtpProp.size(); i++) {
-		if (mtpProp[i].property == property) {
-			mtpProp[i].valueInt = valueInt;
-			mtpProp[i].valueStr = valueStr;
-			mtpProp[i].dataType = dataType;
-			return;
-		}
+void Node::addProperties(const std::string& path) {
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0) {
+		addProperties(st);
+	} else {
+		size = 0;
+		mtime = 0;
+		format = MTP_FORMAT_UNDEFINED;
 	}
-	addProperty(property, valueInt, valueStr, dataType);
 }
 
-std::vector<Node::mtpProperty>& Node::getMtpProps() {
-	return mtpProp;
+void Node::addProperties(const struct stat& st) {
+	MTPD("addProperties: handle: %u, filename: '%s'\n", handle, name);
+	size = st.st_size;
+	mtime = st.st_mtime;
+	format = S_ISDIR(st.st_mode) ? MTP_FORMAT_ASSOCIATION : MTP_FORMAT_UNDEFINED;
 }
 
-void Node::addProperties(const std::string& path, int storageID) {
-	MTPD("addProperties: handle: %u, filename: '%s'\n", handle, getName().c_str());
-	struct stat st;
-	int mFormat = 0;
-	uint64_t puid = ((uint64_t)storageID << 32) + handle;
-	off_t file_size = 0;
+const MtpPropertyCode Node::supportedProperties[] = {
+	MTP_PROPERTY_STORAGE_ID,
+	MTP_PROPERTY_OBJECT_FORMAT,
+	MTP_PROPERTY_PROTECTION_STATUS,
+	MTP_PROPERTY_OBJECT_SIZE,
+	MTP_PROPERTY_OBJECT_FILE_NAME,
+	MTP_PROPERTY_DATE_MODIFIED,
+	MTP_PROPERTY_PARENT_OBJECT,
+	MTP_PROPERTY_PERSISTENT_UID,
+	MTP_PROPERTY_NAME,
+	MTP_PROPERTY_DISPLAY_NAME,
+	MTP_PROPERTY_DATE_ADDED,
+	MTP_PROPERTY_DESCRIPTION,
+	MTP_PROPERTY_ARTIST,
+	MTP_PROPERTY_ALBUM_NAME,
+	MTP_PROPERTY_ALBUM_ARTIST,
+	MTP_PROPERTY_TRACK,
+	MTP_PROPERTY_ORIGINAL_RELEASE_DATE,
+	MTP_PROPERTY_DURATION,
+	MTP_PROPERTY_GENRE,
+	MTP_PROPERTY_COMPOSER,
+};
+const size_t Node::supportedPropertyCount = sizeof(Node::supportedProperties) / sizeof(Node::supportedProperties[0]);
 
-	mFormat = MTP_FORMAT_UNDEFINED;   // file
-	if (lstat(path.c_str(), &st) == 0) {
-		file_size = st.st_size;
-		if (S_ISDIR(st.st_mode))
-			mFormat = MTP_FORMAT_ASSOCIATION; // folder
+bool Node::getProperty(MtpPropertyCode property, MtpStorageID storageID, mtpProperty& prop) const {
+	prop.property = property;
+	prop.valueInt = 0;
+	prop.valueStr.clear();
+	switch (property) {
+		case MTP_PROPERTY_STORAGE_ID:
+			prop.dataType = MTP_TYPE_UINT32;
+			prop.valueInt = storageID;
+			break;
+		case MTP_PROPERTY_OBJECT_FORMAT:
+			prop.dataType = MTP_TYPE_UINT16;
+			prop.valueInt = format;
+			break;
+		case MTP_PROPERTY_PROTECTION_STATUS:
+		case MTP_PROPERTY_TRACK:
+			prop.dataType = MTP_TYPE_UINT16;
+			break;
+		case MTP_PROPERTY_OBJECT_SIZE:
+			prop.dataType = MTP_TYPE_UINT64;
+			prop.valueInt = size;
+			break;
+		case MTP_PROPERTY_OBJECT_FILE_NAME:
+		case MTP_PROPERTY_NAME:
+		case MTP_PROPERTY_DISPLAY_NAME:
+			prop.dataType = MTP_TYPE_STR;
+			prop.valueStr = name;
+			break;
+		case MTP_PROPERTY_DATE_MODIFIED:
+		case MTP_PROPERTY_DATE_ADDED:
+			prop.dataType = MTP_TYPE_UINT64;
+			prop.valueInt = mtime;
+			break;
+		case MTP_PROPERTY_PARENT_OBJECT:
+			prop.dataType = MTP_TYPE_UINT32;
+			prop.valueInt = parent;
+			break;
+		case MTP_PROPERTY_PERSISTENT_UID:
+			// TODO: we can't really support persistent UIDs without a persistent DB.
+			// probably a combination of volume UUID + st_ino would come close.
+			// doesn't help for fs with no native inodes numbers like fat though...
+			// however, Microsoft's own impl (Zune, etc.) does not support persistent UIDs either
+			prop.dataType = MTP_TYPE_UINT128;
+			prop.valueInt = ((uint64_t)storageID << 32) + handle;
+			break;
+		case MTP_PROPERTY_DESCRIPTION:
+		case MTP_PROPERTY_ARTIST:
+		case MTP_PROPERTY_ALBUM_NAME:
+		case MTP_PROPERTY_ALBUM_ARTIST:
+		case MTP_PROPERTY_GENRE:
+		case MTP_PROPERTY_COMPOSER:
+			prop.dataType = MTP_TYPE_STR;
+			break;
+		case MTP_PROPERTY_ORIGINAL_RELEASE_DATE:
+			prop.dataType = MTP_TYPE_UINT64;
+			prop.valueInt = 2014;	// TODO: extract year from mtime?
+			break;
+		case MTP_PROPERTY_DURATION:
+			prop.dataType = MTP_TYPE_UINT32;
+			break;
+		default:
+			MTPE("Node::getProperty failed to find property %x\n", (unsigned)property);
+			prop.property = 0;
+			prop.dataType = 0;
+			return false;
 	}
-
-	// TODO: don't store properties with constant values at all, add them at query time instead
-	addProperty(MTP_PROPERTY_STORAGE_ID, storageID, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_OBJECT_FORMAT, mFormat, "", MTP_TYPE_UINT16);
-	addProperty(MTP_PROPERTY_PROTECTION_STATUS, 0, "", MTP_TYPE_UINT16);
-	addProperty(MTP_PROPERTY_OBJECT_SIZE, file_size, "", MTP_TYPE_UINT64);
-	addProperty(MTP_PROPERTY_OBJECT_FILE_NAME, 0, getName().c_str(), MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DATE_MODIFIED, st.st_mtime, "", MTP_TYPE_UINT64);
-	addProperty(MTP_PROPERTY_PARENT_OBJECT, parent, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_PERSISTENT_UID, puid, "", MTP_TYPE_UINT128);
-		// TODO: we can't really support persistent UIDs without a persistent DB.
-		// probably a combination of volume UUID + st_ino would come close.
-		// doesn't help for fs with no native inodes numbers like fat though...
-		// however, Microsoft's own impl (Zune, etc.) does not support persistent UIDs either
-	addProperty(MTP_PROPERTY_NAME, 0, getName().c_str(), MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DISPLAY_NAME, 0, getName().c_str(), MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DATE_ADDED, st.st_mtime, "", MTP_TYPE_UINT64);
-	addProperty(MTP_PROPERTY_DESCRIPTION, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ARTIST, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ALBUM_NAME, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ALBUM_ARTIST, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_TRACK, 0, "", MTP_TYPE_UINT16);
-	addProperty(MTP_PROPERTY_ORIGINAL_RELEASE_DATE, 2014, "", MTP_TYPE_UINT64);	// TODO: extract year from st.st_mtime?
-	addProperty(MTP_PROPERTY_DURATION, 0, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_GENRE, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_COMPOSER, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ARTIST, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_ALBUM_NAME, 0, "", MTP_TYPE_STR);
-	addProperty(MTP_PROPERTY_DURATION, 0, "", MTP_TYPE_UINT32);
-	addProperty(MTP_PROPERTY_DESCRIPTION, 0, "", MTP_TYPE_STR);
+	return true;
 }
@@ -103,6 +103,14 @@ int OpenRecoveryScript::copy_script_file(string filename) {
 	return 0;
 }
 
+// Tells ORS event clients that a script command finished and how long it took
+static void Send_Command_Done(const char* command, int ret_val, timespec& start) {
+	timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	ProgressEvent("command").Add("command", command).Add("state", "done").Add("result", (long long)ret_val)
+		.Add("elapsed_ms", (long long)TWFunc::timespec_diff_ms(start, stop)).Send();
+}
+
 int OpenRecoveryScript::run_script_file(void) {
 	int ret_val = 0, cindex, line_len, i, remove_nl, install_cmd = 0, sideload = 0, tmp_tmp = 0;
 	char script_line[SCRIPT_COMMAND_SIZE], command[SCRIPT_COMMAND_SIZE],
@@ -149,6 +157,9 @@ int OpenRecoveryScript::run_script_file(void) {
 				strncpy(command, script_line, line_len - remove_nl + 1);
 				gui_print("command is: '%s' and there is no value\n", command);
 			}
+			timespec command_start;
+			clock_gettime(CLOCK_MONOTONIC, &command_start);
+			ProgressEvent("command").Add("command", command).Add("state", "start").Send();
 			if (strcmp(command, "install") == 0) {
 				// Install Zip
 				DataManager::SetValue("tw_action_text2", "Installing Zip");
@@ -202,6 +213,7 @@ int OpenRecoveryScript::run_script_file(void) {
 					gui_msg(Msg("backup_folder_set=Backup folder set to '{1}'")(value2));
 					if (PartitionManager.Check_Backup_Name(value2, true, true) != 0) {
 						ret_val = 1;
+						Send_Command_Done(command, ret_val, command_start);
 						continue;
 					}
 				} else {
@@ -258,6 +270,7 @@ int OpenRecoveryScript::run_script_file(void) {
 				if (!TWFunc::Path_Exists(folder_path)) {
 					gui_msg(Msg(msg::kError, "locate_backup_err=Unable to locate backup '{1}'")(folder_path));
 					ret_val = 1;
+					Send_Command_Done(command, ret_val, command_start);
 					continue;
 				}
 				DataManager::SetValue("tw_restore", folder_path);
@@ -475,6 +488,7 @@ int OpenRecoveryScript::run_script_file(void) {
 				LOGERR("Unrecognized script command: '%s'\n", command);
 				ret_val = 1;
 			}
+			Send_Command_Done(command, ret_val, command_start);
 		}
 		fclose(fp);
 		unlink(SCRIPT_FILE_TMP);
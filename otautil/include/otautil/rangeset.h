@@ -43,17 +43,18 @@ class RangeSet {
 
   std::string ToString() const;
 
-  // Gets the block number for the i-th (starting from 0) block in the RangeSet.
+  // Gets the block number for the i-th (starting from 0) block in the RangeSet. Runs in O(log n).
   size_t GetBlockNumber(size_t idx) const;
 
   // Returns whether the current RangeSet overlaps with other. RangeSet has half-closed half-open
   // bounds. For example, "3,5" contains blocks 3 and 4. So "3,5" and "5,7" are not overlapped.
+  // Large sets are compared with a sort and a single sweep rather than pair by pair.
   bool Overlaps(const RangeSet& other) const;
 
   // Returns a subset of ranges starting from |start_index| with respect to the original range. The
   // output range will have |num_of_blocks| blocks in size. Returns std::nullopt if the input is
   // invalid. e.g. RangeSet({{0, 5}, {10, 15}}).GetSubRanges(1, 5) returns
-  // RangeSet({{1, 5}, {10, 11}}).
+  // RangeSet({{1, 5}, {10, 11}}). The first range is found by a binary search.
   std::optional<RangeSet> GetSubRanges(size_t start_index, size_t num_of_blocks) const;
 
   // Returns a vector of RangeSets that contain the same set of blocks represented by the current
@@ -126,8 +127,16 @@ class RangeSet {
   }
 
  protected:
+  // Recomputes offsets_ after ranges_ has been changed in place.
+  void RebuildIndex();
+
+  // Returns the index of the range that holds the idx-th block. idx must be less than blocks_.
+  size_t FindRange(size_t idx) const;
+
   // Actual limit for each value and the total number are both INT_MAX.
   std::vector<Range> ranges_;
+  // offsets_[i] is the number of blocks in the ranges before ranges_[i].
+  std::vector<size_t> offsets_;
   size_t blocks_;
 };
 
@@ -94,15 +94,32 @@ bool RangeSet::PushBack(Range range) {
   }
 
   ranges_.push_back(std::move(range));
+  offsets_.push_back(blocks_);
   blocks_ += sz;
   return true;
 }
 
 void RangeSet::Clear() {
   ranges_.clear();
+  offsets_.clear();
   blocks_ = 0;
 }
 
+void RangeSet::RebuildIndex() {
+  offsets_.resize(ranges_.size());
+  blocks_ = 0;
+  for (size_t i = 0; i < ranges_.size(); i++) {
+    offsets_[i] = blocks_;
+    blocks_ += ranges_[i].second - ranges_[i].first;
+  }
+}
+
+size_t RangeSet::FindRange(size_t idx) const {
+  // The last range that starts at or before idx.
+  auto it = std::upper_bound(offsets_.cbegin(), offsets_.cend(), idx);
+  return (it - offsets_.cbegin()) - 1;
+}
+
 std::vector<RangeSet> RangeSet::Split(size_t groups) const {
   if (ranges_.empty() || groups == 0) return {};
 
@@ -159,27 +176,43 @@ std::string RangeSet::ToString() const {
 size_t RangeSet::GetBlockNumber(size_t idx) const {
   CHECK_LT(idx, blocks_) << "Out of bound index " << idx << " (total blocks: " << blocks_ << ")";
 
-  for (const auto& [begin, end] : ranges_) {
-    if (idx < end - begin) {
-      return begin + idx;
-    }
-    idx -= (end - begin);
-  }
-
-  CHECK(false) << "Failed to find block number for index " << idx;
-  return 0;  // Unreachable, but to make compiler happy.
+  size_t i = FindRange(idx);
+  return ranges_[i].first + (idx - offsets_[i]);
 }
 
 // RangeSet has half-closed half-open bounds. For example, "3,5" contains blocks 3 and 4. So "3,5"
 // and "5,7" are not overlapped.
 bool RangeSet::Overlaps(const RangeSet& other) const {
-  for (const auto& [begin, end] : ranges_) {
-    for (const auto& [other_begin, other_end] : other.ranges_) {
-      // [begin, end) vs [other_begin, other_end)
-      if (!(other_begin >= end || begin >= other_end)) {
-        return true;
+  // Pairwise checks are cheapest for the small sets that most block commands use.
+  static constexpr size_t kPairwiseLimit = 64;
+  if (ranges_.size() * other.ranges_.size() <= kPairwiseLimit) {
+    for (const auto& [begin, end] : ranges_) {
+      for (const auto& [other_begin, other_end] : other.ranges_) {
+        // [begin, end) vs [other_begin, other_end)
+        if (!(other_begin >= end || begin >= other_end)) {
+          return true;
+        }
       }
     }
+    return false;
+  }
+
+  // Sweep both sets in order of their start blocks; a range can be skipped once it ends before the
+  // current range of the other set begins, as no later range there starts any earlier.
+  std::vector<Range> sorted = ranges_;
+  std::vector<Range> other_sorted = other.ranges_;
+  std::sort(sorted.begin(), sorted.end());
+  std::sort(other_sorted.begin(), other_sorted.end());
+  auto it = sorted.cbegin();
+  auto other_it = other_sorted.cbegin();
+  while (it != sorted.cend() && other_it != other_sorted.cend()) {
+    if (it->second <= other_it->first) {
+      it++;
+    } else if (other_it->second <= it->first) {
+      other_it++;
+    } else {
+      return true;
+    }
   }
   return false;
 }
@@ -199,15 +232,13 @@ std::optional<RangeSet> RangeSet::GetSubRanges(size_t start_index, size_t num_of
   }
 
   RangeSet result;
-  size_t current_index = 0;
-  for (const auto& [range_start, range_end] : ranges_) {
+  // Skip straight to the range that holds start_index.
+  size_t first = FindRange(start_index);
+  size_t current_index = offsets_[first];
+  for (auto it = ranges_.cbegin() + first; it != ranges_.cend(); it++) {
+    const auto& [range_start, range_end] = *it;
     CHECK_LT(range_start, range_end);
     size_t blocks_in_range = range_end - range_start;
-    // Linear search to skip the ranges until we reach start_block.
-    if (current_index + blocks_in_range <= start_index) {
-      current_index += blocks_in_range;
-      continue;
-    }
 
     size_t trimmed_range_start = range_start;
     // We have found the first block range to read, trim the heading blocks.
@@ -239,11 +270,38 @@ std::optional<RangeSet> RangeSet::GetSubRanges(size_t start_index, size_t num_of
 // Ranges in the the set should be mutually exclusive; and they're sorted by the start block.
 SortedRangeSet::SortedRangeSet(std::vector<Range>&& pairs) : RangeSet(std::move(pairs)) {
   std::sort(ranges_.begin(), ranges_.end());
+  RebuildIndex();
 }
 
+// Insert a single range; the ranges it overlaps or touches are found by binary search and merged
+// into it in place.
 void SortedRangeSet::Insert(const Range& to_insert) {
-  SortedRangeSet rs({ to_insert });
-  Insert(rs);
+  if (to_insert.first >= to_insert.second) {
+    LOG(ERROR) << "Empty or negative range: " << to_insert.first << ", " << to_insert.second;
+    return;
+  }
+  // The first range that ends at or after the start of to_insert, and the first range that starts
+  // after its end; everything in between is merged.
+  auto lo = std::lower_bound(ranges_.begin(), ranges_.end(), to_insert.first,
+                             [](const Range& r, size_t block) { return r.second < block; });
+  auto hi = std::upper_bound(lo, ranges_.end(), to_insert.second,
+                             [](size_t block, const Range& r) { return block < r.first; });
+  Range merged = to_insert;
+  if (lo != hi) {
+    merged.first = std::min(merged.first, lo->first);
+    merged.second = std::max(merged.second, (hi - 1)->second);
+  }
+  size_t first = lo - ranges_.begin();
+  lo = ranges_.erase(lo, hi);
+  ranges_.insert(lo, merged);
+
+  // Only the offsets from the merged range on change.
+  offsets_.resize(ranges_.size());
+  blocks_ = first == 0 ? 0 : offsets_[first - 1] + (ranges_[first - 1].second - ranges_[first - 1].first);
+  for (size_t i = first; i < ranges_.size(); i++) {
+    offsets_[i] = blocks_;
+    blocks_ += ranges_[i].second - ranges_[i].first;
+  }
 }
 
 // Insert the input SortedRangeSet; keep the ranges sorted and merge the overlap ranges.
@@ -251,12 +309,12 @@ void SortedRangeSet::Insert(const SortedRangeSet& rs) {
   if (rs.size() == 0) {
     return;
   }
-  // Merge and sort the two RangeSets.
-  std::vector<Range> temp = std::move(ranges_);
-  std::copy(rs.begin(), rs.end(), std::back_inserter(temp));
-  std::sort(temp.begin(), temp.end());
+  // Both sets are already sorted, so a single merge pass keeps the result sorted.
+  std::vector<Range> temp;
+  temp.reserve(ranges_.size() + rs.size());
+  std::merge(ranges_.cbegin(), ranges_.cend(), rs.cbegin(), rs.cend(), std::back_inserter(temp));
 
-  Clear();
+  ranges_.clear();
   // Trim overlaps and insert the result back to ranges_.
   Range to_insert = temp.front();
   for (auto it = temp.cbegin() + 1; it != temp.cend(); it++) {
@@ -264,12 +322,11 @@ void SortedRangeSet::Insert(const SortedRangeSet& rs) {
       to_insert.second = std::max(to_insert.second, it->second);
     } else {
       ranges_.push_back(to_insert);
-      blocks_ += (to_insert.second - to_insert.first);
       to_insert = *it;
     }
   }
   ranges_.push_back(to_insert);
-  blocks_ += (to_insert.second - to_insert.first);
+  RebuildIndex();
 }
 
 // Compute the block range the file occupies, and insert that range.
@@ -279,8 +336,12 @@ void SortedRangeSet::Insert(size_t start, size_t len) {
 }
 
 bool SortedRangeSet::Overlaps(size_t start, size_t len) const {
-  RangeSet rs({ { start / kBlockSize, (start + len - 1) / kBlockSize + 1 } });
-  return Overlaps(rs);
+  size_t begin = start / kBlockSize;
+  size_t end = (start + len - 1) / kBlockSize + 1;
+  // Only the first range that ends after begin can overlap.
+  auto it = std::upper_bound(ranges_.cbegin(), ranges_.cend(), begin,
+                             [](size_t block, const Range& r) { return block < r.second; });
+  return it != ranges_.cend() && it->first < end;
 }
 
 // Given an offset of the file, checks if the corresponding block (by considering the file as
@@ -295,21 +356,19 @@ bool SortedRangeSet::Overlaps(size_t start, size_t len) const {
 // + 10) in a range represented by this SortedRangeSet.
 size_t SortedRangeSet::GetOffsetInRangeSet(size_t old_offset) const {
   size_t old_block_start = old_offset / kBlockSize;
-  size_t new_block_start = 0;
-  for (const auto& [start, end] : ranges_) {
-    // Find the index of old_block_start.
-    if (old_block_start >= end) {
-      new_block_start += (end - start);
-    } else if (old_block_start >= start) {
-      new_block_start += (old_block_start - start);
-      return (new_block_start * kBlockSize + old_offset % kBlockSize);
-    } else {
-      CHECK(false) << "block_start " << old_block_start
-                   << " is missing between two ranges: " << ToString();
-      return 0;
-    }
+  // Find the range that ends after old_block_start.
+  auto it = std::upper_bound(ranges_.cbegin(), ranges_.cend(), old_block_start,
+                             [](size_t block, const Range& r) { return block < r.second; });
+  if (it == ranges_.cend()) {
+    CHECK(false) << "block_start " << old_block_start
+                 << " exceeds the limit of current RangeSet: " << ToString();
+    return 0;
+  }
+  if (old_block_start < it->first) {
+    CHECK(false) << "block_start " << old_block_start
+                 << " is missing between two ranges: " << ToString();
+    return 0;
   }
-  CHECK(false) << "block_start " << old_block_start
-               << " exceeds the limit of current RangeSet: " << ToString();
-  return 0;
+  size_t new_block_start = offsets_[it - ranges_.cbegin()] + (old_block_start - it->first);
+  return (new_block_start * kBlockSize + old_offset % kBlockSize);
 }
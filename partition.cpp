@@ -36,7 +36,15 @@
 #include <pwd.h>
 #include <zlib.h>
 #include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <android-base/properties.h>
+#include <android-base/unique_fd.h>
 #include <libsnapshot/snapshot.h>
 
 #include "cutils/properties.h"
@@ -75,9 +83,12 @@ extern "C" {
 #include <linux/xattr.h>
 #endif
 #include <sparse_format.h>
+#include <sparse/sparse.h>
 #include "progresstracking.hpp"
 
 #define CRYPT_FOOTER_OFFSET 0x4000
+#define RW_WRITEBACK_WINDOW (8 * 1048576LLU) // Raw_Read_Write starts writeback every 8MB during backups
+#define FS_PROBE_MAX_THREADS 4 // Probe_FS_Types runs at most this many blkid probes at once
 
 using namespace std;
 
@@ -86,6 +97,17 @@ static int auto_index = 0; // v2 fstab allows you to specify a mount point of "a
 extern struct selabel_handle *selinux_handle;
 extern bool datamedia;
 
+// Marks the partition contents as changed when a wipe, restore or flash starts and
+// again when it returns, so nothing read while it was running stays cached
+class Contents_Change_Scope {
+public:
+	explicit Contents_Change_Scope(TWPartition* Part) : part(Part) { part->Contents_Changed(); }
+	~Contents_Change_Scope() { part->Contents_Changed(); }
+
+private:
+	TWPartition* part;
+};
+
 struct flag_list {
 	const char *name;
 	unsigned long flag;
@@ -291,6 +313,7 @@ TWPartition::TWPartition() {
 	Original_Path = "";
 	Use_Original_Path = false;
 	Needs_Fs_Compress = false;
+	Mount_Generation = 0;
 }
 
 TWPartition::~TWPartition(void) {
@@ -1462,57 +1485,6 @@ bool TWPartition::Get_Size_Via_statfs(bool Display_Error) {
 	return true;
 }
 
-bool TWPartition::Get_Size_Via_df(bool Display_Error) {
-	FILE* fp;
-	char command[255], line[512];
-	int include_block = 1;
-	unsigned int min_len;
-
-	if (!Mount(Display_Error))
-		return false;
-
-	min_len = Actual_Block_Device.size() + 2;
-	sprintf(command, "df %s > /tmp/dfoutput.txt", Mount_Point.c_str());
-	TWFunc::Exec_Cmd(command);
-	fp = fopen("/tmp/dfoutput.txt", "rt");
-	if (fp == NULL) {
-		LOGINFO("Unable to open /tmp/dfoutput.txt.\n");
-		return false;
-	}
-
-	while (fgets(line, sizeof(line), fp) != NULL)
-	{
-		unsigned long blocks, used, available;
-		char device[64];
-		char tmpString[64];
-
-		if (strncmp(line, "Filesystem", 10) == 0)
-			continue;
-		if (strlen(line) < min_len) {
-			include_block = 0;
-			continue;
-		}
-		if (include_block) {
-			sscanf(line, "%s %lu %lu %lu", device, &blocks, &used, &available);
-		} else {
-			// The device block string is so long that the df information is on the next line
-			int space_count = 0;
-			sprintf(tmpString, "/dev/block/%s", Actual_Block_Device.c_str());
-			while (tmpString[space_count] == 32)
-				space_count++;
-			sscanf(line + space_count, "%lu %lu %lu", &blocks, &used, &available);
-		}
-
-		// Adjust block size to byte size
-		Size = blocks * 1024ULL;
-		Used = used * 1024ULL;
-		Free = available * 1024ULL;
-		Backup_Size = Used;
-	}
-	fclose(fp);
-	return true;
-}
-
 unsigned long long TWPartition::IOCTL_Get_Block_Size() {
 	Find_Actual_Block_Device();
 
@@ -1794,6 +1766,7 @@ bool TWPartition::UnMount(bool Display_Error) {
 				LOGINFO("Unable to unmount '%s'\n", Mount_Point.c_str());
 			return false;
 		} else {
+			Mount_Generation++;
 			return true;
 		}
 	} else {
@@ -1845,6 +1818,8 @@ bool TWPartition::Wipe(string New_File_System) {
 	if (Mount_Point == "/cache")
 		Log_Offset = 0;
 
+	Contents_Change_Scope change(this);
+
 	if (Mount_Point == PartitionManager.Get_Android_Root_Path()) {
 		if (tw_get_default_metadata(PartitionManager.Get_Android_Root_Path().c_str()) != 0) {
 			gui_msg(Msg(msg::kWarning, "restore_system_context=Unable to get default context for {1} -- Android may not boot.")(PartitionManager.Get_Android_Root_Path()));
@@ -2158,6 +2133,7 @@ bool TWPartition::Restore(PartitionSettings *part_settings) {
 	}
 	string Restore_File_System = Get_Restore_File_System(part_settings);
 
+	Contents_Change_Scope change(this);
 	if (Is_File_System(Restore_File_System))
 		return Restore_Tar(part_settings);
 	else if (Is_Image(Restore_File_System))
@@ -2272,9 +2248,131 @@ exit:
 	return ret;
 }
 
-void TWPartition::Check_FS_Type() {
+// blkid results, keyed by block device. An entry is reused as long as the
+// bytes that tell the supported file systems apart are unchanged, so a
+// reformat or a different card behind the same node costs one small read to
+// notice instead of a full probe. Wipes, restores, flashes and uevents drop
+// the entry outright.
+struct FS_Probe_Result {
+	string fingerprint;
+	int rc;                                                                   // blkid_do_fullprobe result, 1 if nothing was found
+	string type;
+};
+static std::unordered_map<string, FS_Probe_Result> fs_probe_cache;
+static std::mutex fs_probe_cache_lock;
+
+// Only the file systems recovery can mount are probed for
+static const char* fs_probe_types[] = { "ext2", "ext3", "ext4", "vfat", "exfat", "ntfs", "f2fs", "erofs", "squashfs", NULL };
+
+// Device number, size, and the magic and feature fields of the supported
+// file systems, all from the first 4KB of the device
+static bool FS_Probe_Fingerprint(const string& Device, string* Fingerprint) {
+	static const struct { size_t offset, size; } fields[] = {
+		{ 0x0, 0x10 },     // boot jump and OEM name: exfat, ntfs, vfat; squashfs magic
+		{ 0x36, 0x8 },     // FAT12/16 file system type
+		{ 0x52, 0x8 },     // FAT32 file system type
+		{ 0x1fe, 0x2 },    // boot sector signature
+		{ 0x400, 0x4 },    // f2fs and erofs magic
+		{ 0x438, 0x2 },    // ext magic
+		{ 0x45c, 0xc },    // ext compat, incompat and ro_compat features
+	};
+	char buf[4096];
+	struct stat st;
+	uint64_t size = 0;
+
+	android::base::unique_fd fd(open(Device.c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd < 0 || fstat(fd, &st) != 0 || ioctl(fd, BLKGETSIZE64, &size) != 0)
+		return false;
+	if (TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), 0)) != (ssize_t)sizeof(buf))
+		return false;
+	Fingerprint->assign((const char*)&st.st_rdev, sizeof(st.st_rdev));
+	Fingerprint->append((const char*)&size, sizeof(size));
+	for (auto&& field : fields)
+		Fingerprint->append(buf + field.offset, field.size);
+	return true;
+}
+
+// Runs blkid on the device, returns the blkid_do_fullprobe result
+static int FS_Probe(const string& Device, string* Type) {
 	const char* type;
 	blkid_probe pr;
+	int rc;
+
+	Type->clear();
+	pr = blkid_new_probe_from_filename(Device.c_str());
+	if (!pr)
+		return -1;
+	blkid_probe_filter_superblocks_type(pr, BLKID_FLTR_ONLYIN, const_cast<char**>(fs_probe_types));
+	rc = blkid_do_fullprobe(pr);
+	if (rc == 0 && blkid_probe_lookup_value(pr, "TYPE", &type, NULL) == 0)
+		*Type = type;
+	blkid_free_probe(pr);
+	return rc;
+}
+
+static int FS_Probe_Cached(const string& Device, string* Type) {
+	FS_Probe_Result result;
+	bool cacheable = FS_Probe_Fingerprint(Device, &result.fingerprint);
+
+	if (cacheable) {
+		std::lock_guard<std::mutex> guard(fs_probe_cache_lock);
+		auto cached = fs_probe_cache.find(Device);
+		if (cached != fs_probe_cache.end() && cached->second.fingerprint == result.fingerprint) {
+			*Type = cached->second.type;
+			return cached->second.rc;
+		}
+	}
+	result.rc = FS_Probe(Device, &result.type);
+	*Type = result.type;
+	// Errors are retried next time, "nothing found" is remembered
+	if (cacheable && result.rc >= 0) {
+		std::lock_guard<std::mutex> guard(fs_probe_cache_lock);
+		fs_probe_cache.insert_or_assign(Device, result);
+	}
+	return result.rc;
+}
+
+void TWPartition::Invalidate_FS_Type() {
+	std::lock_guard<std::mutex> guard(fs_probe_cache_lock);
+	for (const string& device : { Actual_Block_Device, Primary_Block_Device, Alternate_Block_Device, Decrypted_Block_Device }) {
+		if (!device.empty())
+			fs_probe_cache.erase(device);
+	}
+}
+
+void TWPartition::Probe_FS_Types(const std::vector<TWPartition*>& Partitions) {
+	std::vector<string> devices;
+
+	for (TWPartition* part : Partitions) {
+		if (!part->Can_Be_Mounted || part->Fstab_File_System == "yaffs2" || part->Fstab_File_System == "mtd" || part->Fstab_File_System == "bml" || part->Ignore_Blkid)
+			continue;
+		part->Find_Actual_Block_Device();
+		if (part->Is_Present && std::find(devices.begin(), devices.end(), part->Actual_Block_Device) == devices.end())
+			devices.push_back(part->Actual_Block_Device);
+	}
+	if (devices.empty())
+		return;
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		string type;
+		for (size_t i = next++; i < devices.size(); i = next++)
+			FS_Probe_Cached(devices[i], &type);
+	};
+	// libblkid sets up its globals on first use, do that before the workers race for it
+	blkid_init_debug(0);
+	std::vector<std::thread> workers;
+	size_t threads = std::min<size_t>(devices.size(), FS_PROBE_MAX_THREADS);
+	for (size_t i = 1; i < threads; i++)
+		workers.emplace_back(worker);
+	worker();
+	for (auto&& w : workers)
+		w.join();
+	LOGINFO("Probed file systems on %zu block devices\n", devices.size());
+}
+
+void TWPartition::Check_FS_Type() {
+	string type;
 
 	if (Fstab_File_System == "yaffs2" || Fstab_File_System == "mtd" || Fstab_File_System == "bml" || Ignore_Blkid)
 		return; // Running blkid on some mtd devices causes a massive crash or needs to be skipped
@@ -2283,21 +2381,17 @@ void TWPartition::Check_FS_Type() {
 	if (!Is_Present)
 		return;
 
-	pr = blkid_new_probe_from_filename(Actual_Block_Device.c_str());
-	if (blkid_do_fullprobe(pr)) {
-		blkid_free_probe(pr);
+	if (FS_Probe_Cached(Actual_Block_Device, &type) != 0) {
 		LOGINFO("Can't probe device %s\n", Actual_Block_Device.c_str());
 		return;
 	}
 
-	if (blkid_probe_lookup_value(pr, "TYPE", &type, NULL) < 0) {
-		blkid_free_probe(pr);
+	if (type.empty()) {
 		LOGINFO("can't find filesystem on device %s\n", Actual_Block_Device.c_str());
 		return;
 	}
 
 	Current_File_System = type;
-	blkid_free_probe(pr);
 	if (fs_flags.size() > 1) {
 		std::vector<partition_fs_flags_struct>::iterator iter;
 		std::vector<partition_fs_flags_struct>::iterator found = fs_flags.begin();
@@ -2864,7 +2958,7 @@ bool TWPartition::Backup_Tar(PartitionSettings *part_settings, pid_t *tar_fork_p
 bool TWPartition::Backup_Image(PartitionSettings *part_settings) {
 	string Full_FileName, adb_file_name;
 
-  	if (DataManager::GetIntValue(FOX_RUN_SURVIVAL_BACKUP) != 1) {
+  	if (!part_settings->background && DataManager::GetIntValue(FOX_RUN_SURVIVAL_BACKUP) != 1) {
 	   TWFunc::GUI_Operation_Text(TW_BACKUP_TEXT, Display_Name, gui_parse_text("{@backing}"));
 	    gui_msg(Msg("backing_up=Backing up {1}...")(Backup_Display_Name));
 	}
@@ -2894,13 +2988,27 @@ bool TWPartition::Backup_Image(PartitionSettings *part_settings) {
 	return true;
 }
 
+// Paces the callers so that together they stay within limit bytes per second
+// since start; a worker that finishes early leaves its share to the others
+void Bandwidth_Budget::Charge(uint64_t bytes) {
+	if (limit == 0)
+		return;
+	uint64_t expected_ms = (used += bytes) * 1000 / limit;
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t elapsed_ms = (uint64_t)TWFunc::timespec_diff_ms(start, now);
+	if (expected_ms > elapsed_ms)
+		usleep((expected_ms - elapsed_ms) * 1000);
+}
+
 bool TWPartition::Raw_Read_Write(PartitionSettings *part_settings) {
 	unsigned long long RW_Block_Size, Remain = Backup_Size;
 	int src_fd = -1, dest_fd = -1;
 	ssize_t bs;
 	bool ret = false;
 	void* buffer = NULL;
-	unsigned long long backedup_size = 0;
+	unsigned long long backedup_size = 0, writeback_start = 0;
+	bool writeback_async = (part_settings->PM_Method == PM_BACKUP && !part_settings->adbbackup);
 	string srcfn, destfn;
 
 	if (part_settings->PM_Method == PM_BACKUP) {
@@ -2926,13 +3034,19 @@ bool TWPartition::Raw_Read_Write(PartitionSettings *part_settings) {
 
 	src_fd = open(srcfn.c_str(), O_RDONLY | O_LARGEFILE);
 	if (src_fd < 0) {
-		gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(srcfn.c_str())(strerror(errno)));
+		if (part_settings->background)
+			LOGINFO("Error opening '%s' (%s)\n", srcfn.c_str(), strerror(errno));
+		else
+			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(srcfn.c_str())(strerror(errno)));
 		return false;
 	}
 
 	dest_fd = open(destfn.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, S_IRUSR | S_IWUSR);
 	if (dest_fd < 0) {
-		gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(destfn.c_str())(strerror(errno)));
+		if (part_settings->background)
+			LOGINFO("Error opening '%s' (%s)\n", destfn.c_str(), strerror(errno));
+		else
+			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(destfn.c_str())(strerror(errno)));
 		goto exit;
 	}
 
@@ -2969,14 +3083,28 @@ bool TWPartition::Raw_Read_Write(PartitionSettings *part_settings) {
 		}
 		backedup_size += (unsigned long long)(bs);
 		Remain -= (unsigned long long)(bs);
+		if (writeback_async && backedup_size - writeback_start >= RW_WRITEBACK_WINDOW) {
+			// Start writeback of this window and wait for the previous one, so the
+			// page cache never holds more than two windows of dirty image data
+			sync_file_range(dest_fd, writeback_start, backedup_size - writeback_start, SYNC_FILE_RANGE_WRITE);
+			if (writeback_start >= RW_WRITEBACK_WINDOW)
+				sync_file_range(dest_fd, writeback_start - RW_WRITEBACK_WINDOW, RW_WRITEBACK_WINDOW,
+					SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+			writeback_start = backedup_size;
+		}
+		if (part_settings->bandwidth)
+			part_settings->bandwidth->Charge(bs);
 		if (part_settings->progress)
 			part_settings->progress->UpdateSize(backedup_size);
-		if (PartitionManager.Check_Backup_Cancel() != 0)
+		if (PartitionManager.Check_Backup_Cancel() != 0 || (part_settings->cancel && *part_settings->cancel))
 			goto exit;
 	}
 	if (part_settings->progress)
 		part_settings->progress->UpdateDisplayDetails(true);
-	fsync(dest_fd);
+	if (writeback_async)
+		sync_file_range(dest_fd, writeback_start, 0, SYNC_FILE_RANGE_WRITE); // Run_Backup does one syncfs at the end
+	else
+		fsync(dest_fd);
 
 	if (!part_settings->adbbackup && part_settings->PM_Method == PM_BACKUP) {
 		tw_set_default_metadata(destfn.c_str());
@@ -3011,7 +3139,7 @@ bool TWPartition::Backup_Dump_Image(PartitionSettings *part_settings) {
 	Command = "dump_image " + MTD_Name + " '" + Full_FileName + "'";
 
 	LOGINFO("Backup command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command);
+	TWFunc::Exec_Argv({ "dump_image", MTD_Name, Full_FileName }, NULL);
 	tw_set_default_metadata(Full_FileName.c_str());
 	if (TWFunc::Get_File_Size(Full_FileName) == 0) {
 		// Actual size may not match backup size due to bad blocks on MTD devices so just check for 0 bytes
@@ -3200,12 +3328,10 @@ bool TWPartition::Update_Size(bool Display_Error) {
 		goto fail;
 
 	ret = Get_Size_Via_statfs(Display_Error);
-	if (!ret || Size == 0) {
-		if (!Get_Size_Via_df(Display_Error)) {
-			if (!Was_Already_Mounted)
-				UnMount(false);
-			goto fail;
-		}
+	if (!ret) {
+		if (!Was_Already_Mounted)
+			UnMount(false);
+		goto fail;
 	}
 
 	if (Has_Data_Media) {
@@ -3414,18 +3540,11 @@ bool TWPartition::Flash_Image(PartitionSettings *part_settings) {
 	full_filename = part_settings->Backup_Folder + "/" + Backup_FileName;
 
 	LOGINFO("Image filename is: %s\n", Backup_FileName.c_str());
+	Contents_Change_Scope change(this);
 
-	if (Backup_Method == BM_FILES) {
-		LOGERR("Cannot flash images to file systems\n");
-		return false;
-	} else if (!Can_Flash_Img) {
-		LOGERR("Cannot flash images to partitions %s\n", Display_Name.c_str());
+	if (!Can_Flash_Image()) {
 		return false;
 	} else {
-		if (!Find_Partition_Size()) {
-			LOGERR("Unable to find partition size for '%s'\n", Mount_Point.c_str());
-			return false;
-		}
 		unsigned long long image_size = TWFunc::Get_File_Size(full_filename);
 		if (image_size > Size) {
 			LOGINFO("Size (%llu bytes) of image '%s' is larger than target device '%s' (%llu bytes)\n",
@@ -3449,6 +3568,39 @@ bool TWPartition::Flash_Image(PartitionSettings *part_settings) {
 	return false;
 }
 
+bool TWPartition::Flash_Generated_Image(const std::function<bool(const string&)>& Write_Image) {
+	Contents_Change_Scope change(this);
+
+	if (!Can_Flash_Image())
+		return false;
+	if (Backup_Method == BM_DD)
+		return Write_Image(Actual_Block_Device);
+	if (Backup_Method == BM_FLASH_UTILS) {
+		// flash_image only takes a file
+		string image_file = "/tmp/" + Backup_Name + ".img";
+		bool ret = Write_Image(image_file) && Flash_Image_FI(image_file, NULL);
+		unlink(image_file.c_str());
+		return ret;
+	}
+
+	LOGERR("Unknown flash method for '%s'\n", Mount_Point.c_str());
+	return false;
+}
+
+bool TWPartition::Can_Flash_Image() {
+	if (Backup_Method == BM_FILES) {
+		LOGERR("Cannot flash images to file systems\n");
+		return false;
+	} else if (!Can_Flash_Img) {
+		LOGERR("Cannot flash images to partitions %s\n", Display_Name.c_str());
+		return false;
+	} else if (!Find_Partition_Size()) {
+		LOGERR("Unable to find partition size for '%s'\n", Mount_Point.c_str());
+		return false;
+	}
+	return true;
+}
+
 bool TWPartition::Is_Sparse_Image(const string& Filename) {
 	uint32_t magic = 0;
 	int fd = open(Filename.c_str(), O_RDONLY);
@@ -3469,17 +3621,31 @@ bool TWPartition::Is_Sparse_Image(const string& Filename) {
 }
 
 bool TWPartition::Flash_Sparse_Image(const string& Filename) {
-	string Command;
-
 #ifdef TW_ENABLE_BLKDISCARD
 	BlkDiscard();
 #endif
 
 	gui_msg(Msg("flashing=Flashing {1}...")(Display_Name));
 
-	Command = "simg2img '" + Filename + "' '" + Actual_Block_Device + "'";
-	LOGINFO("Flash command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command);
+	// Same as simg2img, without the extra process
+	LOGINFO("Writing sparse image '%s' to '%s'\n", Filename.c_str(), Actual_Block_Device.c_str());
+	android::base::unique_fd in_fd(open(Filename.c_str(), O_RDONLY | O_CLOEXEC));
+	android::base::unique_fd out_fd(open(Actual_Block_Device.c_str(), O_WRONLY | O_CLOEXEC));
+	if (in_fd < 0 || out_fd < 0) {
+		LOGERR("Unable to open '%s' or '%s' for flashing: %s\n", Filename.c_str(), Actual_Block_Device.c_str(), strerror(errno));
+		return false;
+	}
+	struct sparse_file* sparse = sparse_file_import(in_fd, true, false);
+	if (!sparse) {
+		LOGERR("Unable to read sparse image '%s'\n", Filename.c_str());
+		return false;
+	}
+	int ret = sparse_file_write(sparse, out_fd, false, false, false);
+	sparse_file_destroy(sparse);
+	if (ret < 0 || fsync(out_fd) != 0) {
+		LOGERR("Unable to write sparse image '%s' to '%s'\n", Filename.c_str(), Actual_Block_Device.c_str());
+		return false;
+	}
 	return true;
 }
 
@@ -3495,10 +3661,10 @@ bool TWPartition::Flash_Image_FI(const string& Filename, ProgressTracking *progr
 	// Sometimes flash image doesn't like to flash due to the first 2KB matching, so we erase first to ensure that it flashes
 	Command = "erase_image " + MTD_Name;
 	LOGINFO("Erase command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command);
+	TWFunc::Exec_Argv({ "erase_image", MTD_Name }, NULL);
 	Command = "flash_image " + MTD_Name + " '" + Filename + "'";
 	LOGINFO("Flash command: '%s'\n", Command.c_str());
-	TWFunc::Exec_Cmd(Command);
+	TWFunc::Exec_Argv({ "flash_image", MTD_Name, Filename }, NULL);
 	if (progress)
 		progress->UpdateSize(file_size);
 	return true;
@@ -3763,6 +3929,15 @@ void TWPartition::Set_Can_Be_Wiped(bool val) {
 	Wipe_Available_in_GUI = val;
 }
 
+unsigned int TWPartition::Get_Mount_Generation() {
+	return Mount_Generation;
+}
+
+void TWPartition::Contents_Changed() {
+	Mount_Generation++;
+	Invalidate_FS_Type();
+}
+
 void TWPartition::Set_Block_Device(std::string block_device) {
 	Primary_Block_Device = Actual_Block_Device = block_device;
 }
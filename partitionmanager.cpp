@@ -27,6 +27,11 @@
 #include <unistd.h>
 #include <map>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <dirent.h>
 #include <time.h>
 #include <errno.h>
@@ -380,6 +385,7 @@ void TWPartitionManager::Setup_Fstab_Partitions(bool Display_Error) {
 		Decrypt_Data();
 	#endif
 
+		TWPartition::Probe_FS_Types(Partitions);
 		Update_System_Details();
 		if (Get_Super_Status())
 			Setup_Super_Partition();
@@ -845,27 +851,89 @@ int TWPartitionManager::Check_Backup_Name(const std::string& Backup_Name, bool D
 	return 0;
 }
 
+// Size of a partition's backup files as written to the backup folder, split archives included
+static uint64_t Backup_Output_Size(const string& Backup_Folder, const string& Backup_FileName) {
+	uint64_t size = 0;
+	DIR* d = opendir(Backup_Folder.c_str());
+	if (d == NULL)
+		return 0;
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL) {
+		string name = de->d_name;
+		if (name.compare(0, Backup_FileName.size(), Backup_FileName) != 0)
+			continue;
+		string ext = name.substr(Backup_FileName.size());
+		if (ext.find('.') != string::npos)
+			continue; // digests and info files
+		struct stat st;
+		if (stat((Backup_Folder + "/" + name).c_str(), &st) == 0)
+			size += st.st_size;
+	}
+	closedir(d);
+	return size;
+}
+
+// Generates the digest of the partition's backup file, adding the time it took to
+// digest_ms and to the backup's total
+static bool Make_Backup_Digest(PartitionSettings *part_settings, int32_t *digest_ms) {
+	timespec digest_start, digest_stop;
+
+	if (part_settings->adbbackup || !part_settings->generate_digest)
+		return true;
+	part_settings->progress->SetPhase(part_settings->Part->Backup_Display_Name, "digest");
+	clock_gettime(CLOCK_MONOTONIC, &digest_start);
+	bool ret = twrpDigestDriver::Make_Digest(part_settings->Backup_Folder + "/" + part_settings->Part->Backup_FileName);
+	clock_gettime(CLOCK_MONOTONIC, &digest_stop);
+	int32_t elapsed_ms = TWFunc::timespec_diff_ms(digest_start, digest_stop);
+	*digest_ms += elapsed_ms;
+	part_settings->digest_ms += elapsed_ms;
+	return ret;
+}
+
+static void Send_Backup_Done_Event(PartitionSettings *part_settings, int32_t elapsed_ms, int32_t digest_ms) {
+	ProgressEvent event("partition_done");
+	event.Add("operation", "backup").Add("partition", part_settings->Part->Backup_Display_Name);
+	event.Add("bytes", (unsigned long long)part_settings->Part->Backup_Size);
+	if (!part_settings->adbbackup) {
+		uint64_t output_size = Backup_Output_Size(part_settings->Backup_Folder, part_settings->Part->Backup_FileName);
+		event.Add("output_bytes", (unsigned long long)output_size);
+		if (output_size != 0)
+			event.Add("compression_ratio", (double)part_settings->Part->Backup_Size / (double)output_size);
+	}
+	event.Add("elapsed_ms", (long long)elapsed_ms);
+	event.Add("digest_ms", (long long)digest_ms);
+	if (part_settings->Part->Backup_Method == BM_FILES)
+		event.Add("child_cpu_ms", (unsigned long long)part_settings->child_cpu_ms);
+	event.Send();
+}
+
+// The backup and restore operation_done events carry the same fields
+static void Send_Operation_Done_Event(const char* operation, unsigned long long bytes, const timespec& start, int32_t digest_ms, int32_t sync_ms) {
+	timespec stop;
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	int32_t elapsed_ms = TWFunc::timespec_diff_ms(start, stop);
+	ProgressEvent("operation_done").Add("operation", operation).Add("bytes", bytes)
+		.Add("elapsed_ms", (long long)elapsed_ms).Add("digest_ms", (long long)digest_ms).Add("sync_ms", (long long)sync_ms)
+		.Add("bytes_per_sec", elapsed_ms > 0 ? (double)bytes * 1000.0 / (double)elapsed_ms : 0.0).Send();
+}
+
 bool TWPartitionManager::Backup_Partition(PartitionSettings *part_settings) {
 	time_t start, stop;
-	int use_compression;
-	string backup_log = part_settings->Backup_Folder + "/recovery.log";
+	timespec start_ts, stop_ts;
+	int32_t digest_ms = 0;
 
 	if (part_settings->Part == NULL)
 		return true;
 
-	DataManager::GetValue(TW_USE_COMPRESSION_VAR, use_compression);
-
 	TWFunc::SetPerformanceMode(true);
 	time(&start);
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	part_settings->child_cpu_ms = 0;
+	part_settings->progress->SetPhase(part_settings->Part->Backup_Display_Name, "backup");
 
 	if (part_settings->Part->Backup(part_settings, &tar_fork_pid)) {
-		sync();
-		sync();
-		string Full_Filename = part_settings->Backup_Folder + "/" + part_settings->Part->Backup_FileName;
-		if (!part_settings->adbbackup && part_settings->generate_digest) {
-			if (!twrpDigestDriver::Make_Digest(Full_Filename))
-				goto backup_error;
-		}
+		if (!Make_Backup_Digest(part_settings, &digest_ms))
+			goto backup_error;
 
 		if (part_settings->Part->Has_SubPartition) {
 			std::vector<TWPartition*>::iterator subpart;
@@ -874,16 +942,12 @@ bool TWPartitionManager::Backup_Partition(PartitionSettings *part_settings) {
 			for (subpart = Partitions.begin(); subpart != Partitions.end(); subpart++) {
 				if ((*subpart)->Can_Be_Backed_Up && (*subpart)->Is_SubPartition && (*subpart)->SubPartition_Of == parentPart->Mount_Point) {
 					part_settings->Part = *subpart;
+					part_settings->progress->SetPhase(part_settings->Part->Backup_Display_Name, "backup");
 					if (!(*subpart)->Backup(part_settings, &tar_fork_pid)) {
 						goto backup_error;
 					}
-					sync();
-					sync();
-					string Full_Filename = part_settings->Backup_Folder + "/" + part_settings->Part->Backup_FileName;
-					if (!part_settings->adbbackup && part_settings->generate_digest) {
-						if (!twrpDigestDriver::Make_Digest(Full_Filename)) {
-							goto backup_error;
-						}
+					if (!Make_Backup_Digest(part_settings, &digest_ms)) {
+						goto backup_error;
 					}
 				}
 			}
@@ -900,15 +964,53 @@ bool TWPartitionManager::Backup_Partition(PartitionSettings *part_settings) {
 
 		}
 
+		clock_gettime(CLOCK_MONOTONIC, &stop_ts);
+		Send_Backup_Done_Event(part_settings, TWFunc::timespec_diff_ms(start_ts, stop_ts), digest_ms);
+
 		TWFunc::SetPerformanceMode(false);
 		return true;
 	}
 backup_error:
+	ProgressEvent("partition_failed").Add("operation", "backup").Add("partition", part_settings->Part->Backup_Display_Name).Send();
+	TWFunc::SetPerformanceMode(false);
+	return false;
+}
+
+bool TWPartitionManager::Finish_Image_Backup(PartitionSettings *part_settings, int32_t backup_ms) {
+	int32_t digest_ms = 0;
+
+	if (!Make_Backup_Digest(part_settings, &digest_ms)) {
+		ProgressEvent("partition_failed").Add("operation", "backup").Add("partition", part_settings->Part->Backup_Display_Name).Send();
+		return false;
+	}
+	part_settings->img_time += (backup_ms + digest_ms) / 1000;
+	Send_Backup_Done_Event(part_settings, backup_ms + digest_ms, digest_ms);
+	return true;
+}
+
+void TWPartitionManager::Backup_Failed(PartitionSettings *part_settings) {
+	string backup_log = part_settings->Backup_Folder + "/recovery.log";
+
 	Clean_Backup_Folder(part_settings->Backup_Folder);
 	TWFunc::copy_file("/tmp/recovery.log", backup_log, 0644);
 	tw_set_default_metadata(backup_log.c_str());
-	TWFunc::SetPerformanceMode(false);
-	return false;
+	// Flush what was written before the failure, the user may reboot right away
+	if (!part_settings->adbbackup)
+		Sync_Backup_Storage(part_settings->Backup_Folder);
+}
+
+void TWPartitionManager::Sync_Backup_Storage(const string& Backup_Folder) {
+	// Backup files have their writeback started while they are written, so
+	// only the file system holding the backup needs to be flushed here.
+	int fd = open(Backup_Folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		LOGINFO("Unable to open '%s' for syncfs (%s), using sync\n", Backup_Folder.c_str(), strerror(errno));
+		sync();
+		return;
+	}
+	if (syncfs(fd) != 0)
+		LOGINFO("syncfs on '%s' failed (%s)\n", Backup_Folder.c_str(), strerror(errno));
+	close(fd);
 }
 
 void TWPartitionManager::Clean_Backup_Folder(string Backup_Folder) {
@@ -975,6 +1077,118 @@ int TWPartitionManager::Cancel_Backup() {
 	return 0;
 }
 
+// Backs up raw image partitions on worker threads while the caller keeps
+// backing up file system partitions. Image backups are I/O bound on their own
+// block devices, so they overlap well with the CPU bound tar/compression work.
+// Workers only copy the images; digests, GUI messages, events and cleanup are
+// left to the thread that started them.
+class Image_Backup_Scheduler {
+public:
+	struct Result {
+		TWPartition* Part;
+		int32_t Backup_ms;
+		bool Success;
+	};
+
+	Image_Backup_Scheduler() : Next(0), Running(0), Failed(false), Stop(false) {}
+	~Image_Backup_Scheduler() { Cancel(); Wait(); }
+
+	void Start(const PartitionSettings& base, const std::vector<TWPartition*>& parts, int threads, uint64_t bandwidth_limit) {
+		Base = base;
+		Parts = parts;
+		if (threads > (int)Parts.size())
+			threads = Parts.size();
+		if (threads <= 0)
+			return;
+		// All image workers charge one budget, so a worker that finishes
+		// early leaves its share to the ones still running
+		Budget.limit = bandwidth_limit;
+		clock_gettime(CLOCK_MONOTONIC, &Budget.start);
+		Base.bandwidth = &Budget;
+		Base.background = true;
+		Base.cancel = &Stop;
+		LOGINFO("Backing up %zu image partition(s) on %i worker thread(s)\n", Parts.size(), threads);
+		Running = threads;
+		for (int i = 0; i < threads; i++)
+			Workers.emplace_back(&Image_Backup_Scheduler::Worker, this);
+	}
+
+	// Stops handing out images and makes running image backups bail out
+	void Cancel() { Stop = true; }
+
+	// Joins the workers, refreshing the shared progress display while they run;
+	// returns false if any image backup failed
+	bool Wait() {
+		std::unique_lock<std::mutex> lock(Queue_Lock);
+		while (Running > 0) {
+			Done_Cond.wait_for(lock, std::chrono::milliseconds(200));
+			if (Running > 0 && Base.progress) {
+				lock.unlock();
+				Base.progress->UpdateDisplayDetails(false);
+				lock.lock();
+			}
+		}
+		lock.unlock();
+		for (std::thread& worker : Workers)
+			worker.join();
+		Workers.clear();
+		return !Failed;
+	}
+
+	// Hands over the images that finished since the last call
+	std::vector<Result> Take_Results() {
+		std::lock_guard<std::mutex> lock(Queue_Lock);
+		std::vector<Result> results;
+		results.swap(Results);
+		return results;
+	}
+
+	bool Has_Failed() { return Failed; }
+
+private:
+	void Worker() {
+		while (!Stop) {
+			PartitionSettings part_settings;
+			{
+				std::lock_guard<std::mutex> lock(Queue_Lock);
+				if (Next >= Parts.size())
+					break;
+				part_settings = Base;
+				part_settings.Part = Parts[Next++];
+			}
+			ProgressTracking progress(Base.progress);
+			part_settings.progress = &progress;
+			timespec start, stop;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			TWFunc::SetPerformanceMode(true);
+			bool success = part_settings.Part->Backup(&part_settings, NULL);
+			TWFunc::SetPerformanceMode(false);
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			std::lock_guard<std::mutex> lock(Queue_Lock);
+			Results.push_back({ part_settings.Part, TWFunc::timespec_diff_ms(start, stop), success });
+			if (!success) {
+				Failed = true;
+				Stop = true;
+			}
+		}
+		std::lock_guard<std::mutex> lock(Queue_Lock);
+		Running--;
+		Done_Cond.notify_all();
+	}
+
+	PartitionSettings Base;
+	Bandwidth_Budget Budget;
+	std::vector<TWPartition*> Parts;
+	std::vector<std::thread> Workers;
+	std::vector<Result> Results;
+	std::mutex Queue_Lock;
+	std::condition_variable Done_Cond;
+	size_t Next;
+	int Running;
+	std::atomic<bool> Failed;
+	std::atomic<bool> Stop;
+};
+
 int TWPartitionManager::Run_Backup(bool adbbackup) {
 	PartitionSettings part_settings;
 	int partition_count = 0, disable_free_space_check = 0, skip_digest = 0;
@@ -983,6 +1197,7 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 	TWPartition* storage = NULL;
 	struct tm *t;
 	time_t seconds, total_start, total_stop;
+	timespec total_start_ts;
 	size_t start_pos = 0, end_pos = 0;
 	stop_backup.set_value(0);
 	seconds = time(0);
@@ -998,6 +1213,7 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 
 	part_settings.adbbackup = adbbackup;
 	time(&total_start);
+	clock_gettime(CLOCK_MONOTONIC, &total_start_ts);
 
 	Update_System_Details();
 
@@ -1116,11 +1332,16 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 
 	DataManager::SetProgress(0.0);
 
+	int img_threads = 0, img_bw_limit = 0;
+	DataManager::GetValue(TW_BACKUP_IMG_THREADS_VAR, img_threads);
+	DataManager::GetValue(TW_BACKUP_IMG_BW_LIMIT_VAR, img_bw_limit);
+	if (adbbackup)
+		img_threads = 0; // the adb stream carries one partition at a time
+
+	std::vector<TWPartition*> file_parts, image_parts;
 	start_pos = 0;
 	end_pos = Backup_List.find(";", start_pos);
 	while (end_pos != string::npos && start_pos < Backup_List.size()) {
-		if (stop_backup.get_value() != 0)
-			return -1;
 		backup_path = Backup_List.substr(start_pos, end_pos - start_pos);
 		part_settings.Part = Find_Partition_By_Path(backup_path);
 		if (part_settings.Part != NULL) {
@@ -1136,8 +1357,10 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
              		   else gui_msg("fox_internal_q1=OrangeFox - Internal Storage - take care!");
         	}
 // DJ9 20/08/2018 }
-			if (!Backup_Partition(&part_settings))
-				return false;
+			if (img_threads > 0 && part_settings.Part->Backup_Method == BM_DD && !part_settings.Part->Has_SubPartition)
+				image_parts.push_back(part_settings.Part);
+			else
+				file_parts.push_back(part_settings.Part);
 		} else {
 			gui_msg(Msg(msg::kError, "unable_to_locate_partition=Unable to locate '{1}' partition for backup calculations.")(backup_path));
 		}
@@ -1145,6 +1368,66 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 		end_pos = Backup_List.find(";", start_pos);
 	}
 
+	for (TWPartition* part : image_parts)
+		gui_msg(Msg("backing_up=Backing up {1}...")(part->Backup_Display_Name));
+	Image_Backup_Scheduler image_scheduler;
+	image_scheduler.Start(part_settings, image_parts, img_threads, (uint64_t)img_bw_limit * 1024 * 1024);
+
+	// Images finished by the workers are digested and reported here, between file backups
+	bool backup_ok = true;
+	auto finish_images = [&]() {
+		for (const Image_Backup_Scheduler::Result& result : image_scheduler.Take_Results()) {
+			part_settings.Part = result.Part;
+			if (!result.Success) {
+				// Images stopped because the backup was already failing or cancelled are not reported
+				if (backup_ok && stop_backup.get_value() == 0) {
+					gui_msg(Msg(msg::kError, "backup_img_fail=Unable to back up {1}.")(result.Part->Backup_Display_Name));
+					ProgressEvent("partition_failed").Add("operation", "backup").Add("partition", result.Part->Backup_Display_Name).Send();
+				}
+				backup_ok = false;
+			} else if (backup_ok && !Finish_Image_Backup(&part_settings, result.Backup_ms)) {
+				backup_ok = false;
+			}
+		}
+	};
+
+	for (TWPartition* part : file_parts) {
+		if (stop_backup.get_value() != 0)
+			break;
+		finish_images();
+		if (!backup_ok || image_scheduler.Has_Failed())
+			break;
+		part_settings.Part = part;
+		if (!Backup_Partition(&part_settings)) {
+			backup_ok = false;
+			break;
+		}
+	}
+	// Nothing may still be writing to the backup folder when it is cleaned up
+	if (!backup_ok || stop_backup.get_value() != 0)
+		image_scheduler.Cancel();
+	image_scheduler.Wait();
+	finish_images();
+	if (stop_backup.get_value() != 0) {
+		if (!adbbackup)
+			Sync_Backup_Storage(part_settings.Backup_Folder);
+		return -1;
+	}
+	if (!backup_ok) {
+		Backup_Failed(&part_settings);
+		return false;
+	}
+
+	int32_t sync_ms = 0;
+	if (!adbbackup) {
+		timespec sync_start, sync_stop;
+		progress.SetPhase("", "sync");
+		clock_gettime(CLOCK_MONOTONIC, &sync_start);
+		Sync_Backup_Storage(part_settings.Backup_Folder);
+		clock_gettime(CLOCK_MONOTONIC, &sync_stop);
+		sync_ms = TWFunc::timespec_diff_ms(sync_start, sync_stop);
+	}
+
 	// Average BPS
 	if (part_settings.img_time == 0)
 		part_settings.img_time = 1;
@@ -1161,6 +1444,8 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 	time(&total_stop);
 	int total_time = (int) difftime(total_stop, total_start);
 
+	Send_Operation_Done_Event("backup", total_bytes, total_start_ts, part_settings.digest_ms, sync_ms);
+
 	uint64_t actual_backup_size;
 	if (!adbbackup) {
 		TWExclude twe;
@@ -1209,6 +1494,7 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 
 bool TWPartitionManager::Restore_Partition(PartitionSettings *part_settings) {
 	time_t Start, Stop;
+	timespec start_ts, stop_ts;
 
 	if (part_settings->adbbackup) {
 		std::string partName = part_settings->Part->Backup_Name + "." + part_settings->Part->Current_File_System + ".win";
@@ -1219,8 +1505,12 @@ bool TWPartitionManager::Restore_Partition(PartitionSettings *part_settings) {
 	TWFunc::SetPerformanceMode(true);
 
 	time(&Start);
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	part_settings->progress->SetPhase(part_settings->Part->Backup_Display_Name, "restore");
 
 	if (!part_settings->Part->Restore(part_settings)) {
+		ProgressEvent("partition_failed").Add("operation", "restore").Add("partition", part_settings->Part->Backup_Display_Name).Send();
+		sync(); // the restore stops here, flush what was written before the user reboots
 		TWFunc::SetPerformanceMode(false);
 		return false;
 	}
@@ -1233,7 +1523,10 @@ bool TWPartitionManager::Restore_Partition(PartitionSettings *part_settings) {
 			if ((*subpart)->Is_SubPartition && (*subpart)->SubPartition_Of == parentPart->Mount_Point) {
 				part_settings->Part = (*subpart);
 				part_settings->Part->Set_Backup_FileName(part_settings->Part->Backup_Name + "." + part_settings->Part->Current_File_System + ".win");
+				part_settings->progress->SetPhase(part_settings->Part->Backup_Display_Name, "restore");
 				if (!(*subpart)->Restore(part_settings)) {
+					ProgressEvent("partition_failed").Add("operation", "restore").Add("partition", part_settings->Part->Backup_Display_Name).Send();
+					sync();
 					TWFunc::SetPerformanceMode(false);
 					return false;
 				}
@@ -1243,6 +1536,9 @@ bool TWPartitionManager::Restore_Partition(PartitionSettings *part_settings) {
 	time(&Stop);
 	TWFunc::SetPerformanceMode(false);
 	gui_msg(Msg("restore_part_done=[{1} done ({2} seconds)]")(part_settings->Part->Backup_Display_Name)((int)difftime(Stop, Start)));
+	clock_gettime(CLOCK_MONOTONIC, &stop_ts);
+	ProgressEvent("partition_done").Add("operation", "restore").Add("partition", part_settings->Part->Backup_Display_Name)
+		.Add("elapsed_ms", (long long)TWFunc::timespec_diff_ms(start_ts, stop_ts)).Send();
 
 	return true;
 }
@@ -1252,7 +1548,9 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 	int check_digest;
 
 	time_t rStart, rStop;
+	timespec start_ts;
 	time(&rStart);
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
 	string Restore_List, restore_path;
 	size_t start_pos = 0, end_pos;
 
@@ -1270,6 +1568,16 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 		return false;
 
 	DataManager::GetValue(TW_SKIP_DIGEST_CHECK_VAR, check_digest);
+	int32_t digest_ms = 0;
+	auto verify_digest = [&digest_ms](const string& Display_Name, const string& Filename) {
+		timespec digest_start, digest_stop;
+		ProgressEvent("phase").Add("partition", Display_Name).Add("phase", "verify_digest").Send();
+		clock_gettime(CLOCK_MONOTONIC, &digest_start);
+		bool ret = twrpDigestDriver::Check_Digest(Filename);
+		clock_gettime(CLOCK_MONOTONIC, &digest_stop);
+		digest_ms += TWFunc::timespec_diff_ms(digest_start, digest_stop);
+		return ret;
+	};
 	if (check_digest > 0) {
 		// Check Digest files first before restoring to ensure that all of them match before starting a restore
 		TWFunc::GUI_Operation_Text(TW_VERIFY_DIGEST_TEXT, gui_parse_text("{@verifying_digest}"));
@@ -1297,7 +1605,7 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 					gui_msg(Msg(msg::kWarning, "restore_system_context=Unable to get default context for {1} -- Android may not boot.")(Get_Android_Root_Path()));
 				}
 
-				if (check_digest > 0 && !twrpDigestDriver::Check_Digest(Full_Filename))
+				if (check_digest > 0 && !verify_digest(part_settings.Part->Backup_Display_Name, Full_Filename))
 					return false;
 				part_settings.partition_count++;
 				part_settings.total_restore_size += part_settings.Part->Get_Restore_Size(&part_settings);
@@ -1308,7 +1616,7 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 					for (subpart = Partitions.begin(); subpart != Partitions.end(); subpart++) {
 						part_settings.Part = *subpart;
 						if ((*subpart)->Is_SubPartition && (*subpart)->SubPartition_Of == parentPart->Mount_Point) {
-							if (check_digest > 0 && !twrpDigestDriver::Check_Digest(Full_Filename))
+							if (check_digest > 0 && !verify_digest((*subpart)->Backup_Display_Name, Full_Filename))
 								return false;
 							part_settings.total_restore_size += (*subpart)->Get_Restore_Size(&part_settings);
 						}
@@ -1357,8 +1665,18 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 	UnMount_By_Path(Get_Android_Root_Path(), false);
 	Update_System_Details();
 	UnMount_Main_Partitions();
+
+	// Flush the restored partitions before reporting completion
+	timespec sync_start, sync_stop;
+	progress.SetPhase("", "sync");
+	clock_gettime(CLOCK_MONOTONIC, &sync_start);
+	sync();
+	clock_gettime(CLOCK_MONOTONIC, &sync_stop);
+	int32_t sync_ms = TWFunc::timespec_diff_ms(sync_start, sync_stop);
+
 	time(&rStop);
 	gui_msg(Msg(msg::kHighlight, "restore_completed=[RESTORE COMPLETED IN {1} SECONDS]")((int)difftime(rStop,rStart)));
+	Send_Operation_Done_Event("restore", part_settings.total_restore_size, start_ts, digest_ms, sync_ms);
 	TWPartition* Decrypt_Data = Find_Partition_By_Path("/data");
 	if (Decrypt_Data && Decrypt_Data->Is_Encrypted)
 		gui_print_color("warning", "It is recommended to reboot Android once after first boot.");
@@ -3462,6 +3780,8 @@ void TWPartitionManager::Handle_Uevent(const Uevent_Block_Data& uevent_data) {
 			}
 			if (device == uevent_data.sysfs_path.substr(0, device.size())) {
 				// Found a match
+				// Whatever the cache knew about this device may be stale now
+				(*iter)->Invalidate_FS_Type();
 				if (uevent_data.action == "add") {
 					(*iter)->Primary_Block_Device = "/dev/block/" + uevent_data.block_device;
 					(*iter)->Alternate_Block_Device = (*iter)->Primary_Block_Device;
@@ -3851,13 +4171,20 @@ int TWPartitionManager::Run_OTA_Survival_Backup(bool adbbackup)
   while (end_pos != string::npos && start_pos < Backup_List.size())
     {
       if (stop_backup.get_value() != 0)
-	return -1;
+	{
+	  if (!adbbackup)
+	    Sync_Backup_Storage(part_settings.Backup_Folder);
+	  return -1;
+	}
       backup_path = Backup_List.substr(start_pos, end_pos - start_pos);
       part_settings.Part = Find_Partition_By_Path(backup_path);
       if (part_settings.Part != NULL)
 	{
 	  if (!Backup_Partition(&part_settings))
-	    return false;
+	    {
+	      Backup_Failed(&part_settings);
+	      return false;
+	    }
 	}
       else
 	{
@@ -3870,6 +4197,9 @@ int TWPartitionManager::Run_OTA_Survival_Backup(bool adbbackup)
       end_pos = Backup_List.find(";", start_pos);
     }
 
+  if (!adbbackup)
+    Sync_Backup_Storage(part_settings.Backup_Folder);
+
   // Average BPS
   if (part_settings.img_time == 0)
     part_settings.img_time = 1;
@@ -22,6 +22,8 @@
 #ifndef __TWRP_Partition_Manager
 #define __TWRP_Partition_Manager
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <vector>
 #include <string>
@@ -104,6 +106,13 @@ enum PartitionManager_Op {                                                    //
 
 class TWPartition;
 
+struct Bandwidth_Budget {                                                         // Byte rate shared by all image backups running concurrently
+	uint64_t limit = 0;                                                       // Bytes per second, 0 for no limit
+	timespec start;                                                           // When the budget started counting
+	std::atomic<uint64_t> used{0};                                            // Bytes charged so far by all users
+	void Charge(uint64_t bytes);                                              // Sleeps until bytes more fit in the budget
+};
+
 struct PartitionSettings {                                                        // Settings for backup session
 	TWPartition* Part;                                                        // Partition to pass to the partition backup loop
 	std::string Backup_Folder;                                                // Path to restore folder
@@ -120,6 +129,11 @@ struct PartitionSettings {
 	uint64_t file_bytes;                                                      // total file bytes of all file based partitions
 	int partition_count;                                                      // Number of partitions to restore
 	ProgressTracking *progress;                                               // Keep track of progress in GUI
+	Bandwidth_Budget* bandwidth = NULL;                                       // Budget Raw_Read_Write charges, NULL for no limit
+	bool background = false;                                                  // Image backup on a worker thread: no GUI or DataManager access, the caller reports the result
+	const std::atomic<bool>* cancel = NULL;                                   // Stops a background image backup at its next block when set
+	uint64_t child_cpu_ms = 0;                                                // CPU time of the children reaped during the last file backup: the tar fork, pigz and openaes
+	uint64_t digest_ms = 0;                                                   // Time spent generating digests for the whole backup
 	enum PartitionManager_Op PM_Method;                                       // Current operation of backup or restore
 };
 
@@ -162,10 +176,13 @@ public:
 	bool Decrypt(string Password);                                            // Decrypts the partition, return 0 for failure and -1 for success
 	bool Wipe_Encryption();                                                   // Ignores wipe commands for /data/media devices and formats the original block device
 	void Check_FS_Type();                                                     // Checks the fs type using blkid, does not do anything on MTD / yaffs2 because this crashes on some devices
+	void Invalidate_FS_Type();                                                // Forgets the cached blkid result for the partition's block devices
+	static void Probe_FS_Types(const std::vector<TWPartition*>& Partitions);  // Runs blkid on all partitions in parallel so later Check_FS_Type calls hit the cache
 	bool Update_Size(bool Display_Error);                                     // Updates size information
 	void Recreate_Media_Folder();                                             // Recreates the /data/media folder
 
 	bool Flash_Image(PartitionSettings *part_settings);                       // Flashes an image to the partition
+	bool Flash_Generated_Image(const std::function<bool(const string&)>& Write_Image); // Flashes an image that Write_Image writes to the given block device or file
 	void Change_Mount_Read_Only(bool new_value);                              // Changes Mount_Read_Only to new_value
 	bool Is_Read_Only();                                                      // Check if system is read-only in TWRP
 	int Check_Lifetime_Writes();
@@ -182,6 +199,8 @@ public:
 	string Get_Mount_Point();						  // Return Mount_Point or directory the current partition is mounted on
 	void Set_Can_Be_Backed_Up(bool val);					  // Update whether the partition can be backed up or not
 	void Set_Can_Be_Wiped(bool val);					  // Update whether the partition can be wiped or not
+	unsigned int Get_Mount_Generation();                                      // Returns a counter that changes whenever the partition contents may have changed while unmounted
+	void Contents_Changed();                                                  // Bumps the mount generation and forgets the cached file system type
 
 public:
 	string Current_File_System;                                               // Current file system
@@ -241,12 +260,12 @@ private:
 	bool Restore_Image(PartitionSettings *part_settings);                     // Restore using dd for images
 	bool Check_Restore_File_MD5(const string& Filename);                      // Verifies MD5 matches for a file before restoration
 	bool Get_Size_Via_statfs(bool Display_Error);                             // Get Partition size, used, and free space using statfs
-	bool Get_Size_Via_df(bool Display_Error);                                 // Get Partition size, used, and free space using df command
 	bool Make_Dir(string Path, bool Display_Error);                           // Creates a directory if it doesn't already exist
 	bool Find_MTD_Block_Device(string MTD_Name);                              // Finds the mtd block device based on the name from the fstab
 	void Recreate_AndSec_Folder(void);                                        // Recreates the .android_secure folder
 	bool Mount_Storage_Retry(bool Display_Error);                             // Tries multiple times with a half second delay to mount a device in case storage is slow to mount
 	bool Is_Sparse_Image(const string& Filename);                             // Determines if a file is in sparse image format
+	bool Can_Flash_Image();                                                   // Checks that images may be flashed to the partition and finds its size
 	bool Flash_Sparse_Image(const string& Filename);                          // Flashes a sparse image using simg2img
 	bool Flash_Image_FI(const string& Filename, ProgressTracking *progress);  // Flashes an image to the partition using flash_image for mtd nand
 	void ExcludeAll(const string& path);                                      // Adds an exclusion for path to both the backup and wipe exclusion lists
@@ -310,6 +329,7 @@ private:
 	string Original_Path;
 	bool Use_Original_Path;
 	bool Needs_Fs_Compress;
+	std::atomic<unsigned int> Mount_Generation;                               // Bumped on unmount and before and after wipe, restore and image flash; used to invalidate cached file contents
 
 	struct partition_fs_flags_struct {                                        // This struct is used to store mount flags and options for different file systems for the same partition
 		string File_System;
@@ -449,6 +469,9 @@ private:
 	void Setup_Settings_Storage_Partition(TWPartition* Part);                 // Sets up settings storage
 	void Setup_Android_Secure_Location(TWPartition* Part);                    // Sets up .android_secure if needed
 	bool Backup_Partition(struct PartitionSettings *part_settings);           // Backup the partitions based on type
+	bool Finish_Image_Backup(struct PartitionSettings *part_settings, int32_t backup_ms); // Digests and reports an image backed up on a worker thread
+	void Backup_Failed(struct PartitionSettings *part_settings);              // Cleans up a failed backup once no backup work is running
+	void Sync_Backup_Storage(const string& Backup_Folder);                    // Flushes only the file system holding the backup folder
 	TWPartition* Find_Partition_By_MTP_Storage_ID(unsigned int Storage_ID);   // Returns a pointer to a partition based on MTP Storage ID
 	bool Add_Remove_MTP_Storage(TWPartition* Part, int message_type);         // Adds or removes an MTP Storage partition
 	TWPartition* Find_Next_Storage(string Path, bool Exclude_Data_Media);
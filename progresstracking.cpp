@@ -26,10 +26,79 @@
 #include "data.hpp"
 #endif
 #include "twrp-functions.hpp"
+#include <inttypes.h>
+#include <stdio.h>
 #include <time.h>
 
 const int32_t update_interval_ms = 200; // Update interval in ms
 
+ProgressEvent::ProgressEvent(const char* event) {
+	line = "{";
+	Add("event", event);
+}
+
+ProgressEvent& ProgressEvent::Add(const char* key, const std::string& value) {
+	if (line.size() > 1)
+		line += ',';
+	line += '"';
+	line += key;
+	line += "\":\"";
+	for (unsigned char c : value) {
+		if (c == '"' || c == '\\') {
+			line += '\\';
+			line += c;
+		} else if (c < 0x20) {
+			char esc[8];
+			snprintf(esc, sizeof(esc), "\\u%04x", c);
+			line += esc;
+		} else {
+			line += c;
+		}
+	}
+	line += '"';
+	return *this;
+}
+
+ProgressEvent& ProgressEvent::Add(const char* key, const char* value) {
+	return Add(key, std::string(value ? value : ""));
+}
+
+ProgressEvent& ProgressEvent::Add(const char* key, unsigned long long value) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%llu", value);
+	line += ",\"";
+	line += key;
+	line += "\":";
+	line += buf;
+	return *this;
+}
+
+ProgressEvent& ProgressEvent::Add(const char* key, long long value) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%lld", value);
+	line += ",\"";
+	line += key;
+	line += "\":";
+	line += buf;
+	return *this;
+}
+
+ProgressEvent& ProgressEvent::Add(const char* key, double value) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.2f", value);
+	line += ",\"";
+	line += key;
+	line += "\":";
+	line += buf;
+	return *this;
+}
+
+void ProgressEvent::Send() {
+#ifndef BUILD_TWRPTAR_MAIN
+	gui_event(line + "}");
+#endif
+}
+
 ProgressTracking::ProgressTracking(const unsigned long long backup_size) {
 	total_backup_size = backup_size;
 	partition_size = 0;
@@ -39,40 +108,138 @@ ProgressTracking::ProgressTracking(const unsigned long long backup_size) {
 	previous_partitions_size = 0;
 	display_file_count = false;
 	clock_gettime(CLOCK_MONOTONIC, &last_update);
+	parent = NULL;
+	concurrent_size = 0;
+	rate_update = last_update;
+	rate_size = 0;
+}
+
+ProgressTracking::ProgressTracking(ProgressTracking* parent_tracker) : ProgressTracking(0ULL) {
+	parent = parent_tracker;
+	std::lock_guard<std::mutex> lock(parent->update_lock);
+	parent->children.push_back(this);
+}
+
+ProgressTracking::~ProgressTracking() {
+	if (!parent)
+		return;
+	std::lock_guard<std::mutex> lock(parent->update_lock);
+	for (std::vector<ProgressTracking*>::iterator it = parent->children.begin(); it != parent->children.end(); ++it) {
+		if (*it == this) {
+			parent->children.erase(it);
+			break;
+		}
+	}
+}
+
+std::mutex& ProgressTracking::Lock() {
+	return parent ? parent->update_lock : update_lock;
 }
 
 void ProgressTracking::SetPartitionSize(const unsigned long long part_size) {
-	previous_partitions_size += partition_size;
-	partition_size = part_size;
+	if (parent) {
+		std::lock_guard<std::mutex> lock(Lock());
+		partition_size = part_size;
+		current_size = 0;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(update_lock);
+		previous_partitions_size += partition_size;
+		partition_size = part_size;
+		current_size = 0;
+	}
 	UpdateDisplayDetails(true);
 }
 
 void ProgressTracking::SetSizeCount(const unsigned long long part_size, unsigned long long f_count) {
-	previous_partitions_size += partition_size;
-	partition_size = part_size;
-	file_count = f_count;
-	display_file_count = (file_count != 0);
+	if (parent) {
+		std::lock_guard<std::mutex> lock(Lock());
+		partition_size = part_size;
+		current_size = 0;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(update_lock);
+		previous_partitions_size += partition_size;
+		partition_size = part_size;
+		current_size = 0;
+		file_count = f_count;
+		display_file_count = (file_count != 0);
+	}
 	UpdateDisplayDetails(true);
 }
 
 void ProgressTracking::UpdateSize(const unsigned long long size) {
-	current_size = size;
+	if (parent) {
+		// Only the growth since the last update is passed on to the shared tracker;
+		// the thread owning it sends the progress events of both
+		std::lock_guard<std::mutex> lock(Lock());
+		if (size > current_size)
+			parent->concurrent_size += size - current_size;
+		current_size = size;
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(update_lock);
+		current_size = size;
+	}
 	UpdateDisplayDetails(false);
 }
 
 void ProgressTracking::UpdateSizeCount(const unsigned long long size, const unsigned long long count) {
-	current_size = size;
-	current_count = count;
+	if (parent) {
+		UpdateSize(size);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(update_lock);
+		current_size = size;
+		current_count = count;
+	}
 	UpdateDisplayDetails(false);
 }
 
 void ProgressTracking::DisplayFileCount(const bool display) {
-	display_file_count = display;
+	if (parent)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(update_lock);
+		display_file_count = display;
+	}
 	UpdateDisplayDetails(true);
 }
 
+void ProgressTracking::SetPhase(const std::string& partition, const std::string& new_phase) {
+	{
+		std::lock_guard<std::mutex> lock(Lock());
+		partition_name = partition;
+		phase = new_phase;
+	}
+	ProgressEvent("phase").Add("partition", partition).Add("phase", new_phase).Send();
+}
+
+void ProgressTracking::SendProgress(timespec now, const unsigned long long done) {
+	int32_t diff = TWFunc::timespec_diff_ms(rate_update, now);
+	double rate = 0.0;
+	if (diff > 0 && done >= rate_size)
+		rate = (double)(done - rate_size) * 1000.0 / (double)diff;
+	rate_update = now;
+	rate_size = done;
+
+	ProgressEvent event("progress");
+	event.Add("partition", partition_name).Add("phase", phase);
+	event.Add("bytes_done", current_size).Add("bytes_total", partition_size);
+	if (!parent)
+		event.Add("total_done", done).Add("total_bytes", total_backup_size);
+	event.Add("bytes_per_sec", rate).Send();
+}
+
 void ProgressTracking::UpdateDisplayDetails(const bool force) {
 #ifndef BUILD_TWRPTAR_MAIN
+	if (parent)
+		return; // the GUI is only updated from the thread owning the parent tracker
+	std::lock_guard<std::mutex> lock(update_lock);
 	if (!force) {
 		// Do something to check the time frame and only update periodically to reduce the total number of GUI updates
 		timespec now;
@@ -83,16 +250,19 @@ void ProgressTracking::UpdateDisplayDetails(const bool force) {
 			return;
 	}
 	clock_gettime(CLOCK_MONOTONIC, &last_update);
+	SendProgress(last_update, current_size + previous_partitions_size + concurrent_size);
+	for (ProgressTracking* child : children)
+		child->SendProgress(last_update, child->current_size);
 	double display_percent = 0.0, progress_percent;
 	//string size_prog = gui_lookup("size_progress", "%lluMB of %lluMB, %i%%");
 	string size_prog = gui_lookup("size_progress_v2", "%lluMB of %lluMB (%i%%)");
 	char size_progress[1024];
 
 	if (total_backup_size != 0) // prevent division by 0
-		display_percent = (double)(current_size + previous_partitions_size) / (double)(total_backup_size) * 100;
+		display_percent = (double)(current_size + previous_partitions_size + concurrent_size) / (double)(total_backup_size) * 100;
 	if (display_percent > 100.0) //prevent displaying 146% in gui
 		display_percent = 100.0;
-	sprintf(size_progress, size_prog.c_str(), (current_size + previous_partitions_size) / 1048576, total_backup_size / 1048576, (int)(display_percent));
+	sprintf(size_progress, size_prog.c_str(), (current_size + previous_partitions_size + concurrent_size) / 1048576, total_backup_size / 1048576, (int)(display_percent));
 	DataManager::SetValue("tw_size_progress", size_progress);
 	progress_percent = (display_percent / 100);
 	DataManager::SetProgress((float)(progress_percent));
@@ -20,12 +20,36 @@
 #define __PROGRESSTRACKING_HPP
 
 #include <time.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// One line of the machine readable event stream sent to ORS clients, built as a flat JSON object
+// {"event":"progress","partition":"Data",...}. Nothing is sent unless tw_ors_events is set and an
+// ORS command is running.
+class ProgressEvent
+{
+public:
+	explicit ProgressEvent(const char* event);
+
+	ProgressEvent& Add(const char* key, const std::string& value);
+	ProgressEvent& Add(const char* key, const char* value);
+	ProgressEvent& Add(const char* key, unsigned long long value);
+	ProgressEvent& Add(const char* key, long long value);
+	ProgressEvent& Add(const char* key, double value);
+	void Send();
+
+private:
+	std::string line;
+};
 
 // Progress tracking class for tracking backup progess and updating the progress bar as appropriate
 class ProgressTracking
 {
 public:
 	ProgressTracking(const unsigned long long backup_size);
+	explicit ProgressTracking(ProgressTracking* parent_tracker);          // Tracks one partition backed up concurrently and reports its progress into parent_tracker
+	~ProgressTracking();
 
 	void SetPartitionSize(const unsigned long long part_size);
 	void SetSizeCount(const unsigned long long part_size, unsigned long long f_count);
@@ -35,6 +59,11 @@ public:
 
 	void DisplayFileCount(const bool display);
 	void UpdateDisplayDetails(const bool force);
+	void SetPhase(const std::string& partition, const std::string& new_phase); // Names the partition and phase reported in progress events
+
+private:
+	void SendProgress(timespec now, const unsigned long long done);       // Sends a progress event, rate is measured against the previous one
+	std::mutex& Lock();                                                   // update_lock of the tracker that owns the display
 
 private:
 	unsigned long long total_backup_size;              // Overall size (for the progress bar)
@@ -49,6 +78,14 @@ private:
 
 	bool display_file_count;                           // Inidicates if we will display the file count text
 	timespec last_update;                              // Tracks last update of the displayed progress (frequent updates tax the CPU and slow us down)
+	ProgressTracking* parent;                          // Tracker that owns the display when this one tracks a concurrent partition
+	std::vector<ProgressTracking*> children;           // Trackers of concurrent partitions; their progress events are sent with this one's
+	unsigned long long concurrent_size;                // Data backed up so far by concurrently running partitions
+	std::mutex update_lock;                            // Serializes updates from concurrent partitions, also guards the children's state
+	std::string partition_name;                        // Partition and phase reported in progress events
+	std::string phase;
+	timespec rate_update;                              // Time and bytes done of the last progress event, for the throughput
+	unsigned long long rate_size;
 };
 
 #endif //__PROGRESSTRACKING_HPP
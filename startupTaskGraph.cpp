@@ -0,0 +1,170 @@
+/*
+	Copyright (C) 2018-2023 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <thread>
+#include <time.h>
+
+#include "startupTaskGraph.hpp"
+#include "twcommon.h"
+
+#define STARTUP_MAX_THREADS 4
+
+void startupTaskGraph::Add(const std::string& name, std::function<bool()> task, const std::vector<std::string>& deps, bool main_thread) {
+	Task t;
+	t.name = name;
+	t.func = task;
+	t.unfinished_deps = 0;
+	t.main_thread = main_thread;
+	t.state = PENDING;
+	t.thread = -1;
+	t.start_ms = t.end_ms = 0;
+	size_t index = tasks.size();
+	for (auto&& dep:deps) {
+		auto it = std::find_if(tasks.begin(), tasks.end(), [&dep](const Task& other) { return other.name == dep; });
+		if (it == tasks.end()) {
+			// stages are added in an order where dependencies come first
+			LOGERR("Startup stage '%s' depends on unknown stage '%s'\n", name.c_str(), dep.c_str());
+			continue;
+		}
+		it->dependents.push_back(index);
+		t.unfinished_deps++;
+	}
+	if (t.unfinished_deps == 0)
+		t.state = READY;
+	tasks.push_back(t);
+}
+
+bool startupTaskGraph::Run() {
+	uint64_t start_ms = Boot_Time_Ms();
+	size_t background = 0;
+	for (auto&& t:tasks) {
+		if (!t.main_thread)
+			background++;
+	}
+	remaining = tasks.size();
+
+	std::vector<std::thread> workers;
+	size_t threads = std::min<size_t>(background, STARTUP_MAX_THREADS);
+	for (size_t i = 0; i < threads; i++)
+		workers.emplace_back(&startupTaskGraph::Worker, this, (int)i + 1, false);
+	Worker(0, true);
+	for (auto&& w:workers)
+		w.join();
+
+	Log_Trace(start_ms);
+	for (auto&& t:tasks) {
+		if (t.state != DONE)
+			return false;
+	}
+	return true;
+}
+
+bool startupTaskGraph::Succeeded(const std::string& name) {
+	for (auto&& t:tasks) {
+		if (t.name == name)
+			return t.state == DONE;
+	}
+	return false;
+}
+
+// The calling thread runs the main_thread stages and helps out with the
+// others; the pool threads only run stages that may leave the main thread.
+void startupTaskGraph::Worker(int thread, bool is_main) {
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;) {
+		size_t index = 0;
+		bool found = false;
+		cond.wait(guard, [&]() {
+			if (remaining == 0)
+				return true;
+			found = Take_Ready(is_main, &index);
+			return found;
+		});
+		if (!found)
+			break;
+
+		Task& task = tasks[index];
+		task.thread = thread;
+		task.start_ms = Boot_Time_Ms();
+		guard.unlock();
+		bool ok = task.func();
+		guard.lock();
+		task.end_ms = Boot_Time_Ms();
+		Finish(index, ok);
+		cond.notify_all();
+	}
+	cond.notify_all();
+}
+
+bool startupTaskGraph::Take_Ready(bool is_main, size_t* index) {
+	// main thread stages first, so the UI comes up as early as possible
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; i < tasks.size(); i++) {
+			Task& t = tasks[i];
+			if (t.state != READY || t.main_thread != (pass == 0))
+				continue;
+			if (t.main_thread && !is_main)
+				continue;
+			t.state = RUNNING;
+			*index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void startupTaskGraph::Finish(size_t index, bool ok) {
+	std::vector<size_t> finished = { index };
+	tasks[index].state = ok ? DONE : FAILED;
+	while (!finished.empty()) {
+		Task& t = tasks[finished.back()];
+		finished.pop_back();
+		remaining--;
+		for (size_t dep:t.dependents) {
+			Task& d = tasks[dep];
+			if (t.state != DONE && d.state == PENDING) {
+				LOGINFO("Skipping startup stage '%s' because '%s' did not complete\n", d.name.c_str(), t.name.c_str());
+				d.state = SKIPPED;
+				finished.push_back(dep);
+				continue;
+			}
+			if (d.state == PENDING && --d.unfinished_deps == 0)
+				d.state = READY;
+		}
+	}
+}
+
+void startupTaskGraph::Log_Trace(uint64_t start_ms) {
+	static const char* state_names[] = { "pending", "ready", "running", "done", "failed", "skipped" };
+	LOGINFO("Startup trace (ms since boot, graph started at %llu):\n", (unsigned long long)start_ms);
+	for (auto&& t:tasks) {
+		if (t.state == DONE || t.state == FAILED)
+			LOGINFO("  %-24s %6llu -> %6llu  %5llu ms  thread %d  %s\n", t.name.c_str(), (unsigned long long)t.start_ms,
+				(unsigned long long)t.end_ms, (unsigned long long)(t.end_ms - t.start_ms), t.thread, state_names[t.state]);
+		else
+			LOGINFO("  %-24s %s\n", t.name.c_str(), state_names[t.state]);
+	}
+	LOGINFO("Startup graph finished in %llu ms\n", (unsigned long long)(Boot_Time_Ms() - start_ms));
+}
+
+uint64_t startupTaskGraph::Boot_Time_Ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
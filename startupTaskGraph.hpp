@@ -0,0 +1,64 @@
+/*
+	Copyright (C) 2018-2023 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STARTUPTASKGRAPH_HPP
+#define STARTUPTASKGRAPH_HPP
+
+#include <condition_variable>
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Runs the startup stages as a dependency graph: every stage starts as soon
+// as the stages it depends on have finished, independent stages run on a
+// small thread pool, and a per-stage timing trace is written to the log.
+class startupTaskGraph {
+public:
+	// A stage returns false on failure; stages depending on it are then skipped.
+	// Stages that drive the GUI must set main_thread so they run on the caller.
+	void Add(const std::string& name, std::function<bool()> task, const std::vector<std::string>& deps = {}, bool main_thread = false);
+	bool Run(); // false if any stage failed or was skipped
+	bool Succeeded(const std::string& name);
+
+private:
+	enum State { PENDING, READY, RUNNING, DONE, FAILED, SKIPPED };
+	struct Task {
+		std::string name;
+		std::function<bool()> func;
+		std::vector<size_t> dependents;
+		size_t unfinished_deps;
+		bool main_thread;
+		State state;
+		int thread;
+		uint64_t start_ms, end_ms; // CLOCK_BOOTTIME
+	};
+
+	void Worker(int thread, bool is_main);
+	bool Take_Ready(bool is_main, size_t* index);
+	void Finish(size_t index, bool ok);
+	void Log_Trace(uint64_t start_ms);
+	static uint64_t Boot_Time_Ms();
+
+	std::vector<Task> tasks;
+	std::mutex lock;
+	std::condition_variable cond;
+	size_t remaining = 0;
+};
+#endif
@@ -16,10 +16,14 @@
 	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include "libtar/libtar.h"
 #include "twcommon.h"
 
@@ -30,12 +34,45 @@ unsigned buffer_loc = 0;
 int buffer_status = 0;
 int prog_pipe = -1;
 const unsigned long long progress_size = (unsigned long long)(T_BLOCKSIZE);
+const unsigned long long writeback_size = 8 * 1024 * 1024;
+unsigned long long writeback_pending = 0;
+unsigned long long writeback_written = 0;
+unsigned long long writeback_start = 0;
+unsigned long long writeback_prev = 0;
+int writeback_fd = -1;
+
+static void reset_writeback(void) {
+	writeback_pending = 0;
+	writeback_written = 0;
+	writeback_start = 0;
+	writeback_prev = 0;
+}
+
+/* Starts writeback of the archive up to end once a window of writeback_size
+   has built up and waits for the previous window, so the page cache never
+   holds more than two windows of dirty archive data (as Raw_Read_Write does).
+*/
+static void start_writeback(int fd, unsigned long long end) {
+	if (end < writeback_start + writeback_size)
+		return;
+	sync_file_range(fd, writeback_start, end - writeback_start, SYNC_FILE_RANGE_WRITE);
+	if (writeback_start > writeback_prev)
+		sync_file_range(fd, writeback_prev, writeback_start - writeback_prev,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	writeback_prev = writeback_start;
+	writeback_start = end;
+}
+
+void finish_libtar_writeback(int fd) {
+	sync_file_range(fd, writeback_start, 0, SYNC_FILE_RANGE_WRITE);
+}
 
 void reinit_libtar_buffer(void) {
 	flush = 0;
 	eot_count = -1;
 	buffer_loc = 0;
 	buffer_status = 1;
+	reset_writeback();
 }
 
 void init_libtar_buffer(unsigned new_buff_size, int pipe_fd) {
@@ -45,6 +82,7 @@ void init_libtar_buffer(unsigned new_buff_size, int pipe_fd) {
 	reinit_libtar_buffer();
 	write_buffer = (unsigned char*) malloc(sizeof(char *) * buffer_size);
 	prog_pipe = pipe_fd;
+	writeback_fd = -1;
 }
 
 void free_libtar_buffer(void) {
@@ -86,6 +124,8 @@ ssize_t write_libtar_buffer(int fd, const void *buffer, size_t size) {
 			unsigned long long fs = (unsigned long long)(buffer_loc);
 			write(prog_pipe, &fs, sizeof(fs));
 			buffer_loc = 0;
+			writeback_written += fs;
+			start_writeback(fd, writeback_written);
 			return size;
 		}
 	} else {
@@ -101,13 +141,26 @@ void flush_libtar_buffer(int fd) {
 		buffer_status = 2;
 }
 
-void init_libtar_no_buffer(int pipe_fd) {
+void init_libtar_no_buffer(int pipe_fd, int output_fd) {
 	buffer_size = T_BLOCKSIZE;
 	prog_pipe = pipe_fd;
 	buffer_status = 0;
+	writeback_fd = output_fd;
+	reset_writeback();
 }
 
 ssize_t write_libtar_no_buffer(int fd, const void *buffer, size_t size) {
 	write(prog_pipe, &progress_size, sizeof(progress_size));
+	if (writeback_fd >= 0) {
+		/* pigz/openaes write the archive, so follow its size every
+		   writeback_size bytes fed to them */
+		writeback_pending += size;
+		if (writeback_pending >= writeback_size) {
+			struct stat st;
+			writeback_pending = 0;
+			if (fstat(writeback_fd, &st) == 0)
+				start_writeback(writeback_fd, st.st_size);
+		}
+	}
 	return write(fd, buffer, size);
 }
@@ -24,8 +24,9 @@ void init_libtar_buffer(unsigned new_buff_size, int pipe_fd);
 void free_libtar_buffer();
 writefunc_t write_libtar_buffer(int fd, const void *buffer, size_t size);
 void flush_libtar_buffer(int fd);
+void finish_libtar_writeback(int fd);
 
-void init_libtar_no_buffer(int pipe_fd);
+void init_libtar_no_buffer(int pipe_fd, int output_fd);
 writefunc_t write_libtar_no_buffer(int fd, const void *buffer, size_t size);
 
 #endif  // _TARWRITE_HEADER
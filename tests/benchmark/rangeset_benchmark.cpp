@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "otautil/rangeset.h"
+
+// A heavily fragmented map: |count| 3-block ranges with 1-block gaps, like a block-mapped package
+// on a full file system.
+static RangeSet MakeFragmented(size_t count, size_t first_block) {
+  RangeSet rs;
+  for (size_t i = 0; i < count; i++) {
+    rs.PushBack({ first_block + i * 4, first_block + i * 4 + 3 });
+  }
+  return rs;
+}
+
+static void BM_GetBlockNumber(benchmark::State& state) {
+  RangeSet rs = MakeFragmented(state.range(0), 0);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<size_t> dist(0, rs.blocks() - 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rs.GetBlockNumber(dist(rng)));
+  }
+}
+BENCHMARK(BM_GetBlockNumber)->Arg(1000)->Arg(100000);
+
+// The access pattern of FuseBlockDataProvider: one 64 KiB block after another.
+static void BM_GetSubRanges_sequential(benchmark::State& state) {
+  RangeSet rs = MakeFragmented(state.range(0), 0);
+  constexpr size_t kFuseBlocks = 16;
+  size_t start = 0;
+  for (auto _ : state) {
+    if (start + kFuseBlocks > rs.blocks()) {
+      start = 0;
+    }
+    benchmark::DoNotOptimize(rs.GetSubRanges(start, kFuseBlocks));
+    start += kFuseBlocks;
+  }
+}
+BENCHMARK(BM_GetSubRanges_sequential)->Arg(1000)->Arg(100000);
+
+static void BM_Overlaps(benchmark::State& state) {
+  // Interleaved without overlapping, so every range has to be looked at.
+  RangeSet r1 = MakeFragmented(state.range(0), 0);
+  RangeSet r2;
+  for (size_t i = 0; i < static_cast<size_t>(state.range(0)); i++) {
+    r2.PushBack({ i * 4 + 3, i * 4 + 4 });
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(r1.Overlaps(r2));
+  }
+}
+BENCHMARK(BM_Overlaps)->Arg(1000)->Arg(100000);
+
+static void BM_SortedRangeSet_Insert(benchmark::State& state) {
+  std::vector<Range> ranges;
+  std::mt19937 rng(0);
+  for (size_t i = 0; i < static_cast<size_t>(state.range(0)); i++) {
+    size_t start = rng() % (state.range(0) * 8);
+    ranges.emplace_back(start, start + 1 + rng() % 4);
+  }
+  for (auto _ : state) {
+    SortedRangeSet rs;
+    for (const auto& range : ranges) {
+      rs.Insert(range);
+    }
+    benchmark::DoNotOptimize(rs.blocks());
+  }
+}
+BENCHMARK(BM_SortedRangeSet_Insert)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void BM_SortedRangeSet_GetOffsetInRangeSet(benchmark::State& state) {
+  SortedRangeSet rs;
+  for (size_t i = 0; i < static_cast<size_t>(state.range(0)); i++) {
+    rs.Insert({ i * 4, i * 4 + 3 });
+  }
+  std::mt19937 rng(0);
+  for (auto _ : state) {
+    size_t block = rs.GetBlockNumber(rng() % rs.blocks());
+    benchmark::DoNotOptimize(rs.GetOffsetInRangeSet(block * SortedRangeSet::kBlockSize));
+  }
+}
+BENCHMARK(BM_SortedRangeSet_GetOffsetInRangeSet)->Arg(1000)->Arg(100000);
+
+BENCHMARK_MAIN();
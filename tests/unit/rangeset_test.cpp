@@ -124,6 +124,24 @@ TEST(RangeSetTest, Overlaps) {
   ASSERT_FALSE(RangeSet::Parse("2,5,7").Overlaps(RangeSet::Parse("2,3,5")));
 }
 
+TEST(RangeSetTest, Overlaps_many_ranges) {
+  // Enough ranges on both sides to take the sorted sweep rather than the pairwise checks.
+  std::vector<Range> even;
+  std::vector<Range> odd;
+  for (size_t i = 0; i < 100; i++) {
+    even.emplace_back((99 - i) * 20, (99 - i) * 20 + 10);
+    odd.emplace_back(i * 20 + 10, i * 20 + 20);
+  }
+  RangeSet r1(std::move(even));
+  RangeSet r2(std::move(odd));
+  ASSERT_FALSE(r1.Overlaps(r2));
+  ASSERT_FALSE(r2.Overlaps(r1));
+
+  ASSERT_TRUE(r2.PushBack({ 1009, 1010 }));
+  ASSERT_TRUE(r1.Overlaps(r2));
+  ASSERT_TRUE(r2.Overlaps(r1));
+}
+
 TEST(RangeSetTest, Split) {
   RangeSet rs1 = RangeSet::Parse("2,1,2");
   ASSERT_TRUE(rs1);
@@ -215,6 +233,21 @@ TEST(RangeSetTest, GetBlockNumber) {
   ASSERT_EXIT(rs.GetBlockNumber(9), ::testing::KilledBySignal(SIGABRT), "");
 }
 
+TEST(RangeSetTest, GetBlockNumber_many_ranges) {
+  RangeSet rs;
+  for (size_t i = 0; i < 1000; i++) {
+    ASSERT_TRUE(rs.PushBack({ i * 10, i * 10 + 3 }));
+  }
+  ASSERT_EQ(static_cast<size_t>(0), rs.GetBlockNumber(0));
+  ASSERT_EQ(static_cast<size_t>(2), rs.GetBlockNumber(2));
+  ASSERT_EQ(static_cast<size_t>(10), rs.GetBlockNumber(3));
+  ASSERT_EQ(static_cast<size_t>(5001), rs.GetBlockNumber(1501));
+  ASSERT_EQ(static_cast<size_t>(9992), rs.GetBlockNumber(2999));
+
+  ASSERT_EQ(RangeSet({ { 5001, 5003 }, { 5010, 5013 }, { 5020, 5021 } }),
+            rs.GetSubRanges(1501, 6));
+}
+
 TEST(RangeSetTest, equality) {
   ASSERT_EQ(RangeSet::Parse("2,1,6"), RangeSet::Parse("2,1,6"));
 
@@ -292,6 +325,24 @@ TEST(SortedRangeSetTest, Insert) {
   ASSERT_EQ(static_cast<size_t>(22), rs.blocks());
 }
 
+TEST(SortedRangeSetTest, Insert_block_index) {
+  SortedRangeSet rs({ { 10, 12 }, { 20, 22 }, { 30, 32 } });
+  rs.Insert({ 0, 2 });
+  rs.Insert({ 25, 26 });
+  rs.Insert({ 12, 20 });
+  ASSERT_EQ(SortedRangeSet({ { 0, 2 }, { 10, 22 }, { 25, 26 }, { 30, 32 } }), rs);
+  ASSERT_EQ(static_cast<size_t>(17), rs.blocks());
+
+  ASSERT_EQ(static_cast<size_t>(1), rs.GetBlockNumber(1));
+  ASSERT_EQ(static_cast<size_t>(10), rs.GetBlockNumber(2));
+  ASSERT_EQ(static_cast<size_t>(25), rs.GetBlockNumber(14));
+  ASSERT_EQ(static_cast<size_t>(31), rs.GetBlockNumber(16));
+  ASSERT_EQ(static_cast<size_t>(4096 * 15 + 1), rs.GetOffsetInRangeSet(4096 * 30 + 1));
+
+  ASSERT_TRUE(rs.Overlaps(4096 * 25, 1));
+  ASSERT_FALSE(rs.Overlaps(4096 * 26, 4096 * 4));
+}
+
 TEST(SortedRangeSetTest, file_range) {
   SortedRangeSet rs;
   rs.Insert(4096, 4096);
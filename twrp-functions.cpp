@@ -36,6 +36,7 @@
 #include <sys/vfs.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <zlib.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -47,6 +48,12 @@
 #include <selinux/label.h>
 #include <android-base/properties.h>
 #include <thread>
+#include <mutex>
+#include <unordered_map>
+#include <map>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
 #include <android-base/chrono_utils.h>
 
 #include "twrp-functions.hpp"
@@ -396,63 +403,209 @@ void TWFunc::Run_Before_Reboot(void)
 }
 
 /* Execute a command */
-int TWFunc::Exec_Cmd(const string& cmd, string &result) {
-	FILE* exec;
-	char buffer[130];
-	int ret = 0;
-	exec = __popen(cmd.c_str(), "r");
-	if (!exec) return -1;
-	while (!feof(exec)) {
-		if (fgets(buffer, 128, exec) != NULL) {
-			result += buffer;
+struct exec_stats {
+	unsigned long count;
+	uint64_t total_ms;
+	uint64_t max_ms;
+};
+static std::mutex exec_stats_lock;
+static std::map<string, exec_stats> exec_stats_map;
+
+static uint64_t Exec_Time_Ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Shell syntax in a command needs sh; anything else is split on whitespace and run directly
+static bool Needs_Shell(const string& cmd) {
+	static const char* builtins[] = { "cd", "export", "set", "unset", "exit", ".", "source", "ulimit", "umask",
+		"exec", "eval", "command", "type", "read", "trap", "wait", "alias", "local", "return", "shift", NULL };
+	if (cmd.find_first_of("|&;<>()$`\\\"'*?[]#~{}!\t\n") != string::npos)
+		return true;
+	vector<string> args = TWFunc::split_string(cmd, ' ', true);
+	if (args.empty() || args[0].find('=') != string::npos)
+		return true;
+	for (int i = 0; builtins[i]; i++) {
+		if (args[0] == builtins[i])
+			return true;
+	}
+	return false;
+}
+
+static void Record_Exec_Time(const string& name, uint64_t start_ms) {
+	uint64_t elapsed = Exec_Time_Ms() - start_ms;
+	std::lock_guard<std::mutex> guard(exec_stats_lock);
+	exec_stats& stats = exec_stats_map[name];
+	stats.count++;
+	stats.total_ms += elapsed;
+	if (elapsed > stats.max_ms)
+		stats.max_ms = elapsed;
+}
+
+// Starts args with posix_spawn; stdout (and stderr if combine_stderr) go to out_fd when it is not -1
+static pid_t Spawn_Command(const vector<string>& args, bool search_path, int out_fd, bool combine_stderr) {
+	vector<char*> argv;
+	for (auto&& arg:args)
+		argv.push_back(const_cast<char*>(arg.c_str()));
+	argv.push_back(NULL);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (out_fd >= 0) {
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+		if (combine_stderr)
+			posix_spawn_file_actions_adddup2(&actions, out_fd, STDERR_FILENO);
+	}
+	// children should not inherit an ignored SIGPIPE
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t defaults;
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &defaults);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+	pid_t pid;
+	int ret;
+	if (search_path)
+		ret = posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+	else
+		ret = posix_spawn(&pid, argv[0], &actions, &attr, argv.data(), environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	if (ret != 0) {
+		errno = ret;
+		return -1;
+	}
+	return pid;
+}
+
+static pid_t Spawn_Shell_Command(const string& cmd, int out_fd, bool combine_stderr, string* name) {
+	if (!Needs_Shell(cmd)) {
+		vector<string> args = TWFunc::split_string(cmd, ' ', true);
+		*name = TWFunc::Get_Filename(args[0]);
+		pid_t pid = Spawn_Command(args, true, out_fd, combine_stderr);
+		if (pid >= 0 || errno != ENOENT)
+			return pid;
+		// not in PATH; let sh report it like before
+	}
+	string sh = "/sbin/sh";
+	if (!TWFunc::Path_Exists(sh))
+		sh = "/system/bin/sh";
+	vector<string> args = { sh, "-c", cmd };
+	*name = "sh -c " + cmd.substr(0, cmd.find_first_of(" \t"));
+	return Spawn_Command(args, false, out_fd, combine_stderr);
+}
+
+// Reads everything the child writes to fd, killing it once timeout_ms (if > 0) has passed
+static void Read_Command_Output(int fd, pid_t pid, string* output, int timeout_ms, const string& name) {
+	std::vector<char> buffer(64 * 1024);
+	uint64_t deadline = timeout_ms > 0 ? Exec_Time_Ms() + timeout_ms : 0;
+	for (;;) {
+		int wait_ms = -1;
+		if (deadline) {
+			uint64_t now = Exec_Time_Ms();
+			if (now >= deadline) {
+				LOGERR("%s took too long, killing process\n", name.c_str());
+				kill(pid, SIGKILL);
+				return;
+			}
+			wait_ms = deadline - now;
 		}
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int ret = TEMP_FAILURE_RETRY(poll(&pfd, 1, wait_ms));
+		if (ret < 0)
+			return;
+		if (ret == 0)
+			continue;
+		ssize_t len = TEMP_FAILURE_RETRY(read(fd, buffer.data(), buffer.size()));
+		if (len <= 0)
+			return;
+		if (output)
+			output->append(buffer.data(), len);
 	}
-	ret = __pclose(exec);
-	return ret;
+}
+
+int TWFunc::Run_Command(const string& cmd, string* output, bool combine_stderr, int timeout_ms) {
+	int pipe_fds[2];
+	if (pipe2(pipe_fds, O_CLOEXEC) < 0)
+		return -1;
+	uint64_t start_ms = Exec_Time_Ms();
+	string name;
+	pid_t pid = Spawn_Shell_Command(cmd, pipe_fds[1], combine_stderr, &name);
+	close(pipe_fds[1]);
+	if (pid < 0) {
+		LOGINFO("Unable to run '%s': %s\n", cmd.c_str(), strerror(errno));
+		close(pipe_fds[0]);
+		return -1;
+	}
+	Read_Command_Output(pipe_fds[0], pid, output, timeout_ms, cmd);
+	close(pipe_fds[0]);
+	int status;
+	if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != pid)
+		status = -1;
+	Record_Exec_Time(name, start_ms);
+	return status;
+}
+
+int TWFunc::Exec_Argv(const vector<string>& args, string* output, bool combine_stderr, int timeout_ms) {
+	if (args.empty())
+		return -1;
+	int pipe_fds[2];
+	if (pipe2(pipe_fds, O_CLOEXEC) < 0)
+		return -1;
+	uint64_t start_ms = Exec_Time_Ms();
+	pid_t pid = Spawn_Command(args, true, pipe_fds[1], combine_stderr);
+	close(pipe_fds[1]);
+	if (pid < 0) {
+		LOGINFO("Unable to run '%s': %s\n", args[0].c_str(), strerror(errno));
+		close(pipe_fds[0]);
+		return -1;
+	}
+	Read_Command_Output(pipe_fds[0], pid, output, timeout_ms, args[0]);
+	close(pipe_fds[0]);
+	int status;
+	if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != pid)
+		status = -1;
+	Record_Exec_Time(Get_Filename(args[0]), start_ms);
+	return status;
+}
+
+void TWFunc::Log_Exec_Stats() {
+	std::lock_guard<std::mutex> guard(exec_stats_lock);
+	if (exec_stats_map.empty())
+		return;
+	vector<std::pair<string, exec_stats>> sorted(exec_stats_map.begin(), exec_stats_map.end());
+	std::sort(sorted.begin(), sorted.end(), [](const std::pair<string, exec_stats>& a, const std::pair<string, exec_stats>& b) {
+		return a.second.total_ms > b.second.total_ms;
+	});
+	LOGINFO("External commands (runs, total ms, max ms):\n");
+	for (auto&& entry:sorted)
+		LOGINFO("  %-32s %5lu %8llu %6llu\n", entry.first.c_str(), entry.second.count,
+			(unsigned long long)entry.second.total_ms, (unsigned long long)entry.second.max_ms);
+}
+
+int TWFunc::Exec_Cmd(const string& cmd, string &result) {
+	return Run_Command(cmd, &result, false);
 }
 
 int TWFunc::Exec_Cmd(const string& cmd, bool Show_Errors) {
-	pid_t pid;
 	int status;
-	string tmp = "/sbin/sh";
-	if (!Path_Exists(tmp))
-	   tmp = "/system/bin/sh";
-	
-	switch(pid = fork())
-	{
-		case -1:
-			LOGERR("Exec_Cmd(): vfork failed: %d!\n", errno);
-			return -1;
-		case 0: // child
-			execl(tmp.c_str(), "sh", "-c", cmd.c_str(), NULL);
-			_exit(127);
-			break;
-		default:
-		{
-			if (TWFunc::Wait_For_Child(pid, &status, cmd, Show_Errors) != 0)
-				return -1;
-			else
-				return 0;
-		}
+	string name;
+	uint64_t start_ms = Exec_Time_Ms();
+	pid_t pid = Spawn_Shell_Command(cmd, -1, false, &name);
+	if (pid < 0) {
+		LOGERR("Exec_Cmd(): spawn failed: %d!\n", errno);
+		return -1;
 	}
+	int ret = TWFunc::Wait_For_Child(pid, &status, cmd, Show_Errors);
+	Record_Exec_Time(name, start_ms);
+	return ret != 0 ? -1 : 0;
 }
 
 int TWFunc::Exec_Cmd(const string& cmd, string &result, bool combine_stderr) {
-	FILE* exec;
-	char buffer[130];
-	int ret = 0;
-	std::string popen_cmd = cmd;
-	if (combine_stderr)
-		popen_cmd = cmd + " 2>&1";
-	exec = __popen(popen_cmd.c_str(), "r");
-
-	while (!feof(exec)) {
-		if (fgets(buffer, 128, exec) != NULL) {
-			result += buffer;
-		}
-	}
-	ret = __pclose(exec);
-	return ret;
+	return Run_Command(cmd, &result, combine_stderr);
 }
 
 // Returns "file.name" from a full /path/to/file.name
@@ -487,24 +640,9 @@ string TWFunc::Get_Path(const string & Path)
 string TWFunc::Exec_With_Output(const string &cmd)
 {
   string data;
-  FILE *stream;
-  const int max_buffer = 256;
-  char buffer[max_buffer];
-  string s = cmd + " 2>&1";
-
-  stream = popen(s.c_str(), "r");
-  if (stream)
-    {
-      while (!feof(stream))
-	{
-	  if (fgets(buffer, max_buffer, stream) != NULL)
-	     data.append(buffer);
-	}
-      pclose(stream);
-      return (Trim_Trailing_NewLine (data));
-    }
- else 
+  if (Run_Command(cmd, &data, true) == -1)
     return exec_error_str;
+  return (Trim_Trailing_NewLine (data));
 }
 
 int TWFunc::Wait_For_Child(pid_t pid, int *status, string Child_Name, bool Show_Errors) {
@@ -929,9 +1067,6 @@ void TWFunc::GUI_Operation_Text(string Read_Value, string Partition_Name,
 }
 
 void TWFunc::Copy_Log(string Source, string Destination) {
-	int logPipe[2];
-	int pigz_pid;
-	int destination_fd;
 	std::string destLogBuffer;
 
 	PartitionManager.Mount_By_Path(Destination, false);
@@ -940,16 +1075,20 @@ void TWFunc::Copy_Log(string Source, string Destination) {
 	std::string uncompressedLog(Destination);
 	uncompressedLog.replace(extPos, Destination.length(), "");
 
+	// The persistent log is compressed in process rather than through pigz
 	if (Path_Exists(Destination)) {
 		Archive_Type type = Get_File_Type(Destination);
 		if (type == COMPRESSED) {
-			std::string destFileBuffer;
-			std::string getCompressedContents = "pigz -c -d " + Destination;
-			if (Exec_Cmd(getCompressedContents, destFileBuffer) < 0) {
+			gzFile compressed = gzopen(Destination.c_str(), "rb");
+			if (!compressed) {
 				LOGINFO("Unable to get destination logfile contents.\n");
 				return;
 			}
-			destLogBuffer.append(destFileBuffer);
+			std::vector<char> buffer(64 * 1024);
+			int len;
+			while ((len = gzread(compressed, buffer.data(), buffer.size())) > 0)
+				destLogBuffer.append(buffer.data(), len);
+			gzclose(compressed);
 		}
 	} else if (Path_Exists(uncompressedLog)) {
 		std::ifstream uncompressedIfs(uncompressedLog);
@@ -967,44 +1106,15 @@ void TWFunc::Copy_Log(string Source, string Destination) {
 	std::string srcLogBuffer(ss.str());
 	ifs.close();
 
-	if (pipe(logPipe) < 0) {
-		LOGINFO("Unable to open pipe to write to persistent log file: %s\n", Destination.c_str());
-	}
-
-	destination_fd = open(Destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
-
-	pigz_pid = fork();
-	if (pigz_pid < 0) {
-		LOGINFO("fork() failed\n");
-		close(destination_fd);
-		close(logPipe[0]);
-		close(logPipe[1]);
-	} else if (pigz_pid == 0) {
-		close(logPipe[1]);
-		dup2(logPipe[0], fileno(stdin));
-		dup2(destination_fd, fileno(stdout));
-		if (execlp("pigz", "pigz", "-", NULL) < 0) {
-			close(destination_fd);
-			close(logPipe[0]);
-			_exit(-1);
-		}
-	} else {
-		close(logPipe[0]);
-		if (write(logPipe[1], destLogBuffer.c_str(), destLogBuffer.size()) < 0) {
-			LOGINFO("Unable to append to persistent log: %s\n", Destination.c_str());
-			close(logPipe[1]);
-			close(destination_fd);
-			return;
-		}
-		if (write(logPipe[1], srcLogBuffer.c_str(), srcLogBuffer.size()) < 0) {
-			LOGINFO("Unable to append to persistent log: %s\n", Destination.c_str());
-			close(logPipe[1]);
-			close(destination_fd);
-			return;
-		}
-		close(logPipe[1]);
+	gzFile destination = gzopen(Destination.c_str(), "wb");
+	if (!destination) {
+		LOGINFO("Unable to open persistent log file: %s\n", Destination.c_str());
+		return;
 	}
-	close(destination_fd);
+	if ((!destLogBuffer.empty() && gzwrite(destination, destLogBuffer.data(), destLogBuffer.size()) <= 0) ||
+		(!srcLogBuffer.empty() && gzwrite(destination, srcLogBuffer.data(), srcLogBuffer.size()) <= 0))
+		LOGINFO("Unable to append to persistent log: %s\n", Destination.c_str());
+	gzclose(destination);
 }
 
 void TWFunc::Update_Log_File(void) {
@@ -1060,6 +1170,7 @@ void TWFunc::Update_Intent_File(string Intent)
 int TWFunc::tw_reboot(RebootCommand command)
 {
 	DataManager::Flush();
+	Log_Exec_Stats();
 	Update_Log_File();
 
 	// Always force a sync before we reboot
@@ -1411,86 +1522,103 @@ string TWFunc::Get_Current_Date()
   return Current_Date;
 }
 
-string TWFunc::System_Property_Get(string Prop_Name) {
-	return System_Property_Get(Prop_Name, PartitionManager, PartitionManager.Get_Android_Root_Path(), "build.prop");
+// Parsed build.prop files, keyed by the full path of the prop file. An index
+// stays valid as long as the owning partition has not been unmounted, wiped,
+// restored or flashed since it was built (Mount_Generation) and the file's
+// mtime/size still match, so repeated lookups neither re-read the file nor
+// cycle the partition through mount/unmount.
+struct Prop_File_Index {
+	unsigned int generation;
+	struct timespec mtime;
+	off_t size;
+	std::unordered_map<string, string> props;
+};
+static std::unordered_map<string, Prop_File_Index> prop_file_cache;
+static std::mutex prop_file_cache_lock;
+
+static bool Prop_Index_Matches(const Prop_File_Index& index, const struct stat& st) {
+	return index.size == st.st_size && index.mtime.tv_sec == st.st_mtim.tv_sec &&
+		index.mtime.tv_nsec == st.st_mtim.tv_nsec;
 }
 
-string TWFunc::System_Property_Get(string Prop_Name, TWPartitionManager &PartitionManager, string Mount_Point, string prop_file_name) {
-	bool mount_state = PartitionManager.Is_Mounted_By_Path(Mount_Point);
+static bool Prop_Index_Build(const string& prop_file, const struct stat& st, Prop_File_Index& index) {
 	std::vector<string> buildprop;
+	if (TWFunc::read_file(prop_file, buildprop) != 0)
+		return false;
+	index.props.clear();
+	index.props.reserve(buildprop.size());
+	for (const string& line : buildprop) {
+		size_t end_pos = line.find('=');
+		if (end_pos == string::npos)
+			continue;
+		// The first definition wins, same as the old linear scan
+		index.props.emplace(line.substr(0, end_pos), line.substr(end_pos + 1));
+	}
+	index.mtime = st.st_mtim;
+	index.size = st.st_size;
+	return true;
+}
+
+string TWFunc::Partition_Property_Get(string Prop_Name, TWPartitionManager &PartitionManager, string Mount_Point, string prop_file, bool Display_Error) {
+	std::lock_guard<std::mutex> guard(prop_file_cache_lock);
+	TWPartition* Part = PartitionManager.Find_Partition_By_Path(Mount_Point);
+	unsigned int generation = Part ? Part->Get_Mount_Generation() : 0;
+	bool mount_state = PartitionManager.Is_Mounted_By_Path(Mount_Point);
 	string propvalue;
-	if (!PartitionManager.Mount_By_Path(Mount_Point, true))
+	struct stat st;
+
+	auto cached = prop_file_cache.find(prop_file);
+	if (cached != prop_file_cache.end() && cached->second.generation == generation) {
+		// While mounted the file may have been rewritten in place, so recheck it
+		if (!mount_state || (stat(prop_file.c_str(), &st) == 0 && Prop_Index_Matches(cached->second, st))) {
+			auto prop = cached->second.props.find(Prop_Name);
+			return prop == cached->second.props.end() ? propvalue : prop->second;
+		}
+	}
+
+	if (!PartitionManager.Mount_By_Path(Mount_Point, Display_Error))
 		return propvalue;
-	string prop_file = Mount_Point + "/system/" + prop_file_name;
-	if (!TWFunc::Path_Exists(prop_file)) {
+	if (stat(prop_file.c_str(), &st) != 0) {
 		LOGINFO("Unable to locate file: %s\n", prop_file.c_str());
-		return propvalue;
-	}
-	if (TWFunc::read_file(prop_file, buildprop) != 0) {
-		LOGINFO("Unable to open %s for getting '%s'.\n", prop_file_name.c_str(), Prop_Name.c_str());
-		DataManager::SetValue(TW_BACKUP_NAME, Get_Current_Date());
 		if (!mount_state)
 			PartitionManager.UnMount_By_Path(Mount_Point, false);
 		return propvalue;
 	}
-	int line_count = buildprop.size();
-	int index;
-	size_t start_pos = 0, end_pos;
-	string propname;
-	for (index = 0; index < line_count; index++) {
-		end_pos = buildprop.at(index).find("=", start_pos);
-		propname = buildprop.at(index).substr(start_pos, end_pos);
-		if (propname == Prop_Name) {
-			propvalue = buildprop.at(index).substr(end_pos + 1, buildprop.at(index).size());
+	if (cached == prop_file_cache.end() || !Prop_Index_Matches(cached->second, st)) {
+		Prop_File_Index index;
+		if (!Prop_Index_Build(prop_file, st, index)) {
+			LOGINFO("Unable to open %s for getting '%s'.\n", prop_file.c_str(), Prop_Name.c_str());
+			DataManager::SetValue(TW_BACKUP_NAME, Get_Current_Date());
 			if (!mount_state)
 				PartitionManager.UnMount_By_Path(Mount_Point, false);
 			return propvalue;
 		}
+		cached = prop_file_cache.insert_or_assign(prop_file, std::move(index)).first;
 	}
+	auto prop = cached->second.props.find(Prop_Name);
+	if (prop != cached->second.props.end())
+		propvalue = prop->second;
 	if (!mount_state)
 		PartitionManager.UnMount_By_Path(Mount_Point, false);
+	// Record the generation after our own unmount so the next lookup is served from the index
+	cached->second.generation = Part ? Part->Get_Mount_Generation() : 0;
 	return propvalue;
 }
 
+string TWFunc::System_Property_Get(string Prop_Name) {
+	return System_Property_Get(Prop_Name, PartitionManager, PartitionManager.Get_Android_Root_Path(), "build.prop");
+}
+
+string TWFunc::System_Property_Get(string Prop_Name, TWPartitionManager &PartitionManager, string Mount_Point, string prop_file_name) {
+	return Partition_Property_Get(Prop_Name, PartitionManager, Mount_Point, Mount_Point + "/system/" + prop_file_name, true);
+}
+
 string TWFunc::Product_Property_Get(string Prop_Name) {
 	return Product_Property_Get(Prop_Name, PartitionManager, "product", "build.prop");
 }
 
 string TWFunc::Product_Property_Get(string Prop_Name, TWPartitionManager &PartitionManager, string Mount_Point, string prop_file_name) {
-	bool mount_state = PartitionManager.Is_Mounted_By_Path(Mount_Point);
-	std::vector<string> buildprop;
-	string propvalue;
-	if (!PartitionManager.Mount_By_Path(Mount_Point, false))
-		return propvalue;
-	string prop_file = Mount_Point + "/etc/" + prop_file_name;
-	if (!TWFunc::Path_Exists(prop_file)) {
-		LOGINFO("Unable to locate file: %s\n", prop_file.c_str());
-		return propvalue;
-	}
-	if (TWFunc::read_file(prop_file, buildprop) != 0) {
-		LOGINFO("Unable to open %s for getting '%s'.\n", prop_file_name.c_str(), Prop_Name.c_str());
-		DataManager::SetValue(TW_BACKUP_NAME, Get_Current_Date());
-		if (!mount_state)
-			PartitionManager.UnMount_By_Path(Mount_Point, false);
-		return propvalue;
-	}
-	int line_count = buildprop.size();
-	int index;
-	size_t start_pos = 0, end_pos;
-	string propname;
-	for (index = 0; index < line_count; index++) {
-		end_pos = buildprop.at(index).find("=", start_pos);
-		propname = buildprop.at(index).substr(start_pos, end_pos);
-		if (propname == Prop_Name) {
-			propvalue = buildprop.at(index).substr(end_pos + 1, buildprop.at(index).size());
-			if (!mount_state)
-				PartitionManager.UnMount_By_Path(Mount_Point, false);
-			return propvalue;
-		}
-	}
-	if (!mount_state)
-		PartitionManager.UnMount_By_Path(Mount_Point, false);
-	return propvalue;
+	return Partition_Property_Get(Prop_Name, PartitionManager, Mount_Point, Mount_Point + "/etc/" + prop_file_name, false);
 }
 
 string TWFunc::Vendor_Property_Get(string Prop_Name) {
@@ -1498,40 +1626,7 @@ string TWFunc::Vendor_Property_Get(string Prop_Name) {
 }
 
 string TWFunc::Vendor_Property_Get(string Prop_Name, TWPartitionManager &PartitionManager, string Mount_Point, string prop_file_name) {
-	bool mount_state = PartitionManager.Is_Mounted_By_Path(Mount_Point);
-	std::vector<string> buildprop;
-	string propvalue;
-	if (!PartitionManager.Mount_By_Path(Mount_Point, false))
-		return propvalue;
-	string prop_file = Mount_Point + "/" + prop_file_name;
-	if (!TWFunc::Path_Exists(prop_file)) {
-		LOGINFO("Unable to locate file: %s\n", prop_file.c_str());
-		return propvalue;
-	}
-	if (TWFunc::read_file(prop_file, buildprop) != 0) {
-		LOGINFO("Unable to open %s for getting '%s'.\n", prop_file_name.c_str(), Prop_Name.c_str());
-		DataManager::SetValue(TW_BACKUP_NAME, Get_Current_Date());
-		if (!mount_state)
-			PartitionManager.UnMount_By_Path(Mount_Point, false);
-		return propvalue;
-	}
-	int line_count = buildprop.size();
-	int index;
-	size_t start_pos = 0, end_pos;
-	string propname;
-	for (index = 0; index < line_count; index++) {
-		end_pos = buildprop.at(index).find("=", start_pos);
-		propname = buildprop.at(index).substr(start_pos, end_pos);
-		if (propname == Prop_Name) {
-			propvalue = buildprop.at(index).substr(end_pos + 1, buildprop.at(index).size());
-			if (!mount_state)
-				PartitionManager.UnMount_By_Path(Mount_Point, false);
-			return propvalue;
-		}
-	}
-	if (!mount_state)
-		PartitionManager.UnMount_By_Path(Mount_Point, false);
-	return propvalue;
+	return Partition_Property_Get(Prop_Name, PartitionManager, Mount_Point, Mount_Point + "/" + prop_file_name, false);
 }
 
 string TWFunc::File_Property_Get(string File_Path, string Prop_Name)
@@ -1838,12 +1933,21 @@ bool TWFunc::Toggle_MTP(bool enable)
 
 void TWFunc::SetPerformanceMode(bool mode)
 {
+  // Reference counted, so that partitions backed up concurrently
+  // don't switch performance mode off under each other
+  static int perf_mode_users = 0;
+  static std::mutex perf_mode_lock;
+  std::lock_guard<std::mutex> lock(perf_mode_lock);
   if (mode)
     {
+      if (perf_mode_users++ > 0)
+        return;
       property_set("recovery.perf.mode", "1");
     }
   else
     {
+      if (perf_mode_users > 0 && --perf_mode_users > 0)
+        return;
       property_set("recovery.perf.mode", "0");
     }
   // Some time for events to catch up to init handlers
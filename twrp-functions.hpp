@@ -75,6 +75,9 @@ public:
 	static int Exec_Cmd(const string& cmd, string &result, bool combine_stderr);     //execute a command and return the result as a string by reference, set combined_stderror to add stderr
 	static int Exec_Cmd(const string& cmd, string &result);                     //execute a command and return the result as a string by reference
 	static int Exec_Cmd(const string& cmd, bool Show_Errors = true);                   //execute a command, displays an error to the GUI if Show_Errors is true, Show_Errors is true by default
+	static int Run_Command(const string& cmd, string* output, bool combine_stderr, int timeout_ms = 0); // posix_spawn a command (through sh only if it uses shell syntax), capture its output and kill it after timeout_ms if > 0; returns the wait status or -1
+	static int Exec_Argv(const vector<string>& args, string* output, bool combine_stderr = false, int timeout_ms = 0); // Same as Run_Command for an argument vector, never uses a shell
+	static void Log_Exec_Stats();                                               // Logs how many times each external command ran and how long it took
 	static int Wait_For_Child(pid_t pid, int *status, string Child_Name, bool Show_Errors = true); // Waits for pid to exit and checks exit status, displays an error to the GUI if Show_Errors is true which is the default
 	static int Wait_For_Child_Timeout(pid_t pid, int *status, const string& Child_Name, int timeout); // Waits for a pid to exit until the timeout is hit. If timeout is hit, kill the chilld.
 	static bool Path_Exists(string Path);                                       // Returns true if the path exists
@@ -227,6 +230,7 @@ public:
 	static string Check_For_TwrpFolder();
 
 private:
+	static string Partition_Property_Get(string Prop_Name, TWPartitionManager &PartitionManager, string Mount_Point, string prop_file, bool Display_Error); // Looks up Prop_Name in the cached index of prop_file on Mount_Point
 	static void Copy_Log(string Source, string Destination);
 	static string Load_File(string extension);
 	static bool Patch_Forced_Encryption(void);
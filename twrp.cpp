@@ -63,6 +63,7 @@ extern "C" {
 #include "openrecoveryscript.hpp"
 #include "variables.h"
 #include "startupArgs.hpp"
+#include "startupTaskGraph.hpp"
 #include "twrpAdbBuFifo.hpp"
 #ifdef TW_USE_NEW_MINADBD
 // #include "minadbd/minadbd.h"
@@ -488,33 +489,80 @@ int main(int argc, char **argv) {
 	if (!TWFunc::Path_Exists(fstab_filename)) {
 		fstab_filename = "/etc/recovery.fstab";
 	}
-	printf("=> Processing %s\n", fstab_filename.c_str());
-	if (!PartitionManager.Process_Fstab(fstab_filename, 1, !startup.Get_Fastboot_Mode())) {
-		LOGERR("Failing out of recovery due to problem with fstab.\n");
-		return -1;
-	}
+	// Startup stages; each one starts as soon as its dependencies are done.
+	// Stages that may print translated messages stay ordered against the GUI
+	// stages, since translation reads the page resources being loaded there.
+	startupTaskGraph startup_graph;
+	startup_graph.Add("fstab", [&]() {
+		printf("=> Processing %s\n", fstab_filename.c_str());
+		if (!PartitionManager.Process_Fstab(fstab_filename, 1, !startup.Get_Fastboot_Mode())) {
+			LOGERR("Failing out of recovery due to problem with fstab.\n");
+			return false;
+		}
+		return true;
+	});
+
+	startup_graph.Add("language_catalog", []() {
+		if (gui_prepareResources() != 0)
+			LOGINFO("Base language catalog not compiled, it will be parsed at load time\n");
+		return true;
+	});
 
 	// Set the props for OrangeFox dynamic partitions
 	//PartitionManager.Fox_Set_Dynamic_Partition_Props();
 
+	// Stages touching PartitionManager or partition state run one after the
+	// other on this chain; only the GUI and language stages run beside them.
+	std::string partition_stage = "fstab";
+	std::vector<std::string> gui_deps = { "fstab" };
 #ifdef TW_LOAD_VENDOR_MODULES
-	if (startup.Get_Fastboot_Mode()) {
-		TWPartition* ven_dlkm = PartitionManager.Find_Partition_By_Path("/vendor_dlkm");
-		android::base::SetProperty("ro.twrp.fastbootd", "1");
-		PartitionManager.Prepare_Super_Volume(PartitionManager.Find_Partition_By_Path("/vendor"));
-		if(ven_dlkm) {
-			PartitionManager.Prepare_Super_Volume(ven_dlkm);
+	startup_graph.Add("vendor_modules", [&]() {
+		if (startup.Get_Fastboot_Mode()) {
+			TWPartition* ven_dlkm = PartitionManager.Find_Partition_By_Path("/vendor_dlkm");
+			android::base::SetProperty("ro.twrp.fastbootd", "1");
+			PartitionManager.Prepare_Super_Volume(PartitionManager.Find_Partition_By_Path("/vendor"));
+			if(ven_dlkm) {
+				PartitionManager.Prepare_Super_Volume(ven_dlkm);
+			}
 		}
-	}
-	KernelModuleLoader::Load_Vendor_Modules();
+		KernelModuleLoader::Load_Vendor_Modules();
+		return true;
+	}, { partition_stage });
+	partition_stage = "vendor_modules";
+	// display and touch drivers may be modules
+	gui_deps.push_back("vendor_modules");
 #endif
 
-	// start the UI
-	printf("Starting the UI...\n");
-	gui_init();
+	// Process_Fstab also decrypts /data, so this runs after decryption
+	startup_graph.Add("clear_bootloader_message", []() {
+		TWFunc::Clear_Bootloader_Message();
+		return true;
+	}, { partition_stage });
+	partition_stage = "clear_bootloader_message";
 
-	// Load up all the resources
-	gui_loadResources();
+	// start the UI
+	startup_graph.Add("gui_init", []() {
+		printf("Starting the UI...\n");
+		gui_init();
+		return true;
+	}, gui_deps, true);
+
+	// Mount the settings storage holding the theme while the splash screen
+	// is up
+	startup_graph.Add("theme_path", []() {
+		gui_prepareTheme();
+		return true;
+	}, { partition_stage });
+
+	// Load up all the resources; the display must be up for the theme scaling
+	startup_graph.Add("gui_resources", []() {
+		gui_loadResources();
+		return true;
+	}, { "gui_init", "theme_path", "language_catalog" }, true);
+
+	startup_graph.Run();
+	if (!startup_graph.Succeeded("fstab"))
+		return -1;
 
 	std::string value;
 	static char charging = ' ';
@@ -579,7 +627,6 @@ int main(int argc, char **argv) {
 	static std::thread battery_monitor(monitorBatteryInBackground);
 
 	twrpAdbBuFifo *adb_bu_fifo = new twrpAdbBuFifo();
-	TWFunc::Clear_Bootloader_Message();
 
 	if (startup.Get_Fastboot_Mode()) {
 		process_fastbootd_mode();
@@ -1,3 +1,6 @@
+#include <atomic>
+#include <thread>
+
 #include "twrpApex.hpp"
 #include "twrp-functions.hpp"
 #include "common.h"
@@ -97,98 +100,171 @@ bool twrpApex::mountApexOnLoopbackDevices(std::vector<std::string> apexFiles) {
 		return false;
 	}
 
-	size_t device_no = 0;
-	for (auto&& apexFile:apexFiles) {
-		int num = ioctl(fd, LOOP_CTL_GET_FREE);
-		std::string loop_device = LOOP_BLOCK_DEVICE_DIR;
-		loop_device = loop_device + "loop" + std::to_string(num);
-		if (!TWFunc::Path_Exists(loop_device)) {
-			int ret = mknod(loop_device.c_str(), S_IFBLK | S_IRUSR | S_IWUSR , makedev(7, device_no));
-			if (ret != 0) {
-				LOGERR("Unable to create loop device: %s\n", loop_device.c_str());
-				return false;
-			}
-		}
-		std::string fileToMount = unzipImage(apexFile);
-		if (fileToMount.empty()) {
-			LOGINFO("Skipping non-existent apex file: %s\n", apexFile.c_str());
-			continue;
-		}
-		bool load_result = loadApexImage(fileToMount, device_no);
-		if (!load_result) {
-			return false;
+	// Each APEX is independent, so set them up on a pool of one thread per CPU
+	size_t threads = std::thread::hardware_concurrency();
+	if (threads == 0)
+		threads = 1;
+	if (threads > apexFiles.size())
+		threads = apexFiles.size();
+
+	std::atomic<size_t> next(0);
+	std::atomic<bool> ret(true);
+	auto worker = [this, &apexFiles, &next, &ret, fd]() {
+		for (size_t i = next++; i < apexFiles.size(); i = next++) {
+			if (!mountApex(apexFiles[i], fd))
+				ret = false;
 		}
-		device_no++;
+	};
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < threads; i++)
+		workers.emplace_back(worker);
+	worker();
+	for (std::thread& t : workers)
+		t.join();
+	close(fd);
+	return ret;
+}
+
+bool twrpApex::mountApex(const std::string& apexFile, int loop_control_fd) {
+	if (!TWFunc::Path_Exists(apexFile)) {
+		LOGINFO("Skipping non-existent apex file: %s\n", apexFile.c_str());
+		return true;
 	}
-	return true;
+
+	// The payload is copied out even when it is stored uncompressed: a loop
+	// device backed by the APEX itself would keep /system busy after it is
+	// unmounted at the end of Process_Fstab.
+	std::string payloadFile = unzipImage(apexFile);
+	if (payloadFile.empty()) {
+		LOGINFO("Skipping apex file without a usable payload: %s\n", apexFile.c_str());
+		return true;
+	}
+	return loadApexImage(apexFile, payloadFile, loop_control_fd);
 }
 
-bool twrpApex::loadApexImage(std::string fileToMount, size_t loop_device_number) {
+bool twrpApex::loadApexImage(const std::string& apexFile, const std::string& payloadFile, int loop_control_fd) {
 	struct loop_info64 info;
 
-	int fd = open(fileToMount.c_str(), O_RDONLY | O_CLOEXEC);
+	int fd = open(payloadFile.c_str(), O_RDONLY | O_CLOEXEC);
 	if (fd < 0) {
-		LOGERR("unable to open apex file: %s. Reason: %s\n", fileToMount.c_str(), strerror(errno));
+		LOGERR("unable to open apex file: %s. Reason: %s\n", payloadFile.c_str(), strerror(errno));
 		return false;
 	}
 
-	std::string loop_device = "/dev/block/loop" + std::to_string(loop_device_number);
-	int loop_fd = open(loop_device.c_str(), O_RDONLY);
-	if (loop_fd < 0) {
-		LOGERR("unable to open loop device: %s\n", loop_device.c_str());
-		close(fd);
-		return false;
-	}
+	std::string loop_device;
+	int loop_fd;
+	{
+		std::lock_guard<std::mutex> lock(loop_lock);
+		int num = ioctl(loop_control_fd, LOOP_CTL_GET_FREE);
+		if (num < 0) {
+			LOGERR("Unable to get a free loop device. Reason: %s\n", strerror(errno));
+			close(fd);
+			return false;
+		}
+		loop_device = LOOP_BLOCK_DEVICE_DIR "loop" + std::to_string(num);
+		if (!TWFunc::Path_Exists(loop_device)) {
+			int ret = mknod(loop_device.c_str(), S_IFBLK | S_IRUSR | S_IWUSR , makedev(7, num));
+			if (ret != 0) {
+				LOGERR("Unable to create loop device: %s\n", loop_device.c_str());
+				close(fd);
+				return false;
+			}
+		}
 
-	if (ioctl(loop_fd, LOOP_SET_FD, fd) < 0) {
-		LOGERR("failed to mount %s to loop device %s. Reason: %s\n", fileToMount.c_str(), loop_device.c_str(), 
-			strerror(errno));
-		close(fd);
-		close(loop_fd);
-		return false;
+		loop_fd = open(loop_device.c_str(), O_RDONLY | O_CLOEXEC);
+		if (loop_fd < 0) {
+			LOGERR("unable to open loop device: %s\n", loop_device.c_str());
+			close(fd);
+			return false;
+		}
+
+		if (ioctl(loop_fd, LOOP_SET_FD, fd) < 0) {
+			LOGERR("failed to mount %s to loop device %s. Reason: %s\n", payloadFile.c_str(), loop_device.c_str(),
+				strerror(errno));
+			close(fd);
+			close(loop_fd);
+			return false;
+		}
 	}
 
 	close(fd);
 
 	memset(&info, 0, sizeof(struct loop_info64));
 	strlcpy((char*)info.lo_crypt_name, "twrpApex", LO_NAME_SIZE);
-	off_t apex_size = lseek(fd, 0, SEEK_END);
-	info.lo_sizelimit = apex_size;
+	info.lo_flags = LO_FLAGS_AUTOCLEAR;
 	if (ioctl(loop_fd, LOOP_SET_STATUS64, &info)) {
-		LOGERR("failed to mount loop: %s: %s\n", fileToMount.c_str(), strerror(errno));
+		LOGERR("failed to mount loop: %s: %s\n", payloadFile.c_str(), strerror(errno));
+		ioctl(loop_fd, LOOP_CLR_FD, 0);
 		close(loop_fd);
 		return false;
 	}
 	if (ioctl(loop_fd, BLKFLSBUF, 0) == -1) {
 		LOGERR("Unable to flush loop device buffers\n");
+		close(loop_fd);
 		return false;
 	}
 	if (ioctl(loop_fd, LOOP_SET_BLOCK_SIZE, 4096) == -1) {
 		LOGINFO("Failed to set DIRECT_IO buffer size\n");
 	}
-	close(loop_fd);
 
 	std::string bind_mount(APEX_BASE);
-	std::string apex_cleaned_mount = fileToMount;
+	std::string apex_cleaned_mount = apexFile;
 	apex_cleaned_mount = std::regex_replace(apex_cleaned_mount, std::regex("\\.apex"), "");
 
 	bind_mount = bind_mount + basename(apex_cleaned_mount.c_str());
 
+	// Autoclear releases the loop device on its last close, so loop_fd stays
+	// open until the mount holds its own reference.
 	int ret = mkdir(bind_mount.c_str(), 0666);
 	if (ret != 0) {
 		LOGERR("Unable to create bind mount directory: %s\n", bind_mount.c_str());
+		close(loop_fd);
 		return false;
 	}
 
 	ret = mount(loop_device.c_str(), bind_mount.c_str(), "ext4", MS_RDONLY, nullptr);
 	if (ret != 0) {
 		LOGERR("unable to mount loop device %s to %s. Reason: %s\n", loop_device.c_str(), bind_mount.c_str(), strerror(errno));
+		close(loop_fd);
 		return false;
 	}
 
+	close(loop_fd);
 	return true;
 }
 
 bool twrpApex::Unmount() {
-	return (umount2(APEX_BASE, MNT_DETACH) == 0);
+	std::vector<std::pair<std::string, std::string>> apexMounts;
+	std::ifstream mounts("/proc/self/mounts");
+	std::string line;
+	while (std::getline(mounts, line)) {
+		std::istringstream fields(line);
+		std::string device, mountPoint;
+		fields >> device >> mountPoint;
+		if (mountPoint.size() > strlen(APEX_BASE) && mountPoint.compare(0, strlen(APEX_BASE), APEX_BASE) == 0)
+			apexMounts.emplace_back(device, mountPoint);
+	}
+
+	bool ret = true;
+	for (const auto& apexMount : apexMounts) {
+		if (umount2(apexMount.second.c_str(), MNT_DETACH) != 0) {
+			LOGINFO("Unable to unmount %s. Reason: %s\n", apexMount.second.c_str(), strerror(errno));
+			ret = false;
+			continue;
+		}
+		if (apexMount.first.compare(0, strlen(LOOP_BLOCK_DEVICE_DIR "loop"), LOOP_BLOCK_DEVICE_DIR "loop") != 0)
+			continue;
+		// Autoclear normally releases the device with the mount; clear it in
+		// case something else still had it open.
+		int loop_fd = open(apexMount.first.c_str(), O_RDONLY | O_CLOEXEC);
+		if (loop_fd >= 0) {
+			if (ioctl(loop_fd, LOOP_CLR_FD, 0) < 0 && errno != ENXIO)
+				LOGINFO("Unable to clear %s. Reason: %s\n", apexMount.first.c_str(), strerror(errno));
+			close(loop_fd);
+		}
+		rmdir(apexMount.second.c_str());
+	}
+	if (umount2(APEX_BASE, MNT_DETACH) != 0 && errno != EINVAL)
+		ret = false;
+	return ret;
 }
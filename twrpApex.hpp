@@ -2,9 +2,11 @@
 #ifndef TWRPAPEX_HPP
 #define TWRPAPEX_HPP
 
+#include <mutex>
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <fstream>
 #include <regex>
 #include <sstream>
 
@@ -35,6 +37,9 @@ public:
 private:
 	std::string unzipImage(std::string file);
 	bool mountApexOnLoopbackDevices(std::vector<std::string> apexFiles);
-	bool loadApexImage(std::string fileToMount, size_t loop_device_number);
+	bool mountApex(const std::string& apexFile, int loop_control_fd);
+	bool loadApexImage(const std::string& apexFile, const std::string& payloadFile, int loop_control_fd);
+
+	std::mutex loop_lock; // LOOP_CTL_GET_FREE only stays valid until the device is bound
 };
 #endif
@@ -0,0 +1,599 @@
+/*
+	Copyright (C) 2020-2023 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <lz4.h>
+#include <lz4hc.h>
+#include <openssl/sha.h>
+#include <zlib.h>
+
+#include "twrpBootImage.hpp"
+#include "twrp-functions.hpp"
+#include "twcommon.h"
+#include "gui/gui.hpp"
+
+#define BOOT_MAGIC "ANDROID!"
+#define VENDOR_BOOT_MAGIC "VNDRBOOT"
+#define BOOT_MAGIC_SIZE 8
+#define BOOT_IMAGE_V3_PAGE_SIZE 4096
+#define AVB_FOOTER_MAGIC "AVBf"
+#define AVB_FOOTER_SIZE 64
+#define AVB_BLOCK_SIZE 4096
+#define LZ4_LEGACY_MAGIC 0x184C2102
+#define LZ4_LEGACY_BLOCK_SIZE (8 << 20)
+
+// Layouts from system/tools/mkbootimg/include/bootimg/bootimg.h; fields of
+// later header versions are only valid when header_version is high enough
+struct boot_img_hdr_v0_2 {
+	uint8_t magic[BOOT_MAGIC_SIZE];
+	uint32_t kernel_size;
+	uint32_t kernel_addr;
+	uint32_t ramdisk_size;
+	uint32_t ramdisk_addr;
+	uint32_t second_size;
+	uint32_t second_addr;
+	uint32_t tags_addr;
+	uint32_t page_size;
+	uint32_t header_version;
+	uint32_t os_version;
+	uint8_t name[16];
+	uint8_t cmdline[512];
+	uint32_t id[8];
+	uint8_t extra_cmdline[1024];
+	uint32_t recovery_dtbo_size;  // v1
+	uint64_t recovery_dtbo_offset;
+	uint32_t header_size;
+	uint32_t dtb_size;            // v2
+	uint64_t dtb_addr;
+} __attribute__((packed));
+
+struct boot_img_hdr_v3_4 {
+	uint8_t magic[BOOT_MAGIC_SIZE];
+	uint32_t kernel_size;
+	uint32_t ramdisk_size;
+	uint32_t os_version;
+	uint32_t header_size;
+	uint32_t reserved[4];
+	uint32_t header_version;
+	uint8_t cmdline[1536];
+	uint32_t signature_size;      // v4
+} __attribute__((packed));
+
+struct vendor_boot_img_hdr_v3_4 {
+	uint8_t magic[BOOT_MAGIC_SIZE];
+	uint32_t header_version;
+	uint32_t page_size;
+	uint32_t kernel_addr;
+	uint32_t ramdisk_addr;
+	uint32_t vendor_ramdisk_size;
+	uint8_t cmdline[2048];
+	uint32_t tags_addr;
+	uint8_t name[16];
+	uint32_t header_size;
+	uint32_t dtb_size;
+	uint64_t dtb_addr;
+	uint32_t vendor_ramdisk_table_size;        // v4
+	uint32_t vendor_ramdisk_table_entry_num;
+	uint32_t vendor_ramdisk_table_entry_size;
+	uint32_t bootconfig_size;
+} __attribute__((packed));
+
+struct vendor_ramdisk_table_entry_v4 {
+	uint32_t ramdisk_size;
+	uint32_t ramdisk_offset;
+	uint32_t ramdisk_type;
+	uint8_t ramdisk_name[32];
+	uint32_t board_id[16];
+} __attribute__((packed));
+
+static uint64_t Align(uint64_t Value, uint64_t Alignment) {
+	return (Value + Alignment - 1) / Alignment * Alignment;
+}
+
+static uint64_t Read_Be64(const char* p) {
+	uint64_t value = 0;
+	for (int i = 0; i < 8; i++)
+		value = (value << 8) | (uint8_t)p[i];
+	return value;
+}
+
+static void Write_Be64(char* p, uint64_t value) {
+	for (int i = 7; i >= 0; i--) {
+		p[i] = value & 0xff;
+		value >>= 8;
+	}
+}
+
+twrpBootImage::twrpBootImage() {
+	vendor = false;
+	header_version = 0;
+	page_size = 0;
+	avb_partition_size = 0;
+}
+
+bool twrpBootImage::Load(const std::string& Path) {
+	std::string image;
+	if (!android::base::ReadFileToString(Path, &image)) {
+		LOGINFO("Unable to read '%s': %s\n", Path.c_str(), strerror(errno));
+		return false;
+	}
+
+	uint64_t offset;
+	if (image.size() >= sizeof(boot_img_hdr_v0_2) && memcmp(image.data(), BOOT_MAGIC, BOOT_MAGIC_SIZE) == 0) {
+		vendor = false;
+		header_version = ((const boot_img_hdr_v0_2*)image.data())->header_version;
+		if (header_version < 3) {
+			const boot_img_hdr_v0_2* hdr = (const boot_img_hdr_v0_2*)image.data();
+			page_size = hdr->page_size;
+			if (page_size < 2048 || page_size > 65536 || (page_size & (page_size - 1))) {
+				LOGINFO("Invalid page size %u in '%s'\n", page_size, Path.c_str());
+				return false;
+			}
+			header = image.substr(0, page_size);
+			offset = page_size;
+			if (!Take_Section(image, &offset, hdr->kernel_size, &kernel) ||
+				!Take_Section(image, &offset, hdr->ramdisk_size, &ramdisk) ||
+				!Take_Section(image, &offset, hdr->second_size, &second) ||
+				(header_version >= 1 && !Take_Section(image, &offset, hdr->recovery_dtbo_size, &recovery_dtbo)) ||
+				(header_version >= 2 && !Take_Section(image, &offset, hdr->dtb_size, &dtb)))
+				return false;
+		} else if (header_version <= 4) {
+			const boot_img_hdr_v3_4* hdr = (const boot_img_hdr_v3_4*)image.data();
+			page_size = BOOT_IMAGE_V3_PAGE_SIZE;
+			header = image.substr(0, page_size);
+			offset = page_size;
+			if (!Take_Section(image, &offset, hdr->kernel_size, &kernel) ||
+				!Take_Section(image, &offset, hdr->ramdisk_size, &ramdisk) ||
+				(header_version >= 4 && !Take_Section(image, &offset, hdr->signature_size, &signature)))
+				return false;
+		} else {
+			LOGINFO("Unsupported boot image header version %u in '%s'\n", header_version, Path.c_str());
+			return false;
+		}
+	} else if (image.size() >= sizeof(vendor_boot_img_hdr_v3_4) && memcmp(image.data(), VENDOR_BOOT_MAGIC, BOOT_MAGIC_SIZE) == 0) {
+		const vendor_boot_img_hdr_v3_4* hdr = (const vendor_boot_img_hdr_v3_4*)image.data();
+		vendor = true;
+		header_version = hdr->header_version;
+		page_size = hdr->page_size;
+		if (header_version < 3 || header_version > 4 || page_size == 0 || (page_size & (page_size - 1))) {
+			LOGINFO("Unsupported vendor boot image header in '%s'\n", Path.c_str());
+			return false;
+		}
+		offset = Align(hdr->header_size, page_size);
+		if (offset > image.size())
+			return false;
+		header = image.substr(0, offset);
+		if (!Take_Section(image, &offset, hdr->vendor_ramdisk_size, &ramdisk) ||
+			!Take_Section(image, &offset, hdr->dtb_size, &dtb) ||
+			(header_version >= 4 && !Take_Section(image, &offset, hdr->vendor_ramdisk_table_size, &ramdisk_table)) ||
+			(header_version >= 4 && !Take_Section(image, &offset, hdr->bootconfig_size, &bootconfig)))
+			return false;
+	} else {
+		LOGINFO("'%s' is not an Android boot image\n", Path.c_str());
+		return false;
+	}
+	Read_Avb_Footer(image);
+	LOGINFO("Loaded %sboot image v%u from '%s' (kernel %zu, ramdisk %zu bytes, ramdisk format %s)\n", vendor ? "vendor " : "",
+		header_version, Path.c_str(), kernel.size(), ramdisk.size(), Ramdisk_Format_Name(Get_Ramdisk_Format(ramdisk)).c_str());
+	return true;
+}
+
+bool twrpBootImage::Take_Section(const std::string& Image, uint64_t* Offset, uint32_t Size, std::string* Section) {
+	if (*Offset + Size > Image.size()) {
+		LOGINFO("Boot image section at %llu (%u bytes) is past the end of the image\n", (unsigned long long)*Offset, Size);
+		return false;
+	}
+	Section->assign(Image, *Offset, Size);
+	*Offset += Align(Size, page_size);
+	return true;
+}
+
+void twrpBootImage::Read_Avb_Footer(const std::string& Image) {
+	vbmeta.clear();
+	avb_footer.clear();
+	if (Image.size() < AVB_FOOTER_SIZE)
+		return;
+	const char* footer = Image.data() + Image.size() - AVB_FOOTER_SIZE;
+	if (memcmp(footer, AVB_FOOTER_MAGIC, 4) != 0)
+		return;
+	uint64_t vbmeta_offset = Read_Be64(footer + 20);
+	uint64_t vbmeta_size = Read_Be64(footer + 28);
+	if (vbmeta_offset > Image.size() || vbmeta_size > Image.size() - vbmeta_offset)
+		return;
+	vbmeta.assign(Image, vbmeta_offset, vbmeta_size);
+	avb_footer.assign(footer, AVB_FOOTER_SIZE);
+	avb_partition_size = Image.size();
+}
+
+bool twrpBootImage::Is_Vendor_Boot() {
+	return vendor;
+}
+
+uint32_t twrpBootImage::Get_Header_Version() {
+	return header_version;
+}
+
+const std::string& twrpBootImage::Get_Kernel() {
+	return kernel;
+}
+
+const std::string& twrpBootImage::Get_Ramdisk() {
+	return ramdisk;
+}
+
+void twrpBootImage::Set_Kernel(const std::string& Kernel) {
+	kernel = Kernel;
+}
+
+bool twrpBootImage::Set_Ramdisk(const std::string& Ramdisk) {
+	if (vendor && header_version >= 4) {
+		vendor_boot_img_hdr_v3_4* hdr = (vendor_boot_img_hdr_v3_4*)&header[0];
+		if (hdr->vendor_ramdisk_table_entry_num > 1) {
+			LOGINFO("Vendor boot image has %u ramdisk fragments, not replacing\n", hdr->vendor_ramdisk_table_entry_num);
+			return false;
+		}
+		if (hdr->vendor_ramdisk_table_entry_num == 1 && ramdisk_table.size() >= sizeof(vendor_ramdisk_table_entry_v4)) {
+			vendor_ramdisk_table_entry_v4* entry = (vendor_ramdisk_table_entry_v4*)&ramdisk_table[0];
+			entry->ramdisk_size = Ramdisk.size();
+			entry->ramdisk_offset = 0;
+		}
+	}
+	ramdisk = Ramdisk;
+	return true;
+}
+
+bool twrpBootImage::Update_Header() {
+	if (vendor) {
+		vendor_boot_img_hdr_v3_4* hdr = (vendor_boot_img_hdr_v3_4*)&header[0];
+		hdr->vendor_ramdisk_size = ramdisk.size();
+		return true;
+	}
+	if (header_version >= 3) {
+		boot_img_hdr_v3_4* hdr = (boot_img_hdr_v3_4*)&header[0];
+		hdr->kernel_size = kernel.size();
+		hdr->ramdisk_size = ramdisk.size();
+		return true;
+	}
+
+	boot_img_hdr_v0_2* hdr = (boot_img_hdr_v0_2*)&header[0];
+	hdr->kernel_size = kernel.size();
+	hdr->ramdisk_size = ramdisk.size();
+	if (header_version >= 1)
+		hdr->recovery_dtbo_offset = recovery_dtbo.empty() ? 0 :
+			page_size + Align(kernel.size(), page_size) + Align(ramdisk.size(), page_size) + Align(second.size(), page_size);
+
+	// Same id as mkbootimg: a digest of every section followed by its size.
+	// Images made with --id using sha256 have the upper id words set.
+	std::vector<const std::string*> sections = { &kernel, &ramdisk, &second };
+	if (header_version >= 1)
+		sections.push_back(&recovery_dtbo);
+	if (header_version >= 2)
+		sections.push_back(&dtb);
+	bool sha256 = hdr->id[5] || hdr->id[6] || hdr->id[7];
+	unsigned char digest[SHA256_DIGEST_LENGTH] = { 0 };
+	if (sha256) {
+		SHA256_CTX ctx;
+		SHA256_Init(&ctx);
+		for (auto&& section:sections) {
+			uint32_t size = section->size();
+			SHA256_Update(&ctx, section->data(), section->size());
+			SHA256_Update(&ctx, &size, sizeof(size));
+		}
+		SHA256_Final(digest, &ctx);
+	} else {
+		SHA_CTX ctx;
+		SHA1_Init(&ctx);
+		for (auto&& section:sections) {
+			uint32_t size = section->size();
+			SHA1_Update(&ctx, section->data(), section->size());
+			SHA1_Update(&ctx, &size, sizeof(size));
+		}
+		SHA1_Final(digest, &ctx);
+	}
+	memcpy(hdr->id, digest, sizeof(hdr->id));
+	return true;
+}
+
+bool twrpBootImage::Write_Section(int fd, const std::string& Section, uint64_t* Offset) {
+	static const char zeroes[BOOT_IMAGE_V3_PAGE_SIZE] = { 0 };
+	if (!android::base::WriteFully(fd, Section.data(), Section.size()))
+		return false;
+	uint64_t padding = Align(Section.size(), page_size) - Section.size();
+	*Offset += Section.size() + padding;
+	while (padding > 0) {
+		size_t len = padding < sizeof(zeroes) ? padding : sizeof(zeroes);
+		if (!android::base::WriteFully(fd, zeroes, len))
+			return false;
+		padding -= len;
+	}
+	return true;
+}
+
+bool twrpBootImage::Write(const std::string& Path) {
+	if (header.empty()) {
+		LOGERR("No boot image loaded\n");
+		return false;
+	}
+	Update_Header();
+
+	int fd = open(Path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		LOGERR("Unable to open '%s' for writing: %s\n", Path.c_str(), strerror(errno));
+		return false;
+	}
+	struct stat st;
+	uint64_t device_size = 0;
+	if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &device_size) != 0)
+			device_size = 0;
+	} else if (ftruncate(fd, 0) != 0) {
+		LOGERR("Unable to truncate '%s': %s\n", Path.c_str(), strerror(errno));
+		close(fd);
+		return false;
+	}
+
+	uint64_t image_size = header.size();
+	for (auto&& section:{ &kernel, &ramdisk, &second, &recovery_dtbo, &dtb, &signature, &ramdisk_table, &bootconfig })
+		image_size += Align(section->size(), page_size);
+	// The footer goes at the end of the partition, vbmeta right after the image
+	uint64_t footer_space = device_size ? device_size : avb_partition_size;
+	uint64_t vbmeta_offset = Align(image_size, AVB_BLOCK_SIZE);
+	bool keep_footer = !avb_footer.empty() && vbmeta_offset + vbmeta.size() + AVB_FOOTER_SIZE <= footer_space;
+	if (!avb_footer.empty() && !keep_footer)
+		LOGINFO("No room to keep the AVB footer after the new image\n");
+	if (device_size && image_size > device_size) {
+		LOGINFO("Size (%llu bytes) of the new image is larger than target device '%s' (%llu bytes)\n",
+			(unsigned long long)image_size, Path.c_str(), (unsigned long long)device_size);
+		gui_err("img_size_err=Size of image is larger than target device");
+		close(fd);
+		return false;
+	}
+
+	uint64_t offset = 0;
+	bool ret = Write_Section(fd, header, &offset);
+	for (auto&& section:{ &kernel, &ramdisk, &second, &recovery_dtbo, &dtb, &signature, &ramdisk_table, &bootconfig }) {
+		if (ret && !section->empty())
+			ret = Write_Section(fd, *section, &offset);
+	}
+	if (ret && keep_footer) {
+		std::string footer = avb_footer;
+		Write_Be64(&footer[12], image_size);
+		Write_Be64(&footer[20], vbmeta_offset);
+		ret = TEMP_FAILURE_RETRY(pwrite(fd, vbmeta.data(), vbmeta.size(), vbmeta_offset)) == (ssize_t)vbmeta.size() &&
+			TEMP_FAILURE_RETRY(pwrite(fd, footer.data(), footer.size(), footer_space - AVB_FOOTER_SIZE)) == (ssize_t)footer.size();
+	}
+	if (ret)
+		ret = fsync(fd) == 0;
+	if (!ret)
+		LOGERR("Unable to write boot image to '%s': %s\n", Path.c_str(), strerror(errno));
+	close(fd);
+	return ret;
+}
+
+Ramdisk_Format twrpBootImage::Get_Ramdisk_Format(const std::string& Data) {
+	if (Data.empty() || Data.compare(0, 6, "070701") == 0 || Data.compare(0, 6, "070702") == 0)
+		return RAMDISK_CPIO;
+	if (Data.size() >= 2 && (uint8_t)Data[0] == 0x1f && (uint8_t)Data[1] == 0x8b)
+		return RAMDISK_GZIP;
+	if (Data.size() >= 4) {
+		uint32_t magic;
+		memcpy(&magic, Data.data(), sizeof(magic));
+		if (magic == LZ4_LEGACY_MAGIC)
+			return RAMDISK_LZ4_LEGACY;
+	}
+	return RAMDISK_UNKNOWN;
+}
+
+std::string twrpBootImage::Ramdisk_Format_Name(Ramdisk_Format Format) {
+	switch (Format) {
+		case RAMDISK_CPIO:
+			return "raw";
+		case RAMDISK_GZIP:
+			return "gzip";
+		case RAMDISK_LZ4_LEGACY:
+			return "lz4_legacy";
+		default:
+			return "unknown";
+	}
+}
+
+static bool Gunzip(const std::string& Data, std::string* Cpio) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, 15 + 16) != Z_OK)
+		return false;
+	zs.next_in = (Bytef*)Data.data();
+	zs.avail_in = Data.size();
+	std::string buf(1024 * 1024, '\0');
+	int ret;
+	do {
+		zs.next_out = (Bytef*)&buf[0];
+		zs.avail_out = buf.size();
+		ret = inflate(&zs, Z_NO_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END)
+			break;
+		Cpio->append(buf.data(), buf.size() - zs.avail_out);
+		// Concatenated gzip members; anything else after the stream is padding
+		if (ret == Z_STREAM_END && zs.avail_in >= 2 && zs.next_in[0] == 0x1f && zs.next_in[1] == 0x8b) {
+			inflateReset(&zs);
+			ret = Z_OK;
+		}
+	} while (ret == Z_OK);
+	inflateEnd(&zs);
+	return ret == Z_STREAM_END;
+}
+
+static bool Gzip(const std::string& Cpio, std::string* Data) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+	Data->resize(deflateBound(&zs, Cpio.size()));
+	zs.next_in = (Bytef*)Cpio.data();
+	zs.avail_in = Cpio.size();
+	zs.next_out = (Bytef*)&(*Data)[0];
+	zs.avail_out = Data->size();
+	int ret = deflate(&zs, Z_FINISH);
+	Data->resize(zs.total_out);
+	deflateEnd(&zs);
+	return ret == Z_STREAM_END;
+}
+
+static bool Lz4_Legacy_Decompress(const std::string& Data, std::string* Cpio) {
+	size_t pos = 4;
+	while (pos + 4 <= Data.size()) {
+		uint32_t block_size;
+		memcpy(&block_size, Data.data() + pos, sizeof(block_size));
+		pos += 4;
+		if (block_size == LZ4_LEGACY_MAGIC)
+			continue; // concatenated stream
+		// Ends with padding or the total size some tools append
+		if (block_size == 0 || block_size > Data.size() - pos)
+			break;
+		size_t out = Cpio->size();
+		Cpio->resize(out + LZ4_LEGACY_BLOCK_SIZE);
+		int len = LZ4_decompress_safe(Data.data() + pos, &(*Cpio)[out], block_size, LZ4_LEGACY_BLOCK_SIZE);
+		if (len < 0)
+			return false;
+		Cpio->resize(out + len);
+		pos += block_size;
+	}
+	return true;
+}
+
+static bool Lz4_Legacy_Compress(const std::string& Cpio, std::string* Data) {
+	uint32_t magic = LZ4_LEGACY_MAGIC;
+	Data->assign((const char*)&magic, sizeof(magic));
+	std::string block(LZ4_compressBound(LZ4_LEGACY_BLOCK_SIZE), '\0');
+	for (size_t pos = 0; pos < Cpio.size(); pos += LZ4_LEGACY_BLOCK_SIZE) {
+		int len = std::min<size_t>(Cpio.size() - pos, LZ4_LEGACY_BLOCK_SIZE);
+		uint32_t block_size = LZ4_compress_HC(Cpio.data() + pos, &block[0], len, block.size(), LZ4HC_CLEVEL_MAX);
+		if (block_size == 0)
+			return false;
+		Data->append((const char*)&block_size, sizeof(block_size));
+		Data->append(block.data(), block_size);
+	}
+	return true;
+}
+
+bool twrpBootImage::Decompress_Ramdisk(const std::string& Data, std::string* Cpio) {
+	Cpio->clear();
+	switch (Get_Ramdisk_Format(Data)) {
+		case RAMDISK_CPIO:
+			*Cpio = Data;
+			return true;
+		case RAMDISK_GZIP:
+			return Gunzip(Data, Cpio);
+		case RAMDISK_LZ4_LEGACY:
+			return Lz4_Legacy_Decompress(Data, Cpio);
+		default:
+			return false;
+	}
+}
+
+bool twrpBootImage::Compress_Ramdisk(const std::string& Cpio, Ramdisk_Format Format, std::string* Data) {
+	switch (Format) {
+		case RAMDISK_CPIO:
+			*Data = Cpio;
+			return true;
+		case RAMDISK_GZIP:
+			return Gzip(Cpio, Data);
+		case RAMDISK_LZ4_LEGACY:
+			return Lz4_Legacy_Compress(Cpio, Data);
+		default:
+			return false;
+	}
+}
+
+bool twrpBootImage::Convert_Ramdisk(const std::string& Data, Ramdisk_Format Format, std::string* Result) {
+	Ramdisk_Format current = Get_Ramdisk_Format(Data);
+	if (current == Format) {
+		*Result = Data;
+		return true;
+	}
+	std::string cpio;
+	if (!Decompress_Ramdisk(Data, &cpio)) {
+		LOGINFO("Unable to decompress %s ramdisk\n", Ramdisk_Format_Name(current).c_str());
+		return false;
+	}
+	LOGINFO("Recompressing ramdisk from %s to %s\n", Ramdisk_Format_Name(current).c_str(), Ramdisk_Format_Name(Format).c_str());
+	return Compress_Ramdisk(cpio, Format, Result);
+}
+
+static void Append_Cpio_Entry(std::string* Cpio, uint32_t ino, const struct stat& st, uint32_t nlink, const std::string& Name, const std::string& Data) {
+	char hdr[111];
+	snprintf(hdr, sizeof(hdr), "070701%08x%08x%08x%08x%08x%08x%08zx%08x%08x%08x%08x%08zx%08x",
+		ino, st.st_mode, st.st_uid, st.st_gid, nlink, (uint32_t)st.st_mtime, Data.size(),
+		major(st.st_dev), minor(st.st_dev), major(st.st_rdev), minor(st.st_rdev), Name.size() + 1, 0);
+	Cpio->append(hdr, 110);
+	Cpio->append(Name.c_str(), Name.size() + 1);
+	Cpio->append(Align(Cpio->size(), 4) - Cpio->size(), '\0');
+	Cpio->append(Data);
+	Cpio->append(Align(Cpio->size(), 4) - Cpio->size(), '\0');
+}
+
+bool twrpBootImage::Create_Cpio(const std::string& List_File, const std::string& Root, std::string* Cpio) {
+	std::vector<std::string> files;
+	if (TWFunc::read_file(List_File, files) != 0) {
+		LOGINFO("Unable to read '%s'\n", List_File.c_str());
+		return false;
+	}
+	Cpio->clear();
+	uint32_t ino = 300000;
+	for (auto&& name:files) {
+		if (name.empty())
+			continue;
+		std::string path = Root + "/" + name;
+		struct stat st;
+		if (lstat(path.c_str(), &st) != 0) {
+			LOGINFO("Unable to stat '%s': %s\n", path.c_str(), strerror(errno));
+			return false;
+		}
+		std::string data;
+		if (S_ISREG(st.st_mode)) {
+			if (!android::base::ReadFileToString(path, &data)) {
+				LOGINFO("Unable to read '%s'\n", path.c_str());
+				return false;
+			}
+		} else if (S_ISLNK(st.st_mode)) {
+			char target[PATH_MAX];
+			ssize_t len = readlink(path.c_str(), target, sizeof(target));
+			if (len < 0)
+				return false;
+			data.assign(target, len);
+		}
+		// Every file gets its own inode so hard links are stored as copies
+		Append_Cpio_Entry(Cpio, ino++, st, S_ISDIR(st.st_mode) ? st.st_nlink : 1, name, data);
+	}
+	struct stat trailer;
+	memset(&trailer, 0, sizeof(trailer));
+	Append_Cpio_Entry(Cpio, 0, trailer, 1, "TRAILER!!!", std::string());
+	return true;
+}
@@ -0,0 +1,76 @@
+/*
+	Copyright (C) 2020-2023 OrangeFox Recovery Project
+	This file is part of the OrangeFox Recovery Project.
+
+	TWRP is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	TWRP is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRP_BOOT_IMAGE
+#define TWRP_BOOT_IMAGE
+
+#include <stdint.h>
+#include <string>
+
+enum Ramdisk_Format {
+	RAMDISK_UNKNOWN = 0,
+	RAMDISK_CPIO = 1,
+	RAMDISK_GZIP = 2,
+	RAMDISK_LZ4_LEGACY = 3,
+};
+
+// Boot (header v0 - v4) and vendor_boot (v3 - v4) images, held in memory so the
+// kernel or ramdisk can be swapped and the result streamed straight to the block device
+class twrpBootImage {
+public:
+	twrpBootImage();
+	bool Load(const std::string& Path);                                       // Reads and parses an image from a file or block device
+	bool Write(const std::string& Path);                                      // Writes the image to a block device or file, moving an AVB footer along
+	bool Is_Vendor_Boot();                                                    // Returns true for vendor_boot images
+	uint32_t Get_Header_Version();
+	const std::string& Get_Kernel();
+	const std::string& Get_Ramdisk();
+	void Set_Kernel(const std::string& Kernel);
+	bool Set_Ramdisk(const std::string& Ramdisk);                             // Fails on vendor_boot images with several ramdisk fragments
+
+	static Ramdisk_Format Get_Ramdisk_Format(const std::string& Data);        // Detects the compression of a ramdisk from its magic
+	static std::string Ramdisk_Format_Name(Ramdisk_Format Format);
+	static bool Decompress_Ramdisk(const std::string& Data, std::string* Cpio);
+	static bool Compress_Ramdisk(const std::string& Cpio, Ramdisk_Format Format, std::string* Data);
+	static bool Convert_Ramdisk(const std::string& Data, Ramdisk_Format Format, std::string* Result); // Recompresses Data to Format if needed
+	static bool Create_Cpio(const std::string& List_File, const std::string& Root, std::string* Cpio); // Same archive as cpio -H newc -o < List_File run from Root
+
+private:
+	bool Take_Section(const std::string& Image, uint64_t* Offset, uint32_t Size, std::string* Section);
+	void Read_Avb_Footer(const std::string& Image);
+	bool Update_Header();
+	bool Write_Section(int fd, const std::string& Section, uint64_t* Offset);
+
+private:
+	bool vendor;                                                              // vendor_boot image
+	uint32_t header_version;
+	uint32_t page_size;
+	std::string header;                                                       // Header, padded to the page size
+	std::string kernel;
+	std::string ramdisk;                                                      // Vendor ramdisk for vendor_boot
+	std::string second;
+	std::string recovery_dtbo;
+	std::string dtb;
+	std::string signature;                                                    // v4 boot signature
+	std::string ramdisk_table;                                                // v4 vendor ramdisk table
+	std::string bootconfig;
+	std::string vbmeta;                                                       // vbmeta blob from an AVB footer, if present
+	std::string avb_footer;
+	uint64_t avb_partition_size;                                              // Size of the image or partition that held the footer
+};
+#endif // TWRP_BOOT_IMAGE
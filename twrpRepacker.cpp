@@ -21,9 +21,12 @@
 
 #include <string>
 
+#include <android-base/file.h>
+
 #include "data.hpp"
 #include "partitions.hpp"
 #include "twrp-functions.hpp"
+#include "twrpBootImage.hpp"
 #include "twrpRepacker.hpp"
 #include "twcommon.h"
 #include "variables.h"
@@ -35,18 +38,10 @@ bool twrpRepacker::Prepare_Empty_Folder(const std::string& Folder) {
 	return TWFunc::Recursive_Mkdir(Folder);
 }
 
-bool twrpRepacker::Backup_Image_For_Repack(TWPartition* Part, const std::string& Temp_Folder_Destination,
-										 const bool Create_Backup, const std::string& Backup_Name) {
-	if (!Part) {
-		LOGERR("Partition was null!\n");
-		return false;
-	}
-	if (!Prepare_Empty_Folder(Temp_Folder_Destination))
-		return false;
-	std::string target_image = Temp_Folder_Destination + "boot.img";
+bool twrpRepacker::Backup_Partition(TWPartition* Part, const std::string& Backup_Folder, const std::string& Backup_Name, std::string* Backup_File) {
 	PartitionSettings part_settings;
 	part_settings.Part = Part;
-	if (Create_Backup) {
+	if (Backup_Folder.empty()) {
 		if (PartitionManager.Check_Backup_Name(Backup_Name, true, false) != 0)
 			return false;
 		DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, part_settings.Backup_Folder);
@@ -54,7 +49,7 @@ bool twrpRepacker::Backup_Image_For_Repack(TWPartition* Part, const std::string&
 		if (!TWFunc::Recursive_Mkdir(part_settings.Backup_Folder))
 			return false;
 	} else
-		part_settings.Backup_Folder = Temp_Folder_Destination;
+		part_settings.Backup_Folder = Backup_Folder;
 	part_settings.adbbackup = false;
 	part_settings.generate_digest = false;
 	part_settings.generate_md5 = false;
@@ -63,13 +58,25 @@ bool twrpRepacker::Backup_Image_For_Repack(TWPartition* Part, const std::string&
 	pid_t not_a_pid = 0;
 	if (!Part->Backup(&part_settings, &not_a_pid))
 		return false;
-	std::string backed_up_image = part_settings.Backup_Folder;
-	backed_up_image += Part->Get_Backup_FileName();
-	target_image = Temp_Folder_Destination + "boot.img";
+	*Backup_File = part_settings.Backup_Folder + Part->Get_Backup_FileName();
+	return true;
+}
+
+bool twrpRepacker::Backup_Image_For_Repack(TWPartition* Part, const std::string& Temp_Folder_Destination,
+										 const bool Create_Backup, const std::string& Backup_Name) {
+	if (!Part) {
+		LOGERR("Partition was null!\n");
+		return false;
+	}
+	if (!Prepare_Empty_Folder(Temp_Folder_Destination))
+		return false;
+	std::string target_image = Temp_Folder_Destination + "boot.img";
+	std::string backed_up_image;
+	if (!Backup_Partition(Part, Create_Backup ? std::string() : Temp_Folder_Destination, Backup_Name, &backed_up_image))
+		return false;
 	if (Create_Backup) {
-		std::string source = part_settings.Backup_Folder + Part->Get_Backup_FileName();
-		if (TWFunc::copy_file(source, target_image, 0644) != 0) {
-			LOGERR("Failed to copy backup file '%s' to temp folder target '%s'\n", source.c_str(), target_image.c_str());
+		if (TWFunc::copy_file(backed_up_image, target_image, 0644) != 0) {
+			LOGERR("Failed to copy backup file '%s' to temp folder target '%s'\n", backed_up_image.c_str(), target_image.c_str());
 			return false;
 		}
 	} else {
@@ -114,6 +121,115 @@ std::string twrpRepacker::Unpack_Image(const std::string& Source_Path, const std
 }
 
 bool twrpRepacker::Repack_Image_And_Flash(const std::string& Target_Image, const struct Repack_Options_struct& Repack_Options) {
+	twrpBootImage new_image;
+	std::string new_ramdisk;
+	bool native;
+	if (Repack_Options.Type == REPLACE_RAMDISK_UNPACKED) {
+		native = android::base::ReadFileToString(Target_Image, &new_ramdisk);
+	} else {
+		gui_msg(Msg("unpacking_image=Unpacking {1}...")(Target_Image));
+		native = new_image.Load(Target_Image) && !new_image.Is_Vendor_Boot();
+		new_ramdisk = new_image.Get_Ramdisk();
+	}
+	if (native) {
+		int ret = Repack_And_Flash_Native(&new_image, new_ramdisk, Repack_Options);
+		if (ret >= 0)
+			return ret == 0;
+		LOGINFO("Using magiskboot to repack '%s'\n", Target_Image.c_str());
+	}
+	return Repack_With_MagiskBoot(Target_Image, Repack_Options);
+}
+
+bool twrpRepacker::Repack_Ramdisk_And_Flash(const std::string& Ramdisk, const struct Repack_Options_struct& Repack_Options) {
+	int ret = Repack_And_Flash_Native(NULL, Ramdisk, Repack_Options);
+	if (ret >= 0)
+		return ret == 0;
+
+	// magiskboot needs the ramdisk in a file
+	std::string compressed;
+	std::string ramdisk_file = "/tmp/currentramdisk.cpio.gz";
+	if (!twrpBootImage::Convert_Ramdisk(Ramdisk, RAMDISK_GZIP, &compressed) || !android::base::WriteStringToFile(compressed, ramdisk_file)) {
+		gui_msg(Msg(msg::kError, "create_ramdisk_error=failed to create ramdisk to flash."));
+		return false;
+	}
+	return Repack_With_MagiskBoot(ramdisk_file, Repack_Options);
+}
+
+int twrpRepacker::Repack_Partition_Native(TWPartition* Part, twrpBootImage* New_Image, const std::string& New_Ramdisk, const struct Repack_Options_struct& Repack_Options) {
+	twrpBootImage boot;
+	if (!boot.Load(Part->Actual_Block_Device) || boot.Is_Vendor_Boot())
+		return -1;
+	DataManager::SetProgress(.25);
+
+	std::string ramdisk;
+	twrpBootImage* target = &boot;
+	if (Repack_Options.Type == REPLACE_KERNEL) {
+		// The new image keeps its header and kernel and gets the ramdisk of the boot partition
+		Ramdisk_Format format = twrpBootImage::Get_Ramdisk_Format(New_Image->Get_Ramdisk());
+		if (format == RAMDISK_UNKNOWN || !twrpBootImage::Convert_Ramdisk(boot.Get_Ramdisk(), format, &ramdisk))
+			return -1;
+		target = New_Image;
+	} else if (Repack_Options.Type == REPLACE_RAMDISK || Repack_Options.Type == REPLACE_RAMDISK_UNPACKED) {
+		Ramdisk_Format format = twrpBootImage::Get_Ramdisk_Format(boot.Get_Ramdisk());
+		if (format == RAMDISK_UNKNOWN || !twrpBootImage::Convert_Ramdisk(New_Ramdisk, format, &ramdisk))
+			return -1;
+	} else {
+		LOGERR("Invalid repacking options specified\n");
+		return 1;
+	}
+	if (!target->Set_Ramdisk(ramdisk))
+		return -1;
+	DataManager::SetProgress(.5);
+
+	if (Repack_Options.Disable_Verity)
+		LOGERR("Disabling verity is not implemented yet\n");
+	if (Repack_Options.Disable_Force_Encrypt)
+		LOGERR("Disabling force encrypt is not implemented yet\n");
+	if (Repack_Options.Backup_First) {
+		std::string backup_file;
+		if (!Backup_Partition(Part, std::string(), gui_lookup("repack", "Repack"), &backup_file))
+			return 1;
+	}
+	gui_msg(Msg("repacking_image=Repacking {1}...")(Part->Get_Display_Name()));
+	if (!Part->Flash_Generated_Image([target](const std::string& Path) { return target->Write(Path); })) {
+		gui_msg(Msg(msg::kError, "repack_error=Error repacking image."));
+		return 1;
+	}
+	DataManager::SetProgress(1);
+	return 0;
+}
+
+int twrpRepacker::Repack_And_Flash_Native(twrpBootImage* New_Image, const std::string& New_Ramdisk, const struct Repack_Options_struct& Repack_Options) {
+	DataManager::SetProgress(0);
+	PartitionManager.Update_System_Details();
+	TWPartition* part = PartitionManager.Find_Partition_By_Path("/boot");
+	if (!part) {
+		gui_msg(Msg(msg::kError, "unable_to_locate=Unable to locate {1}.")("/boot"));
+		return 1;
+	}
+	gui_msg(Msg("unpacking_image=Unpacking {1}...")(part->Get_Display_Name()));
+	int ret = Repack_Partition_Native(part, New_Image, New_Ramdisk, Repack_Options);
+	if (ret != 0)
+		return ret;
+
+	if (part->Is_SlotSelect() && (Repack_Options.Type == REPLACE_RAMDISK || Repack_Options.Type == REPLACE_RAMDISK_UNPACKED)) {
+		LOGINFO("Switching slots to flash ramdisk to both partitions\n");
+		string Current_Slot = PartitionManager.Get_Active_Slot_Display();
+		PartitionManager.Override_Active_Slot(Current_Slot == "A" ? "B" : "A");
+		ret = Repack_Partition_Native(part, New_Image, New_Ramdisk, Repack_Options);
+		PartitionManager.Override_Active_Slot(Current_Slot);
+		if (ret != 0) {
+			// the first slot is already flashed, so there is no falling back from here
+			if (ret < 0)
+				gui_msg(Msg(msg::kError, "repack_error=Error repacking image."));
+			return 1;
+		}
+	}
+	gui_msg(Msg(msg::kWarning, "repack_overwrite_warning=If device was previously rooted, then root has been overwritten and will need to be reinstalled."));
+	return 0;
+}
+
+bool twrpRepacker::Repack_With_MagiskBoot(const std::string& Target_Image, const struct Repack_Options_struct& Repack_Options) {
 	bool recompress = false;
 
 	if (!TWFunc::Path_Exists(TWFunc::Get_MagiskBoot())) {
@@ -289,13 +405,10 @@ if (!TWFunc::Path_Exists("/ramdisk-files.txt")) {
 			return false;
 		}
 		#endif
-		std::string command = "cd / && /system/bin/cpio -H newc -o < ramdisk-files.txt > /tmp/currentramdisk.cpio && /system/bin/gzip -f /tmp/currentramdisk.cpio";
-		if (TWFunc::Exec_Cmd(command) != 0) {
+		std::string ramdisk;
+		if (!twrpBootImage::Create_Cpio("/ramdisk-files.txt", "/", &ramdisk)) {
 			gui_msg(Msg(msg::kError, "create_ramdisk_error=failed to create ramdisk to flash."));
 			return false;
 		}
-		if (!Repack_Image_And_Flash("/tmp/currentramdisk.cpio.gz", Repack_Options))
-			return false;
-       else
-       return true;
+		return Repack_Ramdisk_And_Flash(ramdisk, Repack_Options);
 }
@@ -18,6 +18,7 @@
 
 #include <string>
 #include "partitions.hpp"
+#include "twrpBootImage.hpp"
 
 #ifndef TWRP_REPACKER
 #define TWRP_REPACKER
@@ -41,8 +42,13 @@ class twrpRepacker {
         bool Backup_Image_For_Repack(TWPartition* Part, const std::string& Temp_Folder_Destination, const bool Create_Backup, const std::string& Backup_Name); // Prepares an image for repacking by unpacking it to the temp folder destination
         std::string Unpack_Image(const std::string& Source_Path, const std::string& Temp_Folder_Destination, const bool Copy_Source, const bool Create_Destination = true); // Prepares an image for repacking by unpacking it to the temp folder destination and return the ramdisk format
         bool Repack_Image_And_Flash(const std::string& Target_Image, const struct Repack_Options_struct& Repack_Options); // Repacks the boot image with a new kernel or a new ramdisk
+        bool Repack_Ramdisk_And_Flash(const std::string& Ramdisk, const struct Repack_Options_struct& Repack_Options); // Flashes a ramdisk held in memory (cpio, gzip or lz4) into the boot image
         bool Flash_Current_Twrp();
     private:
+    	bool Backup_Partition(TWPartition* Part, const std::string& Backup_Folder, const std::string& Backup_Name, std::string* Backup_File); // Backs up Part into Backup_Folder, or into a new named backup when Backup_Folder is empty
+    	int Repack_And_Flash_Native(twrpBootImage* New_Image, const std::string& New_Ramdisk, const struct Repack_Options_struct& Repack_Options); // Repacks /boot in memory (both slots for ramdisks); 0 on success, 1 on failure, -1 if magiskboot is needed
+    	int Repack_Partition_Native(TWPartition* Part, twrpBootImage* New_Image, const std::string& New_Ramdisk, const struct Repack_Options_struct& Repack_Options);
+    	bool Repack_With_MagiskBoot(const std::string& Target_Image, const struct Repack_Options_struct& Repack_Options); // Repacks through magiskboot and the temp folders
     	bool Prepare_Empty_Folder(const std::string& Folder); // Creates an empty folder at Folder. If the folder already exists, the folder is deleted, then created
     	std::string original_ramdisk_format;                  // Ramdisk format of boot partition
 	    std::string image_ramdisk_format;                     // Ramdisk format of boot image to repack from
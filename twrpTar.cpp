@@ -28,6 +28,7 @@ extern "C" {
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -437,6 +438,9 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 		// Parent side
 		unsigned long long fs, size_backup = 0, files_backup = 0, file_count = 0;
 		int first_data = 0;
+		struct rusage usage_start, usage_stop;
+
+		getrusage(RUSAGE_CHILDREN, &usage_start);
 
 		// Parent closes output side
 		close(progress_pipe[1]);
@@ -486,6 +490,10 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 #endif //ndef BUILD_TWRPTAR_MAIN
 		if (TWFunc::Wait_For_Child(*tar_fork_pid, &status, "createTarFork()") != 0)
 			return -1;
+		// pigz and openaes run under the tar fork, so their CPU time arrives with the fork's once it is reaped
+		getrusage(RUSAGE_CHILDREN, &usage_stop);
+		part_settings->child_cpu_ms = (usage_stop.ru_utime.tv_sec - usage_start.ru_utime.tv_sec + usage_stop.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) * 1000
+			+ (usage_stop.ru_utime.tv_usec - usage_start.ru_utime.tv_usec + usage_stop.ru_stime.tv_usec - usage_start.ru_stime.tv_usec) / 1000;
 	}
 	return 0;
 }
@@ -973,7 +981,7 @@ int twrpTar::createTar() {
 				close(pipes[2]);
 				close(pipes[3]);
 				fd = pipes[1];
-				init_libtar_no_buffer(progress_pipe_fd);
+				init_libtar_no_buffer(progress_pipe_fd, output_fd);
 				tar_type.writefunc = write_tar_no_buffer;
 				if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_CLOEXEC | O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
 					close(fd);
@@ -1029,7 +1037,7 @@ int twrpTar::createTar() {
 			// Parent
 			close(pigzfd[0]); // close parent input
 			fd = pigzfd[1];   // copy parent output
-			init_libtar_no_buffer(progress_pipe_fd);
+			init_libtar_no_buffer(progress_pipe_fd, part_settings->adbbackup ? -1 : output_fd);
 			tar_type.writefunc = write_tar_no_buffer;
 			if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_CLOEXEC | O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
 				close(fd);
@@ -1076,7 +1084,7 @@ int twrpTar::createTar() {
 			// Parent
 			close(oaesfd[0]); // close parent input
 			fd = oaesfd[1];   // copy parent output
-			init_libtar_no_buffer(progress_pipe_fd);
+			init_libtar_no_buffer(progress_pipe_fd, output_fd);
 			tar_type.writefunc = write_tar_no_buffer;
 			if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_CLOEXEC | O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
 				close(fd);
@@ -1350,6 +1358,8 @@ int twrpTar::closeTar() {
 		tar_close(t);
 		return -1;
 	}
+	if (current_archive_type == UNCOMPRESSED && !part_settings->adbbackup)
+		finish_libtar_writeback(t->fd);
 	if (tar_close(t) != 0) {
 		LOGINFO("Unable to close tar archive: '%s'\n", tarfn.c_str());
 		return -1;
@@ -1360,6 +1370,9 @@ int twrpTar::closeTar() {
 			return -1;
 		if (oaes_pid > 0 && TWFunc::Wait_For_Child(oaes_pid, &status, "openaes") != 0)
 			return -1;
+		// pigz/openaes wrote the archive directly, start writeback of its last window without waiting for it
+		if (output_fd >= 0 && !part_settings->adbbackup)
+			finish_libtar_writeback(output_fd);
 	}
 	free_libtar_buffer();
 	if (!part_settings->adbbackup) {
@@ -1470,28 +1483,18 @@ unsigned long long twrpTar::get_size() {
 
 unsigned long long twrpTar::uncompressedSize(string filename) {
 	unsigned long long total_size = 0;
-	string Tar, Command, result;
-	vector<string> split;
 
 	Set_Archive_Type(TWFunc::Get_File_Type(tarfn));
 	if (current_archive_type == UNCOMPRESSED) {
 		total_size = TWFunc::Get_File_Size(filename);
 	} else if (current_archive_type == COMPRESSED) {
-		// Compressed
-		Command = "pigz -l '" + filename + "'";
-		/* if we set Command = "pigz -l " + tarfn + " | sed '1d' | cut -f5 -d' '";
-		we get the uncompressed size at once. */
-		TWFunc::Exec_Cmd(Command, result, false);
-		if (!result.empty()) {
-			/* Expected output:
-			compressed original  reduced name
-			95855838   179403776 -1.3%   data.yaffs2.win
-			^
-			split[5]
-			*/
-			split = TWFunc::split_string(result, ' ', true);
-			if (split.size() > 4)
-				total_size = atoi(split[5].c_str());
+		// Compressed: read the size from the gzip trailer like pigz -l does
+		int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			uint8_t isize[4];
+			if (pread(fd, isize, sizeof(isize), lseek(fd, 0, SEEK_END) - sizeof(isize)) == sizeof(isize))
+				total_size = isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t)isize[3] << 24);
+			close(fd);
 		}
 	} else if (current_archive_type == COMPRESSED_ENCRYPTED) {
 		// File is encrypted and may be compressed
@@ -1503,6 +1506,9 @@ unsigned long long twrpTar::uncompressedSize(string filename) {
 			LOGERR("Decrypted file is not in tar format.\n");
 			total_size = TWFunc::Get_File_Size(filename);
 		} else if (ret == 3) {
+			string Command, result;
+			vector<string> split;
+
 			Command = "openaes dec --key \"" + password + "\" --in '" + filename + "' | pigz -l";
 			/* if we set Command = "pigz -l " + tarfn + " | sed '1d' | cut -f5 -d' '";
 			we get the uncompressed size at once. */
@@ -89,11 +89,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <linux/fiemap.h>
 #include <linux/fs.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -122,8 +124,23 @@
 using android::fs_mgr::Fstab;
 using android::fs_mgr::ReadDefaultFstab;
 
-static constexpr int WINDOW_SIZE = 5;
 static constexpr int FIBMAP_RETRY_LIMIT = 3;
+// Extents fetched per FS_IOC_FIEMAP call.
+static constexpr uint32_t FIEMAP_BATCH_EXTENTS = 512;
+// Largest single read / write when rewriting the package on an encrypted device.
+static constexpr size_t BULK_IO_SIZE = 1024 * 1024;
+// Extents whose blocks can't be read back from the raw device as they are.
+static constexpr uint32_t FIEMAP_UNUSABLE_FLAGS =
+    FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_ENCODED |
+    FIEMAP_EXTENT_NOT_ALIGNED | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL |
+    FIEMAP_EXTENT_UNWRITTEN;
+
+// A run of file blocks that is contiguous on the block device.
+struct FileExtent {
+  int64_t logical;   // first block in the file
+  int64_t physical;  // first block on the block device
+  int64_t length;    // in blocks
+};
 
 // uncrypt provides three services: SETUP_BCB, CLEAR_BCB and UNCRYPT.
 //
@@ -154,15 +171,15 @@ static int write_at_offset(unsigned char* buffer, size_t size, int wfd, off64_t
     return 0;
 }
 
-static void add_block_to_ranges(std::vector<int>& ranges, int new_block) {
-    if (!ranges.empty() && new_block == ranges.back()) {
-        // If the new block comes immediately after the current range,
+static void add_extent_to_ranges(std::vector<int64_t>& ranges, int64_t physical, int64_t length) {
+    if (!ranges.empty() && physical == ranges.back()) {
+        // If the new extent comes immediately after the current range,
         // all we have to do is extend the current range.
-        ++ranges.back();
+        ranges.back() += length;
     } else {
         // We need to start a new range.
-        ranges.push_back(new_block);
-        ranges.push_back(new_block + 1);
+        ranges.push_back(physical);
+        ranges.push_back(physical + length);
     }
 }
 
@@ -240,6 +257,93 @@ static int RetryFibmap(int fd, const std::string& name, int* block, const int he
   return kUncryptIoctlError;
 }
 
+// Maps the file with FS_IOC_FIEMAP. Returns false if the kernel or file system can't, or if any
+// part of the file isn't plainly allocated, so the caller can fall back to FIBMAP.
+static bool MapExtentsFiemap(int fd, int64_t block_size, int64_t blocks,
+                             std::vector<FileExtent>* extents) {
+  std::vector<uint8_t> buffer(sizeof(struct fiemap) +
+                              FIEMAP_BATCH_EXTENTS * sizeof(struct fiemap_extent));
+  struct fiemap* fm = reinterpret_cast<struct fiemap*>(buffer.data());
+  uint64_t start = 0;
+  uint64_t end = static_cast<uint64_t>(blocks) * block_size;
+  int64_t next_block = 0;
+  bool last = false;
+
+  while (!last && start < end) {
+    memset(buffer.data(), 0, buffer.size());
+    fm->fm_start = start;
+    fm->fm_length = end - start;
+    fm->fm_flags = FIEMAP_FLAG_SYNC;
+    fm->fm_extent_count = FIEMAP_BATCH_EXTENTS;
+    if (ioctl(fd, FS_IOC_FIEMAP, fm) != 0) {
+      PLOG(WARNING) << "FS_IOC_FIEMAP failed";
+      return false;
+    }
+    if (fm->fm_mapped_extents == 0) {
+      break;
+    }
+    for (uint32_t i = 0; i < fm->fm_mapped_extents && !last; i++) {
+      const struct fiemap_extent& fe = fm->fm_extents[i];
+      if ((fe.fe_flags & FIEMAP_UNUSABLE_FLAGS) != 0 || fe.fe_logical % block_size != 0 ||
+          fe.fe_physical % block_size != 0 || fe.fe_length % block_size != 0) {
+        LOG(WARNING) << "unusable extent at " << fe.fe_logical << " (flags 0x" << std::hex
+                     << fe.fe_flags << std::dec << ")";
+        return false;
+      }
+      int64_t logical = fe.fe_logical / block_size;
+      if (logical != next_block || fe.fe_physical == 0) {
+        LOG(WARNING) << "block " << next_block << " is not mapped";
+        return false;
+      }
+      int64_t length = std::min<int64_t>(fe.fe_length / block_size, blocks - logical);
+      extents->push_back({ logical, static_cast<int64_t>(fe.fe_physical / block_size), length });
+      next_block += length;
+      start = fe.fe_logical + fe.fe_length;
+      last = (fe.fe_flags & FIEMAP_EXTENT_LAST) != 0 || next_block >= blocks;
+    }
+  }
+  if (next_block != blocks) {
+    LOG(WARNING) << "FIEMAP mapped " << next_block << " of " << blocks << " blocks";
+    return false;
+  }
+  return true;
+}
+
+// Maps the file one block at a time with FIBMAP, merging contiguous blocks into extents.
+static int MapExtentsFibmap(int fd, const std::string& path, int64_t blocks, int socket,
+                            std::vector<FileExtent>* extents) {
+  int last_progress = 0;
+  for (int64_t head_block = 0; head_block < blocks; head_block++) {
+    // Update the status file, progress must be between [0, 99].
+    int progress = static_cast<int>(100 * (double(head_block) / double(blocks)));
+    if (progress > last_progress) {
+      last_progress = progress;
+      write_status_to_socket(progress, socket);
+    }
+
+    int block = head_block;
+    if (ioctl(fd, FIBMAP, &block) != 0) {
+      PLOG(ERROR) << "failed to find block " << head_block;
+      return kUncryptIoctlError;
+    }
+
+    if (block == 0) {
+      LOG(ERROR) << "failed to find block " << head_block << ", retrying";
+      int error = RetryFibmap(fd, path, &block, head_block);
+      if (error != kUncryptNoError) {
+        return error;
+      }
+    }
+
+    if (!extents->empty() && extents->back().physical + extents->back().length == block) {
+      extents->back().length++;
+    } else {
+      extents->push_back({ head_block, block, 1 });
+    }
+  }
+  return kUncryptNoError;
+}
+
 static int ProductBlockMap(const std::string& path, const std::string& map_file,
                            const std::string& blk_dev, bool encrypted, bool f2fs_fs, int socket) {
   std::string err;
@@ -268,10 +372,10 @@ static int ProductBlockMap(const std::string& path, const std::string& map_file,
 
   LOG(INFO) << " block size: " << sb.st_blksize << " bytes";
 
-  int blocks = ((sb.st_size - 1) / sb.st_blksize) + 1;
+  int64_t blocks = ((sb.st_size - 1) / sb.st_blksize) + 1;
   LOG(INFO) << "  file size: " << sb.st_size << " bytes, " << blocks << " blocks";
 
-  std::vector<int> ranges;
+  std::vector<int64_t> ranges;
 
   std::string s = android::base::StringPrintf("%s\n%" PRId64 " %" PRId64 "\n", blk_dev.c_str(),
                                               static_cast<int64_t>(sb.st_size),
@@ -281,13 +385,6 @@ static int ProductBlockMap(const std::string& path, const std::string& map_file,
     return kUncryptWriteError;
   }
 
-  std::vector<std::vector<unsigned char>> buffers;
-  if (encrypted) {
-    buffers.resize(WINDOW_SIZE, std::vector<unsigned char>(sb.st_blksize));
-  }
-  int head_block = 0;
-  int head = 0, tail = 0;
-
   android::base::unique_fd fd(open(path.c_str(), O_RDWR));
   if (fd == -1) {
     PLOG(ERROR) << "failed to open " << path << " for reading";
@@ -329,86 +426,55 @@ static int ProductBlockMap(const std::string& path, const std::string& map_file,
         }
     }
 
-    off64_t pos = 0;
-    int last_progress = 0;
-    while (pos < sb.st_size) {
-        // Update the status file, progress must be between [0, 99].
-        int progress = static_cast<int>(100 * (double(pos) / double(sb.st_size)));
-        if (progress > last_progress) {
-            last_progress = progress;
-            write_status_to_socket(progress, socket);
+    std::vector<FileExtent> extents;
+    if (!MapExtentsFiemap(fd, sb.st_blksize, blocks, &extents)) {
+        LOG(INFO) << "falling back to FIBMAP";
+        extents.clear();
+        int error = MapExtentsFibmap(fd, path, blocks, socket, &extents);
+        if (error != kUncryptNoError) {
+            return error;
         }
+    }
+    LOG(INFO) << "  " << extents.size() << " extents";
 
-        if ((tail+1) % WINDOW_SIZE == head) {
-            // write out head buffer
-            int block = head_block;
-            if (ioctl(fd, FIBMAP, &block) != 0) {
-                PLOG(ERROR) << "failed to find block " << head_block;
-                return kUncryptIoctlError;
-            }
+    for (const auto& extent : extents) {
+        add_extent_to_ranges(ranges, extent.physical, extent.length);
+    }
 
-            if (block == 0) {
-                LOG(ERROR) << "failed to find block " << head_block << ", retrying";
-                int error = RetryFibmap(fd, path, &block, head_block);
-                if (error != kUncryptNoError) {
-                    return error;
+    if (encrypted) {
+        // Copy whole extents, BULK_IO_SIZE at a time, from the file to the same blocks of the
+        // underlying block device.
+        int64_t chunk_blocks = std::max<int64_t>(BULK_IO_SIZE / sb.st_blksize, 1);
+        std::vector<unsigned char> buffer(chunk_blocks * sb.st_blksize);
+        off64_t done = 0;
+        int last_progress = 0;
+        for (const auto& extent : extents) {
+            for (int64_t offset = 0; offset < extent.length; offset += chunk_blocks) {
+                int64_t count = std::min(chunk_blocks, extent.length - offset);
+                off64_t pos = static_cast<off64_t>(extent.logical + offset) * sb.st_blksize;
+                size_t size = static_cast<size_t>(count * sb.st_blksize);
+                size_t to_read = static_cast<size_t>(
+                        std::min(static_cast<off64_t>(size), sb.st_size - pos));
+                if (!android::base::ReadFullyAtOffset(fd, buffer.data(), to_read, pos)) {
+                    PLOG(ERROR) << "failed to read " << path;
+                    return kUncryptReadError;
                 }
-            }
-
-            add_block_to_ranges(ranges, block);
-            if (encrypted) {
-                if (write_at_offset(buffers[head].data(), sb.st_blksize, wfd,
-                                    static_cast<off64_t>(sb.st_blksize) * block) != 0) {
+                // The tail of the last block is padded with zeroes.
+                memset(buffer.data() + to_read, 0, size - to_read);
+                if (write_at_offset(buffer.data(), size, wfd,
+                                    static_cast<off64_t>(extent.physical + offset) * sb.st_blksize) != 0) {
                     return kUncryptWriteError;
                 }
-            }
-            head = (head + 1) % WINDOW_SIZE;
-            ++head_block;
-        }
-
-        // read next block to tail
-        if (encrypted) {
-            size_t to_read = static_cast<size_t>(
-                    std::min(static_cast<off64_t>(sb.st_blksize), sb.st_size - pos));
-            if (!android::base::ReadFully(fd, buffers[tail].data(), to_read)) {
-                PLOG(ERROR) << "failed to read " << path;
-                return kUncryptReadError;
-            }
-            pos += to_read;
-        } else {
-            // If we're not encrypting; we don't need to actually read
-            // anything, just skip pos forward as if we'd read a
-            // block.
-            pos += sb.st_blksize;
-        }
-        tail = (tail+1) % WINDOW_SIZE;
-    }
 
-    while (head != tail) {
-        // write out head buffer
-        int block = head_block;
-        if (ioctl(fd, FIBMAP, &block) != 0) {
-            PLOG(ERROR) << "failed to find block " << head_block;
-            return kUncryptIoctlError;
-        }
-
-        if (block == 0) {
-            LOG(ERROR) << "failed to find block " << head_block << ", retrying";
-            int error = RetryFibmap(fd, path, &block, head_block);
-            if (error != kUncryptNoError) {
-                return error;
-            }
-        }
-
-        add_block_to_ranges(ranges, block);
-        if (encrypted) {
-            if (write_at_offset(buffers[head].data(), sb.st_blksize, wfd,
-                                static_cast<off64_t>(sb.st_blksize) * block) != 0) {
-                return kUncryptWriteError;
+                // Update the status file, progress must be between [0, 99].
+                done += to_read;
+                int progress = static_cast<int>(100 * (double(done) / double(sb.st_size)));
+                if (progress > last_progress && progress < 100) {
+                    last_progress = progress;
+                    write_status_to_socket(progress, socket);
+                }
             }
         }
-        head = (head + 1) % WINDOW_SIZE;
-        ++head_block;
     }
 
     if (!android::base::WriteStringToFd(
@@ -416,12 +482,13 @@ static int ProductBlockMap(const std::string& path, const std::string& map_file,
         PLOG(ERROR) << "failed to write " << tmp_map_file;
         return kUncryptWriteError;
     }
+    std::string range_lines;
     for (size_t i = 0; i < ranges.size(); i += 2) {
-        if (!android::base::WriteStringToFd(
-                android::base::StringPrintf("%d %d\n", ranges[i], ranges[i+1]), mapfd)) {
-            PLOG(ERROR) << "failed to write " << tmp_map_file;
-            return kUncryptWriteError;
-        }
+        range_lines += android::base::StringPrintf("%" PRId64 " %" PRId64 "\n", ranges[i], ranges[i+1]);
+    }
+    if (!android::base::WriteStringToFd(range_lines, mapfd)) {
+        PLOG(ERROR) << "failed to write " << tmp_map_file;
+        return kUncryptWriteError;
     }
 
     if (fsync(mapfd) == -1) {
@@ -19,6 +19,7 @@
 #include <functional>
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "otautil/rangeset.h"
@@ -53,9 +54,10 @@ class UpdateVerifier {
   // Finds all the dm-enabled partitions, and returns a map of <partition_name, block_device>.
   std::map<std::string, std::string> FindDmPartitions();
 
-  // Returns true if we successfully read the blocks in |ranges| of the |dm_block_device|.
-  bool ReadBlocks(const std::string partition_name, const std::string& dm_block_device,
-                  const RangeSet& ranges);
+  // Returns true if we successfully read the cared blocks of all |partitions|, given as pairs of
+  // <partition_name, dm_block_device>. The ranges of all partitions are read by one pool of
+  // threads, bypassing the page cache where the device allows it.
+  bool ReadBlocks(const std::vector<std::pair<std::string, std::string>>& partitions);
 
   // Functions to override the care_map_prefix_ and property_reader_, used in test only.
   void set_care_map_prefix(const std::string& prefix);
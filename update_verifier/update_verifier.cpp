@@ -49,7 +49,10 @@
 #include <unistd.h>
 
 #include <algorithm>
-#include <future>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <thread>
 
 #include <android-base/file.h>
@@ -135,57 +138,171 @@ std::map<std::string, std::string> UpdateVerifier::FindDmPartitions() {
   return dm_block_devices;
 }
 
-bool UpdateVerifier::ReadBlocks(const std::string partition_name,
-                                const std::string& dm_block_device, const RangeSet& ranges) {
-  // RangeSet::Split() splits the ranges into multiple groups with same number of blocks (except for
-  // the last group).
-  size_t thread_num = std::thread::hardware_concurrency() ?: 4;
-  std::vector<RangeSet> groups = ranges.Split(thread_num);
-
-  std::vector<std::future<bool>> threads;
-  for (const auto& group : groups) {
-    auto thread_func = [&group, &dm_block_device, &partition_name]() {
-      android::base::unique_fd fd(TEMP_FAILURE_RETRY(open(dm_block_device.c_str(), O_RDONLY)));
-      if (fd.get() == -1) {
-        PLOG(ERROR) << "Error reading " << dm_block_device << " for partition " << partition_name;
-        return false;
-      }
+// A slice of one partition's care map ranges, read with a single pread.
+struct VerifyChunk {
+  size_t partition;
+  size_t start_block;
+  size_t num_blocks;
+};
+
+// Per-partition state shared by the verification threads.
+struct VerifyPartition {
+  std::string name;
+  std::string dm_block_device;
+  android::base::unique_fd fd;
+  bool direct = false;  // opened with O_DIRECT, otherwise read pages are dropped after use
+  size_t blocks = 0;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point end;
+  bool started = false;
+};
+
+static constexpr size_t kBlockSize = 4096;
+static constexpr size_t kChunkBlocks = 1024;
+
+// Returns the ranges sorted, with overlapping and adjacent ranges merged.
+static std::vector<Range> MergeRanges(const RangeSet& ranges) {
+  std::vector<Range> sorted(ranges.cbegin(), ranges.cend());
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<Range> merged;
+  for (const auto& range : sorted) {
+    if (!merged.empty() && range.first <= merged.back().second) {
+      merged.back().second = std::max(merged.back().second, range.second);
+    } else {
+      merged.push_back(range);
+    }
+  }
+  return merged;
+}
 
-      static constexpr size_t kBlockSize = 4096;
-      std::vector<uint8_t> buf(1024 * kBlockSize);
+// Opens the dm block device, preferring O_DIRECT so the verification doesn't fill the page cache
+// (and doesn't get served from it). Falls back to buffered reads if the device rejects O_DIRECT.
+static bool OpenVerifyPartition(VerifyPartition* partition, size_t probe_block, uint8_t* buf) {
+  partition->fd.reset(
+      TEMP_FAILURE_RETRY(open(partition->dm_block_device.c_str(), O_RDONLY | O_DIRECT)));
+  if (partition->fd.get() != -1) {
+    if (TEMP_FAILURE_RETRY(pread64(partition->fd.get(), buf, kBlockSize,
+                                   static_cast<off64_t>(probe_block) * kBlockSize)) ==
+        static_cast<ssize_t>(kBlockSize)) {
+      partition->direct = true;
+      return true;
+    }
+    PLOG(WARNING) << "O_DIRECT read failed on " << partition->dm_block_device
+                  << ", using buffered reads";
+  }
+  partition->fd.reset(TEMP_FAILURE_RETRY(open(partition->dm_block_device.c_str(), O_RDONLY)));
+  if (partition->fd.get() == -1) {
+    PLOG(ERROR) << "Error reading " << partition->dm_block_device << " for partition "
+                << partition->name;
+    return false;
+  }
+  partition->direct = false;
+  return true;
+}
 
-      size_t block_count = 0;
-      for (const auto& [range_start, range_end] : group) {
-        if (lseek64(fd.get(), static_cast<off64_t>(range_start) * kBlockSize, SEEK_SET) == -1) {
-          PLOG(ERROR) << "lseek to " << range_start << " failed";
-          return false;
-        }
+bool UpdateVerifier::ReadBlocks(
+    const std::vector<std::pair<std::string, std::string>>& partitions) {
+  using BlockBuffer = std::unique_ptr<uint8_t, decltype(&free)>;
+  auto alloc_buffer = []() {
+    return BlockBuffer(static_cast<uint8_t*>(aligned_alloc(kBlockSize, kChunkBlocks * kBlockSize)),
+                       &free);
+  };
+
+  // Queue the care map ranges of every partition, merged and cut into chunks, so that a single
+  // pool of threads streams through all of them.
+  std::vector<VerifyPartition> states(partitions.size());
+  std::vector<VerifyChunk> chunks;
+  BlockBuffer probe = alloc_buffer();
+  if (!probe) {
+    LOG(ERROR) << "Failed to allocate the read buffer";
+    return false;
+  }
+  for (size_t i = 0; i < partitions.size(); i++) {
+    VerifyPartition& state = states[i];
+    state.name = partitions[i].first;
+    state.dm_block_device = partitions[i].second;
+    std::vector<Range> ranges = MergeRanges(partition_map_.at(state.name));
+    if (!OpenVerifyPartition(&state, ranges.empty() ? 0 : ranges[0].first, probe.get())) {
+      return false;
+    }
+    for (const auto& [range_start, range_end] : ranges) {
+      for (size_t block = range_start; block < range_end; block += kChunkBlocks) {
+        chunks.push_back({ i, block, std::min(kChunkBlocks, range_end - block) });
+      }
+      state.blocks += range_end - range_start;
+    }
+  }
+  probe.reset();
 
-        size_t remain = (range_end - range_start) * kBlockSize;
-        while (remain > 0) {
-          size_t to_read = std::min(remain, 1024 * kBlockSize);
-          if (!android::base::ReadFully(fd.get(), buf.data(), to_read)) {
-            PLOG(ERROR) << "Failed to read blocks " << range_start << " to " << range_end;
-            return false;
-          }
-          remain -= to_read;
+  size_t thread_num = std::thread::hardware_concurrency() ?: 4;
+  thread_num = std::min(thread_num, std::max<size_t>(chunks.size(), 1));
+  std::atomic<size_t> next_chunk(0);
+  std::atomic<bool> failed(false);
+  std::mutex stats_lock;
+
+  auto thread_func = [&]() {
+    BlockBuffer buf = alloc_buffer();
+    if (!buf) {
+      LOG(ERROR) << "Failed to allocate the read buffer";
+      failed = true;
+      return;
+    }
+    while (!failed) {
+      size_t index = next_chunk++;
+      if (index >= chunks.size()) {
+        return;
+      }
+      const VerifyChunk& chunk = chunks[index];
+      VerifyPartition& state = states[chunk.partition];
+      auto start = std::chrono::steady_clock::now();
+      {
+        std::lock_guard<std::mutex> lock(stats_lock);
+        if (!state.started) {
+          state.started = true;
+          state.start = start;
         }
-        block_count += (range_end - range_start);
       }
-      LOG(INFO) << "Finished reading " << block_count << " blocks on " << dm_block_device;
-      return true;
-    };
 
-    threads.emplace_back(std::async(std::launch::async, thread_func));
-  }
+      off64_t offset = static_cast<off64_t>(chunk.start_block) * kBlockSize;
+      size_t size = chunk.num_blocks * kBlockSize;
+      if (!android::base::ReadFullyAtOffset(state.fd.get(), buf.get(), size, offset)) {
+        PLOG(ERROR) << "Failed to read blocks " << chunk.start_block << " to "
+                    << chunk.start_block + chunk.num_blocks << " on " << state.dm_block_device;
+        failed = true;
+        return;
+      }
+      if (!state.direct) {
+        posix_fadvise(state.fd.get(), offset, size, POSIX_FADV_DONTNEED);
+      }
+
+      auto end = std::chrono::steady_clock::now();
+      std::lock_guard<std::mutex> lock(stats_lock);
+      state.end = std::max(state.end, end);
+    }
+  };
 
-  bool ret = true;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_num; i++) {
+    threads.emplace_back(thread_func);
+  }
   for (auto& t : threads) {
-    ret = t.get() && ret;
+    t.join();
+  }
+  if (failed) {
+    return false;
+  }
+
+  for (const auto& state : states) {
+    double seconds = std::chrono::duration<double>(state.end - state.start).count();
+    double mb = static_cast<double>(state.blocks) * kBlockSize / (1024 * 1024);
+    LOG(INFO) << "Finished reading " << state.blocks << " blocks on " << state.dm_block_device
+              << " for " << state.name << " in " << seconds << "s ("
+              << (seconds > 0 ? mb / seconds : 0) << " MB/s"
+              << (state.direct ? ", direct" : "") << ")";
   }
-  LOG(INFO) << "Finished reading blocks on " << dm_block_device << " with " << thread_num
-            << " threads.";
-  return ret;
+  LOG(INFO) << "Finished reading " << chunks.size() << " chunks from " << states.size()
+            << " partitions with " << thread_num << " threads.";
+  return true;
 }
 
 bool UpdateVerifier::VerifyPartitions() {
@@ -195,18 +312,16 @@ bool UpdateVerifier::VerifyPartitions() {
     return false;
   }
 
+  std::vector<std::pair<std::string, std::string>> partitions;
   for (const auto& [partition_name, ranges] : partition_map_) {
     if (dm_block_devices.find(partition_name) == dm_block_devices.end()) {
       LOG(ERROR) << "Failed to find dm block device for " << partition_name;
       return false;
     }
-
-    if (!ReadBlocks(partition_name, dm_block_devices.at(partition_name), ranges)) {
-      return false;
-    }
+    partitions.emplace_back(partition_name, dm_block_devices.at(partition_name));
   }
 
-  return true;
+  return ReadBlocks(partitions);
 }
 
 bool UpdateVerifier::ParseCareMap() {
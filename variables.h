@@ -193,6 +193,9 @@ static int Fox_Current_ROM_IsMIUI = 0; // is the currently installed ROM a MIUI
 #define TW_BACKUP_AVG_IMG_RATE      	"tw_backup_avg_img_rate"
 #define TW_BACKUP_AVG_FILE_RATE     	"tw_backup_avg_file_rate"
 #define TW_BACKUP_AVG_FILE_COMP_RATE    "tw_backup_avg_file_comp_rate"
+#define TW_BACKUP_IMG_THREADS_VAR   	"tw_backup_img_threads"
+#define TW_BACKUP_IMG_BW_LIMIT_VAR  	"tw_backup_img_bw_limit"
+#define TW_ORS_EVENTS_VAR           	"tw_ors_events"
 #define TW_BACKUP_SYSTEM_SIZE       	"tw_backup_system_size"
 #define TW_BACKUP_DATA_SIZE         	"tw_backup_data_size"
 #define TW_BACKUP_BOOT_SIZE         	"tw_backup_boot_size"